@@ -18,16 +18,20 @@
 #include "config.h"
 
 #include <iostream>
+#include <vector>
 
 #include "access_scanner.h"
 #include "ep_engine.h"
 
+//! Entries a clone gathers before appending them to the shared log.
+static const size_t ACCESS_LOG_BATCH(1000);
+
 class ItemAccessVisitor : public VBucketVisitor {
 public:
     ItemAccessVisitor(EventuallyPersistentStore &_store, EPStats &_stats,
                       bool *sfin) :
         store(_store), stats(_stats), startTime(ep_real_time()),
-        stateFinalizer(sfin)
+        stateFinalizer(sfin), root(this)
     {
         Configuration &conf = store.getEPEngine().getConfiguration();
         name = conf.getAlogPath();
@@ -46,24 +50,39 @@ public:
     }
 
     void visit(StoredValue *v) {
-        if (log != NULL && v->isReferenced(true, &currentBucket->ht)) {
+        if (root->log != NULL && v->isReferenced(true, &currentBucket->ht)) {
             if (v->isExpired(startTime) || v->isDeleted()) {
                 LOG(EXTENSION_LOG_INFO, "INFO: Skipping expired/deleted item: %s",
                     v->getKey().c_str());
-            } else {
+            } else if (root == this) {
                 log->newItem(currentBucket->getId(), v->getKey(), v->getId());
+            } else {
+                pending.push_back(AccessEntry(currentBucket->getId(),
+                                              v->getKey(), v->getId()));
+                if (pending.size() >= ACCESS_LOG_BATCH) {
+                    root->logItems(pending);
+                }
             }
         }
     }
 
     bool visitBucket(RCPtr<VBucket> &vb) {
-        if (log == NULL) {
+        if (root->log == NULL) {
             return false;
         }
 
         return VBucketVisitor::visitBucket(vb);
     }
 
+    VBucketVisitor *clone() {
+        return new ItemAccessVisitor(*this);
+    }
+
+    void merge(VBucketVisitor &other) {
+        ItemAccessVisitor &clone = static_cast<ItemAccessVisitor&>(other);
+        logItems(clone.pending);
+    }
+
     virtual void complete() {
         if (stateFinalizer) {
             *stateFinalizer = true;
@@ -103,6 +122,32 @@ public:
     }
 
 private:
+    struct AccessEntry {
+        AccessEntry(uint16_t vb, const std::string &k, uint64_t r) :
+            vbid(vb), key(k), rowid(r) {}
+
+        uint16_t vbid;
+        std::string key;
+        uint64_t rowid;
+    };
+
+    /**
+     * A clone sharing the log of the given visitor.
+     */
+    ItemAccessVisitor(ItemAccessVisitor &parent) :
+        VBucketVisitor(parent.getVBucketFilter()), store(parent.store),
+        stats(parent.stats), startTime(parent.startTime), log(NULL),
+        stateFinalizer(NULL), root(&parent) {}
+
+    void logItems(std::vector<AccessEntry> &entries) {
+        LockHolder lh(logMutex);
+        std::vector<AccessEntry>::iterator it;
+        for (it = entries.begin(); it != entries.end(); ++it) {
+            log->newItem(it->vbid, it->key, it->rowid);
+        }
+        entries.clear();
+    }
+
     EventuallyPersistentStore &store;
     EPStats &stats;
     rel_time_t startTime;
@@ -112,6 +157,11 @@ private:
 
     MutationLog *log;
     bool *stateFinalizer;
+
+    //! The visitor owning the log; itself unless this is a clone.
+    ItemAccessVisitor *root;
+    Mutex logMutex;
+    std::vector<AccessEntry> pending;
 };
 
 AccessScanner::AccessScanner(EventuallyPersistentStore &_store, EPStats &st,
@@ -18,8 +18,22 @@
 #include "config.h"
 
 #include "atomic.h"
+#include "lockprofile.h"
 
-SpinLock::SpinLock() : lock(0) {
+static ThreadLocal<void*> threadShard;
+static Atomic<size_t> nextThreadShard;
+
+size_t threadShardIndex() {
+    // Stored plus one, as a thread that hasn't picked one yet gets NULL.
+    size_t idx = reinterpret_cast<size_t>(threadShard.get());
+    if (idx == 0) {
+        idx = nextThreadShard++ + 1;
+        threadShard.set(reinterpret_cast<void*>(idx));
+    }
+    return idx - 1;
+}
+
+SpinLock::SpinLock() : lock(0), site(NULL), acquiredAt(0) {
     EP_SPINLOCK_CREATED(this);
 }
 
@@ -29,6 +43,11 @@ SpinLock::~SpinLock() {
 }
 
 void SpinLock::acquire(void) {
+   hrtime_t start = 0;
+   if (site != NULL && LockSite::isProfiling()) {
+       start = gethrtime();
+   }
+
    int spin = 0;
    while (!tryAcquire()) {
       ++spin;
@@ -37,10 +56,24 @@ void SpinLock::acquire(void) {
       }
    }
 
+   if (start != 0) {
+       acquiredAt = gethrtime();
+       site->acquired(acquiredAt - start, spin > 0);
+   }
+
    EP_SPINLOCK_ACQUIRED(this, spin);
 }
 
 void SpinLock::release(void) {
+    bool profiled = acquiredAt != 0;
+    hrtime_t heldFor = 0;
+    if (profiled) {
+        heldFor = gethrtime() - acquiredAt;
+        acquiredAt = 0;
+    }
     ep_sync_lock_release(&lock);
+    if (profiled) {
+        site->released(heldFor);
+    }
     EP_SPINLOCK_RELEASED(this);
 }
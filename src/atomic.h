@@ -237,6 +237,13 @@ public:
     }
 };
 
+/**
+ * A small number for the calling thread, picked round robin the first
+ * time it asks, so structures kept in per-thread shards spread their
+ * threads over the shards.  Take it modulo the number of shards.
+ */
+size_t threadShardIndex();
+
 /**
  * A lighter-weight, smaller lock than a mutex.
  *
@@ -252,12 +259,23 @@ public:
     void acquire(void);
     void release(void);
 
+    /**
+     * Report how contended this lock is to the given site while lock
+     * profiling is on.
+     */
+    void setLockSite(LockSite *s) {
+        site = s;
+    }
+
 private:
     bool tryAcquire() {
        return ep_sync_lock_test_and_set(&lock, 1) == 0;
     }
 
     volatile int lock;
+    LockSite *site;
+    //! When the holder got the lock if it was profiled, else 0.
+    hrtime_t acquiredAt;
     DISALLOW_COPY_AND_ASSIGN(SpinLock);
 };
 
@@ -290,9 +308,89 @@ private:
     bool locked;
 };
 
+/**
+ * A mutex that also admits optimistic readers which never take it.
+ *
+ * Writers lock it as usual.  Acquiring bumps the sequence number to an
+ * odd value and then waits for readers already inside a read section
+ * to leave, so a reader that got in sees neither partial updates nor
+ * freed memory.  Readers never block: if the mutex is held they are
+ * turned away and are expected to take the lock instead.
+ *
+ * Readers are counted rather than validated, so a writer waits for
+ * every read section in progress; keep them to a lookup and copying
+ * out what's needed.
+ */
+class SeqMutex : public Mutex {
+public:
+    SeqMutex() : seqno(0), readers(0) {}
+
+    /**
+     * Enter a read section.
+     *
+     * @return false if a writer holds the mutex (no section entered)
+     */
+    bool readBegin() {
+        ++readers;
+        if (seqno.get() & 1) {
+            --readers;
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * Leave a read section entered with readBegin().
+     */
+    void readEnd() {
+        --readers;
+    }
+
+    /**
+     * Number of times this mutex was acquired or released.
+     */
+    uint32_t getSeqno() const {
+        return seqno.get();
+    }
+
+protected:
+    void acquire() {
+        Mutex::acquire();
+        ++seqno;
+        int spin = 0;
+        while (readers.get() != 0) {
+            if (++spin > 64) {
+                sched_yield();
+            }
+        }
+    }
+
+    void release() {
+        ++seqno;
+        Mutex::release();
+    }
+
+private:
+    Atomic<uint32_t> seqno;
+    Atomic<uint32_t> readers;
+
+    DISALLOW_COPY_AND_ASSIGN(SeqMutex);
+};
+
 template <class T> class RCPtr;
 template <class S> class SingleThreadedRCPtr;
 
+/**
+ * Release a reference counted value whose last reference went away.
+ *
+ * Types whose storage isn't a plain heap allocation may provide an
+ * overload of this in their own namespace.
+ */
+template <class T>
+inline void destroyRCValue(T *v) {
+    delete v;
+}
+
 /**
  * A reference counted value (used by RCPtr and SingleThreadedRCPtr).
  */
@@ -301,7 +399,7 @@ public:
     RCValue() : _rc_refcount(0) {}
     RCValue(const RCValue &) : _rc_refcount(0) {}
     ~RCValue() {}
-private:
+protected:
     template <class MyTT> friend class RCPtr;
     template <class MySS> friend class SingleThreadedRCPtr;
     int _rc_incref() const {
@@ -312,6 +410,11 @@ private:
         return --_rc_refcount;
     }
 
+    int _rc_count() const {
+        return _rc_refcount.get();
+    }
+
+private:
     mutable Atomic<int> _rc_refcount;
 };
 
@@ -331,7 +434,7 @@ public:
 
     ~RCPtr() {
         if (value && static_cast<RCValue *>(value)->_rc_decref() == 0) {
-            delete value;
+            destroyRCValue(value.get());
         }
     }
 
@@ -354,7 +457,7 @@ public:
             if (tmp != NULL &&
                 static_cast<RCValue *>(tmp)->_rc_decref() == 0) {
                 lh.unlock();
-                delete tmp;
+                destroyRCValue(tmp);
             }
             return true;
         }
@@ -401,7 +504,7 @@ private:
         C *tmp(value.swap(newValue));
         lh.unlock();
         if (tmp != NULL && static_cast<RCValue *>(tmp)->_rc_decref() == 0) {
-            delete tmp;
+            destroyRCValue(tmp);
         }
     }
 
@@ -428,7 +531,7 @@ public:
 
     ~SingleThreadedRCPtr() {
         if (value && static_cast<RCValue *>(value)->_rc_decref() == 0) {
-            delete value;
+            destroyRCValue(value);
         }
     }
 
@@ -481,7 +584,7 @@ private:
         T *old = value;
         value = newValue;
         if (old != NULL && static_cast<RCValue *>(old)->_rc_decref() == 0) {
-            delete old;
+            destroyRCValue(old);
         }
     }
 
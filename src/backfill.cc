@@ -115,13 +115,16 @@ bool BackFillVisitor::visitBucket(RCPtr<VBucket> &vb) {
         double num_non_resident = static_cast<double>(vb->ht.getNumNonResidentItems());
         size_t num_backfill_items = 0;
 
-        if (num_items == 0) {
+        // Under full eviction the hash table doesn't hold every item,
+        // so only the disk has the complete set.
+        bool fullEviction = engine->epstore->isFullEviction();
+        if (num_items == 0 && !fullEviction) {
             return false;
         }
 
         double resident_threshold = engine->getTapConfig().getBackfillResidentThreshold();
-        residentRatioBelowThreshold =
-            ((num_items - num_non_resident) / num_items) < resident_threshold ? true : false;
+        residentRatioBelowThreshold = fullEviction ||
+            ((num_items - num_non_resident) / num_items) < resident_threshold;
 
         if (efficientVBDump && residentRatioBelowThreshold) {
             // disk backfill for persisted items + memory backfill for resident items
@@ -215,6 +218,16 @@ bool BackFillVisitor::pauseVisitor() {
     return pause;
 }
 
+VBucketVisitor *BackFillVisitor::clone() {
+    return new BackFillVisitor(*this);
+}
+
+void BackFillVisitor::merge(VBucketVisitor &other) {
+    // Hand over what the clone queued and the disk loads it set up
+    // since its last vbucket.
+    static_cast<BackFillVisitor&>(other).apply();
+}
+
 void BackFillVisitor::complete() {
     apply();
     CompleteBackfillTapOperation tapop;
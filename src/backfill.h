@@ -104,8 +104,22 @@ public:
 
     void complete(void);
 
+    VBucketVisitor *clone();
+
+    void merge(VBucketVisitor &other);
+
 private:
 
+    /**
+     * A clone with its own queue, for another visitor thread.
+     */
+    BackFillVisitor(const BackFillVisitor &other) :
+        VBucketVisitor(other.vBucketFilter), engine(other.engine),
+        name(other.name), queue(new std::list<queued_item>),
+        connToken(other.connToken), valid(other.valid),
+        efficientVBDump(other.efficientVBDump),
+        residentRatioBelowThreshold(false) { }
+
     void setEvents();
 
     bool pauseVisitor();
@@ -47,11 +47,31 @@ void BgFetcher::doFetch(uint16_t vbId) {
         "numDocs = %d, startTime = %lld\n", vbId, items2fetch.size(),
         startTime/1000000);
 
-    store->getROUnderlying()->getMulti(vbId, items2fetch);
+    // Values still in the value cache don't have to come from disk.
+    vb_bgfetch_queue_t diskItems;
+    vb_bgfetch_queue_t::iterator itr = items2fetch.begin();
+    for (; itr != items2fetch.end(); ++itr) {
+        std::list<VBucketBGFetchItem *> &requestedItems = (*itr).second;
+        Item *cached = store->fetchFromValueCache(vbId,
+                                                  requestedItems.front()->key);
+        if (cached == NULL) {
+            diskItems.insert(*itr);
+            continue;
+        }
+        // Like the ones read from disk, they share the one item.
+        std::list<VBucketBGFetchItem *>::iterator itm = requestedItems.begin();
+        for (; itm != requestedItems.end(); ++itm) {
+            (*itm)->value.setValue(cached);
+            (*itm)->value.setStatus(ENGINE_SUCCESS);
+        }
+    }
+    if (!diskItems.empty()) {
+        store->getROUnderlying()->getMulti(vbId, diskItems);
+    }
 
     int totalfetches = 0;
     std::vector<VBucketBGFetchItem *> fetchedItems;
-    vb_bgfetch_queue_t::iterator itr = items2fetch.begin();
+    itr = items2fetch.begin();
     for (; itr != items2fetch.end(); ++itr) {
         std::list<VBucketBGFetchItem *> &requestedItems = (*itr).second;
         std::list<VBucketBGFetchItem *>::iterator itm = requestedItems.begin();
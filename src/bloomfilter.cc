@@ -0,0 +1,100 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2012 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "config.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "bloomfilter.h"
+
+const uint8_t BloomFilter::MAX_COUNT(0x0f);
+
+BloomFilter::BloomFilter(size_t keyCount, double falsePositiveProb) {
+    // m = -n ln(p) / ln(2)^2 counters and k = m / n ln(2) hashes.
+    double ln2 = std::log(2.0);
+    double m = -static_cast<double>(keyCount) * std::log(falsePositiveProb) /
+        (ln2 * ln2);
+    numCounters = std::max(static_cast<size_t>(std::ceil(m)),
+                           static_cast<size_t>(64));
+    numHashes = static_cast<size_t>(std::floor(m / keyCount * ln2 + 0.5));
+    numHashes = std::max(numHashes, static_cast<size_t>(1));
+    counters.resize((numCounters + 1) / 2, 0);
+}
+
+void BloomFilter::hashKey(const std::string &key,
+                          uint32_t &h1, uint32_t &h2) const {
+    // 64 bit FNV-1a with a final avalanche, split into the two hashes
+    // every position is derived from.
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < key.length(); ++i) {
+        h ^= static_cast<uint8_t>(key[i]);
+        h *= 0x100000001b3ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+
+    h1 = static_cast<uint32_t>(h);
+    // Odd, so the positions don't repeat early.
+    h2 = static_cast<uint32_t>(h >> 32) | 1;
+}
+
+void BloomFilter::addKey(const std::string &key) {
+    uint32_t h1, h2;
+    hashKey(key, h1, h2);
+    SpinLockHolder lh(&lock);
+    for (size_t i = 0; i < numHashes; ++i) {
+        size_t pos = position(h1, h2, i);
+        uint8_t c = getCounter(pos);
+        if (c < MAX_COUNT) {
+            setCounter(pos, c + 1);
+        }
+    }
+    ++numKeys;
+}
+
+void BloomFilter::removeKey(const std::string &key) {
+    uint32_t h1, h2;
+    hashKey(key, h1, h2);
+    SpinLockHolder lh(&lock);
+    for (size_t i = 0; i < numHashes; ++i) {
+        size_t pos = position(h1, h2, i);
+        uint8_t c = getCounter(pos);
+        // Saturated counters no longer know how many keys they hold.
+        if (c > 0 && c < MAX_COUNT) {
+            setCounter(pos, c - 1);
+        }
+    }
+    if (numKeys.get() > 0) {
+        --numKeys;
+    }
+}
+
+bool BloomFilter::maybeKeyExists(const std::string &key) {
+    uint32_t h1, h2;
+    hashKey(key, h1, h2);
+    SpinLockHolder lh(&lock);
+    for (size_t i = 0; i < numHashes; ++i) {
+        if (getCounter(position(h1, h2, i)) == 0) {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,107 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2012 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#ifndef SRC_BLOOMFILTER_H_
+#define SRC_BLOOMFILTER_H_ 1
+
+#include "config.h"
+
+#include <string>
+#include <vector>
+
+#include "atomic.h"
+#include "common.h"
+
+/**
+ * A counting Bloom filter over keys.
+ *
+ * Each key bumps a four bit counter at several positions, so keys can
+ * be removed again as well as added.  A counter that reaches its
+ * maximum sticks there, which can only cause false positives.  A
+ * negative answer from maybeKeyExists() is always right, as long as
+ * every removeKey() matches an earlier addKey() of the same key.
+ */
+class BloomFilter {
+public:
+
+    /**
+     * Size a filter for the given number of keys.
+     *
+     * @param keyCount the number of keys expected at once
+     * @param falsePositiveProb the wanted false positive rate at that
+     *        number of keys
+     */
+    BloomFilter(size_t keyCount, double falsePositiveProb);
+
+    void addKey(const std::string &key);
+
+    void removeKey(const std::string &key);
+
+    /**
+     * @return false if the key is definitely not in the filter
+     */
+    bool maybeKeyExists(const std::string &key);
+
+    size_t getNumKeys() const {
+        return numKeys.get();
+    }
+
+    size_t getNumCounters() const {
+        return numCounters;
+    }
+
+    size_t getNumHashes() const {
+        return numHashes;
+    }
+
+    /**
+     * Bytes used by the counters.
+     */
+    size_t memorySize() const {
+        return counters.size();
+    }
+
+private:
+
+    static const uint8_t MAX_COUNT;
+
+    void hashKey(const std::string &key, uint32_t &h1, uint32_t &h2) const;
+
+    size_t position(uint32_t h1, uint32_t h2, size_t i) const {
+        return (h1 + i * h2) % numCounters;
+    }
+
+    uint8_t getCounter(size_t pos) const {
+        return (counters[pos >> 1] >> ((pos & 1) << 2)) & 0x0f;
+    }
+
+    void setCounter(size_t pos, uint8_t val) {
+        int shift = (pos & 1) << 2;
+        counters[pos >> 1] = static_cast<uint8_t>(
+            (counters[pos >> 1] & ~(0x0f << shift)) | (val << shift));
+    }
+
+    size_t               numCounters;
+    size_t               numHashes;
+    //! Two counters per byte.
+    std::vector<uint8_t> counters;
+    Atomic<size_t>       numKeys;
+    SpinLock             lock;
+
+    DISALLOW_COPY_AND_ASSIGN(BloomFilter);
+};
+
+#endif  // SRC_BLOOMFILTER_H_
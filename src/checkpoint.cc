@@ -17,12 +17,20 @@
 
 #include "config.h"
 
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <sstream>
 #include <string>
 #include <utility>
 #include <vector>
 
 #include "checkpoint.h"
 #include "ep_engine.h"
+#include "lockprofile.h"
 #define STATWRITER_NAMESPACE checkpoint
 #include "statwriter.h"
 #undef STATWRITER_NAMESPACE
@@ -60,10 +68,78 @@ private:
     CheckpointConfig &config;
 };
 
+/**
+ * An item as written to a checkpoint segment file, followed by its key.
+ * Segment files only live as long as the process, so nothing is done
+ * about byte order.
+ */
+struct SegmentRecord {
+    uint64_t seqno;
+    uint64_t mutationId;
+    uint32_t queuedTime;
+    uint16_t vbucket;
+    uint16_t op;
+    uint16_t keylen;
+};
+
+static bool writeSegment(const std::string &path, const std::string &buf) {
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) {
+        return false;
+    }
+    size_t done = 0;
+    while (done < buf.size()) {
+        ssize_t n = ::write(fd, buf.data() + done, buf.size() - done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n <= 0) {
+            int err = errno;
+            ::close(fd);
+            errno = err;
+            return false;
+        }
+        done += n;
+    }
+    return ::close(fd) == 0;
+}
+
+static bool readSegment(const std::string &path, std::string &buf) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        ::close(fd);
+        return false;
+    }
+    buf.resize(st.st_size);
+    size_t done = 0;
+    while (done < buf.size()) {
+        ssize_t n = ::read(fd, &buf[done], buf.size() - done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n <= 0) {
+            ::close(fd);
+            return false;
+        }
+        done += n;
+    }
+    ::close(fd);
+    return true;
+}
+
+LockSite CheckpointManager::queueLockSite("checkpoint_queue_lock");
+Atomic<uint64_t> CheckpointManager::cursorsVersionCounter;
+Atomic<uint64_t> CheckpointManager::segmentCounter;
+
 Checkpoint::~Checkpoint() {
     LOG(EXTENSION_LOG_INFO,
         "Checkpoint %llu for vbucket %d is purged from memory",
         checkpointId, vbucketId);
+    if (isSpilled()) {
+        unlink(segmentPath.c_str());
+    }
     stats.memOverhead.decr(memorySize());
     assert(stats.memOverhead.get() < GIGANTOR);
 }
@@ -74,33 +150,57 @@ void Checkpoint::setState(checkpoint_state state) {
 
 void Checkpoint::popBackCheckpointEndItem() {
     if (!toWrite.empty() && toWrite.back()->getOperation() == queue_op_checkpoint_end) {
+        // The index entry borrows the item's key, so it has to go first.
+        checkpoint_index::iterator it = keyIndex.find(toWrite.back()->getKey());
+        if (it != keyIndex.end() && it->second.position == --toWrite.end()) {
+            keyIndex.erase(it);
+            memOverhead -= entryOverhead();
+            stats.memOverhead.decr(entryOverhead());
+        }
+        itemBytes -= toWrite.back()->size();
         toWrite.pop_back();
     }
 }
 
+void Checkpoint::setCheckpointStartItem(const queued_item &qi) {
+    checkpoint_queue::iterator pos = ++toWrite.begin();
+    assert((*pos)->getOperation() == queue_op_checkpoint_start);
+    // The index entry borrows the old item's key, so it is keyed anew.
+    checkpoint_index::iterator it = keyIndex.find(qi->getKey());
+    assert(it != keyIndex.end() && it->second.position == pos);
+    index_entry entry = it->second;
+    keyIndex.erase(it);
+    *pos = qi;
+    keyIndex[qi->getKey()] = entry;
+}
+
 bool Checkpoint::keyExists(const std::string &key) {
     return keyIndex.find(key) != keyIndex.end();
 }
 
-queue_dirty_t Checkpoint::queueDirty(const queued_item &qi, CheckpointManager *checkpointManager) {
+queue_dirty_t Checkpoint::queueDirty(const std::string &key,
+                                     enum queue_operation op,
+                                     uint64_t seqno,
+                                     const queued_item *qi,
+                                     CheckpointManager *checkpointManager) {
     assert (checkpointState == CHECKPOINT_OPEN);
 
     uint64_t newMutationId = checkpointManager->nextMutationId();
     queue_dirty_t rv;
 
-    checkpoint_index::iterator it = keyIndex.find(qi->getKey());
+    checkpoint_index::iterator it = keyIndex.find(key);
     // Check if this checkpoint already had an item for the same key.
     if (it != keyIndex.end()) {
         rv = EXISTING_ITEM;
-        std::list<queued_item>::iterator currPos = it->second.position;
+        checkpoint_queue::iterator currPos = it->second.position;
         uint64_t currMutationId = it->second.mutation_id;
         CheckpointCursor &pcursor = checkpointManager->persistenceCursor;
 
         if (*(pcursor.currentCheckpoint) == this) {
             // If the existing item is in the left-hand side of the item pointed by the
             // persistence cursor, decrease the persistence cursor's offset by 1.
-            const std::string &key = (*(pcursor.currentPos))->getKey();
-            checkpoint_index::iterator ita = keyIndex.find(key);
+            const std::string &cursorKey = (*(pcursor.currentPos))->getKey();
+            checkpoint_index::iterator ita = keyIndex.find(cursorKey);
             if (ita != keyIndex.end()) {
                 uint64_t mutationId = ita->second.mutation_id;
                 if (currMutationId <= mutationId) {
@@ -120,8 +220,8 @@ queue_dirty_t Checkpoint::queueDirty(const queued_item &qi, CheckpointManager *c
              map_it != checkpointManager->tapCursors.end(); ++map_it) {
 
             if (*(map_it->second.currentCheckpoint) == this) {
-                const std::string &key = (*(map_it->second.currentPos))->getKey();
-                checkpoint_index::iterator ita = keyIndex.find(key);
+                const std::string &cursorKey = (*(map_it->second.currentPos))->getKey();
+                checkpoint_index::iterator ita = keyIndex.find(cursorKey);
                 if (ita != keyIndex.end()) {
                     uint64_t mutationId = ita->second.mutation_id;
                     if (currMutationId <= mutationId) {
@@ -136,49 +236,56 @@ queue_dirty_t Checkpoint::queueDirty(const queued_item &qi, CheckpointManager *c
         }
 
         queued_item &existing_itm = *currPos;
-        existing_itm->setOperation(qi->getOperation());
-        existing_itm->setQueuedTime(qi->getQueuedTime());
-        toWrite.push_back(existing_itm);
-        // Remove the existing item for the same key from the list.
-        toWrite.erase(currPos);
+        existing_itm->setOperation(op);
+        existing_itm->setQueuedTime(qi ? (*qi)->getQueuedTime() : ep_current_time());
+        // Move the existing item for the same key to the tail.  Its old slot
+        // is left empty rather than anything being shifted over it.
+        it->second.position = toWrite.moveToBack(currPos);
+        it->second.mutation_id = newMutationId;
+        return rv;
+    }
+
+    if (op == queue_op_set || op == queue_op_del) {
+        ++numItems;
+    }
+    rv = NEW_ITEM;
+    // Push the new item into the list
+    if (qi) {
+        toWrite.push_back(*qi);
     } else {
-        if (qi->getOperation() == queue_op_set || qi->getOperation() == queue_op_del) {
-            ++numItems;
-        }
-        rv = NEW_ITEM;
-        // Push the new item into the list
-        toWrite.push_back(qi);
+        toWrite.push_back(queued_item(new QueuedItem(key, vbucketId, op, seqno)));
     }
+    itemBytes += toWrite.back()->size();
 
-    if (qi->getKey().size() > 0) {
-        std::list<queued_item>::iterator last = toWrite.end();
+    if (key.size() > 0) {
+        checkpoint_queue::iterator last = toWrite.end();
         // --last is okay as the list is not empty now.
         index_entry entry = {--last, newMutationId};
-        // Set the index of the key to the new item that is pushed back into the list.
-        keyIndex[qi->getKey()] = entry;
-        if (rv == NEW_ITEM) {
-            size_t newEntrySize = qi->getKey().size() + sizeof(index_entry) + sizeof(queued_item);
-            memOverhead += newEntrySize;
-            stats.memOverhead.incr(newEntrySize);
-            assert(stats.memOverhead.get() < GIGANTOR);
-        }
+        // Index the key held by the item in the list, not the caller's copy.
+        keyIndex[(*last)->getKey()] = entry;
+        memOverhead += entryOverhead();
+        stats.memOverhead.incr(entryOverhead());
+        assert(stats.memOverhead.get() < GIGANTOR);
     }
     return rv;
 }
 
-size_t Checkpoint::mergePrevCheckpoint(Checkpoint *pPrevCheckpoint) {
-    size_t numNewItems = 0;
-    size_t newEntryMemOverhead = 0;
-    std::list<queued_item>::reverse_iterator rit = pPrevCheckpoint->rbegin();
+size_t Checkpoint::mergePrevCheckpoint(Checkpoint *pPrevCheckpoint,
+                                       CheckpointManager *checkpointManager) {
+    std::vector<queued_item> newItems;
+    checkpoint_queue::reverse_iterator rit = pPrevCheckpoint->rbegin();
 
     LOG(EXTENSION_LOG_INFO,
         "Collapse the checkpoint %llu into the checkpoint %llu for vbucket %d",
         pPrevCheckpoint->getId(), checkpointId, vbucketId);
 
-    keyIndex["dummy_key"].mutation_id =
-        pPrevCheckpoint->getMutationIdForKey("dummy_key");
-    keyIndex["checkpoint_start"].mutation_id =
-        pPrevCheckpoint->getMutationIdForKey("checkpoint_start");
+    // This checkpoint's own meta items are always indexed.
+    const std::string metaKeys[] = { "dummy_key", "checkpoint_start" };
+    for (size_t i = 0; i < 2; ++i) {
+        checkpoint_index::iterator it = keyIndex.find(metaKeys[i]);
+        assert(it != keyIndex.end());
+        it->second.mutation_id = pPrevCheckpoint->getMutationIdForKey(metaKeys[i]);
+    }
     for (; rit != pPrevCheckpoint->rend(); ++rit) {
         const std::string &key = (*rit)->getKey();
         if ((*rit)->getOperation() != queue_op_del &&
@@ -187,23 +294,167 @@ size_t Checkpoint::mergePrevCheckpoint(Checkpoint *pPrevCheckpoint) {
         }
         checkpoint_index::iterator it = keyIndex.find(key);
         if (it == keyIndex.end()) {
-            std::list<queued_item>::iterator pos = toWrite.begin();
-            // Skip the first two meta items
-            ++pos; ++pos;
-            toWrite.insert(pos, *rit);
-            index_entry entry = {--pos, pPrevCheckpoint->getMutationIdForKey(key)};
+            newItems.push_back(*rit);
+            itemBytes += (*rit)->size();
+            // The position is filled in below.  The item is shared with the
+            // previous checkpoint and kept alive by this one's queue, so its
+            // key can be borrowed.
+            index_entry entry = {checkpoint_queue::iterator(),
+                                 pPrevCheckpoint->getMutationIdForKey(key)};
             keyIndex[key] = entry;
-            newEntryMemOverhead += key.size() + sizeof(index_entry);
             ++numItems;
-            ++numNewItems;
         }
     }
-    memOverhead += newEntryMemOverhead;
-    stats.memOverhead.incr(newEntryMemOverhead);
+    size_t numNewItems = newItems.size();
+    memOverhead += numNewItems * entryOverhead();
+    stats.memOverhead.incr(numNewItems * entryOverhead());
     assert(stats.memOverhead.get() < GIGANTOR);
+    if (numNewItems == 0) {
+        return 0;
+    }
+
+    // The new items go right after the first two meta items.  Nothing can
+    // be inserted in the middle of the queue, so it is rebuilt, taking the
+    // cursors in this checkpoint along.
+    std::vector<CheckpointCursor*> movedCursors;
+    if (*(checkpointManager->persistenceCursor.currentCheckpoint) == this) {
+        movedCursors.push_back(&checkpointManager->persistenceCursor);
+    }
+    std::map<const std::string, CheckpointCursor>::iterator map_it;
+    for (map_it = checkpointManager->tapCursors.begin();
+         map_it != checkpointManager->tapCursors.end(); ++map_it) {
+        if (*(map_it->second.currentCheckpoint) == this) {
+            movedCursors.push_back(&map_it->second);
+        }
+    }
+
+    checkpoint_queue merged;
+    checkpoint_queue::iterator pos = toWrite.begin();
+    appendTo(merged, pos++, movedCursors);
+    appendTo(merged, pos++, movedCursors);
+    std::vector<queued_item>::reverse_iterator nit = newItems.rbegin();
+    for (; nit != newItems.rend(); ++nit) {
+        merged.push_back(*nit);
+        keyIndex.find((*nit)->getKey())->second.position = --merged.end();
+    }
+    for (; pos != toWrite.end(); ++pos) {
+        appendTo(merged, pos, movedCursors);
+    }
+    toWrite.swap(merged);
     return numNewItems;
 }
 
+void Checkpoint::appendTo(checkpoint_queue &dest, checkpoint_queue::iterator pos,
+                          std::vector<CheckpointCursor*> &movedCursors) {
+    dest.push_back(*pos);
+    checkpoint_queue::iterator newPos = --dest.end();
+    std::vector<CheckpointCursor*>::iterator cit = movedCursors.begin();
+    for (; cit != movedCursors.end(); ++cit) {
+        if ((*cit)->currentPos == pos) {
+            (*cit)->currentPos = newPos;
+        }
+    }
+    const std::string &key = (*pos)->getKey();
+    if (key.size() > 0) {
+        checkpoint_index::iterator it = keyIndex.find(key);
+        if (it != keyIndex.end() && it->second.position == pos) {
+            it->second.position = newPos;
+        }
+    }
+}
+
+size_t Checkpoint::encodeSegment(std::string &buf) {
+    size_t records = toWrite.size();
+    buf.reserve(itemBytes + records * sizeof(SegmentRecord));
+    checkpoint_queue::iterator it = toWrite.begin();
+    for (; it != toWrite.end(); ++it) {
+        const std::string &key = (*it)->getKey();
+        SegmentRecord rec;
+        memset(&rec, 0, sizeof(rec));
+        rec.seqno = (*it)->getSeqno();
+        rec.mutationId = getMutationIdForKey(key);
+        rec.queuedTime = (*it)->getQueuedTime();
+        rec.vbucket = (*it)->getVBucketId();
+        rec.op = static_cast<uint16_t>((*it)->getOperation());
+        rec.keylen = static_cast<uint16_t>(key.length());
+        buf.append(reinterpret_cast<const char*>(&rec), sizeof(rec));
+        buf.append(key);
+    }
+    return records;
+}
+
+bool Checkpoint::spilled(const std::string &path, size_t records) {
+    if (checkpointState != CHECKPOINT_CLOSED || !cursors.empty() ||
+        isSpilled() || toWrite.size() != records) {
+        return false;
+    }
+
+    // The index borrows the items' keys, so it has to go first.
+    keyIndex.clear();
+    toWrite.clear();
+    stats.memOverhead.decr(memOverhead);
+    memOverhead = 0;
+    itemBytes = 0;
+    segmentPath = path;
+    numRecords = records;
+    ++stats.numCheckpointsSpilled;
+    LOG(EXTENSION_LOG_INFO,
+        "Checkpoint %llu for vbucket %d is spilled to %s",
+        checkpointId, vbucketId, path.c_str());
+    return true;
+}
+
+bool Checkpoint::load(const std::string &buf) {
+    assert(isSpilled() && !unreadable);
+    // Decode it all before anything is put back, so that a damaged
+    // segment leaves the checkpoint as it was.
+    std::vector<std::pair<queued_item, uint64_t> > items;
+    items.reserve(numRecords);
+    size_t pos = 0;
+    while (pos < buf.size()) {
+        SegmentRecord rec;
+        if (pos + sizeof(rec) > buf.size()) {
+            break;
+        }
+        memcpy(&rec, buf.data() + pos, sizeof(rec));
+        pos += sizeof(rec);
+        if (pos + rec.keylen > buf.size() || rec.op > queue_op_checkpoint_end) {
+            break;
+        }
+        queued_item qi(new QueuedItem(buf.substr(pos, rec.keylen), rec.vbucket,
+                                      static_cast<enum queue_operation>(rec.op),
+                                      rec.seqno));
+        pos += rec.keylen;
+        qi->setQueuedTime(rec.queuedTime);
+        items.push_back(std::make_pair(qi, rec.mutationId));
+    }
+    if (pos != buf.size() || items.size() != numRecords) {
+        LOG(EXTENSION_LOG_WARNING,
+            "Checkpoint %llu for vbucket %d has a damaged segment in %s",
+            checkpointId, vbucketId, segmentPath.c_str());
+        setUnreadable();
+        return false;
+    }
+
+    std::vector<std::pair<queued_item, uint64_t> >::iterator it = items.begin();
+    for (; it != items.end(); ++it) {
+        toWrite.push_back(it->first);
+        itemBytes += it->first->size();
+        if (it->first->getKey().size() > 0) {
+            checkpoint_queue::iterator last = --toWrite.end();
+            index_entry entry = {last, it->second};
+            keyIndex[(*last)->getKey()] = entry;
+            memOverhead += entryOverhead();
+        }
+    }
+    stats.memOverhead.incr(memOverhead);
+    assert(stats.memOverhead.get() < GIGANTOR);
+    segmentPath.clear();
+    numRecords = 0;
+    ++stats.numCheckpointsLoaded;
+    return true;
+}
+
 uint64_t Checkpoint::getMutationIdForKey(const std::string &key) {
     uint64_t mid = 0;
     checkpoint_index::iterator it = keyIndex.find(key);
@@ -256,8 +507,7 @@ void CheckpointManager::setOpenCheckpointId_UNLOCKED(uint64_t id) {
         checkpointList.back()->setId(id);
         // Update the checkpoint_start item with the new Id.
         queued_item qi = createCheckpointItem(id, vbucketId, queue_op_checkpoint_start);
-        std::list<queued_item>::iterator it = ++(checkpointList.back()->begin());
-        *it = qi;
+        checkpointList.back()->setCheckpointStartItem(qi);
     }
 }
 
@@ -374,7 +624,9 @@ bool CheckpointManager::registerTAPCursor_UNLOCKED(const std::string &name,
     std::list<Checkpoint*>::iterator it = checkpointList.begin();
     for (; it != checkpointList.end(); ++it) {
         if (checkpointId == (*it)->getId()) {
-            found = true;
+            // A spilled checkpoint is as good as gone from memory, so the
+            // cursor is backfilled instead.
+            found = !(*it)->isSpilled();
             break;
         }
     }
@@ -395,6 +647,7 @@ bool CheckpointManager::registerTAPCursor_UNLOCKED(const std::string &name,
     if (map_it != tapCursors.end()) {
         (*(map_it->second.currentCheckpoint))->removeCursorName(name);
     }
+    lostTAPCursors.erase(name);
 
     if (!found) {
         LOG(EXTENSION_LOG_DEBUG,
@@ -406,10 +659,11 @@ bool CheckpointManager::registerTAPCursor_UNLOCKED(const std::string &name,
                             numItems - ((*it)->getNumItems() + 1), // 1 is for checkpoint start item
                             closedCheckpointOnly, open_chk_id);
         tapCursors.insert(std::pair<std::string, CheckpointCursor>(name, cursor));
+        cursorsVersion = ++cursorsVersionCounter;
         (*it)->registerCursorName(name);
     } else {
         size_t offset = 0;
-        std::list<queued_item>::iterator curr;
+        checkpoint_queue::iterator curr;
 
         LOG(EXTENSION_LOG_DEBUG,
             "Checkpoint %llu for vbucket %d exists in memory. "
@@ -434,6 +688,7 @@ bool CheckpointManager::registerTAPCursor_UNLOCKED(const std::string &name,
 
         CheckpointCursor cursor(name, it, curr, offset, closedCheckpointOnly, open_chk_id);
         tapCursors.insert(std::pair<std::string, CheckpointCursor>(name, cursor));
+        cursorsVersion = ++cursorsVersionCounter;
         // Register the tap cursor's name to the checkpoint.
         (*it)->registerCursorName(name);
     }
@@ -464,6 +719,8 @@ bool CheckpointManager::removeTAPCursor(const std::string &name) {
     }
 
     tapCursors.erase(it);
+    lostTAPCursors.erase(name);
+    cursorsVersion = ++cursorsVersionCounter;
     return true;
 }
 
@@ -647,6 +904,157 @@ void CheckpointManager::removeInvalidCursorsOnCheckpoint(Checkpoint *pCheckpoint
     }
 }
 
+size_t CheckpointManager::spillClosedCheckpoints() {
+    LockHolder lh(queueLock);
+    std::string dir = checkpointConfig.getSpillPath();
+    if (dir.empty() || stats.getTotalMemoryUsed() <= stats.mem_low_wat ||
+        checkpointList.back()->getId() == 0) {
+        return 0;
+    }
+
+    // Only what the persistence cursor is done with is spilled, and never
+    // the checkpoint right after one a cursor is in, which it's about to
+    // read.  The segments are encoded now, but written without the lock.
+    std::vector<Checkpoint*> chks;
+    std::vector<uint64_t> ids;
+    std::vector<size_t> records;
+    std::vector<std::string> paths;
+    std::vector<std::string> segments;
+    bool prevReferenced = false;
+    std::list<Checkpoint*>::iterator it = checkpointList.begin();
+    for (; it != persistenceCursor.currentCheckpoint; ++it) {
+        Checkpoint *chk = *it;
+        removeInvalidCursorsOnCheckpoint(chk);
+        bool referenced = chk->getNumberOfCursors() > 0;
+        if (!referenced && !prevReferenced &&
+            chk->getState() == CHECKPOINT_CLOSED && !chk->isSpilled()) {
+            std::stringstream path;
+            path << dir << "/chk_" << vbucketId << "_" << chk->getId()
+                 << "." << ++segmentCounter;
+            chks.push_back(chk);
+            ids.push_back(chk->getId());
+            paths.push_back(path.str());
+            segments.push_back(std::string());
+            records.push_back(chk->encodeSegment(segments.back()));
+        }
+        prevReferenced = referenced;
+    }
+    if (chks.empty()) {
+        return 0;
+    }
+
+    lh.unlock();
+    size_t written = 0;
+    for (; written < chks.size(); ++written) {
+        if (!writeSegment(paths[written], segments[written])) {
+            LOG(EXTENSION_LOG_WARNING,
+                "Failed to spill checkpoint %llu for vbucket %d to %s: %s",
+                ids[written], vbucketId, paths[written].c_str(), strerror(errno));
+            unlink(paths[written].c_str());
+            // The others won't fare any better.
+            break;
+        }
+        std::string().swap(segments[written]);
+    }
+    lh.lock();
+
+    // The checkpoints may have been purged, merged into or reached by a
+    // cursor meanwhile, in which case their segments are of no use.
+    size_t spilled = 0;
+    std::vector<std::string> unused;
+    for (size_t i = 0; i < written; ++i) {
+        prevReferenced = false;
+        for (it = checkpointList.begin(); it != checkpointList.end(); ++it) {
+            if (*it == chks[i]) {
+                break;
+            }
+            prevReferenced = (*it)->getNumberOfCursors() > 0;
+        }
+        if (it != checkpointList.end() && (*it)->getId() == ids[i] &&
+            !prevReferenced && (*it)->spilled(paths[i], records[i])) {
+            ++spilled;
+        } else {
+            unused.push_back(paths[i]);
+        }
+    }
+    lh.unlock();
+
+    std::vector<std::string>::iterator uit = unused.begin();
+    for (; uit != unused.end(); ++uit) {
+        unlink(uit->c_str());
+    }
+    return spilled;
+}
+
+void CheckpointManager::requestReadAhead_UNLOCKED(const CheckpointCursor &cursor) {
+    std::list<Checkpoint*>::iterator next = cursor.currentCheckpoint;
+    if (++next != checkpointList.end() && (*next)->isSpilled() &&
+        !(*next)->isUnreadable() && !(*next)->isLoading()) {
+        readAheadPending.set(true);
+    }
+}
+
+size_t CheckpointManager::loadSpilledCheckpoints() {
+    LockHolder lh(queueLock);
+    // Cleared first, so a cursor that asks while this runs isn't lost.
+    readAheadPending.set(false);
+    std::vector<std::string> paths;
+    std::map<const std::string, CheckpointCursor>::iterator cit = tapCursors.begin();
+    for (; cit != tapCursors.end(); ++cit) {
+        std::list<Checkpoint*>::iterator next = cit->second.currentCheckpoint;
+        if (++next != checkpointList.end() && (*next)->isSpilled() &&
+            !(*next)->isUnreadable() && !(*next)->isLoading()) {
+            (*next)->setLoading(true);
+            paths.push_back((*next)->getSegmentPath());
+            ++numLoading;
+        }
+    }
+    lh.unlock();
+
+    size_t loaded = 0;
+    std::vector<std::string>::iterator pit = paths.begin();
+    for (; pit != paths.end(); ++pit) {
+        const std::string &path = *pit;
+        std::string buf;
+        bool ok = readSegment(path, buf);
+        int err = errno;
+        // What's been read is all that's needed of the file.
+        unlink(path.c_str());
+
+        // The checkpoint may have been purged meanwhile.  Its segment path
+        // is unique to it.
+        LockHolder llh(queueLock);
+        --numLoading;
+        std::list<Checkpoint*>::iterator it = checkpointList.begin();
+        for (; it != checkpointList.end(); ++it) {
+            if ((*it)->getSegmentPath() == path) {
+                break;
+            }
+        }
+        if (it == checkpointList.end()) {
+            continue;
+        }
+        (*it)->setLoading(false);
+        if (!ok) {
+            LOG(EXTENSION_LOG_WARNING,
+                "Failed to read checkpoint %llu for vbucket %d back from %s: %s",
+                (*it)->getId(), vbucketId, path.c_str(), strerror(err));
+            (*it)->setUnreadable();
+        } else if ((*it)->load(buf)) {
+            ++loaded;
+        }
+    }
+    return loaded;
+}
+
+void CheckpointManager::backfillTAPCursor_UNLOCKED(const std::string &name) {
+    if (lostTAPCursors.insert(name).second) {
+        LOG(EXTENSION_LOG_WARNING,
+            "The cursor with name \"%s\" lost items to a spilled checkpoint "
+            "of vbucket %d, and will be backfilled", name.c_str(), vbucketId);
+    }
+}
+
 void CheckpointManager::collapseClosedCheckpoints(std::list<Checkpoint*> &collapsedChks) {
     // If there are one open checkpoint and more than one closed checkpoint, collapse those
     // closed checkpoints into one checkpoint to reduce the memory overhead.
@@ -655,13 +1063,18 @@ void CheckpointManager::collapseClosedCheckpoints(std::list<Checkpoint*> &collap
         std::set<std::string> fastCursors;
         std::list<Checkpoint*>::iterator lastClosedChk = checkpointList.end();
         --lastClosedChk; --lastClosedChk; // Move to the lastest closed checkpoint.
-        fastCursors.insert((*lastClosedChk)->getCursorNameList().begin(),
-                           (*lastClosedChk)->getCursorNameList().end());
         std::list<Checkpoint*>::reverse_iterator rit = checkpointList.rbegin();
         ++rit; ++rit;// Move to the second lastest closed checkpoint.
+        // Spilled checkpoints aren't read back in just to be collapsed.
+        // Only the ones in memory after the latest spilled one are.
+        if ((*lastClosedChk)->isSpilled() || (*rit)->isSpilled()) {
+            return;
+        }
+        fastCursors.insert((*lastClosedChk)->getCursorNameList().begin(),
+                           (*lastClosedChk)->getCursorNameList().end());
         size_t numDuplicatedItems = 0, numMetaItems = 0;
-        for (; rit != checkpointList.rend(); ++rit) {
-            size_t numAddedItems = (*lastClosedChk)->mergePrevCheckpoint(*rit);
+        for (; rit != checkpointList.rend() && !(*rit)->isSpilled(); ++rit) {
+            size_t numAddedItems = (*lastClosedChk)->mergePrevCheckpoint(*rit, this);
             numDuplicatedItems += ((*rit)->getNumItems() - numAddedItems);
             numMetaItems += 2; // checkpoint start and end meta items
 
@@ -679,7 +1092,15 @@ void CheckpointManager::collapseClosedCheckpoints(std::list<Checkpoint*> &collap
                 }
             }
         }
-        putCursorsInChk(slowCursors, lastClosedChk);
+        // The slow cursors' offsets count the items of the checkpoints left
+        // before the collapsed one.
+        std::list<Checkpoint*>::iterator firstCollapsed = rit.base();
+        size_t baseOffset = 0;
+        std::list<Checkpoint*>::iterator it = checkpointList.begin();
+        for (; it != firstCollapsed; ++it) {
+            baseOffset += (*it)->getNumItems() + 2;
+        }
+        putCursorsInChk(slowCursors, lastClosedChk, baseOffset);
 
         numItems -= (numDuplicatedItems + numMetaItems);
         Checkpoint *pOpenCheckpoint = checkpointList.back();
@@ -698,12 +1119,46 @@ void CheckpointManager::collapseClosedCheckpoints(std::list<Checkpoint*> &collap
             }
         }
         collapsedChks.splice(collapsedChks.end(), checkpointList,
-                             checkpointList.begin(),  lastClosedChk);
+                             firstCollapsed, lastClosedChk);
     }
 }
 
 bool CheckpointManager::queueDirty(const queued_item &qi, const RCPtr<VBucket> &vbucket) {
     LockHolder lh(queueLock);
+    return queueDirty_UNLOCKED(qi->getKey(), qi->getOperation(), qi->getSeqno(),
+                               &qi, vbucket);
+}
+
+bool CheckpointManager::queueDirty(const std::string &key,
+                                   enum queue_operation op,
+                                   uint64_t seqno,
+                                   const RCPtr<VBucket> &vbucket) {
+    LockHolder lh(queueLock);
+    return queueDirty_UNLOCKED(key, op, seqno, NULL, vbucket);
+}
+
+size_t CheckpointManager::queueDirty(const std::vector<queued_item> &items,
+                                     const RCPtr<VBucket> &vbucket,
+                                     std::vector<queued_item> &notQueued) {
+    size_t queued = 0;
+    LockHolder lh(queueLock);
+    std::vector<queued_item>::const_iterator it;
+    for (it = items.begin(); it != items.end(); ++it) {
+        if (queueDirty_UNLOCKED((*it)->getKey(), (*it)->getOperation(),
+                                (*it)->getSeqno(), &*it, vbucket)) {
+            ++queued;
+        } else {
+            notQueued.push_back(*it);
+        }
+    }
+    return queued;
+}
+
+bool CheckpointManager::queueDirty_UNLOCKED(const std::string &key,
+                                            enum queue_operation op,
+                                            uint64_t seqno,
+                                            const queued_item *qi,
+                                            const RCPtr<VBucket> &vbucket) {
     if (vbucket->getState() != vbucket_state_active &&
         checkpointList.back()->getState() == CHECKPOINT_CLOSED) {
         // Replica vbucket might receive items from the master even if the current open checkpoint
@@ -729,7 +1184,12 @@ bool CheckpointManager::queueDirty(const queued_item &qi, const RCPtr<VBucket> &
     // mutation messages from the active vbucket, which contain the checkpoint Ids.
 
     assert(checkpointList.back()->getState() == CHECKPOINT_OPEN);
-    queue_dirty_t result = checkpointList.back()->queueDirty(qi, this);
+    queue_dirty_t result;
+    if (qi) {
+        result = checkpointList.back()->queueDirty(*qi, this);
+    } else {
+        result = checkpointList.back()->queueDirty(key, op, seqno, this);
+    }
     if (result == NEW_ITEM) {
         ++numItems;
     }
@@ -762,6 +1222,43 @@ void CheckpointManager::getAllItemsFromCurrentPosition(CheckpointCursor &cursor,
     }
 }
 
+void CheckpointManager::getSlowTAPCursors(size_t maxLag, std::list<std::string> &names,
+                                          std::map<std::string, size_t> &pinnedBytes) {
+    LockHolder lh(queueLock);
+    std::map<const std::string, CheckpointCursor>::iterator it = tapCursors.begin();
+    for (; it != tapCursors.end(); ++it) {
+        size_t lag = 0;
+        size_t bytes = 0;
+        // A cursor can't get past a spilled checkpoint that can't be read.
+        bool lost = lostTAPCursors.find(it->first) != lostTAPCursors.end();
+        std::list<Checkpoint*>::iterator chk = it->second.currentCheckpoint;
+        for (; chk != checkpointList.end() &&
+                 (*chk)->getState() == CHECKPOINT_CLOSED; ++chk) {
+            ++lag;
+            bytes += (*chk)->getMemConsumption();
+            lost = lost || (*chk)->isUnreadable();
+        }
+        if (lost || (maxLag > 0 && lag > maxLag)) {
+            names.push_back(it->first);
+        }
+        pinnedBytes[it->first] = bytes;
+    }
+}
+
+size_t CheckpointManager::getUnrefCheckpointMemory() {
+    LockHolder lh(queueLock);
+    size_t bytes = 0;
+    // Checkpoints are only ever purged from the head of the list.
+    std::list<Checkpoint*>::iterator it = checkpointList.begin();
+    for (; it != checkpointList.end(); ++it) {
+        if ((*it)->getState() == CHECKPOINT_OPEN || (*it)->getNumberOfCursors() > 0) {
+            break;
+        }
+        bytes += (*it)->getMemConsumption();
+    }
+    return bytes;
+}
+
 void CheckpointManager::getAllItemsForPersistence(std::vector<queued_item> &items) {
     LockHolder lh(queueLock);
     // Get all the items up to the end of the current open checkpoint.
@@ -778,6 +1275,9 @@ void CheckpointManager::getAllItemsForTAPConnection(const std::string &name,
                                                     std::vector<queued_item> &items) {
     LockHolder lh(queueLock);
     std::map<const std::string, CheckpointCursor>::iterator it = tapCursors.find(name);
+    if (it != tapCursors.end()) {
+        requestReadAhead_UNLOCKED(it->second);
+    }
     if (it == tapCursors.end()) {
         LOG(EXTENSION_LOG_DEBUG,
             "The cursor for TAP connection \"%s\" is not found in the checkpoint",
@@ -796,6 +1296,9 @@ queued_item CheckpointManager::nextItem(const std::string &name, bool &isLastMut
     LockHolder lh(queueLock);
     isLastMutationItem = false;
     std::map<const std::string, CheckpointCursor>::iterator it = tapCursors.find(name);
+    if (it != tapCursors.end()) {
+        requestReadAhead_UNLOCKED(it->second);
+    }
     if (it == tapCursors.end()) {
         LOG(EXTENSION_LOG_WARNING, "The cursor with name \"%s\" is not found in"
             " the checkpoint of vbucket %d.\n", name.c_str(), vbucketId);
@@ -819,6 +1322,71 @@ queued_item CheckpointManager::nextItem(const std::string &name, bool &isLastMut
     }
 }
 
+size_t CheckpointManager::nextItems(const std::string &name, TapCursorHandle &handle,
+                                    size_t maxItems, size_t maxBytes,
+                                    std::vector<queued_item> &items,
+                                    std::vector<bool> &lastMutationItems) {
+    LockHolder lh(queueLock);
+    std::map<const std::string, CheckpointCursor>::iterator it =
+        findTAPCursor_UNLOCKED(name, handle);
+    if (it != tapCursors.end()) {
+        requestReadAhead_UNLOCKED(it->second);
+    }
+    if (it == tapCursors.end()) {
+        LOG(EXTENSION_LOG_WARNING, "The cursor with name \"%s\" is not found in"
+            " the checkpoint of vbucket %d.\n", name.c_str(), vbucketId);
+        return 0;
+    }
+    if (checkpointList.back()->getId() == 0) {
+        LOG(EXTENSION_LOG_INFO,
+            "VBucket %d is still in backfill phase that doesn't allow "
+            " the tap cursor to fetch an item from it's current checkpoint",
+            vbucketId);
+        return 0;
+    }
+
+    CheckpointCursor &cursor = it->second;
+    size_t count = 0;
+    size_t bytes = 0;
+    while (count < maxItems && bytes < maxBytes) {
+        bool isLastMutationItem = false;
+        queued_item qi;
+        if ((*(cursor.currentCheckpoint))->getState() == CHECKPOINT_CLOSED) {
+            qi = nextItemFromClosedCheckpoint(cursor, isLastMutationItem);
+        } else {
+            qi = nextItemFromOpenCheckpoint(cursor, isLastMutationItem);
+        }
+        if (qi->getOperation() == queue_op_empty) {
+            break;
+        }
+        if (qi->getOperation() == queue_op_checkpoint_end && count > 0) {
+            // Leave it for the next batch, by when the items before it have
+            // been sent and can be acked.
+            decrCursorOffset_UNLOCKED(cursor, 1);
+            decrCursorPos_UNLOCKED(cursor);
+            break;
+        }
+        items.push_back(qi);
+        lastMutationItems.push_back(isLastMutationItem);
+        ++count;
+        bytes += qi->size();
+        if (qi->getOperation() == queue_op_checkpoint_end) {
+            break;
+        }
+    }
+    return count;
+}
+
+std::map<const std::string, CheckpointCursor>::iterator
+CheckpointManager::findTAPCursor_UNLOCKED(const std::string &name,
+                                          TapCursorHandle &handle) {
+    if (handle.cursorsVersion != cursorsVersion) {
+        handle.cursor = tapCursors.find(name);
+        handle.cursorsVersion = cursorsVersion;
+    }
+    return handle.cursor;
+}
+
 queued_item CheckpointManager::nextItemFromClosedCheckpoint(CheckpointCursor &cursor,
                                                             bool &isLastMutationItem) {
     // The cursor already reached to the beginning of the checkpoint that had "open" state
@@ -873,20 +1441,24 @@ queued_item CheckpointManager::nextItemFromOpenCheckpoint(CheckpointCursor &curs
 
 void CheckpointManager::clear(vbucket_state_t vbState) {
     LockHolder lh(queueLock);
-    std::list<Checkpoint*>::iterator it = checkpointList.begin();
-    // Remove all the checkpoints.
-    while(it != checkpointList.end()) {
-        delete *it;
-        ++it;
-    }
-    checkpointList.clear();
+    // Remove all the checkpoints, deleting them once the lock is released
+    // as spilled ones have their segment files removed.
+    std::list<Checkpoint*> oldCheckpoints;
+    oldCheckpoints.swap(checkpointList);
     numItems = 0;
     mutationCounter = 0;
+    lostTAPCursors.clear();
 
     uint64_t checkpointId = vbState == vbucket_state_active ? 1 : 0;
     // Add a new open checkpoint.
     addNewCheckpoint_UNLOCKED(checkpointId);
     resetCursors();
+    lh.unlock();
+
+    std::list<Checkpoint*>::iterator it = oldCheckpoints.begin();
+    for (; it != oldCheckpoints.end(); ++it) {
+        delete *it;
+    }
 }
 
 void CheckpointManager::resetCursors(bool resetPersistenceCursor) {
@@ -898,13 +1470,23 @@ void CheckpointManager::resetCursors(bool resetPersistenceCursor) {
         checkpointList.front()->registerCursorName(persistenceCursor.name);
     }
 
-    // Reset all the TAP cursors.
+    // Reset all the TAP cursors, to the first checkpoint in memory.  The
+    // open checkpoint is never spilled.  If spilled ones are skipped, the
+    // cursors are backfilled instead.
+    std::list<Checkpoint*>::iterator first = checkpointList.begin();
+    size_t offset = 0;
+    for (; (*first)->isSpilled(); ++first) {
+        offset += (*first)->getNumItems() + 2; // 2 is for checkpoint start and end items.
+    }
     std::map<const std::string, CheckpointCursor>::iterator cit = tapCursors.begin();
     for (; cit != tapCursors.end(); ++cit) {
-        cit->second.currentCheckpoint = checkpointList.begin();
-        cit->second.currentPos = checkpointList.front()->begin();
-        cit->second.offset = 0;
-        checkpointList.front()->registerCursorName(cit->second.name);
+        cit->second.currentCheckpoint = first;
+        cit->second.currentPos = (*first)->begin();
+        cit->second.offset = offset;
+        (*first)->registerCursorName(cit->second.name);
+        if (first != checkpointList.begin()) {
+            backfillTAPCursor_UNLOCKED(cit->first);
+        }
     }
 }
 
@@ -924,6 +1506,11 @@ bool CheckpointManager::moveCursorToNextCheckpoint(CheckpointCursor &cursor) {
         if (++currCheckpoint == checkpointList.end()) {
             return false;
         }
+        // A spilled checkpoint has to be read back in first, see
+        // loadSpilledCheckpoints().
+        if ((*currCheckpoint)->isSpilled()) {
+            return false;
+        }
     }
 
     // Remove the cursor's name from its current checkpoint.
@@ -980,9 +1567,14 @@ bool CheckpointManager::eligibleForEviction(const std::string &key) {
         }
     }
 
+    // Spilled checkpoints aren't read back in just for this, so a key only
+    // they hold can be evicted and is fetched from disk for the cursor.
     bool can_evict = true;
     std::list<Checkpoint*>::reverse_iterator it = checkpointList.rbegin();
     for (; it != checkpointList.rend(); ++it) {
+        if ((*it)->isSpilled()) {
+            continue;
+        }
         uint64_t mid = (*it)->getMutationIdForKey(key);
         if (mid == 0) { // key doesn't exist in a checkpoint.
             continue;
@@ -1020,6 +1612,7 @@ uint64_t CheckpointManager::getMutationIdForKey(uint64_t chk_id, std::string key
     std::list<Checkpoint*>::iterator itr = checkpointList.begin();
     for (; itr != checkpointList.end(); ++itr) {
         if (chk_id == (*itr)->getId()) {
+            // A spilled checkpoint isn't read back in for this.
             return (*itr)->getMutationIdForKey(key);
         }
     }
@@ -1027,7 +1620,7 @@ uint64_t CheckpointManager::getMutationIdForKey(uint64_t chk_id, std::string key
 }
 
 bool CheckpointManager::isLastMutationItemInCheckpoint(CheckpointCursor &cursor) {
-    std::list<queued_item>::iterator it = cursor.currentPos;
+    checkpoint_queue::iterator it = cursor.currentPos;
     ++it;
     if (it == (*(cursor.currentCheckpoint))->end() ||
         (*it)->getOperation() == queue_op_checkpoint_end) {
@@ -1091,17 +1684,38 @@ void CheckpointManager::checkAndAddNewCheckpoint(uint64_t id) {
             addNewCheckpoint_UNLOCKED(id);
         }
     } else {
-        collapseCheckpoints(id);
+        std::list<Checkpoint*> collapsedChks;
+        collapseCheckpoints(id, collapsedChks);
+        lh.unlock();
+        std::list<Checkpoint*>::iterator cit = collapsedChks.begin();
+        for (; cit != collapsedChks.end(); ++cit) {
+            delete *cit;
+        }
     }
 }
 
-void CheckpointManager::collapseCheckpoints(uint64_t id) {
+void CheckpointManager::collapseCheckpoints(uint64_t id,
+                                            std::list<Checkpoint*> &collapsedChks) {
     assert(!checkpointList.empty());
 
+    // Spilled checkpoints aren't read back in just to be collapsed.  Their
+    // items are dropped, and the TAP cursors yet to read them backfilled.
+    std::set<Checkpoint*> behindSpilled;
+    std::list<Checkpoint*>::iterator it = checkpointList.end();
+    while (it != checkpointList.begin()) {
+        if ((*--it)->isSpilled()) {
+            behindSpilled.insert(checkpointList.begin(), it);
+            break;
+        }
+    }
+
     std::map<std::string, uint64_t> cursorMap;
     std::map<const std::string, CheckpointCursor>::iterator itr;
     for (itr = tapCursors.begin(); itr != tapCursors.end(); itr++) {
         Checkpoint* chk = *(itr->second.currentCheckpoint);
+        if (behindSpilled.find(chk) != behindSpilled.end()) {
+            backfillTAPCursor_UNLOCKED(itr->first);
+        }
         const std::string& key = (*(itr->second.currentPos))->getKey();
         cursorMap[itr->first.c_str()] = chk->getMutationIdForKey(key);
     }
@@ -1115,16 +1729,18 @@ void CheckpointManager::collapseCheckpoints(uint64_t id) {
     size_t numDuplicatedItems = 0, numMetaItems = 0;
     // Collapse all checkpoints.
     for (; rit != checkpointList.rend(); ++rit) {
-        size_t numAddedItems = checkpointList.back()->mergePrevCheckpoint(*rit);
+        size_t numAddedItems = 0;
+        if (!(*rit)->isSpilled()) {
+            numAddedItems = checkpointList.back()->mergePrevCheckpoint(*rit, this);
+        }
         numDuplicatedItems += ((*rit)->getNumItems() - numAddedItems);
         numMetaItems += 2; // checkpoint start and end meta items
-        delete *rit;
     }
     numItems -= (numDuplicatedItems + numMetaItems);
 
-    if (checkpointList.size() > 1) {
-        checkpointList.erase(checkpointList.begin(), --checkpointList.end());
-    }
+    // They're deleted once the queue lock is released.
+    collapsedChks.splice(collapsedChks.end(), checkpointList,
+                         checkpointList.begin(), --checkpointList.end());
     assert(checkpointList.size() == 1);
 
     if (checkpointList.back()->getState() == CHECKPOINT_CLOSED) {
@@ -1137,11 +1753,12 @@ void CheckpointManager::collapseCheckpoints(uint64_t id) {
 }
 
 void CheckpointManager::putCursorsInChk(std::map<std::string, uint64_t> &cursors,
-                                        std::list<Checkpoint*>::iterator chkItr) {
+                                        std::list<Checkpoint*>::iterator chkItr,
+                                        size_t baseOffset) {
     int i;
     Checkpoint *chk = *chkItr;
-    std::list<queued_item>::iterator cit = chk->begin();
-    std::list<queued_item>::iterator last = chk->begin();
+    checkpoint_queue::iterator cit = chk->begin();
+    checkpoint_queue::iterator last = chk->begin();
     for (i = 0; cit != chk->end(); ++i, ++cit) {
         uint64_t id = chk->getMutationIdForKey((*cit)->getKey());
         std::map<std::string, uint64_t>::iterator mit = cursors.begin();
@@ -1150,14 +1767,14 @@ void CheckpointManager::putCursorsInChk(std::map<std::string, uint64_t> &cursors
                 if (mit->first.compare(persistenceCursor.name) == 0) {
                     persistenceCursor.currentCheckpoint = chkItr;
                     persistenceCursor.currentPos = last;
-                    persistenceCursor.offset = (i > 0) ? i - 1 : 0;
+                    persistenceCursor.offset = baseOffset + ((i > 0) ? i - 1 : 0);
                     chk->registerCursorName(persistenceCursor.name);
                 } else {
                     std::map<const std::string, CheckpointCursor>::iterator cc =
                         tapCursors.find(mit->first);
                     cc->second.currentCheckpoint = chkItr;
                     cc->second.currentPos = last;
-                    cc->second.offset = (i > 0) ? i - 1 : 0;
+                    cc->second.offset = baseOffset + ((i > 0) ? i - 1 : 0);
                     chk->registerCursorName(cc->second.name);
                 }
                 cursors.erase(mit);
@@ -1173,14 +1790,14 @@ void CheckpointManager::putCursorsInChk(std::map<std::string, uint64_t> &cursors
         if (mit->first.compare(persistenceCursor.name) == 0) {
             persistenceCursor.currentCheckpoint = chkItr;
             persistenceCursor.currentPos = last;
-            persistenceCursor.offset = (i > 0) ? i - 1 : 0;
+            persistenceCursor.offset = baseOffset + ((i > 0) ? i - 1 : 0);
             chk->registerCursorName(persistenceCursor.name);
         } else {
             std::map<const std::string, CheckpointCursor>::iterator cc =
                 tapCursors.find(mit->first);
             cc->second.currentCheckpoint = chkItr;
             cc->second.currentPos = last;
-            cc->second.offset = (i > 0) ? i - 1 : 0;
+            cc->second.offset = baseOffset + ((i > 0) ? i - 1 : 0);
             chk->registerCursorName(cc->second.name);
         }
     }
@@ -1194,7 +1811,7 @@ bool CheckpointManager::hasNext(const std::string &name) {
     }
 
     bool hasMore = true;
-    std::list<queued_item>::iterator curr = it->second.currentPos;
+    checkpoint_queue::iterator curr = it->second.currentPos;
     ++curr;
     if (curr == (*(it->second.currentCheckpoint))->end() &&
         (*(it->second.currentCheckpoint)) == checkpointList.back()) {
@@ -1220,7 +1837,7 @@ queued_item CheckpointManager::createCheckpointItem(uint64_t id,
 bool CheckpointManager::hasNextForPersistence() {
     LockHolder lh(queueLock);
     bool hasMore = true;
-    std::list<queued_item>::iterator curr = persistenceCursor.currentPos;
+    checkpoint_queue::iterator curr = persistenceCursor.currentPos;
     ++curr;
     if (curr == (*(persistenceCursor.currentCheckpoint))->end() &&
         (*(persistenceCursor.currentCheckpoint)) == checkpointList.back()) {
@@ -1285,6 +1902,7 @@ CheckpointConfig::CheckpointConfig(EventuallyPersistentEngine &e) {
     inconsistentSlaveCheckpoint = config.isInconsistentSlaveChk();
     itemNumBasedNewCheckpoint = config.isItemNumBasedNewChk();
     keepClosedCheckpoints = config.isKeepClosedChks();
+    spillPath = config.getChkSpillPath();
 }
 
 bool CheckpointConfig::validateCheckpointMaxItemsParam(size_t checkpoint_max_items) {
@@ -1347,6 +1965,15 @@ void CheckpointConfig::setMaxCheckpoints(size_t value) {
     maxCheckpoints = value;
 }
 
+size_t CheckpointManager::getMemoryOverhead_UNLOCKED() {
+    size_t usage = 0;
+    std::list<Checkpoint*>::iterator it = checkpointList.begin();
+    for (; it != checkpointList.end(); ++it) {
+        usage += (*it)->memorySize();
+    }
+    return usage;
+}
+
 void CheckpointManager::addStats(ADD_STAT add_stat, const void *cookie) {
     LockHolder lh(queueLock);
     char buf[256];
@@ -1366,6 +1993,17 @@ void CheckpointManager::addStats(ADD_STAT add_stat, const void *cookie) {
     add_casted_stat(buf, checkpointList.size(), add_stat, cookie);
     snprintf(buf, sizeof(buf), "vb_%d:num_items_for_persistence", vbucketId);
     add_casted_stat(buf, getNumItemsForPersistence_UNLOCKED(), add_stat, cookie);
+    snprintf(buf, sizeof(buf), "vb_%d:mem_usage", vbucketId);
+    add_casted_stat(buf, getMemoryOverhead_UNLOCKED(), add_stat, cookie);
+    size_t numSpilled = 0;
+    std::list<Checkpoint*>::iterator it = checkpointList.begin();
+    for (; it != checkpointList.end(); ++it) {
+        if ((*it)->isSpilled()) {
+            ++numSpilled;
+        }
+    }
+    snprintf(buf, sizeof(buf), "vb_%d:num_spilled_checkpoints", vbucketId);
+    add_casted_stat(buf, numSpilled, add_stat, cookie);
     snprintf(buf, sizeof(buf), "vb_%d:checkpoint_extension", vbucketId);
     add_casted_stat(buf, isCheckpointExtension() ? "true" : "false",
                     add_stat, cookie);
@@ -22,6 +22,7 @@
 
 #include <assert.h>
 
+#include <cstring>
 #include <list>
 #include <map>
 #include <set>
@@ -29,6 +30,7 @@
 #include <vector>
 
 #include "atomic.h"
+#include "chunked_queue.h"
 #include "common.h"
 #include "locks.h"
 #include "queueditem.h"
@@ -53,18 +55,59 @@ typedef enum {
     CHECKPOINT_CLOSED  //!< The checkpoint is not open.
 } checkpoint_state;
 
+/**
+ * The items of a checkpoint, in the order they are to be written.
+ */
+typedef ChunkedQueue<queued_item> checkpoint_queue;
+
 /**
  * A checkpoint index entry.
  */
 struct index_entry {
-    std::list<queued_item>::iterator position;
+    checkpoint_queue::iterator position;
     uint64_t mutation_id;
 };
 
+/**
+ * A key in the checkpoint index.
+ *
+ * It points at the key of the queued item its entry is for rather than
+ * holding a copy, so the checkpoint keeps each key only once, in the
+ * refcounted item that the list, the index and every flusher or TAP
+ * batch share.  The item must stay in the checkpoint as long as the
+ * entry does.
+ */
+class IndexKey {
+public:
+    IndexKey(const std::string &k) : data(k.data()), len(k.length()) {}
+
+    bool operator==(const IndexKey &other) const {
+        return len == other.len && std::memcmp(data, other.data, len) == 0;
+    }
+
+    const char *data;
+    size_t      len;
+};
+
+/**
+ * FNV-1a hash of an IndexKey.
+ */
+class IndexKeyHash {
+public:
+    size_t operator()(const IndexKey &k) const {
+        uint64_t h = 0xcbf29ce484222325ULL;
+        for (size_t i = 0; i < k.len; ++i) {
+            h ^= static_cast<unsigned char>(k.data[i]);
+            h *= 0x100000001b3ULL;
+        }
+        return static_cast<size_t>(h);
+    }
+};
+
 /**
  * The checkpoint index maps a key to a checkpoint index_entry.
  */
-typedef unordered_map<std::string, index_entry> checkpoint_index;
+typedef unordered_map<IndexKey, index_entry, IndexKeyHash> checkpoint_index;
 
 class Checkpoint;
 class CheckpointManager;
@@ -89,7 +132,7 @@ public:
 
     CheckpointCursor(const std::string &n,
                      std::list<Checkpoint*>::iterator checkpoint,
-                     std::list<queued_item>::iterator pos,
+                     checkpoint_queue::iterator pos,
                      size_t os = 0, bool isClosedCheckpointOnly = false,
                      uint64_t openChkId = 1) :
         name(n), currentCheckpoint(checkpoint), currentPos(pos),
@@ -99,12 +142,28 @@ public:
 private:
     std::string                      name;
     std::list<Checkpoint*>::iterator currentCheckpoint;
-    std::list<queued_item>::iterator currentPos;
+    checkpoint_queue::iterator       currentPos;
     Atomic<size_t>                   offset;
     bool                             closedCheckpointOnly;
     uint64_t                         openChkIdAtRegistration;
 };
 
+/**
+ * Where a TAP connection's cursor was last found in a checkpoint manager,
+ * so that it needn't be looked up by name for every batch.  Registering
+ * or removing any cursor makes the manager look it up again.
+ */
+class TapCursorHandle {
+public:
+    TapCursorHandle() : cursorsVersion(0) { }
+
+private:
+    friend class CheckpointManager;
+
+    std::map<const std::string, CheckpointCursor>::iterator cursor;
+    uint64_t                                                cursorsVersion;
+};
+
 /**
  * Result from invoking queueDirty in the current open checkpoint.
  */
@@ -137,7 +196,8 @@ public:
     Checkpoint(EPStats &st, uint64_t id, uint16_t vbid,
                checkpoint_state state = CHECKPOINT_OPEN) :
         stats(st), checkpointId(id), vbucketId(vbid), creationTime(ep_real_time()),
-        checkpointState(state), numItems(0), memOverhead(0) {
+        checkpointState(state), numItems(0), memOverhead(0), itemBytes(0),
+        numRecords(0), unreadable(false), loading(false) {
         stats.memOverhead.incr(memorySize());
         assert(stats.memOverhead.get() < GIGANTOR);
     }
@@ -188,6 +248,11 @@ public:
 
     void popBackCheckpointEndItem();
 
+    /**
+     * Replace the checkpoint_start item, which is always second.
+     */
+    void setCheckpointStartItem(const queued_item &qi);
+
     /**
      * Return the number of cursors that are currently walking through this checkpoint.
      */
@@ -229,22 +294,40 @@ public:
      * @param checkpointManager the checkpoint manager to which this checkpoint belongs
      * @return a result indicating the status of the operation.
      */
-    queue_dirty_t queueDirty(const queued_item &qi, CheckpointManager *checkpointManager);
+    queue_dirty_t queueDirty(const queued_item &qi, CheckpointManager *checkpointManager) {
+        return queueDirty(qi->getKey(), qi->getOperation(), qi->getSeqno(), &qi,
+                          checkpointManager);
+    }
 
+    /**
+     * Queue a mutation of the given key, creating an item for it only if
+     * this checkpoint doesn't already hold one that can be updated.  The
+     * deduplicated case allocates nothing.
+     * @param key the key mutated
+     * @param op the operation
+     * @param seqno the item's revision
+     * @param checkpointManager the checkpoint manager to which this checkpoint belongs
+     * @return a result indicating the status of the operation.
+     */
+    queue_dirty_t queueDirty(const std::string &key, enum queue_operation op,
+                             uint64_t seqno, CheckpointManager *checkpointManager) {
+        return queueDirty(key, op, seqno, NULL, checkpointManager);
+    }
 
-    std::list<queued_item>::iterator begin() {
+
+    checkpoint_queue::iterator begin() {
         return toWrite.begin();
     }
 
-    std::list<queued_item>::iterator end() {
+    checkpoint_queue::iterator end() {
         return toWrite.end();
     }
 
-    std::list<queued_item>::reverse_iterator rbegin() {
+    checkpoint_queue::reverse_iterator rbegin() {
         return toWrite.rbegin();
     }
 
-    std::list<queued_item>::reverse_iterator rend() {
+    checkpoint_queue::reverse_iterator rend() {
         return toWrite.rend();
     }
 
@@ -260,13 +343,88 @@ public:
         return sizeof(Checkpoint) + memOverhead;
     }
 
+    /**
+     * Return the memory this checkpoint takes, its items included.
+     */
+    size_t getMemConsumption() {
+        return memorySize() + itemBytes;
+    }
+
+    /**
+     * Encode this checkpoint's items as a segment, to be written out to a
+     * file without the queue lock held.
+     * @param buf receives the segment
+     * @return the number of items encoded
+     */
+    size_t encodeSegment(std::string &buf);
+
+    /**
+     * Drop the items, and their index, from memory once they're in a
+     * segment file.  Only a closed checkpoint no cursor is in may be
+     * spilled.
+     * @param path the segment file the items were written to
+     * @param records how many items were encoded into it
+     * @return false if the checkpoint changed since it was encoded
+     */
+    bool spilled(const std::string &path, size_t records);
+
+    /**
+     * Put back the items of a spilled checkpoint from its segment, read
+     * in from its file without the queue lock held.  If the segment is
+     * damaged, nothing is put back and the checkpoint is marked
+     * unreadable.
+     * @param buf the contents of the segment file
+     * @return true if the items were put back
+     */
+    bool load(const std::string &buf);
+
+    /**
+     * Return true if this checkpoint's items are in a segment file.
+     */
+    bool isSpilled() const {
+        return !segmentPath.empty();
+    }
+
+    /**
+     * Return true if this checkpoint's segment couldn't be read back.
+     */
+    bool isUnreadable() const {
+        return unreadable;
+    }
+
+    /**
+     * Mark the segment of this spilled checkpoint as one that can't be
+     * read back.
+     */
+    void setUnreadable() {
+        unreadable = true;
+    }
+
+    /**
+     * Return true if this spilled checkpoint's segment file is being read.
+     */
+    bool isLoading() const {
+        return loading;
+    }
+
+    void setLoading(bool l) {
+        loading = l;
+    }
+
+    const std::string &getSegmentPath() const {
+        return segmentPath;
+    }
+
     /**
      * Merge the previous checkpoint into the this checkpoint by adding the items from
      * the previous checkpoint, which don't exist in this checkpoint.
+     * Cursors walking this checkpoint are kept on the items they point at.
      * @param pPrevCheckpoint pointer to the previous checkpoint.
+     * @param checkpointManager the checkpoint manager to which this checkpoint belongs
      * @return the number of items added from the previous checkpoint.
      */
-    size_t mergePrevCheckpoint(Checkpoint *pPrevCheckpoint);
+    size_t mergePrevCheckpoint(Checkpoint *pPrevCheckpoint,
+                               CheckpointManager *checkpointManager);
 
     /**
      * Get the mutation id for a given key in this checkpoint
@@ -276,6 +434,25 @@ public:
     uint64_t getMutationIdForKey(const std::string &key);
 
 private:
+    queue_dirty_t queueDirty(const std::string &key, enum queue_operation op,
+                             uint64_t seqno, const queued_item *qi,
+                             CheckpointManager *checkpointManager);
+
+    /**
+     * Memory an item's index entry and place in the list take.  The key
+     * isn't counted again as the index shares the item's.
+     */
+    static size_t entryOverhead() {
+        return sizeof(checkpoint_index::value_type) + sizeof(queued_item);
+    }
+
+    /**
+     * Append the item at a position in this checkpoint to another queue,
+     * moving its index entry and any of the cursors along with it.
+     */
+    void appendTo(checkpoint_queue &dest, checkpoint_queue::iterator pos,
+                  std::vector<CheckpointCursor*> &movedCursors);
+
     EPStats                       &stats;
     uint64_t                       checkpointId;
     uint16_t                       vbucketId;
@@ -283,10 +460,15 @@ private:
     checkpoint_state               checkpointState;
     size_t                         numItems;
     std::set<std::string>          cursors; // List of cursors with their unique names.
-    // List is used for queueing mutations as vector incurs shift operations for deduplication.
-    std::list<queued_item>         toWrite;
+    // Deduplication erases an item's slot and appends it again, so nothing is shifted.
+    checkpoint_queue               toWrite;
     checkpoint_index               keyIndex;
     size_t                         memOverhead;
+    size_t                         itemBytes;
+    std::string                    segmentPath;
+    size_t                         numRecords;
+    bool                           unreadable;
+    bool                           loading;
 };
 
 /**
@@ -305,8 +487,11 @@ public:
         mutationCounter(0), persistenceCursor("persistence"),
         isCollapsedCheckpoint(false),
         checkpointExtension(false),
-        pCursorPreCheckpointId(0)
+        pCursorPreCheckpointId(0),
+        cursorsVersion(++cursorsVersionCounter), readAheadPending(false),
+        numLoading(0)
     {
+        queueLock.setLockSite(&queueLockSite);
         addNewCheckpoint(checkpointId);
         registerPersistenceCursor();
     }
@@ -377,6 +562,32 @@ public:
      */
     bool queueDirty(const queued_item &qi, const RCPtr<VBucket> &vbucket);
 
+    /**
+     * Queue a mutation of the given key to be written to persistent layer,
+     * only allocating an item for it if the open checkpoint doesn't
+     * already hold one to deduplicate against.
+     * @param key the key mutated
+     * @param op the operation
+     * @param seqno the item's revision
+     * @param vbucket the vbucket that the item is pushed into.
+     * @return true if an item queued increases the size of persistence queue by 1.
+     */
+    bool queueDirty(const std::string &key, enum queue_operation op,
+                    uint64_t seqno, const RCPtr<VBucket> &vbucket);
+
+    /**
+     * Queue a batch of items to be written to persistent layer, taking
+     * the queue lock only once.
+     * @param items the items to be persisted, in order.
+     * @param vbucket the vbucket that the items are pushed into.
+     * @param notQueued receives the items that didn't increase the size of
+     * persistence queue.
+     * @return the number of items that increased the size of persistence queue.
+     */
+    size_t queueDirty(const std::vector<queued_item> &items,
+                      const RCPtr<VBucket> &vbucket,
+                      std::vector<queued_item> &notQueued);
+
     /**
      * Return the next item to be sent to a given TAP connection
      * @param name the name of a given TAP connection
@@ -386,6 +597,69 @@ public:
      */
     queued_item nextItem(const std::string &name, bool &isLastMutationItem);
 
+    /**
+     * Return the next items to be sent to a given TAP connection, taking
+     * the queue lock only once.  A checkpoint_end item always comes in a
+     * batch of its own, so that the items before it are sent before it is
+     * looked at and the cursor can still be moved back from it.
+     * @param name the name of a given TAP connection
+     * @param handle where the cursor was last found, updated as needed
+     * @param maxItems the most items to return
+     * @param maxBytes stop once the items returned take this many bytes
+     * @param items receives the items
+     * @param lastMutationItems receives, for each item, whether it is the
+     * last mutation one in the closed checkpoint
+     * @return the number of items returned, 0 if there is nothing to send
+     */
+    size_t nextItems(const std::string &name, TapCursorHandle &handle,
+                     size_t maxItems, size_t maxBytes,
+                     std::vector<queued_item> &items,
+                     std::vector<bool> &lastMutationItems);
+
+    /**
+     * Find the TAP cursors that have fallen too far behind in this vbucket,
+     * with more than maxLag closed checkpoints still to read, or that lost
+     * items to a spilled checkpoint.  A maxLag of 0 isn't checked.
+     * @param maxLag the most closed checkpoints a cursor may have left to read
+     * @param names receives the names of the cursors found
+     * @param pinnedBytes receives for every TAP cursor the memory its unread
+     *        closed checkpoints take, to be added up over the vbuckets
+     */
+    void getSlowTAPCursors(size_t maxLag, std::list<std::string> &names,
+                           std::map<std::string, size_t> &pinnedBytes);
+
+    /**
+     * Return the memory taken by the closed checkpoints no cursor refers
+     * to any more, which the checkpoint remover is free to purge.
+     */
+    size_t getUnrefCheckpointMemory();
+
+    /**
+     * Spill the closed checkpoints that no cursor is in or is about to
+     * move into to segment files, if a spill path is set and memory usage
+     * is above the low water mark.  Only checkpoints the persistence
+     * cursor is done with are spilled, so the flusher never waits on one.
+     * The files are written without the queue lock held.
+     * @return the number of checkpoints spilled
+     */
+    size_t spillClosedCheckpoints();
+
+    /**
+     * Return true if a TAP cursor is held up at a spilled checkpoint that
+     * hasn't been read back in yet.
+     */
+    bool hasPendingReadAhead() const {
+        return readAheadPending.get() || numLoading.get() > 0;
+    }
+
+    /**
+     * Read back in the spilled checkpoints the TAP cursors are about to
+     * move into.  Meant for a background task: the segment files are read
+     * without the queue lock held, but this thread waits on the disk.
+     * @return the number of checkpoints read back in
+     */
+    size_t loadSpilledCheckpoints();
+
     /**
      * Return the list of items, which needs to be persisted, to the flusher.
      * @param items the array that will contain the list of items to be persisted and
@@ -506,6 +780,16 @@ private:
 
     void registerPersistenceCursor();
 
+    bool queueDirty_UNLOCKED(const std::string &key, enum queue_operation op,
+                             uint64_t seqno, const queued_item *qi,
+                             const RCPtr<VBucket> &vbucket);
+
+    /**
+     * Get the memory the checkpoints take beyond their items.
+     * The lock should be acquired before calling this function.
+     */
+    size_t getMemoryOverhead_UNLOCKED();
+
     /**
      * Create a new open checkpoint and add it to the checkpoint list.
      * The lock should be acquired before calling this function.
@@ -515,6 +799,22 @@ private:
 
     void removeInvalidCursorsOnCheckpoint(Checkpoint *pCheckpoint);
 
+    /**
+     * Ask for the spilled checkpoint right after the one a cursor is in
+     * to be read back in, see loadSpilledCheckpoints().  A cursor doesn't
+     * move into a spilled checkpoint, so until then it gets no items; one
+     * whose segment can't be read holds up the cursors before it until
+     * they're dropped to a backfill.
+     * @param cursor the cursor about to need the checkpoint
+     */
+    void requestReadAhead_UNLOCKED(const CheckpointCursor &cursor);
+
+    /**
+     * Have a TAP cursor dropped to a backfill by the checkpoint remover,
+     * as the items it still has to read aren't all in memory.
+     */
+    void backfillTAPCursor_UNLOCKED(const std::string &name);
+
     /**
      * Create a new open checkpoint and add it to the checkpoint list.
      * @param id the id of a checkpoint to be created.
@@ -564,16 +864,29 @@ private:
 
     void collapseClosedCheckpoints(std::list<Checkpoint*> &collapsedChks);
 
-    void collapseCheckpoints(uint64_t id);
+    void collapseCheckpoints(uint64_t id, std::list<Checkpoint*> &collapsedChks);
 
     void resetCursors(bool resetPersistenceCursor = true);
 
     void putCursorsInChk(std::map<std::string, uint64_t> &cursors,
-                         std::list<Checkpoint*>::iterator chkItr);
+                         std::list<Checkpoint*>::iterator chkItr,
+                         size_t baseOffset = 0);
 
     static queued_item createCheckpointItem(uint64_t id, uint16_t vbid,
                                             enum queue_operation checkpoint_op);
 
+    /**
+     * Find a TAP cursor through a handle, looking it up by name only if
+     * the cursors changed since the handle was filled in.
+     */
+    std::map<const std::string, CheckpointCursor>::iterator
+    findTAPCursor_UNLOCKED(const std::string &name, TapCursorHandle &handle);
+
+    static LockSite queueLockSite;
+    //! Hands out a new cursorsVersion whenever the cursors of any manager change.
+    static Atomic<uint64_t> cursorsVersionCounter;
+    //! Keeps segment file names unique, whatever the checkpoint ids.
+    static Atomic<uint64_t> segmentCounter;
 
     EPStats                 &stats;
     CheckpointConfig        &checkpointConfig;
@@ -588,6 +901,13 @@ private:
     uint64_t                 lastClosedCheckpointId;
     uint64_t                 pCursorPreCheckpointId;
     std::map<const std::string, CheckpointCursor> tapCursors;
+    uint64_t                 cursorsVersion;
+    //! TAP cursors that lost items to a spilled checkpoint and need a backfill.
+    std::set<std::string>    lostTAPCursors;
+    //! Set when a TAP cursor waits on a spilled checkpoint to be read back.
+    Atomic<bool>             readAheadPending;
+    //! Spilled checkpoints being read back in by loadSpilledCheckpoints().
+    Atomic<size_t>           numLoading;
 };
 
 /**
@@ -602,7 +922,8 @@ public:
           maxCheckpoints(DEFAULT_MAX_CHECKPOINTS),
           inconsistentSlaveCheckpoint (false),
           itemNumBasedNewCheckpoint(true),
-          keepClosedCheckpoints(false)
+          keepClosedCheckpoints(false),
+          spillPath()
     { /* empty */ }
 
     CheckpointConfig(EventuallyPersistentEngine &e);
@@ -631,6 +952,14 @@ public:
         return keepClosedCheckpoints;
     }
 
+    /**
+     * Return the directory closed checkpoints are spilled to, empty if
+     * they are always kept in memory.
+     */
+    const std::string &getSpillPath() const {
+        return spillPath;
+    }
+
 protected:
     friend class CheckpointConfigChangeListener;
     friend class EventuallyPersistentEngine;
@@ -655,6 +984,10 @@ protected:
         keepClosedCheckpoints = value;
     }
 
+    void setSpillPath(const std::string &path) {
+        spillPath = path;
+    }
+
     static void addConfigChangeListener(EventuallyPersistentEngine &engine);
 
 private:
@@ -673,6 +1006,8 @@ private:
     // Flag indicating if closed checkpoints should be kept in memory if the current memory usage
     // below the high water mark.
     bool keepClosedCheckpoints;
+    // Directory closed checkpoints are spilled to under memory pressure.
+    std::string spillPath;
 };
 
 #endif  // SRC_CHECKPOINT_H_
@@ -17,6 +17,12 @@
 
 #include "config.h"
 
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <utility>
+#include <vector>
+
 #include "checkpoint_remover.h"
 #include "ep.h"
 #include "ep_engine.h"
@@ -37,8 +43,15 @@ public:
 
     bool visitBucket(RCPtr<VBucket> &vb) {
         currentBucket = vb;
+        dropSlowCursors(vb);
         bool newCheckpointCreated = false;
         removed = vb->checkpointManager.removeClosedUnrefCheckpoints(vb, newCheckpointCreated);
+        // What the slow cursors still hold needn't all be in memory.
+        vb->checkpointManager.spillClosedCheckpoints();
+        // In case a load was asked for as the last one started.
+        if (vb->checkpointManager.hasPendingReadAhead()) {
+            store->scheduleCheckpointLoad();
+        }
         // If the new checkpoint is created, notify this event to the tap notify IO thread
         // so that it can then signal all paused TAP connections.
         if (newCheckpointCreated) {
@@ -58,17 +71,96 @@ public:
         removed = 0;
     }
 
+    /**
+     * Have the TAP producers whose cursors are too many checkpoints behind
+     * in this vbucket, or lost items to a spilled checkpoint, backfill it
+     * from disk instead.  Note what each cursor pins in memory, which is
+     * only checked against tap_cursor_drop_pcnt once it's added up over
+     * all the vbuckets.
+     */
+    void dropSlowCursors(RCPtr<VBucket> &vb) {
+        size_t maxLag = store->getEPEngine().getTapConfig().getCursorDropChks();
+        std::list<std::string> slow;
+        std::map<std::string, size_t> pinnedBytes;
+        vb->checkpointManager.getSlowTAPCursors(maxLag, slow, pinnedBytes);
+
+        std::list<std::string>::iterator it = slow.begin();
+        for (; it != slow.end(); ++it) {
+            if (dropCursor(vb, *it)) {
+                pinnedBytes.erase(*it);
+            }
+        }
+        std::map<std::string, size_t>::iterator pit = pinnedBytes.begin();
+        for (; pit != pinnedBytes.end(); ++pit) {
+            if (pit->second > 0) {
+                pinned[pit->first].push_back(std::make_pair(pit->second, vb->getId()));
+            }
+        }
+    }
+
+    /**
+     * Have the TAP producers whose cursors pin more than
+     * tap_cursor_drop_pcnt of the memory used, over all the vbuckets,
+     * backfill the vbuckets where they pin the most until they're below.
+     */
+    void dropMemoryHogs() {
+        size_t memPcnt = store->getEPEngine().getTapConfig().getCursorDropPcnt();
+        if (memPcnt == 0) {
+            return;
+        }
+        size_t maxBytes = stats.getTotalMemoryUsed() / 100 * memPcnt;
+
+        std::map<std::string, PinnedList>::iterator it = pinned.begin();
+        for (; it != pinned.end(); ++it) {
+            PinnedList &vbs = it->second;
+            size_t total = 0;
+            PinnedList::iterator vit = vbs.begin();
+            for (; vit != vbs.end(); ++vit) {
+                total += vit->first;
+            }
+            std::sort(vbs.begin(), vbs.end(), std::greater<PinnedList::value_type>());
+            for (vit = vbs.begin(); vit != vbs.end() && total > maxBytes; ++vit) {
+                RCPtr<VBucket> vb = store->getVBucket(vit->second);
+                if (vb && dropCursor(vb, it->first)) {
+                    total -= vit->first;
+                }
+            }
+        }
+        pinned.clear();
+    }
+
+    /**
+     * Drop a TAP cursor from a vbucket, to be backfilled from disk.
+     */
+    bool dropCursor(RCPtr<VBucket> &vb, const std::string &name) {
+        size_t unrefBefore = vb->checkpointManager.getUnrefCheckpointMemory();
+        if (!store->getEPEngine().getTapConnMap().dropSlowCursor(name, vb->getId())) {
+            return false;
+        }
+        ++stats.tapCursorsDropped;
+        size_t unrefAfter = vb->checkpointManager.getUnrefCheckpointMemory();
+        if (unrefAfter > unrefBefore) {
+            stats.tapCursorDropMemReclaimed.incr(unrefAfter - unrefBefore);
+        }
+        return true;
+    }
+
     void complete() {
+        dropMemoryHogs();
         if (stateFinalizer) {
             *stateFinalizer = true;
         }
     }
 
 private:
+    //! The memory a cursor pins in each vbucket, with the vbucket's id.
+    typedef std::vector<std::pair<size_t, uint16_t> > PinnedList;
+
     EventuallyPersistentStore *store;
     EPStats                   &stats;
     size_t                     removed;
     bool                      *stateFinalizer;
+    std::map<std::string, PinnedList> pinned;
 };
 
 bool ClosedUnrefCheckpointRemover::callback(Dispatcher &d, TaskId &t) {
@@ -80,3 +172,22 @@ bool ClosedUnrefCheckpointRemover::callback(Dispatcher &d, TaskId &t) {
     d.snooze(t, sleepTime);
     return true;
 }
+
+bool SpilledCheckpointLoader::callback(Dispatcher &d, TaskId &t) {
+    (void)d; (void)t;
+    // Cleared first, so a cursor that asks meanwhile gets another run.
+    store->checkpointLoadScheduled.set(false);
+    size_t loaded = 0;
+    size_t maxSize = store->vbuckets.getSize();
+    for (size_t i = 0; i < maxSize; ++i) {
+        RCPtr<VBucket> vb = store->getVBucket(static_cast<uint16_t>(i));
+        if (vb && vb->checkpointManager.hasPendingReadAhead()) {
+            loaded += vb->checkpointManager.loadSpilledCheckpoints();
+        }
+    }
+    // Wake up the paused TAP connections waiting on them.
+    if (loaded > 0) {
+        store->getEPEngine().notifyNotificationThread();
+    }
+    return false;
+}
@@ -58,4 +58,23 @@ private:
     bool                       available;
 };
 
+/**
+ * Read back in the spilled checkpoints TAP cursors are waiting on, so the
+ * front-end threads driving the TAP producers never wait on the disk.
+ */
+class SpilledCheckpointLoader : public DispatcherCallback {
+public:
+
+    SpilledCheckpointLoader(EventuallyPersistentStore *s) : store(s) {}
+
+    bool callback(Dispatcher &d, TaskId &t);
+
+    std::string description() {
+        return std::string("Reading spilled checkpoints back into memory");
+    }
+
+private:
+    EventuallyPersistentStore *store;
+};
+
 #endif  // SRC_CHECKPOINT_REMOVER_H_
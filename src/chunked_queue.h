@@ -0,0 +1,285 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2012 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#ifndef SRC_CHUNKED_QUEUE_H_
+#define SRC_CHUNKED_QUEUE_H_ 1
+
+#include "config.h"
+
+#include <algorithm>
+#include <cassert>
+#include <iterator>
+
+#include "common.h"
+
+/**
+ * A queue of elements stored in fixed size arrays linked together.
+ *
+ * Elements are only ever appended, so walking the queue reads memory in
+ * order and appending allocates once per chunk rather than once per
+ * element.  Iterators point at a slot and stay valid for as long as the
+ * element in it does, whatever else is appended or erased.
+ *
+ * Erasing leaves the slot empty rather than shifting anything over it,
+ * and iterators step over empty slots.  A chunk is freed as soon as all
+ * of its slots have been erased.
+ */
+template <typename T, size_t N = 64>
+class ChunkedQueue {
+private:
+
+    struct Chunk {
+        Chunk() : prev(NULL), next(NULL), used(0), live(0) {}
+
+        T       slots[N];
+        bool    erased[N];
+        Chunk  *prev;
+        Chunk  *next;
+        //! Slots filled so far, erased or not.
+        size_t  used;
+        size_t  live;
+    };
+
+public:
+
+    /**
+     * A position in the queue.
+     */
+    class iterator : public std::iterator<std::bidirectional_iterator_tag, T> {
+    public:
+        iterator() : chunk(NULL), idx(0) {}
+
+        T &operator*() const {
+            return chunk->slots[idx];
+        }
+
+        T *operator->() const {
+            return &chunk->slots[idx];
+        }
+
+        iterator &operator++() {
+            ++idx;
+            if (idx < chunk->used && !chunk->erased[idx]) {
+                return *this;
+            }
+            return skipForward();
+        }
+
+        iterator operator++(int) {
+            iterator rv(*this);
+            ++(*this);
+            return rv;
+        }
+
+        iterator &operator--() {
+            if (idx > 0 && !chunk->erased[idx - 1]) {
+                --idx;
+                return *this;
+            }
+            return skipBackward();
+        }
+
+        iterator operator--(int) {
+            iterator rv(*this);
+            --(*this);
+            return rv;
+        }
+
+        bool operator==(const iterator &other) const {
+            return chunk == other.chunk && idx == other.idx;
+        }
+
+        bool operator!=(const iterator &other) const {
+            return !(*this == other);
+        }
+
+    private:
+        friend class ChunkedQueue;
+
+        iterator(Chunk *c, size_t i) : chunk(c), idx(i) {}
+
+        // Go on from idx to the next slot in use, or the end.
+        iterator &skipForward() {
+            while (true) {
+                if (idx == chunk->used) {
+                    if (!chunk->next) {
+                        return *this;
+                    }
+                    chunk = chunk->next;
+                    idx = 0;
+                }
+                if (!chunk->erased[idx]) {
+                    return *this;
+                }
+                ++idx;
+            }
+        }
+
+        iterator &skipBackward() {
+            do {
+                if (idx == 0) {
+                    chunk = chunk->prev;
+                    idx = chunk->used;
+                }
+                --idx;
+            } while (chunk->erased[idx]);
+            return *this;
+        }
+
+        Chunk  *chunk;
+        size_t  idx;
+    };
+
+    typedef std::reverse_iterator<iterator> reverse_iterator;
+
+    ChunkedQueue() : head(new Chunk), tail(head), count(0) {}
+
+    ~ChunkedQueue() {
+        clear();
+        delete head;
+    }
+
+    iterator begin() {
+        return iterator(head, 0).skipForward();
+    }
+
+    iterator end() {
+        return iterator(tail, tail->used);
+    }
+
+    reverse_iterator rbegin() {
+        return reverse_iterator(end());
+    }
+
+    reverse_iterator rend() {
+        return reverse_iterator(begin());
+    }
+
+    bool empty() const {
+        return count == 0;
+    }
+
+    /**
+     * The number of elements, not counting erased slots.
+     */
+    size_t size() const {
+        return count;
+    }
+
+    T &back() {
+        return *(--end());
+    }
+
+    void push_back(const T &ob) {
+        if (tail->used == N && tail->live == 0) {
+            // Every slot was erased, so nothing can point into it.
+            tail->used = 0;
+        } else if (tail->used == N) {
+            Chunk *c = new Chunk;
+            c->prev = tail;
+            tail->next = c;
+            tail = c;
+        }
+        tail->slots[tail->used] = ob;
+        tail->erased[tail->used] = false;
+        ++tail->used;
+        ++tail->live;
+        ++count;
+    }
+
+    void pop_back() {
+        assert(!empty());
+        erase(--end());
+        // Trailing erased slots can be filled again.
+        while (tail->used > 0 && tail->erased[tail->used - 1]) {
+            --tail->used;
+        }
+    }
+
+    /**
+     * Erase the element at the given position, which no iterator may
+     * point at afterwards.
+     */
+    void erase(iterator pos) {
+        Chunk *c = pos.chunk;
+        assert(!c->erased[pos.idx]);
+        c->slots[pos.idx] = T();
+        c->erased[pos.idx] = true;
+        --c->live;
+        --count;
+        if (c->live == 0 && c != tail) {
+            unlink(c);
+        }
+    }
+
+    /**
+     * Erase the element at the given position and append it again.
+     *
+     * @return the element's new position
+     */
+    iterator moveToBack(iterator pos) {
+        iterator next(pos);
+        if (++next == end()) {
+            return pos;
+        }
+        T ob(*pos);
+        erase(pos);
+        push_back(ob);
+        return --end();
+    }
+
+    void clear() {
+        while (head != tail) {
+            Chunk *c = head;
+            head = head->next;
+            delete c;
+        }
+        head->prev = NULL;
+        for (size_t i = 0; i < head->used; ++i) {
+            head->slots[i] = T();
+        }
+        head->used = 0;
+        head->live = 0;
+        count = 0;
+    }
+
+    void swap(ChunkedQueue &other) {
+        std::swap(head, other.head);
+        std::swap(tail, other.tail);
+        std::swap(count, other.count);
+    }
+
+private:
+
+    void unlink(Chunk *c) {
+        if (c->prev) {
+            c->prev->next = c->next;
+        } else {
+            head = c->next;
+        }
+        c->next->prev = c->prev;
+        delete c;
+    }
+
+    Chunk  *head;
+    Chunk  *tail;
+    size_t  count;
+
+    DISALLOW_COPY_AND_ASSIGN(ChunkedQueue);
+};
+
+#endif  // SRC_CHUNKED_QUEUE_H_
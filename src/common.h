@@ -235,6 +235,21 @@ inline std::string hrtime2text(hrtime_t time) {
    return ss.str();
 }
 
+/**
+ * Cheap per call randomness without any shared state to fight over:
+ * the time, mixed with an address that tells callers apart.
+ * @param salt an address to mix in
+ * @return a pseudo random number
+ */
+inline uint64_t hrtimeRandom(const void *salt) {
+    uint64_t x = static_cast<uint64_t>(gethrtime()) ^
+        reinterpret_cast<uintptr_t>(salt);
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    return x;
+}
+
 /**
  * Given a vector instance with the sorted elements and a chunk size, this will creates
  * the list of chunks where each chunk represents a specific range and contains the chunk
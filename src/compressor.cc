@@ -0,0 +1,209 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2012 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "config.h"
+
+#include <cstdlib>
+#include <cstring>
+
+#include "atomic.h"
+#include "common.h"
+#include "compressor.h"
+
+static const size_t HASH_LOG(13);
+static const size_t HASH_SIZE(1 << HASH_LOG);
+static const size_t MAX_LITERAL(32);
+static const size_t MAX_OFFSET(1 << 13);
+static const size_t MAX_REF(264);
+
+static inline uint32_t hashAt(const uint8_t *p) {
+    uint32_t v = (p[0] << 16) | (p[1] << 8) | p[2];
+    return ((v * 2654435761U) >> (32 - HASH_LOG)) & (HASH_SIZE - 1);
+}
+
+extern "C" {
+    static void freeHashTable(void *p) {
+        free(p);
+    }
+}
+
+static ThreadLocal<uint32_t*> hashTables(freeHashTable);
+
+/**
+ * Get this thread's trigram table.  It isn't cleared between calls:
+ * whatever an entry holds is only used once it's been checked to point
+ * before the current position and at the same three bytes.
+ */
+static uint32_t *getHashTable() {
+    uint32_t *htab = hashTables.get();
+    if (htab == NULL) {
+        htab = static_cast<uint32_t*>(calloc(HASH_SIZE, sizeof(uint32_t)));
+        if (htab == NULL) {
+            return NULL;
+        }
+        hashTables.set(htab);
+    }
+    return htab;
+}
+
+size_t LZCompressor::compress(const char *in, size_t inLen,
+                              char *out, size_t outLen) {
+    const uint8_t *ip = reinterpret_cast<const uint8_t*>(in);
+    const uint8_t *base = ip;
+    const uint8_t *inEnd = ip + inLen;
+    uint8_t *op = reinterpret_cast<uint8_t*>(out);
+    uint8_t *outEnd = op + outLen;
+
+    if (inLen == 0 || op >= outEnd) {
+        return 0;
+    }
+    // Positions (plus one, so zero means empty) of recent trigrams.
+    uint32_t *htab = getHashTable();
+    if (htab == NULL) {
+        return 0;
+    }
+    size_t lit = 0;
+    ++op; // Control byte of the first literal run.
+
+    while (ip + 2 < inEnd) {
+        uint32_t h = hashAt(ip);
+        uint32_t pos = static_cast<uint32_t>(ip - base);
+        // Entries left by earlier inputs may point anywhere.
+        const uint8_t *ref = htab[h] && htab[h] <= pos ? base + htab[h] - 1 : NULL;
+        htab[h] = pos + 1;
+
+        size_t off = ref ? static_cast<size_t>(ip - ref) - 1 : MAX_OFFSET;
+        if (off < MAX_OFFSET && ref[0] == ip[0] && ref[1] == ip[1] &&
+            ref[2] == ip[2]) {
+            size_t maxLen = inEnd - ip;
+            if (maxLen > MAX_REF) {
+                maxLen = MAX_REF;
+            }
+            size_t len = 3;
+            while (len < maxLen && ref[len] == ip[len]) {
+                ++len;
+            }
+
+            // Close the pending literal run, or take back its unused
+            // control byte.
+            if (lit) {
+                op[-static_cast<ssize_t>(lit) - 1] = static_cast<uint8_t>(lit - 1);
+            } else {
+                --op;
+            }
+            if (op + 4 > outEnd) {
+                return 0;
+            }
+            size_t l = len - 2;
+            if (l < 7) {
+                *op++ = static_cast<uint8_t>((off >> 8) + (l << 5));
+            } else {
+                *op++ = static_cast<uint8_t>((off >> 8) + (7 << 5));
+                *op++ = static_cast<uint8_t>(l - 7);
+            }
+            *op++ = static_cast<uint8_t>(off);
+            lit = 0;
+            ++op;
+
+            ip += len;
+            if (ip + 2 < inEnd) {
+                htab[hashAt(ip - 1)] = static_cast<uint32_t>(ip - 1 - base) + 1;
+            }
+            continue;
+        }
+
+        if (op >= outEnd) {
+            return 0;
+        }
+        *op++ = *ip++;
+        if (++lit == MAX_LITERAL) {
+            op[-static_cast<ssize_t>(lit) - 1] = static_cast<uint8_t>(lit - 1);
+            lit = 0;
+            if (op >= outEnd) {
+                return 0;
+            }
+            ++op;
+        }
+    }
+
+    while (ip < inEnd) {
+        if (op >= outEnd) {
+            return 0;
+        }
+        *op++ = *ip++;
+        if (++lit == MAX_LITERAL) {
+            op[-static_cast<ssize_t>(lit) - 1] = static_cast<uint8_t>(lit - 1);
+            lit = 0;
+            if (op >= outEnd) {
+                return 0;
+            }
+            ++op;
+        }
+    }
+
+    if (lit) {
+        op[-static_cast<ssize_t>(lit) - 1] = static_cast<uint8_t>(lit - 1);
+    } else {
+        --op;
+    }
+    return op - reinterpret_cast<uint8_t*>(out);
+}
+
+size_t LZCompressor::decompress(const char *in, size_t inLen,
+                                char *out, size_t outLen) {
+    const uint8_t *ip = reinterpret_cast<const uint8_t*>(in);
+    const uint8_t *inEnd = ip + inLen;
+    uint8_t *op = reinterpret_cast<uint8_t*>(out);
+    uint8_t *outStart = op;
+    uint8_t *outEnd = op + outLen;
+
+    while (ip < inEnd) {
+        size_t ctrl = *ip++;
+        if (ctrl < MAX_LITERAL) {
+            size_t len = ctrl + 1;
+            if (ip + len > inEnd || op + len > outEnd) {
+                return 0;
+            }
+            std::memcpy(op, ip, len);
+            ip += len;
+            op += len;
+        } else {
+            size_t len = ctrl >> 5;
+            if (len == 7) {
+                if (ip >= inEnd) {
+                    return 0;
+                }
+                len += *ip++;
+            }
+            if (ip >= inEnd) {
+                return 0;
+            }
+            size_t off = ((ctrl & 0x1f) << 8) + *ip++ + 1;
+            len += 2;
+            if (off > static_cast<size_t>(op - outStart) || op + len > outEnd) {
+                return 0;
+            }
+            // Byte by byte: the reference may overlap what we write.
+            const uint8_t *ref = op - off;
+            for (size_t i = 0; i < len; ++i) {
+                op[i] = ref[i];
+            }
+            op += len;
+        }
+    }
+    return op - outStart;
+}
@@ -0,0 +1,64 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2012 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#ifndef SRC_COMPRESSOR_H_
+#define SRC_COMPRESSOR_H_ 1
+
+#include "config.h"
+
+#include <cstddef>
+
+/**
+ * A small, fast LZ77 compressor for in-memory values.
+ *
+ * The encoding is LZF's: a control byte below 32 introduces that many
+ * plus one literal bytes.  Any other control byte starts a back
+ * reference.  Its top three bits hold the match length minus two, and
+ * 7 there means one more length byte follows.  Its low five bits plus
+ * the next byte hold the distance back minus one.
+ */
+class LZCompressor {
+public:
+
+    /**
+     * Compress a buffer.
+     *
+     * @param in the data to compress
+     * @param inLen the length of the data
+     * @param out where to write the compressed data
+     * @param outLen the room available at out
+     *
+     * @return the compressed length, or 0 if it wouldn't fit in outLen
+     */
+    static size_t compress(const char *in, size_t inLen,
+                           char *out, size_t outLen);
+
+    /**
+     * Decompress a buffer produced by compress().
+     *
+     * @param in the compressed data
+     * @param inLen the length of the compressed data
+     * @param out where to write the original data
+     * @param outLen the room available at out
+     *
+     * @return the original length, or 0 if the input is corrupt or
+     *         doesn't fit in outLen
+     */
+    static size_t decompress(const char *in, size_t inLen,
+                             char *out, size_t outLen);
+};
+
+#endif  // SRC_COMPRESSOR_H_
@@ -107,6 +107,16 @@ public:
         } else if (key.compare("mutation_mem_threshold") == 0) {
             double mem_threshold = static_cast<double>(value) / 100;
             StoredValue::setMutationMemoryThreshold(mem_threshold);
+        } else if (key.compare("inline_value_threshold") == 0) {
+            StoredValue::setInlineValueThreshold(value);
+        } else if (key.compare("compression_threshold") == 0) {
+            StoredValue::setCompressionThreshold(value);
+        } else if (key.compare("visitor_threads") == 0) {
+            store.setVisitorThreads(value);
+        } else if (key.compare("visitor_chunk_items") == 0) {
+            store.setVisitorChunkItems(value);
+        } else if (key.compare("visitor_chunk_time") == 0) {
+            store.setVisitorChunkTime(value);
         } else if (key.compare("tap_throttle_queue_cap") == 0) {
             store.getEPEngine().getTapThrottle().setQueueCap(value);
         } else if (key.compare("tap_throttle_cap_pcnt") == 0) {
@@ -118,6 +128,16 @@ public:
         }
     }
 
+    virtual void stringValueChanged(const std::string &key, const char *value) {
+        if (key.compare("compression_mode") == 0) {
+            StoredValue::setCompressionMode(value);
+        } else {
+            LOG(EXTENSION_LOG_WARNING,
+                "Failed to change value for unknown variable, %s\n",
+                key.c_str());
+        }
+    }
+
 private:
     EventuallyPersistentStore &store;
 };
@@ -301,7 +321,10 @@ EventuallyPersistentStore::EventuallyPersistentStore(EventuallyPersistentEngine
                 theEngine.getConfiguration().getKlogBlockSize()),
     accessLog(engine.getConfiguration().getAlogPath(),
               engine.getConfiguration().getAlogBlockSize()),
-    diskFlushAll(false), bgFetchDelay(0), snapshotVBState(false)
+    diskFlushAll(false), bgFetchDelay(0), snapshotVBState(false),
+    checkpointLoadScheduled(false),
+    fullEviction(false), bFilterKeyCount(0), bFilterFpProb(0.01),
+    valueCache(NULL)
 {
     LOG(EXTENSION_LOG_INFO, "Storage props:  c=%ld/r=%ld/rw=%ld\n",
         storageProperties.maxConcurrency(),
@@ -386,9 +409,53 @@ EventuallyPersistentStore::EventuallyPersistentStore(EventuallyPersistentEngine
     config.addValueChangedListener("mutation_mem_threshold",
                                    new EPStoreValueChangeListener(*this));
 
+    StoredValue::setInlineValueThreshold(config.getInlineValueThreshold());
+    config.addValueChangedListener("inline_value_threshold",
+                                   new EPStoreValueChangeListener(*this));
+
+    StoredValue::setCompressionMode(config.getCompressionMode());
+    config.addValueChangedListener("compression_mode",
+                                   new EPStoreValueChangeListener(*this));
+    StoredValue::setCompressionThreshold(config.getCompressionThreshold());
+    config.addValueChangedListener("compression_threshold",
+                                   new EPStoreValueChangeListener(*this));
+
+    fullEviction = config.getItemEvictionPolicy() == "full_eviction";
+    if (fullEviction && !storageProperties.hasEfficientVBDump()) {
+        // Tap backfills couldn't find ejected items without a disk dump.
+        LOG(EXTENSION_LOG_WARNING,
+            "Full eviction needs a store with efficient vbucket dumps, "
+            "ejecting values only\n");
+        fullEviction = false;
+    }
+    setVisitorThreads(config.getVisitorThreads());
+    config.addValueChangedListener("visitor_threads",
+                                   new EPStoreValueChangeListener(*this));
+    setVisitorChunkItems(config.getVisitorChunkItems());
+    config.addValueChangedListener("visitor_chunk_items",
+                                   new EPStoreValueChangeListener(*this));
+    setVisitorChunkTime(config.getVisitorChunkTime());
+    config.addValueChangedListener("visitor_chunk_time",
+                                   new EPStoreValueChangeListener(*this));
+
+    if (!config.getValueCachePath().empty()) {
+        try {
+            valueCache = new ValueCache(stats, config.getValueCachePath(),
+                                        config.getValueCacheSize());
+        } catch (ValueCache::OpenException &e) {
+            LOG(EXTENSION_LOG_WARNING,
+                "Error opening value cache:  %s (disabling)", e.what());
+        }
+    }
+
+    // Only under full eviction may a miss in memory have to go to disk.
+    if (fullEviction && config.isBfilterEnabled()) {
+        bFilterKeyCount = config.getBfilterKeyCount();
+    }
+    bFilterFpProb = config.getBfilterFpProb();
+
     if (startVb0) {
-        RCPtr<VBucket> vb(new VBucket(0, vbucket_state_active, stats,
-                                      engine.getCheckpointConfig()));
+        RCPtr<VBucket> vb(newVBucket(0, vbucket_state_active));
         vbuckets.addBucket(vb);
     }
 
@@ -543,6 +610,7 @@ EventuallyPersistentStore::~EventuallyPersistentStore() {
     delete dispatcher;
     delete nonIODispatcher;
     delete warmupTask;
+    delete valueCache;
 }
 
 void EventuallyPersistentStore::startDispatcher() {
@@ -636,51 +704,245 @@ void EventuallyPersistentStore::firePendingVBucketOps() {
 
 /// @cond DETAILS
 /**
- * Inner loop of deleteExpiredItems.
+ * A key handed to deleteExpiredItems, with where it lives.
  */
-class Deleter {
+class ExpiredKey {
 public:
-    Deleter(EventuallyPersistentStore *ep) : e(ep), startTime(ep_real_time()) {}
-    void operator() (std::pair<uint16_t, std::string> vk) {
-        RCPtr<VBucket> vb = e->getVBucket(vk.first);
+    ExpiredKey(uint16_t vb, int b, int h, const std::string *k) :
+        vbid(vb), bucket(b), hash(h), key(k) {}
+
+    bool operator <(const ExpiredKey &other) const {
+        return vbid < other.vbid ||
+            (vbid == other.vbid && bucket < other.bucket);
+    }
+
+    uint16_t           vbid;
+    int                bucket;
+    int                hash;
+    const std::string *key;
+};
+/// @endcond
+
+void
+EventuallyPersistentStore::deleteExpiredItems(std::list<std::pair<uint16_t, std::string> > &keys) {
+    time_t startTime = ep_real_time();
+
+    // Sort the keys by vbucket and hash bucket, so each bucket is only
+    // locked once however many of its keys expire together.
+    std::vector<ExpiredKey> batch;
+    batch.reserve(keys.size());
+    RCPtr<VBucket> vb;
+    std::list<std::pair<uint16_t, std::string> >::iterator it;
+    for (it = keys.begin(); it != keys.end(); ++it) {
+        if (!vb || vb->getId() != it->first) {
+            vb = getVBucket(it->first);
+        }
         if (vb) {
-            int bucket_num(0);
-            e->incExpirationStat(vb);
-            LockHolder lh = vb->ht.getLockedBucket(vk.second, &bucket_num);
-            StoredValue *v = vb->ht.unlocked_find(vk.second, bucket_num, true, false);
+            int h = vb->ht.hash(it->second);
+            batch.push_back(ExpiredKey(it->first, vb->ht.bucketHint(h), h,
+                                       &it->second));
+        }
+    }
+    std::sort(batch.begin(), batch.end());
+
+    std::vector<queued_item> deletions;
+    size_t i = 0;
+    while (i < batch.size()) {
+        uint16_t vbid = batch[i].vbid;
+        vb = getVBucket(vbid);
+        if (!vb) {
+            while (i < batch.size() && batch[i].vbid == vbid) {
+                ++i;
+            }
+            continue;
+        }
+
+        int bucket_num(0);
+        LockHolder lh = vb->ht.getLockedBucket(batch[i].hash, &bucket_num);
+        do {
+            const std::string &key = *batch[i].key;
+            StoredValue *v = vb->ht.unlocked_find(key, bucket_num, true, false);
             if (v && v->isTempItem()) {
                 // This is a temporary item whose background fetch for metadata
                 // has completed.
-                bool deleted = vb->ht.unlocked_del(vk.second, bucket_num);
+                incExpirationStat(vb);
+                bool deleted = vb->ht.unlocked_del(key, bucket_num);
                 assert(deleted);
             } else if (v && v->isExpired(startTime) && !v->isDeleted()) {
+                // Only count keys that are still expired; the expiry index
+                // may hand us ones that were touched or removed since.
+                incExpirationStat(vb);
                 vb->ht.unlocked_softDelete(v, 0);
-                e->queueDirty(vb, vk.second, vb->getId(), queue_op_del,
-                              v->getSeqno(), false);
+                if (doPersistence) {
+                    deletions.push_back(queued_item(new QueuedItem(key, vbid,
+                                                                   queue_op_del,
+                                                                   v->getSeqno())));
+                }
             }
+            ++i;
+        } while (i < batch.size() && batch[i].vbid == vbid &&
+                 vb->ht.unlocked_inBucket(batch[i].hash, bucket_num));
+
+        // Queued before the bucket is unlocked, so a later mutation of any
+        // of these keys can't be queued ahead of its deletion.
+        if (!deletions.empty()) {
+            queueDirty(vb, deletions);
+            deletions.clear();
         }
     }
+}
 
-private:
-    EventuallyPersistentStore *e;
-    time_t                     startTime;
-};
-/// @endcond
+size_t
+EventuallyPersistentStore::ejectItems(std::list<std::pair<uint16_t, std::string> > &keys) {
+    size_t ejected(0);
+    std::list<std::pair<uint16_t, std::string> >::iterator it;
+    for (it = keys.begin(); it != keys.end(); ++it) {
+        RCPtr<VBucket> vb = getVBucket(it->first);
+        if (!vb) {
+            continue;
+        }
+        int bucket_num(0);
+        LockHolder lh = vb->ht.getLockedBucket(it->second, &bucket_num);
+        StoredValue *v = vb->ht.unlocked_find(it->second, bucket_num,
+                                              false, false);
+        // The item may have been touched since the pager picked it.
+        if (v && vb->checkpointManager.eligibleForEviction(it->second) &&
+            vb->ht.unlocked_ejectItem(v, bucket_num)) {
+            ++ejected;
+        }
+    }
+    return ejected;
+}
 
-void
-EventuallyPersistentStore::deleteExpiredItems(std::list<std::pair<uint16_t, std::string> > &keys) {
-    // This can be made a lot more efficient, but I'd rather see it
-    // show up in a profiling report first.
-    std::for_each(keys.begin(), keys.end(), Deleter(this));
+void EventuallyPersistentStore::cacheEjectedValue(RCPtr<VBucket> &vb,
+                                                  const std::string &key,
+                                                  uint64_t cas,
+                                                  const value_t &value) {
+    if (valueCache == NULL || value.get() == NULL) {
+        return;
+    }
+    value_t raw(value);
+    if (raw->isCompressed()) {
+        raw.reset(raw->decompress());
+    }
+    uint64_t offset;
+    if (!valueCache->put(key, cas, raw, offset)) {
+        return;
+    }
+    int bucket_num(0);
+    LockHolder lh = vb->ht.getLockedBucket(key, &bucket_num);
+    StoredValue *v = vb->ht.unlocked_find(key, bucket_num, false, false);
+    if (v) {
+        v->unlocked_setValueCacheOffset(offset, cas, vb->ht);
+    }
+}
+
+Item *EventuallyPersistentStore::fetchFromValueCache(uint16_t vbucket,
+                                                     const std::string &key) {
+    RCPtr<VBucket> vb = getVBucket(vbucket);
+    if (valueCache == NULL || !vb) {
+        return NULL;
+    }
+    int bucket_num(0);
+    LockHolder lh = vb->ht.getLockedBucket(key, &bucket_num);
+    StoredValue *v = vb->ht.unlocked_find(key, bucket_num, false, false);
+    uint64_t offset;
+    if (v == NULL || !v->getValueCacheOffset(offset)) {
+        return NULL;
+    }
+    uint64_t cas = v->getCas();
+    uint32_t flags = v->getFlags();
+    time_t exptime = v->getExptime();
+    int64_t id = v->getId();
+    uint64_t seqno = v->getSeqno();
+    lh.unlock();
+
+    value_t value(valueCache->get(offset, key, cas));
+    if (value.get() == NULL) {
+        return NULL;
+    }
+    return new Item(key, flags, exptime, value, cas, id, vbucket, seqno);
+}
+
+size_t EventuallyPersistentStore::pageOutItem(RCPtr<VBucket> &vb,
+                                              const std::string &key) {
+    int bucket_num(0);
+    LockHolder lh = vb->ht.getLockedBucket(key, &bucket_num);
+    StoredValue *v = vb->ht.unlocked_find(key, bucket_num, false, false);
+    if (v == NULL || !v->isResident()) {
+        return 0;
+    }
+    size_t before = v->size();
+    if (v->compressValue(stats, vb->ht)) {
+        return before > v->size() ? before - v->size() : 0;
+    }
+    if (!vb->checkpointManager.eligibleForEviction(key)) {
+        return 0;
+    }
+    if (fullEviction) {
+        return vb->ht.unlocked_ejectItem(v, bucket_num) ? before : 0;
+    }
+    if (!v->eligibleForEviction()) {
+        ++stats.numFailedEjects;
+        return 0;
+    }
+    value_t ejected;
+    if (!v->ejectValue(stats, vb->ht, &ejected)) {
+        return 0;
+    }
+    size_t freed = before > v->size() ? before - v->size() : 0;
+    uint64_t cas = v->getCas();
+    lh.unlock();
+    cacheEjectedValue(vb, key, cas, ejected);
+    return freed;
+}
+
+VBucket *EventuallyPersistentStore::newVBucket(uint16_t vbid,
+                                               vbucket_state_t state) {
+    return new VBucket(vbid, state, stats, engine.getCheckpointConfig(),
+                       vbucket_state_dead, 1, bFilterKeyCount, bFilterFpProb);
+}
+
+bool EventuallyPersistentStore::isEjectedKey(RCPtr<VBucket> &vb,
+                                             const std::string &key,
+                                             int bucket_num) {
+    if (!fullEviction) {
+        return false;
+    }
+    StoredValue *v = vb->ht.unlocked_find(key, bucket_num, true, false);
+    if (v != NULL && !v->isTempInitialItem()) {
+        return false;
+    }
+    if (!vb->maybeKeyExistsInFilter(key)) {
+        ++vb->bFilterSkips;
+        return false;
+    }
+    return true;
+}
+
+ENGINE_ERROR_CODE EventuallyPersistentStore::bgFetchEjected(RCPtr<VBucket> &vb,
+                                                            const std::string &key,
+                                                            int bucket_num,
+                                                            const void *cookie) {
+    // A temporary item already there means a fetch is under way; this
+    // requestor gets its own so it's told when the item is back.
+    if (vb->ht.unlocked_find(key, bucket_num, true, false) == NULL &&
+        vb->ht.unlocked_addTempDeletedItem(bucket_num, key) == ADD_NOMEM) {
+        return ENGINE_ENOMEM;
+    }
+    bgFetch(key, vb->getId(), -1, cookie, BG_FETCH_EJECTED);
+    return ENGINE_EWOULDBLOCK;
 }
 
 StoredValue *EventuallyPersistentStore::fetchValidValue(RCPtr<VBucket> &vb,
                                                         const std::string &key,
                                                         int bucket_num,
+                                                        int h,
                                                         bool wantDeleted,
                                                         bool trackReference,
                                                         bool queueExpired) {
-    StoredValue *v = vb->ht.unlocked_find(key, bucket_num, wantDeleted, trackReference);
+    StoredValue *v = vb->ht.unlocked_find(key, bucket_num, h, wantDeleted,
+                                          trackReference);
     if (v && !v->isDeleted()) { // In the deleted case, we ignore expiration time.
         if (v->isExpired(ep_real_time())) {
             incExpirationStat(vb, false);
@@ -719,7 +981,11 @@ protocol_binary_response_status EventuallyPersistentStore::evictKey(const std::s
             v->markClean();
         }
         if (v->isResident()) {
-            if (v->ejectValue(stats, vb->ht)) {
+            value_t ejected;
+            if (v->ejectValue(stats, vb->ht, &ejected)) {
+                uint64_t cas = v->getCas();
+                lh.unlock();
+                cacheEjectedValue(vb, key, cas, ejected);
                 *msg = "Ejected.";
             } else {
                 *msg = "Can't eject: Dirty or a small object.";
@@ -756,7 +1022,25 @@ ENGINE_ERROR_CODE EventuallyPersistentStore::set(const Item &itm,
 
     bool cas_op = (itm.getCas() != 0);
 
-    mutation_type_t mtype = vb->ht.set(itm, trackReference);
+    int bucket_num(0);
+    int h = vb->ht.hash(itm.getKey());
+    LockHolder lh = vb->ht.getLockedBucket(h, &bucket_num);
+    // A CAS needs the current item, which may only be on disk.
+    if (cas_op && cookie && isEjectedKey(vb, itm.getKey(), bucket_num)) {
+        return bgFetchEjected(vb, itm.getKey(), bucket_num, cookie);
+    }
+    // A plain set may overwrite an ejected item without reading it back;
+    // the key filter is the only way to tell it isn't a new one.
+    bool replacesEjected = !cas_op && vb->hasFilter() &&
+        vb->ht.getNumEjectedItems() > 0 &&
+        vb->ht.unlocked_find(itm.getKey(), bucket_num, h, true, false) == NULL &&
+        vb->maybeKeyExistsInFilter(itm.getKey());
+    mutation_type_t mtype = vb->ht.unlocked_set(itm, itm.getCas(), true, false,
+                                                trackReference, bucket_num, h);
+    if (replacesEjected && mtype == WAS_CLEAN) {
+        vb->ht.forgetEjectedItem();
+    }
+    lh.unlock();
     ENGINE_ERROR_CODE ret = ENGINE_SUCCESS;
 
     switch (mtype) {
@@ -805,7 +1089,18 @@ ENGINE_ERROR_CODE EventuallyPersistentStore::add(const Item &itm,
         return ENGINE_NOT_STORED;
     }
 
-    switch (vb->ht.add(itm)) {
+    int bucket_num(0);
+    int h = vb->ht.hash(itm.getKey());
+    LockHolder lh = vb->ht.getLockedBucket(h, &bucket_num);
+    // The key must be known not to exist on disk either.
+    if (cookie && isEjectedKey(vb, itm.getKey(), bucket_num)) {
+        return bgFetchEjected(vb, itm.getKey(), bucket_num, cookie);
+    }
+    add_type_t atype = vb->ht.unlocked_add(bucket_num, h, itm, true, true,
+                                           true);
+    lh.unlock();
+
+    switch (atype) {
     case ADD_NOMEM:
         return ENGINE_ENOMEM;
     case ADD_EXISTS:
@@ -928,7 +1223,7 @@ ENGINE_ERROR_CODE EventuallyPersistentStore::setVBucketState(uint16_t vbid,
         }
         scheduleVBSnapshot(Priority::VBucketPersistLowPriority);
     } else {
-        RCPtr<VBucket> newvb(new VBucket(vbid, to, stats, engine.getCheckpointConfig()));
+        RCPtr<VBucket> newvb(newVBucket(vbid, to));
         // The first checkpoint for active vbucket should start with id 2.
         uint64_t start_chk_id = (to == vbucket_state_active) ? 2 : 0;
         newvb->checkpointManager.setOpenCheckpointId(start_chk_id);
@@ -1037,7 +1332,7 @@ bool EventuallyPersistentStore::resetVBucket(uint16_t vbid) {
 
     RCPtr<VBucket> vb = vbuckets.getBucket(vbid);
     if (vb) {
-        if (vb->ht.getNumItems() == 0) { // Already reset?
+        if (vb->ht.getNumTotalItems() == 0) { // Already reset?
             return true;
         }
 
@@ -1101,20 +1396,67 @@ void EventuallyPersistentStore::completeBGFetch(const std::string &key,
     } else {
         ++stats.bg_fetched;
     }
-    roUnderlying->get(key, rowid, vbucket, gcb);
+    Item *cached = BG_FETCH_VALUE == type ? fetchFromValueCache(vbucket, key)
+                                          : NULL;
+    if (cached != NULL) {
+        GetValue cv(cached);
+        gcb.callback(cv);
+    } else {
+        roUnderlying->get(key, rowid, vbucket, gcb);
+    }
     gcb.waitForValue();
     assert(gcb.fired);
     ENGINE_ERROR_CODE status = gcb.val.getStatus();
 
+    // An ejected key with no live item on disk may still have a deletion
+    // there, which get_meta has to report.
+    RememberingCallback<GetValue> mcb;
+    if (BG_FETCH_EJECTED == type && status == ENGINE_KEY_ENOENT) {
+        RCPtr<VBucket> vb = getVBucket(vbucket);
+        if (vb && vb->hasFilter()) {
+            ++vb->bFilterFalsePositives;
+        }
+        mcb.val.setPartial();
+        ++stats.bg_meta_fetched;
+        roUnderlying->get(key, rowid, vbucket, mcb);
+        mcb.waitForValue();
+        assert(mcb.fired);
+    }
+
     // Lock to prevent a race condition between a fetch for restore and delete
     LockHolder lh(vbsetMutex);
 
     RCPtr<VBucket> vb = getVBucket(vbucket);
-    if (vb && vb->getState() == vbucket_state_active) {
+    if (vb && (vb->getState() == vbucket_state_active ||
+               BG_FETCH_EJECTED == type)) {
         int bucket_num(0);
         LockHolder hlh = vb->ht.getLockedBucket(key, &bucket_num);
         StoredValue *v = fetchValidValue(vb, key, bucket_num, true);
-        if (BG_FETCH_METADATA == type) {
+        if (BG_FETCH_EJECTED == type) {
+            if (v && v->isTempInitialItem()) {
+                if (status == ENGINE_SUCCESS) {
+                    vb->ht.unlocked_restoreEjected(*gcb.val.getValue(),
+                                                   bucket_num);
+                } else if (status == ENGINE_KEY_ENOENT &&
+                           (mcb.val.getStatus() != ENGINE_SUCCESS ||
+                            mcb.val.getValue()->getNBytes() == 0) &&
+                           v->unlocked_restoreMeta(mcb.val.getValue(),
+                                                   mcb.val.getStatus())) {
+                    // The temporary item now says the key doesn't exist.
+                    status = ENGINE_SUCCESS;
+                } else {
+                    // Also when the key was stored on disk between the two
+                    // reads; the retried operation will fetch it again.
+                    LOG(EXTENSION_LOG_WARNING,
+                        "Warning: failed background fetch of ejected "
+                        "key=%s vb=%d", key.c_str(), vbucket);
+                    status = ENGINE_TMPFAIL;
+                }
+            } else {
+                // Someone else's fetch or a mutation got there first.
+                status = ENGINE_SUCCESS;
+            }
+        } else if (BG_FETCH_METADATA == type) {
             if (v && !v->isResident()) {
                 if (v->unlocked_restoreMeta(gcb.val.getValue(),
                                             gcb.val.getStatus())) {
@@ -1150,6 +1492,7 @@ void EventuallyPersistentStore::completeBGFetch(const std::string &key,
     updateBGStats(init, start, stop);
 
     delete gcb.val.getValue();
+    delete mcb.val.getValue();
     engine.notifyIOComplete(cookie, status);
 }
 
@@ -1221,8 +1564,9 @@ void EventuallyPersistentStore::bgFetch(const std::string &key,
     std::stringstream ss;
 
     // NOTE: mutil-fetch feature will be disabled for metadata
-    // read until MB-5808 is fixed
-    if (multiBGFetchEnabled() && type != BG_FETCH_METADATA) {
+    // read until MB-5808 is fixed.  Ejected items have no rowid to
+    // batch them by.
+    if (multiBGFetchEnabled() && type == BG_FETCH_VALUE) {
         RCPtr<VBucket> vb = getVBucket(vbucket);
         assert(vb);
 
@@ -1270,11 +1614,49 @@ GetValue EventuallyPersistentStore::getInternal(const std::string &key,
         }
     }
 
+    bool bumpDue = false;
+    {
+        // Resident, unexpired items that need no nru or frequency update
+        // can be served without taking the bucket lock.  Only a snapshot
+        // is taken inside the read section; the item is built outside it
+        // so writers to the stripe don't wait on that.
+        OptimisticReadHolder rh;
+        StoredValue *v = NULL;
+        if (vb->ht.optimisticFind(key, rh, &v)) {
+            if (v == NULL || v->isDeleted()) {
+                // An ejected key has to be looked up under the lock.
+                if (!fullEviction) {
+                    GetValue rv;
+                    return rv;
+                }
+            } else if (v->isResident() && !v->isTempItem() &&
+                !v->isExpired(ep_real_time()) &&
+                // One the pager compressed is held whole again below.
+                (!v->isCompressed() || StoredValue::isCompressedOnStore()) &&
+                (!trackReference ||
+                 (v->isReferenced() && !(bumpDue = v->frequencyBumpDue())))) {
+                ItemSnapshot snapshot;
+                snapshot.take(*v, v->isLockedReadOnly(ep_current_time()));
+                bool referenced = v->isReferenced();
+                rh.release();
+                GetValue rv(snapshot.toItem(key, vbucket, &vb->ht),
+                            ENGINE_SUCCESS, snapshot.getId(), false,
+                            referenced);
+                return rv;
+            }
+        }
+    }
+
     int bucket_num(0);
-    LockHolder lh = vb->ht.getLockedBucket(key, &bucket_num);
-    StoredValue *v = fetchValidValue(vb, key, bucket_num, false, trackReference);
+    int h = vb->ht.hash(key);
+    LockHolder lh = vb->ht.getLockedBucket(h, &bucket_num);
+    StoredValue *v = fetchValidValue(vb, key, bucket_num, h, false,
+                                     trackReference && !bumpDue, true);
 
     if (v) {
+        if (bumpDue) {
+            v->referenced(vb->ht, true);
+        }
         // If the value is not resident, wait for it...
         if (!v->isResident()) {
             if (queueBG) {
@@ -1284,10 +1666,17 @@ GetValue EventuallyPersistentStore::getInternal(const std::string &key,
                             v->isReferenced());
         }
 
-        GetValue rv(v->toItem(v->isLocked(ep_current_time()), vbucket),
+        // It's been read, so it's no longer the cold value the pager
+        // compressed; don't decompress it on every read from now on.
+        v->decompressValue(stats, vb->ht);
+        GetValue rv(v->toItem(v->isLocked(ep_current_time()), vbucket,
+                              &vb->ht),
                     ENGINE_SUCCESS, v->getId(), false, v->isReferenced());
         return rv;
     } else {
+        if (queueBG && cookie && isEjectedKey(vb, key, bucket_num)) {
+            return GetValue(NULL, bgFetchEjected(vb, key, bucket_num, cookie));
+        }
         GetValue rv;
         return rv;
     }
@@ -1300,7 +1689,6 @@ ENGINE_ERROR_CODE EventuallyPersistentStore::getMetaData(const std::string &key,
                                                          uint32_t &deleted,
                                                          bool trackReferenced)
 {
-    (void) cookie;
     RCPtr<VBucket> vb = getVBucket(vbucket);
     if (!vb || vb->getState() == vbucket_state_dead ||
         vb->getState() == vbucket_state_replica) {
@@ -1310,10 +1698,14 @@ ENGINE_ERROR_CODE EventuallyPersistentStore::getMetaData(const std::string &key,
 
     int bucket_num(0);
     deleted = 0;
-    LockHolder lh = vb->ht.getLockedBucket(key, &bucket_num);
-    StoredValue *v = vb->ht.unlocked_find(key, bucket_num, true, trackReferenced);
-
-    if (v) {
+    int h = vb->ht.hash(key);
+    LockHolder lh = vb->ht.getLockedBucket(h, &bucket_num);
+    StoredValue *v = vb->ht.unlocked_find(key, bucket_num, h, true,
+                                          trackReferenced);
+
+    if (v && v->isTempInitialItem() && fullEviction) {
+        return bgFetchEjected(vb, key, bucket_num, cookie);
+    } else if (v) {
         stats.numOpsGetMeta++;
 
         if (v->isTempNonExistentItem()) {
@@ -1335,7 +1727,11 @@ ENGINE_ERROR_CODE EventuallyPersistentStore::getMetaData(const std::string &key,
         // hash table and schedule a background fetch for its metadata from the
         // persistent store. The item's state will be updated after the fetch
         // completes and the item will automatically expire after a pre-
-        // determined amount of time.
+        // determined amount of time.  In full eviction mode the key may
+        // also be alive on disk, so the whole item is read back.
+        if (fullEviction && vb->maybeKeyExistsInFilter(key)) {
+            return bgFetchEjected(vb, key, bucket_num, cookie);
+        }
         add_type_t rv = vb->ht.unlocked_addTempDeletedItem(bucket_num, key);
         switch(rv) {
         case ADD_NOMEM:
@@ -1434,7 +1830,9 @@ GetValue EventuallyPersistentStore::getAndUpdateTtl(const std::string &key,
         if (exptime_mutated) {
            v->markDirty();
         }
+        time_t indexed = v->getIndexedExptime();
         v->setExptime(exptime);
+        vb->ht.indexExpiry(v, indexed);
 
         if (v->isResident()) {
             if (exptime_mutated) {
@@ -1454,10 +1852,14 @@ GetValue EventuallyPersistentStore::getAndUpdateTtl(const std::string &key,
             }
         }
 
-        GetValue rv(v->toItem(v->isLocked(ep_current_time()), vbucket),
+        GetValue rv(v->toItem(v->isLocked(ep_current_time()), vbucket,
+                              &vb->ht),
                     ENGINE_SUCCESS, v->getId());
         return rv;
     } else {
+        if (queueBG && cookie && isEjectedKey(vb, key, bucket_num)) {
+            return GetValue(NULL, bgFetchEjected(vb, key, bucket_num, cookie));
+        }
         GetValue rv;
         return rv;
     }
@@ -1531,7 +1933,7 @@ bool EventuallyPersistentStore::getLocked(const std::string &key,
         // acquire lock and increment cas value
         v->lock(currentTime + lockTimeout);
 
-        Item *it = v->toItem(false, vbucket);
+        Item *it = v->toItem(false, vbucket, &vb->ht);
         it->setCas();
         v->setCas(it->getCas());
 
@@ -1539,6 +1941,11 @@ bool EventuallyPersistentStore::getLocked(const std::string &key,
         cb.callback(rv);
 
     } else {
+        if (cookie && isEjectedKey(vb, key, bucket_num)) {
+            GetValue rv(NULL, bgFetchEjected(vb, key, bucket_num, cookie));
+            cb.callback(rv);
+            return false;
+        }
         GetValue rv;
         cb.callback(rv);
     }
@@ -1679,11 +2086,17 @@ ENGINE_ERROR_CODE EventuallyPersistentStore::deleteItem(const std::string &key,
     }
 
     int bucket_num(0);
-    LockHolder lh = vb->ht.getLockedBucket(key, &bucket_num);
+    int h = vb->ht.hash(key);
+    LockHolder lh = vb->ht.getLockedBucket(h, &bucket_num);
     // If use_meta is true (delete_with_meta), we'd like to look for the key
     // with the wantsDeleted flag set to true in case a prior get_meta has
     // created a temporary item for the key.
-    StoredValue *v = vb->ht.unlocked_find(key, bucket_num, use_meta, false);
+    StoredValue *v = vb->ht.unlocked_find(key, bucket_num, h, use_meta, false);
+    if ((!v || v->isTempInitialItem()) && cookie &&
+        vb->getState() == vbucket_state_active &&
+        isEjectedKey(vb, key, bucket_num)) {
+        return bgFetchEjected(vb, key, bucket_num, cookie);
+    }
     if (!v) {
         if (vb->getState() != vbucket_state_active && force) {
             queueDirty(vb, key, vbucket, queue_op_del, newSeqno, tapBackfill);
@@ -1746,9 +2159,9 @@ public:
 
     PersistenceCallback(const queued_item &qi, std::queue<queued_item> &q,
                         EventuallyPersistentStore *st, MutationLog *ml,
-                        EPStats *s, uint64_t c) :
+                        EPStats *s, uint64_t c, int64_t r = -1) :
         queuedItem(qi), rq(q), store(st), mutationLog(ml),
-        stats(s), cas(c) {
+        stats(s), cas(c), rowid(r) {
 
         assert(s);
     }
@@ -1762,6 +2175,7 @@ public:
                 LockHolder lh = vb->ht.getLockedBucket(queuedItem->getKey(), &bucket_num);
                 StoredValue *v = store->fetchValidValue(vb, queuedItem->getKey(),
                                                         bucket_num, true, false);
+                value_t ejected;
                 if (v && value.second > 0) {
                     if (v->isPendingId()) {
                         mutationLog->newItem(queuedItem->getVBucketId(), queuedItem->getKey(),
@@ -1782,10 +2196,13 @@ public:
                         // evict unreferenced replica items only
                         if (current > lower && !v->isReferenced() &&
                             vb->checkpointManager.eligibleForEviction(v->getKey())) {
-                            v->ejectValue(*stats, vb->ht);
+                            v->ejectValue(*stats, vb->ht, &ejected);
                         }
                     }
                 }
+                lh.unlock();
+                store->cacheEjectedValue(vb, queuedItem->getKey(), cas,
+                                         ejected);
             }
 
             --stats->diskQueueSize;
@@ -1860,6 +2277,9 @@ public:
                     ++vb->opsDelete;
                 }
             }
+            if (vb && rowid > 0) {
+                vb->removeFromFilter(queuedItem->getKey());
+            }
             --stats->diskQueueSize;
             assert(stats->diskQueueSize < GIGANTOR);
         } else {
@@ -1887,6 +2307,8 @@ private:
     MutationLog *mutationLog;
     EPStats *stats;
     uint64_t cas;
+    //! The row a deletion removes, or -1 if it never reached disk.
+    int64_t rowid;
     DISALLOW_COPY_AND_ASSIGN(PersistenceCallback);
 };
 
@@ -2094,6 +2516,10 @@ EventuallyPersistentStore::flushOneDelOrSet(const queued_item &qi,
             PersistenceCallback *cb;
             cb = new PersistenceCallback(qi, rejectQueues[vb->getId()], this,
                                          &mutationLog, &stats, itm.getCas());
+            if (rowid == -1)  {
+                // Before the write, so a lookup never misses the new key.
+                vb->addToFilter(itm.getKey());
+            }
             rwUnderlying->set(itm, *cb);
             if (rowid == -1)  {
                 ++vb->opsCreate;
@@ -2121,7 +2547,7 @@ EventuallyPersistentStore::flushOneDelOrSet(const queued_item &qi,
             BlockTimer timer(&stats.diskDelHisto, "disk_delete", stats.timingLog);
             PersistenceCallback *cb;
             cb = new PersistenceCallback(qi, rejectQueues[vb->getId()], this,
-                                         &mutationLog, &stats, 0);
+                                         &mutationLog, &stats, 0, rowid);
             rwUnderlying->del(itm, rowid, *cb);
             return cb;
         }
@@ -2141,22 +2567,49 @@ void EventuallyPersistentStore::queueDirty(RCPtr<VBucket> &vb,
                                            bool tapBackfill) {
     if (doPersistence) {
         if (vb) {
-            queued_item itm(new QueuedItem(key, vbid, op, seqno));
-            vb->doStatsForQueueing(*itm, itm->size());
-            bool rv = tapBackfill ? vb->queueBackfillItem(itm) :
-                                    vb->checkpointManager.queueDirty(itm, vb);
+            // The checkpoint only allocates an item for a key it doesn't
+            // already hold, so only a backfill builds one up front.
+            uint32_t queuedTime = ep_current_time();
+            size_t itemBytes = sizeof(QueuedItem) + key.size();
+            vb->doStatsForQueueing(queuedTime, itemBytes);
+            bool rv;
+            if (tapBackfill) {
+                queued_item itm(new QueuedItem(key, vbid, op, seqno));
+                rv = vb->queueBackfillItem(itm);
+            } else {
+                rv = vb->checkpointManager.queueDirty(key, op, seqno, vb);
+            }
             if (rv) {
                 if (++stats.diskQueueSize == 1) {
                     flusher->wake();
                 }
                 ++stats.totalEnqueued;
             } else {
-                vb->doStatsForFlushing(*itm, itm->size());
+                vb->doStatsForFlushing(queuedTime, itemBytes);
             }
         }
     }
 }
 
+void EventuallyPersistentStore::queueDirty(RCPtr<VBucket> &vb,
+                                           const std::vector<queued_item> &items) {
+    std::vector<queued_item>::const_iterator it;
+    for (it = items.begin(); it != items.end(); ++it) {
+        vb->doStatsForQueueing(**it, (*it)->size());
+    }
+    std::vector<queued_item> notQueued;
+    size_t queued = vb->checkpointManager.queueDirty(items, vb, notQueued);
+    if (queued > 0) {
+        if (stats.diskQueueSize.incr(queued) == 0) {
+            flusher->wake();
+        }
+        stats.totalEnqueued.incr(queued);
+    }
+    for (it = notQueued.begin(); it != notQueued.end(); ++it) {
+        vb->doStatsForFlushing(**it, (*it)->size());
+    }
+}
+
 std::map<uint16_t, vbucket_state> EventuallyPersistentStore::loadVBucketState() {
     return roUnderlying->listPersistedVbuckets();
 }
@@ -2383,6 +2836,13 @@ void EventuallyPersistentStore::resetAccessScannerStartTime() {
     }
 }
 
+void EventuallyPersistentStore::scheduleCheckpointLoad() {
+    if (checkpointLoadScheduled.cas(false, true)) {
+        shared_ptr<DispatcherCallback> cb(new SpilledCheckpointLoader(this));
+        auxIODispatcher->schedule(cb, NULL, Priority::BackfillTaskPriority, 0);
+    }
+}
+
 void EventuallyPersistentStore::visit(VBucketVisitor &visitor)
 {
     size_t maxSize = vbuckets.getSize();
@@ -2404,7 +2864,8 @@ void EventuallyPersistentStore::visit(VBucketVisitor &visitor)
 VBCBAdaptor::VBCBAdaptor(EventuallyPersistentStore *s,
                          shared_ptr<VBucketVisitor> v,
                          const char *l, double sleep) :
-    store(s), visitor(v), label(l), sleepTime(sleep), currentvb(0)
+    store(s), visitor(v), label(l), sleepTime(sleep), currentvb(0),
+    inBucket(false)
 {
     const VBucketFilter &vbFilter = visitor->getVBucketFilter();
     size_t maxSize = store->vbuckets.getSize();
@@ -2427,10 +2888,21 @@ bool VBCBAdaptor::callback(Dispatcher & d, TaskId &t) {
                 d.snooze(t, sleepTime);
                 return true;
             }
-            if (visitor->visitBucket(vb)) {
-                vb->ht.visit(*visitor);
+            if (!inBucket && visitor->visitBucket(vb)) {
+                inBucket = true;
+                position = HashTable::Position();
+            }
+            if (inBucket) {
+                position = vb->ht.visit(*visitor, position,
+                                        store->visitorChunkItems.get(),
+                                        store->visitorChunkTime.get());
+                if (!position.isEnd() && visitor->shouldContinue()) {
+                    // Give the other tasks a turn before carrying on.
+                    return true;
+                }
             }
         }
+        inBucket = false;
         vbList.pop();
     }
 
@@ -2440,3 +2912,32 @@ bool VBCBAdaptor::callback(Dispatcher & d, TaskId &t) {
     }
     return !isdone;
 }
+
+void EventuallyPersistentStore::visit(shared_ptr<VBucketVisitor> visitor,
+                                      const char *lbl, Dispatcher *d,
+                                      const Priority &prio, bool isDaemon,
+                                      double sleepTime) {
+    std::vector<shared_ptr<VBucketVisitor> > clones;
+    size_t threads = std::min(visitorThreads.get(), vbuckets.getSize());
+    if (threads > 1) {
+        threads = std::min(threads, visitorPool.grow(threads));
+    }
+    for (size_t i = 0; threads > 1 && i < threads; ++i) {
+        VBucketVisitor *clone = visitor->clone();
+        if (clone == NULL) {
+            break;
+        }
+        clones.push_back(shared_ptr<VBucketVisitor>(clone));
+    }
+
+    shared_ptr<DispatcherCallback> cb;
+    if (clones.empty()) {
+        cb.reset(new VBCBAdaptor(this, visitor, lbl, sleepTime));
+    } else {
+        cb.reset(new ParallelVBCBAdaptor(visitorPool, vbuckets, visitor,
+                                         clones, lbl,
+                                         visitorChunkItems.get(),
+                                         visitorChunkTime.get(), sleepTime));
+    }
+    d->schedule(cb, NULL, prio, 0, isDaemon);
+}
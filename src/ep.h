@@ -51,8 +51,10 @@
 #include "queueditem.h"
 #include "stats.h"
 #include "stored-value.h"
+#include "value_cache.h"
 #include "vbucket.h"
 #include "vbucketmap.h"
+#include "visitor_pool.h"
 
 #define MAX_BG_FETCH_DELAY 900
 
@@ -104,6 +106,24 @@ public:
         return false;
     }
 
+    /**
+     * Create a copy of this visitor to walk some of the vbuckets on
+     * another thread.  What the copy did is handed back by merge().
+     *
+     * @return the copy, or NULL if this visitor has to run alone
+     */
+    virtual VBucketVisitor *clone() {
+        return NULL;
+    }
+
+    /**
+     * Fold in the work of a clone after it visited its last vbucket.
+     * Called before complete(), on the thread that calls it.
+     */
+    virtual void merge(VBucketVisitor &other) {
+        (void)other;
+    }
+
 protected:
     VBucketFilter vBucketFilter;
     RCPtr<VBucket> currentBucket;
@@ -121,6 +141,11 @@ class PersistenceCallback;
 
 /**
  * VBucket visitor callback adaptor.
+ *
+ * Each run of the task walks at most visitor_chunk_items items or
+ * visitor_chunk_time microseconds of a vbucket, and the next run
+ * carries on where it stopped, so a big vbucket doesn't keep the
+ * dispatcher from its other tasks.
  */
 class VBCBAdaptor : public DispatcherCallback {
 public:
@@ -143,15 +168,104 @@ private:
     const char                 *label;
     double                      sleepTime;
     uint16_t                    currentvb;
+    //! Where the walk of currentvb got to, if it was started.
+    HashTable::Position         position;
+    bool                        inBucket;
 
     DISALLOW_COPY_AND_ASSIGN(VBCBAdaptor);
 };
 
+/**
+ * VBucket visitor callback adaptor that walks the vbuckets with clones
+ * of the visitor on the store's visitor pool.
+ *
+ * The pool threads take the next unvisited vbucket as they go, so a big
+ * vbucket doesn't hold up the rest.  The dispatcher task only submits
+ * the clones and polls until they're done, then merges them into the
+ * visitor and completes it.  A clone that asks to pause gives its pool
+ * thread back and is submitted again on a later poll.
+ */
+class ParallelVBCBAdaptor : public DispatcherCallback {
+public:
+
+    ParallelVBCBAdaptor(VisitorPool &p, const VBucketMap &vbs,
+                        shared_ptr<VBucketVisitor> v,
+                        std::vector<shared_ptr<VBucketVisitor> > &clones,
+                        const char *l, size_t chunkItems, size_t chunkTime,
+                        double sleep=0);
+
+    ~ParallelVBCBAdaptor();
+
+    std::string description() {
+        std::stringstream rv;
+        rv << label << " on " << workers.size() << " threads";
+        return rv.str();
+    }
+
+    bool callback(Dispatcher &d, TaskId &t);
+
+    /**
+     * Submit the clones on the first call, then check on them and
+     * resubmit the ones that paused.
+     *
+     * @return true until every clone is done and has been merged
+     */
+    bool step();
+
+private:
+
+    class Worker : public VisitorPool::Job {
+    public:
+        Worker(ParallelVBCBAdaptor &a, shared_ptr<VBucketVisitor> v) :
+            adaptor(a), visitor(v), paused(false) {}
+
+        void run() {
+            adaptor.runWorker(*this);
+        }
+
+        ParallelVBCBAdaptor        &adaptor;
+        shared_ptr<VBucketVisitor>  visitor;
+        //! Set when the clone asked to pause and gave its thread back.
+        Atomic<bool>                paused;
+    };
+
+    friend class Worker;
+
+    /**
+     * Visit vbuckets with the given clone until none are left or it
+     * asks to pause.
+     *
+     * @return true if it paused with vbuckets left to visit
+     */
+    bool run(VBucketVisitor &clone);
+
+    void runWorker(Worker &w);
+
+    void stopWorkers();
+
+    std::vector<uint16_t>       vbList;
+    Atomic<size_t>              nextvb;
+    Atomic<size_t>              running;
+    Atomic<bool>                stopping;
+    std::vector<Worker*>        workers;
+    VisitorPool                &pool;
+    const VBucketMap           &vbuckets;
+    shared_ptr<VBucketVisitor>  visitor;
+    const char                 *label;
+    size_t                      visitorChunkItems;
+    size_t                      visitorChunkTime;
+    double                      sleepTime;
+    bool                        started;
+
+    DISALLOW_COPY_AND_ASSIGN(ParallelVBCBAdaptor);
+};
+
 class EventuallyPersistentEngine;
 
 typedef enum {
     BG_FETCH_VALUE,
-    BG_FETCH_METADATA
+    BG_FETCH_METADATA,
+    BG_FETCH_EJECTED
 } bg_fetch_type_t;
 
 /**
@@ -415,8 +529,9 @@ public:
      * @param vbucket the vbucket in which the key lives
      * @param rowid the rowid of the record within its shard
      * @param cookie the cookie of the requestor
-     * @param type whether the fetch is for a non-resident value or metadata of
-     *             a (possibly) deleted item
+     * @param type whether the fetch is for a non-resident value, metadata of
+     *             a (possibly) deleted item, or a whole item that may have
+     *             been ejected from memory
      */
     void bgFetch(const std::string &key,
                  uint16_t vbucket,
@@ -502,14 +617,39 @@ public:
     void visit(VBucketVisitor &visitor);
 
     /**
-     * Run a vbucket visitor with separate jobs per vbucket.
+     * Run a vbucket visitor with separate jobs per vbucket, spread over
+     * visitor_threads threads if the visitor can be cloned.
      *
      * Note that this is asynchronous.
      */
     void visit(shared_ptr<VBucketVisitor> visitor, const char *lbl,
-               Dispatcher *d, const Priority &prio, bool isDaemon=true, double sleepTime=0) {
-        d->schedule(shared_ptr<DispatcherCallback>(new VBCBAdaptor(this, visitor, lbl, sleepTime)),
-                    NULL, prio, 0, isDaemon);
+               Dispatcher *d, const Priority &prio, bool isDaemon=true,
+               double sleepTime=0);
+
+    /**
+     * Have the spilled checkpoints TAP cursors are waiting on read back in
+     * on the auxiliary IO dispatcher, unless that's already scheduled.
+     */
+    void scheduleCheckpointLoad();
+
+    void setVisitorThreads(size_t to) {
+        visitorThreads.set(to);
+    }
+
+    /**
+     * Set how many items (0 for no limit) the asynchronous visitors
+     * walk at a time before giving up their thread.
+     */
+    void setVisitorChunkItems(size_t to) {
+        visitorChunkItems.set(to);
+    }
+
+    /**
+     * Set for how many microseconds (0 for no limit) the asynchronous
+     * visitors walk at a time before giving up their thread.
+     */
+    void setVisitorChunkTime(size_t to) {
+        visitorChunkTime.set(to);
     }
 
     const Flusher* getFlusher();
@@ -563,6 +703,64 @@ public:
 
     void deleteExpiredItems(std::list<std::pair<uint16_t, std::string> > &);
 
+    /**
+     * Eject the given clean items from memory entirely.
+     *
+     * @return the number of items ejected
+     */
+    size_t ejectItems(std::list<std::pair<uint16_t, std::string> > &);
+
+    /**
+     * Page out one item the way the item pager would: compress its
+     * value, eject its value or, under full eviction, eject it whole.
+     *
+     * @param vb the vbucket holding the item
+     * @param key the key of the item
+     * @return the number of bytes freed, 0 if the item stays as it is
+     */
+    size_t pageOutItem(RCPtr<VBucket> &vb, const std::string &key);
+
+    /**
+     * Get the tier ejected values go to before disk, or NULL if there
+     * is none.
+     */
+    ValueCache *getValueCache() {
+        return valueCache;
+    }
+
+    /**
+     * Copy a value ejected under the bucket lock to the value cache, if
+     * there is one, and let its item know where the copy went.  Must
+     * be called with the bucket unlocked.
+     */
+    void cacheEjectedValue(RCPtr<VBucket> &vb, const std::string &key,
+                           uint64_t cas, const value_t &value);
+
+    /**
+     * Read an ejected value back from the value cache, if there is one
+     * and it still holds the value.  The copy out of the cache is made
+     * with the bucket unlocked, so this is for the background fetch
+     * path to try before going to disk.
+     *
+     * @return the item, which the caller owns, or NULL if the value has
+     *         to come from disk
+     */
+    Item *fetchFromValueCache(uint16_t vbucket, const std::string &key);
+
+    /**
+     * True if the item pager ejects whole items rather than only values,
+     * so a key missing from memory may still exist on disk.
+     */
+    bool isFullEviction() const {
+        return fullEviction;
+    }
+
+    /**
+     * Create a vbucket with this store's stats, checkpoint config and
+     * Bloom filter settings.
+     */
+    VBucket *newVBucket(uint16_t vbid, vbucket_state_t state);
+
     /**
      * Get the memoized storage properties from the DB.kv
      */
@@ -689,6 +887,9 @@ private:
                     uint64_t seqno,
                     bool tapBackfill = false);
 
+    /* Queue a batch of items of one vbucket to be written to persistent layer. */
+    void queueDirty(RCPtr<VBucket> &vb, const std::vector<queued_item> &items);
+
     /**
      * Retrieve a StoredValue and invoke a method on it.
      *
@@ -726,7 +927,38 @@ private:
 
     StoredValue *fetchValidValue(RCPtr<VBucket> &vb, const std::string &key,
                                  int bucket_num, bool wantsDeleted=false,
-                                 bool trackReference=true, bool queueExpired=true);
+                                 bool trackReference=true, bool queueExpired=true) {
+        return fetchValidValue(vb, key, bucket_num, vb->ht.lookupHash(key),
+                               wantsDeleted, trackReference, queueExpired);
+    }
+
+    /**
+     * fetchValidValue() for a caller that already hashed the key to lock
+     * its bucket.
+     */
+    StoredValue *fetchValidValue(RCPtr<VBucket> &vb, const std::string &key,
+                                 int bucket_num, int h, bool wantsDeleted,
+                                 bool trackReference, bool queueExpired);
+
+    /**
+     * True if in full eviction mode the given key isn't in memory, or is
+     * still being read back, so it has to be fetched before an operation
+     * on it can be answered.  The bucket must be locked.
+     */
+    bool isEjectedKey(RCPtr<VBucket> &vb, const std::string &key,
+                      int bucket_num);
+
+    /**
+     * Read back a key that may have been ejected from memory entirely.
+     * A temporary item stands in for it until the fetch completes.  The
+     * bucket must be locked.
+     *
+     * @return ENGINE_EWOULDBLOCK, or ENGINE_ENOMEM if there's no room
+     *         for the temporary item
+     */
+    ENGINE_ERROR_CODE bgFetchEjected(RCPtr<VBucket> &vb,
+                                     const std::string &key,
+                                     int bucket_num, const void *cookie);
 
     GetValue getInternal(const std::string &key, uint16_t vbucket,
                          const void *cookie, bool queueBG,
@@ -741,10 +973,10 @@ private:
     friend class TapBGFetchCallback;
     friend class TapConnection;
     friend class PersistenceCallback;
-    friend class Deleter;
     friend class VBCBAdaptor;
     friend class ItemPager;
     friend class PagingVisitor;
+    friend class SpilledCheckpointLoader;
 
     EventuallyPersistentEngine     &engine;
     EPStats                        &stats;
@@ -799,6 +1031,15 @@ private:
     size_t vbDelChunkSize;
     size_t vbChunkDelThresholdTime;
     Atomic<bool> snapshotVBState;
+    Atomic<bool> checkpointLoadScheduled;
+    bool fullEviction;
+    size_t bFilterKeyCount;
+    double bFilterFpProb;
+    ValueCache *valueCache;
+    Atomic<size_t> visitorThreads;
+    Atomic<size_t> visitorChunkItems;
+    Atomic<size_t> visitorChunkTime;
+    VisitorPool visitorPool;
 
     DISALLOW_COPY_AND_ASSIGN(EventuallyPersistentStore);
 };
@@ -35,7 +35,9 @@
 #include "backfill.h"
 #include "ep_engine.h"
 #include "htresizer.h"
+#include "lockprofile.h"
 #include "memory_tracker.h"
+#include "slab_allocator.h"
 #include "stats-info.h"
 #define STATWRITER_NAMESPACE core_engine
 #include "statwriter.h"
@@ -381,6 +383,23 @@ extern "C" {
             } else if (strcmp(keyz, "mutation_mem_threshold") == 0) {
                 validate(v, 0, 100);
                 e->getConfiguration().setMutationMemThreshold(v);
+            } else if (strcmp(keyz, "inline_value_threshold") == 0) {
+                validate(v, 0, 255);
+                e->getConfiguration().setInlineValueThreshold(v);
+            } else if (strcmp(keyz, "compression_mode") == 0) {
+                e->getConfiguration().setCompressionMode(valz);
+            } else if (strcmp(keyz, "compression_threshold") == 0) {
+                validate(v, 64, 1048576);
+                e->getConfiguration().setCompressionThreshold(v);
+            } else if (strcmp(keyz, "visitor_threads") == 0) {
+                validate(v, 1, 64);
+                e->getConfiguration().setVisitorThreads(v);
+            } else if (strcmp(keyz, "visitor_chunk_items") == 0) {
+                validate(v, 0, 100000000);
+                e->getConfiguration().setVisitorChunkItems(v);
+            } else if (strcmp(keyz, "visitor_chunk_time") == 0) {
+                validate(v, 0, 60000000);
+                e->getConfiguration().setVisitorChunkTime(v);
             } else if (strcmp(keyz, "timing_log") == 0) {
                 EPStats &stats = e->getEpStats();
                 std::ostream *old = stats.timingLog;
@@ -426,8 +445,30 @@ extern "C" {
                 e->getConfiguration().setAlogSleepTime(v);
             } else if (strcmp(keyz, "alog_task_time") == 0) {
                 e->getConfiguration().setAlogTaskTime(v);
+            } else if (strcmp(keyz, "hotkey_capacity") == 0) {
+                validate(v, 1, 1024);
+                e->getConfiguration().setHotkeyCapacity(v);
+            } else if (strcmp(keyz, "hotkey_sample_rate") == 0) {
+                validate(v, 0, 1000000);
+                e->getConfiguration().setHotkeySampleRate(v);
+            } else if (strcmp(keyz, "lock_profiling") == 0) {
+                // One bucket mustn't switch it off under the others.
+                *msg = "lock_profiling is shared by every bucket, "
+                    "set it when the bucket is created";
+                rv = PROTOCOL_BINARY_RESPONSE_EINVAL;
             } else if (strcmp(keyz, "pager_active_vb_pcnt") == 0) {
                 e->getConfiguration().setPagerActiveVbPcnt(v);
+            } else if (strcmp(keyz, "pager_sample_size") == 0) {
+                validate(v, 1, 64);
+                e->getConfiguration().setPagerSampleSize(v);
+            } else if (strcmp(keyz, "pager_sampled_eviction") == 0) {
+                if (strcmp(valz, "true") == 0) {
+                    e->getConfiguration().setPagerSampledEviction(true);
+                } else if (strcmp(valz, "false") == 0) {
+                    e->getConfiguration().setPagerSampledEviction(false);
+                } else {
+                    throw std::runtime_error("value out of range.");
+                }
             } else if (strcmp(keyz, "pager_unbiased_period") == 0) {
                 e->getConfiguration().setPagerUnbiasedPeriod(v);
             } else {
@@ -1189,7 +1230,7 @@ EventuallyPersistentEngine::EventuallyPersistentEngine(GET_SERVER_API get_server
     getServerApiFunc(get_server_api), getlExtension(NULL),
     tapConnMap(NULL), tapConfig(NULL), checkpointConfig(NULL),
     warmingUp(true),
-    flushAllEnabled(false), startupTime(0)
+    flushAllEnabled(false), startupTime(0), hotKeys(1, 0)
 {
     interface.interface = 1;
     ENGINE_HANDLE_V1::get_info = EvpGetInfo;
@@ -1277,6 +1318,10 @@ public:
             engine.setGetlDefaultTimeout(value);
         } else if (key.compare("max_item_size") == 0) {
             engine.setMaxItemSize(value);
+        } else if (key.compare("hotkey_capacity") == 0) {
+            engine.getHotKeys().setCapacity(value);
+        } else if (key.compare("hotkey_sample_rate") == 0) {
+            engine.getHotKeys().setSampleRate(value);
         }
     }
 
@@ -1304,6 +1349,14 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::initialize(const char* config) {
     // Start updating the variables from the config!
     HashTable::setDefaultNumBuckets(configuration.getHtSize());
     HashTable::setDefaultNumLocks(configuration.getHtLocks());
+    HashTable::setIncrementalResize(configuration.isHtIncrementalResize());
+    HashTable::setDefaultGrouped(configuration.getHtBucketType() == "grouped");
+    HashTable::setDefaultExpiryIndex(configuration.isExpPagerIndex());
+    if (!SlabAllocator::configure(configuration.isSlabAllocator())) {
+        LOG(EXTENSION_LOG_WARNING,
+            "slab_allocator is shared by every bucket, keeping it %s",
+            SlabAllocator::isEnabled() ? "on" : "off");
+    }
 
     if (configuration.getMaxSize() == 0) {
         configuration.setMaxSize(std::numeric_limits<size_t>::max());
@@ -1332,6 +1385,19 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::initialize(const char* config) {
     configuration.addValueChangedListener("flushall_enabled",
                                           new EpEngineValueChangeListener(*this));
 
+    // Profiling covers every bucket in the process, so a bucket can
+    // only switch it on, never off.
+    if (configuration.isLockProfiling()) {
+        LockSite::setProfiling(true);
+    }
+
+    hotKeys.setCapacity(configuration.getHotkeyCapacity());
+    configuration.addValueChangedListener("hotkey_capacity",
+                                          new EpEngineValueChangeListener(*this));
+    hotKeys.setSampleRate(configuration.getHotkeySampleRate());
+    configuration.addValueChangedListener("hotkey_sample_rate",
+                                          new EpEngineValueChangeListener(*this));
+
     tapConnMap = new TapConnMap(*this);
     tapConfig = new TapConfig(*this);
     tapThrottle = new TapThrottle(configuration, stats);
@@ -1448,7 +1514,8 @@ ENGINE_ERROR_CODE  EventuallyPersistentEngine::store(const void *cookie,
                                                      item* itm,
                                                      uint64_t *cas,
                                                      ENGINE_STORE_OPERATION operation,
-                                                     uint16_t vbucket)
+                                                     uint16_t vbucket,
+                                                     bool trackHotKey)
 {
     BlockTimer timer(&stats.storeCmdHisto);
     ENGINE_ERROR_CODE ret;
@@ -1456,6 +1523,9 @@ ENGINE_ERROR_CODE  EventuallyPersistentEngine::store(const void *cookie,
     item *i = NULL;
 
     it->setVBucketId(vbucket);
+    if (trackHotKey) {
+        hotKeys.access(vbucket, it->getKey().data(), it->getNKey());
+    }
 
     switch (operation) {
     case OPERATION_CAS:
@@ -1495,7 +1565,7 @@ ENGINE_ERROR_CODE  EventuallyPersistentEngine::store(const void *cookie,
     case OPERATION_REPLACE:
         // @todo this isn't atomic!
         ret = get(cookie, &i, it->getKey().c_str(),
-                  it->getNKey(), vbucket);
+                  it->getNKey(), vbucket, false);
         switch (ret) {
         case ENGINE_SUCCESS:
             itemRelease(cookie, i);
@@ -1516,7 +1586,7 @@ ENGINE_ERROR_CODE  EventuallyPersistentEngine::store(const void *cookie,
     case OPERATION_PREPEND:
         do {
             if ((ret = get(cookie, &i, it->getKey().c_str(),
-                           it->getNKey(), vbucket)) == ENGINE_SUCCESS) {
+                           it->getNKey(), vbucket, false)) == ENGINE_SUCCESS) {
                 Item *old = reinterpret_cast<Item*>(i);
 
                 if (old->getCas() == (uint64_t) -1) {
@@ -1547,7 +1617,7 @@ ENGINE_ERROR_CODE  EventuallyPersistentEngine::store(const void *cookie,
                     }
                 }
 
-                ret = store(cookie, old, cas, OPERATION_CAS, vbucket);
+                ret = store(cookie, old, cas, OPERATION_CAS, vbucket, false);
                 itemRelease(cookie, i);
             }
         } while (ret == ENGINE_KEY_EEXISTS);
@@ -2290,9 +2360,11 @@ void EventuallyPersistentEngine::queueBackfill(const VBucketFilter &backfillVBFi
 
 bool VBucketCountVisitor::visitBucket(RCPtr<VBucket> &vb) {
     ++numVbucket;
-    numItems += vb->ht.getNumItems();
+    // Items ejected whole are still there, on disk only.
+    numItems += vb->ht.getNumTotalItems();
     numTempItems += vb->ht.getNumTempItems();
-    nonResident += vb->ht.getNumNonResidentItems();
+    nonResident += vb->ht.getNumNonResidentItems() +
+        vb->ht.getNumEjectedItems();
 
     if (vb->getHighPriorityChkSize() > 0) {
         chkPersistRemaining++;
@@ -2306,6 +2378,8 @@ bool VBucketCountVisitor::visitBucket(RCPtr<VBucket> &vb) {
         numExpiredItems += vb->numExpiredItems;
         numReferencedItems += vb->ht.getNumReferenced();
         numReferencedEjects += vb->ht.getNumReferencedEjects();
+        expiryIndexKeys += vb->ht.getExpiryIndexKeys();
+        expiryIndexMemory += vb->ht.getExpiryIndexMemory();
         metaDataMemory += vb->ht.metaDataMemory;
         opsCreate += vb->opsCreate;
         opsUpdate += vb->opsUpdate;
@@ -2394,6 +2468,8 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doEngineStats(const void *cookie,
                     add_stat, cookie);
     add_casted_stat("ep_expired_pager", epstats.expired_pager,
                     add_stat, cookie);
+    add_casted_stat("ep_expired_pager_rate", epstats.expiredPagerRate,
+                    add_stat, cookie);
     add_casted_stat("ep_item_flush_expired",
                     epstats.flushExpired, add_stat, cookie);
     add_casted_stat("ep_queue_size",
@@ -2558,6 +2634,16 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doEngineStats(const void *cookie,
                     replicaCountVisitor.getMetaDataMemory() +
                     pendingCountVisitor.getMetaDataMemory(),
                     add_stat, cookie);
+    add_casted_stat("ep_expiry_index_keys",
+                    activeCountVisitor.getExpiryIndexKeys() +
+                    replicaCountVisitor.getExpiryIndexKeys() +
+                    pendingCountVisitor.getExpiryIndexKeys(),
+                    add_stat, cookie);
+    add_casted_stat("ep_expiry_index_memory",
+                    activeCountVisitor.getExpiryIndexMemory() +
+                    replicaCountVisitor.getExpiryIndexMemory() +
+                    pendingCountVisitor.getExpiryIndexMemory(),
+                    add_stat, cookie);
 
     size_t memUsed =  stats.getTotalMemoryUsed();
     add_casted_stat("mem_used", memUsed, add_stat, cookie);
@@ -2589,12 +2675,59 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doEngineStats(const void *cookie,
                     cookie);
     add_casted_stat("ep_num_expiry_pager_runs", epstats.expiryPagerRuns, add_stat,
                     cookie);
+    add_casted_stat("ep_pager_sampled_ejects", epstats.numSampledEjects,
+                    add_stat, cookie);
+    add_casted_stat("ep_pager_sampled_eject_rate", epstats.sampledEjectRate,
+                    add_stat, cookie);
+    size_t samples = epstats.numEvictionSamples.get();
+    add_casted_stat("ep_pager_samples", samples, add_stat, cookie);
+    if (samples > 0) {
+        add_casted_stat("ep_pager_sample_freq_avg",
+                        static_cast<double>(epstats.evictionSampleFreqs.get()) /
+                        samples, add_stat, cookie);
+    }
+    size_t sampledEjects = epstats.numSampledEjects.get();
+    if (sampledEjects > 0) {
+        add_casted_stat("ep_pager_victim_freq_avg",
+                        static_cast<double>(epstats.evictionVictimFreqs.get()) /
+                        sampledEjects, add_stat, cookie);
+    }
+    add_casted_stat("ep_mem_above_high_wat_time", epstats.timeAboveHighWat,
+                    add_stat, cookie);
     add_casted_stat("ep_items_rm_from_checkpoints", epstats.itemsRemovedFromCheckpoints,
                     add_stat, cookie);
+    add_casted_stat("ep_checkpoints_spilled", epstats.numCheckpointsSpilled,
+                    add_stat, cookie);
+    add_casted_stat("ep_checkpoints_loaded", epstats.numCheckpointsLoaded,
+                    add_stat, cookie);
     add_casted_stat("ep_num_value_ejects", epstats.numValueEjects, add_stat,
                     cookie);
+    add_casted_stat("ep_num_meta_ejects", epstats.numMetaEjects, add_stat,
+                    cookie);
+    add_casted_stat("ep_num_eject_refetches", epstats.numEjectRefetches,
+                    add_stat, cookie);
     add_casted_stat("ep_num_eject_failures", epstats.numFailedEjects, add_stat,
                     cookie);
+    ValueCache *valueCache = epstore->getValueCache();
+    if (valueCache) {
+        add_casted_stat("ep_value_cache_size", valueCache->getCapacity(),
+                        add_stat, cookie);
+        add_casted_stat("ep_value_cache_used", valueCache->getUsed(),
+                        add_stat, cookie);
+        add_casted_stat("ep_value_cache_writes", epstats.valueCacheWrites,
+                        add_stat, cookie);
+        add_casted_stat("ep_value_cache_bytes_written",
+                        epstats.valueCacheBytesWritten, add_stat, cookie);
+        size_t hits = epstats.valueCacheHits.get();
+        size_t misses = epstats.valueCacheMisses.get();
+        add_casted_stat("ep_value_cache_hits", hits, add_stat, cookie);
+        add_casted_stat("ep_value_cache_misses", misses, add_stat, cookie);
+        if (hits + misses > 0) {
+            add_casted_stat("ep_value_cache_hit_rate",
+                            static_cast<double>(hits) / (hits + misses),
+                            add_stat, cookie);
+        }
+    }
     add_casted_stat("ep_num_not_my_vbuckets", epstats.numNotMyVBuckets, add_stat,
                     cookie);
 
@@ -2732,6 +2865,7 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doMemoryStats(const void *cookie,
 
     std::map<std::string, size_t> alloc_stats;
     MemoryTracker::getInstance()->getAllocatorStats(alloc_stats);
+    SlabAllocator::getInstance()->getStats(alloc_stats);
     std::map<std::string, size_t>::iterator it = alloc_stats.begin();
     for (; it != alloc_stats.end(); ++it) {
         add_casted_stat(it->first.c_str(), it->second, add_stat, cookie);
@@ -2740,6 +2874,76 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doMemoryStats(const void *cookie,
     return ENGINE_SUCCESS;
 }
 
+ENGINE_ERROR_CODE EventuallyPersistentEngine::doHotKeyStats(const void *cookie,
+                                                           ADD_STAT add_stat) {
+    size_t rate = hotKeys.getSampleRate();
+    size_t samples = hotKeys.getNumSamples();
+    add_casted_stat("ep_hotkeys_sample_rate", rate, add_stat, cookie);
+    add_casted_stat("ep_hotkeys_capacity", hotKeys.getCapacity(),
+                    add_stat, cookie);
+    add_casted_stat("ep_hotkeys_samples", samples, add_stat, cookie);
+
+    std::map<uint16_t, size_t> vbSamples;
+    hotKeys.getVBucketSamples(vbSamples);
+    std::map<uint16_t, size_t>::iterator vit;
+    for (vit = vbSamples.begin(); vit != vbSamples.end(); ++vit) {
+        std::stringstream ss;
+        ss << "vb_" << vit->first << ":samples";
+        add_casted_stat(ss.str().c_str(), vit->second, add_stat, cookie);
+    }
+
+    // Counts are scaled up by the sample rate to estimate operations.
+    std::vector<HotKeyTracker::HotKey> keys;
+    hotKeys.getHotKeys(keys);
+    // Keys may hold anything, so they go in values, not stat names.
+    for (size_t i = 0; i < keys.size(); ++i) {
+        const HotKeyTracker::HotKey &hk = keys[i];
+        std::stringstream prefix;
+        prefix << "hotkey_" << i << ":";
+        std::string key(prefix.str() + "key");
+        std::string vbucket(prefix.str() + "vbucket");
+        std::string ops(prefix.str() + "ops");
+        std::string error(prefix.str() + "error");
+        std::string share(prefix.str() + "share");
+        add_casted_stat(key.c_str(), hk.key.c_str(), add_stat, cookie);
+        add_casted_stat(vbucket.c_str(), hk.vbucket, add_stat, cookie);
+        add_casted_stat(ops.c_str(), hk.count * rate, add_stat, cookie);
+        add_casted_stat(error.c_str(), hk.error * rate, add_stat, cookie);
+        if (samples > 0) {
+            add_casted_stat(share.c_str(),
+                            static_cast<double>(hk.count) / samples,
+                            add_stat, cookie);
+        }
+    }
+
+    return ENGINE_SUCCESS;
+}
+
+ENGINE_ERROR_CODE EventuallyPersistentEngine::doLockStats(const void *cookie,
+                                                         ADD_STAT add_stat) {
+    add_casted_stat("ep_lock_profiling",
+                    LockSite::isProfiling() ? "true" : "false",
+                    add_stat, cookie);
+
+    std::vector<LockSite*> sites;
+    LockSite::getAll(sites);
+    std::vector<LockSite*>::iterator it;
+    for (it = sites.begin(); it != sites.end(); ++it) {
+        LockSite *site = *it;
+        std::string prefix(std::string(site->getName()) + ":");
+        add_casted_stat((prefix + "acquisitions").c_str(),
+                        site->acquisitions, add_stat, cookie);
+        add_casted_stat((prefix + "contended").c_str(),
+                        site->contentions, add_stat, cookie);
+        add_casted_stat((prefix + "wait_ns").c_str(),
+                        site->waitTime, add_stat, cookie);
+        add_casted_stat((prefix + "hold_ns").c_str(),
+                        site->holdTime, add_stat, cookie);
+    }
+
+    return ENGINE_SUCCESS;
+}
+
 ENGINE_ERROR_CODE EventuallyPersistentEngine::doVBucketStats(const void *cookie,
                                                              ADD_STAT add_stat,
                                                              bool prevStateRequested,
@@ -2795,6 +2999,9 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doHashStats(const void *cookie,
             add_casted_stat(buf, vb->ht.getSize(), add_stat, cookie);
             snprintf(buf, sizeof(buf), "vb_%d:locks", vbid);
             add_casted_stat(buf, vb->ht.getNumLocks(), add_stat, cookie);
+            snprintf(buf, sizeof(buf), "vb_%d:bucket_type", vbid);
+            add_casted_stat(buf, vb->ht.isGrouped() ? "grouped" : "chained",
+                            add_stat, cookie);
             snprintf(buf, sizeof(buf), "vb_%d:min_depth", vbid);
             add_casted_stat(buf, depthVisitor.min == -1 ? 0 : depthVisitor.min,
                             add_stat, cookie);
@@ -2812,6 +3019,38 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doHashStats(const void *cookie,
             add_casted_stat(buf, vb->ht.memSize, add_stat, cookie);
             snprintf(buf, sizeof(buf), "vb_%d:mem_size_counted", vbid);
             add_casted_stat(buf, depthVisitor.memUsed, add_stat, cookie);
+            snprintf(buf, sizeof(buf), "vb_%d:optimistic_fallbacks", vbid);
+            add_casted_stat(buf, vb->ht.numOptimisticFallbacks, add_stat, cookie);
+            snprintf(buf, sizeof(buf), "vb_%d:resizing", vbid);
+            add_casted_stat(buf, vb->ht.isResizing() ? "true" : "false",
+                            add_stat, cookie);
+            snprintf(buf, sizeof(buf), "vb_%d:resize_buckets_done", vbid);
+            add_casted_stat(buf, vb->ht.getResizeBucketsDone(), add_stat, cookie);
+            snprintf(buf, sizeof(buf), "vb_%d:resize_buckets_total", vbid);
+            add_casted_stat(buf, vb->ht.getResizeBucketsTotal(), add_stat, cookie);
+            snprintf(buf, sizeof(buf), "vb_%d:resize_steps", vbid);
+            add_casted_stat(buf, vb->ht.resizeSteps, add_stat, cookie);
+            snprintf(buf, sizeof(buf), "vb_%d:resize_step_time", vbid);
+            add_casted_stat(buf, vb->ht.resizeStepTime, add_stat, cookie);
+            snprintf(buf, sizeof(buf), "vb_%d:resize_step_max_time", vbid);
+            add_casted_stat(buf, vb->ht.resizeStepMaxTime, add_stat, cookie);
+            snprintf(buf, sizeof(buf), "vb_%d:compressions", vbid);
+            add_casted_stat(buf, vb->ht.numCompressions, add_stat, cookie);
+            snprintf(buf, sizeof(buf), "vb_%d:compress_failures", vbid);
+            add_casted_stat(buf, vb->ht.numCompressFailures, add_stat, cookie);
+            size_t in = vb->ht.compressInBytes;
+            size_t out = vb->ht.compressOutBytes;
+            snprintf(buf, sizeof(buf), "vb_%d:compress_ratio", vbid);
+            add_casted_stat(buf, out == 0 ? 0.0 : static_cast<double>(in) / out,
+                            add_stat, cookie);
+            snprintf(buf, sizeof(buf), "vb_%d:compress_time", vbid);
+            add_casted_stat(buf, vb->ht.compressTime.get() / 1000,
+                            add_stat, cookie);
+            snprintf(buf, sizeof(buf), "vb_%d:decompressions", vbid);
+            add_casted_stat(buf, vb->ht.numDecompressions, add_stat, cookie);
+            snprintf(buf, sizeof(buf), "vb_%d:decompress_time", vbid);
+            add_casted_stat(buf, vb->ht.decompressTime.get() / 1000,
+                            add_stat, cookie);
 
             return false;
         }
@@ -3035,6 +3274,18 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doTapStats(const void *cookie,
     add_casted_stat("ep_tap_total_fetched", stats.numTapFetched, add_stat, cookie);
     add_casted_stat("ep_tap_bg_max_pending", tapConfig->getBgMaxPending(),
                     add_stat, cookie);
+    add_casted_stat("ep_tap_cursor_batch_items", tapConfig->getCursorBatchItems(),
+                    add_stat, cookie);
+    add_casted_stat("ep_tap_cursor_batch_bytes", tapConfig->getCursorBatchBytes(),
+                    add_stat, cookie);
+    add_casted_stat("ep_tap_cursor_drop_pcnt", tapConfig->getCursorDropPcnt(),
+                    add_stat, cookie);
+    add_casted_stat("ep_tap_cursor_drop_chks", tapConfig->getCursorDropChks(),
+                    add_stat, cookie);
+    add_casted_stat("ep_tap_cursors_dropped", stats.tapCursorsDropped,
+                    add_stat, cookie);
+    add_casted_stat("ep_tap_cursor_drop_reclaimed", stats.tapCursorDropMemReclaimed,
+                    add_stat, cookie);
     add_casted_stat("ep_tap_bg_fetched", stats.numTapBGFetched, add_stat, cookie);
     add_casted_stat("ep_tap_bg_fetch_requeued", stats.numTapBGFetchRequeued,
                     add_stat, cookie);
@@ -3326,6 +3577,10 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::getStats(const void* cookie,
         rv = doDispatcherStats(cookie, add_stat);
     } else if (nkey == 6 && strncmp(stat_key, "memory", 6) == 0) {
         rv = doMemoryStats(cookie, add_stat);
+    } else if (nkey == 7 && strncmp(stat_key, "hotkeys", 7) == 0) {
+        rv = doHotKeyStats(cookie, add_stat);
+    } else if (nkey == 5 && strncmp(stat_key, "locks", 5) == 0) {
+        rv = doLockStats(cookie, add_stat);
     } else if (nkey > 4 && strncmp(stat_key, "key ", 4) == 0) {
         std::string key;
         std::string vbid;
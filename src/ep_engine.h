@@ -36,6 +36,7 @@
 #include "ep-engine/command_ids.h"
 #include "ep_extension.h"
 #include "flusher.h"
+#include "hotkeys.h"
 #include "item_pager.h"
 #include "kvstore.h"
 #include "locks.h"
@@ -103,6 +104,8 @@ public:
                                                  numEjects(0), numExpiredItems(0),
                                                  numReferencedItems(0),
                                                  numReferencedEjects(0),
+                                                 expiryIndexKeys(0),
+                                                 expiryIndexMemory(0),
                                                  metaDataMemory(0), opsCreate(0),
                                                  opsUpdate(0), opsDelete(0),
                                                  opsReject(0), queueSize(0),
@@ -142,6 +145,9 @@ public:
 
     size_t getReferencedEjects() { return numReferencedEjects; }
 
+    size_t getExpiryIndexKeys() { return expiryIndexKeys; }
+    size_t getExpiryIndexMemory() { return expiryIndexMemory; }
+
     size_t getMetaDataMemory() { return metaDataMemory; }
 
     size_t getHashtableMemory() { return htMemory; }
@@ -176,6 +182,8 @@ private:
     size_t numExpiredItems;
     size_t numReferencedItems;
     size_t numReferencedEjects;
+    size_t expiryIndexKeys;
+    size_t expiryIndexMemory;
     size_t metaDataMemory;
 
     size_t opsCreate;
@@ -266,9 +274,13 @@ public:
                           item** itm,
                           const void* key,
                           const int nkey,
-                          uint16_t vbucket)
+                          uint16_t vbucket,
+                          bool trackHotKey = true)
     {
         BlockTimer timer(&stats.getCmdHisto);
+        if (trackHotKey) {
+            hotKeys.access(vbucket, static_cast<const char*>(key), nkey);
+        }
         std::string k(static_cast<const char*>(key), nkey);
 
         GetValue gv(epstore->get(k, vbucket, cookie, serverApi->core));
@@ -296,6 +308,7 @@ public:
 
     void resetStats() {
         stats.reset();
+        hotKeys.reset();
         if (epstore) {
             if (epstore->getRWUnderlying()) {
                 epstore->getRWUnderlying()->resetStats();
@@ -313,7 +326,8 @@ public:
                             item* itm,
                             uint64_t *cas,
                             ENGINE_STORE_OPERATION operation,
-                            uint16_t vbucket);
+                            uint16_t vbucket,
+                            bool trackHotKey = true);
 
     ENGINE_ERROR_CODE arithmetic(const void* cookie,
                                  const void* key,
@@ -328,13 +342,15 @@ public:
                                  uint16_t vbucket)
     {
         BlockTimer timer(&stats.arithCmdHisto);
+        // Counted once here rather than by the get and store it makes.
+        hotKeys.access(vbucket, static_cast<const char*>(key), nkey);
         item *it = NULL;
 
         rel_time_t expiretime = (exptime == 0 ||
                                  exptime == 0xffffffff) ?
             0 : ep_abs_time(ep_reltime(exptime));
 
-        ENGINE_ERROR_CODE ret = get(cookie, &it, key, nkey, vbucket);
+        ENGINE_ERROR_CODE ret = get(cookie, &it, key, nkey, vbucket, false);
         if (ret == ENGINE_SUCCESS) {
             Item *itm = static_cast<Item*>(it);
             char *endptr = NULL;
@@ -368,7 +384,7 @@ public:
                 Item *nit = new Item(key, (uint16_t)nkey, itm->getFlags(),
                                      itm->getExptime(), vals.str().c_str(), nb);
                 nit->setCas(itm->getCas());
-                ret = store(cookie, nit, cas, OPERATION_CAS, vbucket);
+                ret = store(cookie, nit, cas, OPERATION_CAS, vbucket, false);
                 delete nit;
             } else {
                 ret = ENGINE_EINVAL;
@@ -388,7 +404,7 @@ public:
                 *result = initial;
                 Item *itm = new Item(key, (uint16_t)nkey, 0, expiretime,
                                      vals.str().c_str(), nb);
-                ret = store(cookie, itm, cas, OPERATION_ADD, vbucket);
+                ret = store(cookie, itm, cas, OPERATION_ADD, vbucket, false);
                 delete itm;
             }
         }
@@ -657,6 +673,10 @@ protected:
         getlMaxTimeout = value;
     }
 
+    HotKeyTracker &getHotKeys() {
+        return hotKeys;
+    }
+
 private:
     EventuallyPersistentEngine(GET_SERVER_API get_server_api);
     friend ENGINE_ERROR_CODE create_instance(uint64_t interface,
@@ -749,6 +769,8 @@ private:
     ENGINE_ERROR_CODE doEngineStats(const void *cookie, ADD_STAT add_stat);
     ENGINE_ERROR_CODE doKlogStats(const void *cookie, ADD_STAT add_stat);
     ENGINE_ERROR_CODE doMemoryStats(const void *cookie, ADD_STAT add_stat);
+    ENGINE_ERROR_CODE doHotKeyStats(const void *cookie, ADD_STAT add_stat);
+    ENGINE_ERROR_CODE doLockStats(const void *cookie, ADD_STAT add_stat);
     ENGINE_ERROR_CODE doVBucketStats(const void *cookie, ADD_STAT add_stat,
                                      bool prevStateRequested,
                                      bool details);
@@ -839,6 +861,7 @@ private:
     // a unique system generated token initialized at each time
     // ep_engine starts up.
     time_t startupTime;
+    HotKeyTracker hotKeys;
 };
 
 #endif  // SRC_EP_ENGINE_H_
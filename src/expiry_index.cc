@@ -0,0 +1,179 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2012 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "config.h"
+
+#include <algorithm>
+#include <cassert>
+
+#include "expiry_index.h"
+
+ExpiryIndex::ExpiryIndex(EPStats &st, time_t start) :
+    stats(st), current(start) {
+    std::fill(levelKeys, levelKeys + LEVELS, 0);
+    stats.memOverhead.incr(sizeof(ExpiryIndex));
+    assert(stats.memOverhead.get() < GIGANTOR);
+}
+
+ExpiryIndex::~ExpiryIndex() {
+    stats.memOverhead.decr(sizeof(ExpiryIndex) + memory.get());
+    assert(stats.memOverhead.get() < GIGANTOR);
+}
+
+void ExpiryIndex::charge(size_t bytes) {
+    memory.incr(bytes);
+    stats.memOverhead.incr(bytes);
+    assert(stats.memOverhead.get() < GIGANTOR);
+}
+
+void ExpiryIndex::discharge(size_t bytes) {
+    memory.decr(bytes);
+    stats.memOverhead.decr(bytes);
+    assert(stats.memOverhead.get() < GIGANTOR);
+}
+
+size_t ExpiryIndex::entrySize(const std::string &key) {
+    // The entry and a tree node of three pointers and a color.
+    return sizeof(entry_t) + key.size() + 4 * sizeof(void*);
+}
+
+bool ExpiryIndex::place(const entry_t &e) {
+    if (e.first < current) {
+        return due.insert(e).second;
+    }
+    // The lowest level whose current span the time falls in.
+    for (int l = 0; l < LEVELS; ++l) {
+        int shift = SLOT_BITS * (l + 1);
+        if ((e.first >> shift) == (current >> shift)) {
+            size_t slot = (e.first >> (SLOT_BITS * l)) & (SLOTS - 1);
+            if (wheel[l][slot].insert(e).second) {
+                ++levelKeys[l];
+                return true;
+            }
+            return false;
+        }
+    }
+    return overflow.insert(e).second;
+}
+
+bool ExpiryIndex::unplace(const entry_t &e) {
+    if (e.first < current) {
+        return due.erase(e) > 0;
+    }
+    // A key stays on the level it went in on until its slot comes up,
+    // but its slot on each level only depends on its time.
+    for (int l = 0; l < LEVELS; ++l) {
+        size_t slot = (e.first >> (SLOT_BITS * l)) & (SLOTS - 1);
+        if (wheel[l][slot].erase(e) > 0) {
+            --levelKeys[l];
+            return true;
+        }
+    }
+    return overflow.erase(e) > 0;
+}
+
+void ExpiryIndex::add(const std::string &key, time_t exptime) {
+    LockHolder lh(mutex);
+    if (place(std::make_pair(exptime, key))) {
+        ++numKeys;
+        charge(entrySize(key));
+    }
+}
+
+void ExpiryIndex::remove(const std::string &key, time_t exptime) {
+    LockHolder lh(mutex);
+    if (unplace(std::make_pair(exptime, key))) {
+        --numKeys;
+        discharge(entrySize(key));
+    }
+}
+
+void ExpiryIndex::take(slot_t &slot, std::vector<std::string> &keys) {
+    slot_t::iterator it;
+    for (it = slot.begin(); it != slot.end(); ++it) {
+        keys.push_back(it->second);
+        --numKeys;
+        discharge(entrySize(it->second));
+    }
+    slot.clear();
+}
+
+void ExpiryIndex::cascade(time_t t) {
+    // Spread whatever comes up at t over the levels below, top down.
+    time_t top = static_cast<time_t>(1) << (SLOT_BITS * LEVELS);
+    if (t % top == 0) {
+        while (!overflow.empty() && overflow.begin()->first < t + top) {
+            entry_t e(*overflow.begin());
+            overflow.erase(overflow.begin());
+            place(e);
+        }
+    }
+    for (int l = LEVELS - 1; l > 0; --l) {
+        time_t span = static_cast<time_t>(1) << (SLOT_BITS * l);
+        if (t % span != 0) {
+            continue;
+        }
+        slot_t entries;
+        entries.swap(wheel[l][(t >> (SLOT_BITS * l)) & (SLOTS - 1)]);
+        levelKeys[l] -= entries.size();
+        for (slot_t::iterator it = entries.begin(); it != entries.end(); ++it) {
+            place(*it);
+        }
+    }
+}
+
+void ExpiryIndex::popExpired(time_t asOf, std::vector<std::string> &keys) {
+    LockHolder lh(mutex);
+    take(due, keys);
+    while (current < asOf) {
+        cascade(current);
+        slot_t &slot = wheel[0][current & (SLOTS - 1)];
+        levelKeys[0] -= slot.size();
+        take(slot, keys);
+        ++current;
+
+        if (levelKeys[0] == 0) {
+            // Nothing can come up before the next slot of the lowest
+            // level holding any keys, so skip straight to it.
+            int l = 1;
+            while (l < LEVELS && levelKeys[l] == 0) {
+                ++l;
+            }
+            if (l == LEVELS && overflow.empty()) {
+                current = asOf;
+                break;
+            }
+            time_t span = static_cast<time_t>(1) << (SLOT_BITS * l);
+            time_t next = (current + span - 1) / span * span;
+            current = std::min(next, asOf);
+        }
+    }
+}
+
+void ExpiryIndex::clear() {
+    LockHolder lh(mutex);
+    for (int l = 0; l < LEVELS; ++l) {
+        for (int s = 0; s < SLOTS; ++s) {
+            wheel[l][s].clear();
+        }
+        levelKeys[l] = 0;
+    }
+    overflow.clear();
+    due.clear();
+    numKeys.set(0);
+    discharge(memory.get());
+}
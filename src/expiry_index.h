@@ -0,0 +1,125 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2012 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#ifndef SRC_EXPIRY_INDEX_H_
+#define SRC_EXPIRY_INDEX_H_ 1
+
+#include "config.h"
+
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "atomic.h"
+#include "common.h"
+#include "locks.h"
+#include "stats.h"
+
+/**
+ * The keys of the items that carry an expiry time, in a hierarchical
+ * timer wheel keyed on that time.
+ *
+ * Level 0 has a slot per second of the current 64 second span, level
+ * 1 a slot per 64 seconds of the current 4096 second span and so on.
+ * Keys further out than the top level wait in an ordered overflow set.
+ * As time goes by, the slot of a higher level that comes up is spread
+ * over the levels below it, so taking out the keys that are due only
+ * ever looks at those keys.
+ *
+ * The index only holds hints: the caller has to check the item of each
+ * key it takes out, as it may have changed since it was indexed.
+ */
+class ExpiryIndex {
+public:
+
+    /**
+     * @param st the stats to charge the index's memory to
+     * @param start the time from which on keys are due
+     */
+    ExpiryIndex(EPStats &st, time_t start);
+
+    ~ExpiryIndex();
+
+    /**
+     * Index a key that expires at the given time.
+     */
+    void add(const std::string &key, time_t exptime);
+
+    /**
+     * Drop a key that was indexed with the given time.
+     */
+    void remove(const std::string &key, time_t exptime);
+
+    /**
+     * Take out the keys of all items expiring before the given time.
+     *
+     * @param asOf the time items are checked against
+     * @param keys where to append the keys that are due
+     */
+    void popExpired(time_t asOf, std::vector<std::string> &keys);
+
+    /**
+     * Drop every key.
+     */
+    void clear();
+
+    size_t getNumKeys() const {
+        return numKeys.get();
+    }
+
+    /**
+     * Approximate bytes held by the index.
+     */
+    size_t memorySize() const {
+        return memory.get();
+    }
+
+private:
+
+    static const int LEVELS = 4;
+    static const int SLOT_BITS = 6;
+    static const int SLOTS = 1 << SLOT_BITS;
+
+    typedef std::pair<time_t, std::string> entry_t;
+    typedef std::set<entry_t> slot_t;
+
+    bool place(const entry_t &e);
+    bool unplace(const entry_t &e);
+    void cascade(time_t t);
+    void take(slot_t &slot, std::vector<std::string> &keys);
+
+    static size_t entrySize(const std::string &key);
+    void charge(size_t bytes);
+    void discharge(size_t bytes);
+
+    EPStats       &stats;
+    slot_t         wheel[LEVELS][SLOTS];
+    size_t         levelKeys[LEVELS];
+    //! Keys beyond the span of the top level, in time order.
+    slot_t         overflow;
+    //! Keys whose time had already passed when they were indexed.
+    slot_t         due;
+    //! The first second whose keys haven't been taken out yet.
+    time_t         current;
+    Atomic<size_t> numKeys;
+    Atomic<size_t> memory;
+    Mutex          mutex;
+
+    DISALLOW_COPY_AND_ASSIGN(ExpiryIndex);
+};
+
+#endif  // SRC_EXPIRY_INDEX_H_
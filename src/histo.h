@@ -374,6 +374,158 @@ private:
     DISALLOW_COPY_AND_ASSIGN(Histogram);
 };
 
+/**
+ * A histogram of timings with fixed log-linear bins, for recording on
+ * hot paths.
+ *
+ * Every power of two is split into SUB_BINS equal bins, so a bin is
+ * never wider than 1/SUB_BINS of the values it holds and the bin for a
+ * value is computed rather than searched for.  Counts are kept per
+ * thread shard (see threadShardIndex()) and summed when read,
+ * which loses nothing.
+ */
+class LogLinearHistogram {
+public:
+
+    //! Bins per power of two, as a power of two.
+    static const size_t SUB_BITS = 4;
+    static const size_t SUB_BINS = 1 << SUB_BITS;
+    //! Values from 2^MAX_BITS up share the last bin.
+    static const size_t MAX_BITS = 36;
+    static const size_t NUM_BINS = (MAX_BITS - SUB_BITS + 1) * SUB_BINS;
+    static const size_t SHARDS = 4;
+
+    LogLinearHistogram() {}
+
+    /**
+     * Add a value to this histogram.
+     *
+     * @param amount the value
+     * @param count how many times it's being added
+     */
+    void add(uint64_t amount, size_t count=1) {
+        size_t shard = threadShardIndex() % SHARDS;
+        counts[shard][binFor(amount)].incr(count);
+    }
+
+    /**
+     * Set all bins to 0.
+     */
+    void reset() {
+        for (size_t s = 0; s < SHARDS; ++s) {
+            for (size_t i = 0; i < NUM_BINS; ++i) {
+                counts[s][i].set(0);
+            }
+        }
+    }
+
+    /**
+     * Get the count of every bin, summed over the shards.
+     */
+    void getCounts(std::vector<size_t> &out) const {
+        out.assign(NUM_BINS, 0);
+        for (size_t s = 0; s < SHARDS; ++s) {
+            for (size_t i = 0; i < NUM_BINS; ++i) {
+                out[i] += counts[s][i].get();
+            }
+        }
+    }
+
+    /**
+     * Add in everything another histogram counted.
+     */
+    void merge(const LogLinearHistogram &other) {
+        std::vector<size_t> theirs;
+        other.getCounts(theirs);
+        for (size_t i = 0; i < NUM_BINS; ++i) {
+            if (theirs[i] > 0) {
+                counts[0][i].incr(theirs[i]);
+            }
+        }
+    }
+
+    /**
+     * Get the total number of values added.
+     */
+    size_t total() const {
+        std::vector<size_t> c;
+        getCounts(c);
+        return std::accumulate(c.begin(), c.end(), static_cast<size_t>(0));
+    }
+
+    /**
+     * Get the value below which the given fraction of values fell,
+     * rounded up to the end of its bin.
+     *
+     * @param c counts as returned by getCounts()
+     * @param fraction between 0 and 1
+     * @return the value, or 0 if nothing was counted
+     */
+    static uint64_t percentile(const std::vector<size_t> &c, double fraction) {
+        size_t n = std::accumulate(c.begin(), c.end(), static_cast<size_t>(0));
+        if (n == 0) {
+            return 0;
+        }
+        size_t rank = static_cast<size_t>(std::ceil(fraction * n));
+        rank = std::max(rank, static_cast<size_t>(1));
+        size_t seen = 0;
+        for (size_t i = 0; i < c.size(); ++i) {
+            seen += c[i];
+            if (seen >= rank) {
+                return binEnd(i) - 1;
+            }
+        }
+        return binEnd(c.size() - 1) - 1;
+    }
+
+    //! The bin holding the given value.
+    static size_t binFor(uint64_t v) {
+        if (v < SUB_BINS) {
+            return static_cast<size_t>(v);
+        }
+        if (v >= (static_cast<uint64_t>(1) << MAX_BITS)) {
+            return NUM_BINS - 1;
+        }
+        size_t shift = highestBit(v) - SUB_BITS;
+        return (shift + 1) * SUB_BINS +
+            static_cast<size_t>(v >> shift) - SUB_BINS;
+    }
+
+    //! The smallest value in a bin.
+    static uint64_t binStart(size_t bin) {
+        if (bin < SUB_BINS) {
+            return bin;
+        }
+        size_t shift = bin / SUB_BINS - 1;
+        return static_cast<uint64_t>(bin % SUB_BINS + SUB_BINS) << shift;
+    }
+
+    //! The value just past a bin.
+    static uint64_t binEnd(size_t bin) {
+        if (bin == NUM_BINS - 1) {
+            return std::numeric_limits<uint64_t>::max();
+        }
+        return binStart(bin + 1);
+    }
+
+private:
+
+    static size_t highestBit(uint64_t v) {
+        size_t rv = 0;
+        for (size_t step = 32; step > 0; step >>= 1) {
+            if (v >> step) {
+                v >>= step;
+                rv += step;
+            }
+        }
+        return rv;
+    }
+
+    Atomic<size_t> counts[SHARDS][NUM_BINS];
+
+    DISALLOW_COPY_AND_ASSIGN(LogLinearHistogram);
+};
+
 /**
  * Times blocks automatically and records the values in a histogram.
  */
@@ -387,11 +539,18 @@ public:
      * @param d the histogram that will hold the result
      */
     BlockTimer(Histogram<hrtime_t> *d, const char *n=NULL, std::ostream *o=NULL)
-        : dest(d), start(gethrtime()), name(n), out(o) {}
+        : dest(d), llDest(NULL), start(gethrtime()), name(n), out(o) {}
+
+    BlockTimer(LogLinearHistogram *d, const char *n=NULL, std::ostream *o=NULL)
+        : dest(NULL), llDest(d), start(gethrtime()), name(n), out(o) {}
 
     ~BlockTimer() {
         hrtime_t spent(gethrtime() - start);
-        dest->add(spent / 1000);
+        if (llDest) {
+            llDest->add(spent / 1000);
+        } else {
+            dest->add(spent / 1000);
+        }
         log(spent, name, out);
     }
 
@@ -403,6 +562,7 @@ public:
 
 private:
     Histogram<hrtime_t> *dest;
+    LogLinearHistogram  *llDest;
     hrtime_t             start;
     const char          *name;
     std::ostream        *out;
@@ -0,0 +1,114 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2012 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "config.h"
+
+#include <algorithm>
+
+#include "hotkeys.h"
+
+/// @cond DETAILS
+/**
+ * Orders hot keys hottest first.
+ */
+class HotterThan {
+public:
+    bool operator()(const HotKeyTracker::HotKey &a,
+                    const HotKeyTracker::HotKey &b) const {
+        return a.count > b.count;
+    }
+};
+/// @endcond
+
+HotKeyTracker::HotKeyTracker(size_t cap, size_t rate) :
+    capacity(std::max(cap, static_cast<size_t>(1))), sampleRate(rate) {
+    counters.reserve(capacity);
+}
+
+void HotKeyTracker::record(uint16_t vbucket, const std::string &key) {
+    LockHolder lh(mutex);
+    ++numSamples;
+    ++vbSamples[vbucket];
+
+    vbkey_t k(vbucket, key);
+    std::map<vbkey_t, size_t>::iterator it = index.find(k);
+    if (it != index.end()) {
+        ++counters[it->second].count;
+        return;
+    }
+
+    if (counters.size() < capacity) {
+        HotKey hk;
+        hk.vbucket = vbucket;
+        hk.key = key;
+        hk.count = 1;
+        hk.error = 0;
+        index[k] = counters.size();
+        counters.push_back(hk);
+        return;
+    }
+
+    // Take over the smallest counter.
+    size_t victim = 0;
+    for (size_t i = 1; i < counters.size(); ++i) {
+        if (counters[i].count < counters[victim].count) {
+            victim = i;
+        }
+    }
+    HotKey &hk = counters[victim];
+    index.erase(vbkey_t(hk.vbucket, hk.key));
+    hk.vbucket = vbucket;
+    hk.key = key;
+    hk.error = hk.count;
+    ++hk.count;
+    index[k] = victim;
+}
+
+void HotKeyTracker::getHotKeys(std::vector<HotKey> &keys) {
+    {
+        LockHolder lh(mutex);
+        keys = counters;
+    }
+    std::sort(keys.begin(), keys.end(), HotterThan());
+}
+
+void HotKeyTracker::getVBucketSamples(std::map<uint16_t, size_t> &samples) {
+    LockHolder lh(mutex);
+    samples = vbSamples;
+}
+
+size_t HotKeyTracker::getCapacity() {
+    LockHolder lh(mutex);
+    return capacity;
+}
+
+void HotKeyTracker::setCapacity(size_t to) {
+    LockHolder lh(mutex);
+    capacity = std::max(to, static_cast<size_t>(1));
+    counters.clear();
+    index.clear();
+    vbSamples.clear();
+    numSamples.set(0);
+}
+
+void HotKeyTracker::reset() {
+    LockHolder lh(mutex);
+    counters.clear();
+    index.clear();
+    vbSamples.clear();
+    numSamples.set(0);
+}
@@ -0,0 +1,130 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2012 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#ifndef SRC_HOTKEYS_H_
+#define SRC_HOTKEYS_H_ 1
+
+#include "config.h"
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "atomic.h"
+#include "common.h"
+#include "locks.h"
+
+/**
+ * Tracks the keys taking the most traffic.
+ *
+ * One in every sampleRate operations, picked at random, is fed into a
+ * Space-Saving summary of a fixed number of counters: a sampled key
+ * that has a counter gets it bumped, and any other key takes over the
+ * smallest counter and carries its count on as a possible error.  Every
+ * key seen more often than samples / capacity times is guaranteed to
+ * hold a counter, so a key taking a sizeable share of the traffic can't
+ * be missed.
+ *
+ * Operations that aren't sampled only cost a clock read.
+ */
+class HotKeyTracker {
+public:
+
+    /**
+     * A key and what the summary knows about it.
+     */
+    struct HotKey {
+        uint16_t    vbucket;
+        std::string key;
+        //! Times the key was sampled, an overestimate by at most error.
+        size_t      count;
+        size_t      error;
+    };
+
+    /**
+     * @param capacity the number of keys tracked
+     * @param rate one in how many operations is sampled, 0 to disable
+     */
+    HotKeyTracker(size_t capacity, size_t rate);
+
+    /**
+     * Note an operation on a key.
+     */
+    void access(uint16_t vbucket, const char *key, size_t nkey) {
+        size_t rate = sampleRate.get();
+        if (rate != 0 && sampleDue(key, rate)) {
+            record(vbucket, std::string(key, nkey));
+        }
+    }
+
+    /**
+     * Get the tracked keys, hottest first.
+     */
+    void getHotKeys(std::vector<HotKey> &keys);
+
+    /**
+     * Get the number of samples taken per vbucket.
+     */
+    void getVBucketSamples(std::map<uint16_t, size_t> &samples);
+
+    size_t getNumSamples() const {
+        return numSamples.get();
+    }
+
+    size_t getSampleRate() const {
+        return sampleRate.get();
+    }
+
+    void setSampleRate(size_t to) {
+        sampleRate.set(to);
+    }
+
+    size_t getCapacity();
+
+    /**
+     * Change the number of keys tracked, which starts over.
+     */
+    void setCapacity(size_t to);
+
+    /**
+     * Forget every key.
+     */
+    void reset();
+
+private:
+
+    typedef std::pair<uint16_t, std::string> vbkey_t;
+
+    static bool sampleDue(const char *key, size_t rate) {
+        return hrtimeRandom(key) % rate == 0;
+    }
+
+    void record(uint16_t vbucket, const std::string &key);
+
+    size_t                        capacity;
+    Atomic<size_t>                sampleRate;
+    Atomic<size_t>                numSamples;
+    //! The counters, and where each key's counter is.
+    std::vector<HotKey>           counters;
+    std::map<vbkey_t, size_t>     index;
+    std::map<uint16_t, size_t>    vbSamples;
+    Mutex                         mutex;
+
+    DISALLOW_COPY_AND_ASSIGN(HotKeyTracker);
+};
+
+#endif  // SRC_HOTKEYS_H_
@@ -33,6 +33,11 @@ public:
 
     bool visitBucket(RCPtr<VBucket> &vb) {
         vb->ht.resize();
+        // Drain the migration a few buckets at a time so front-end
+        // operations only ever wait on a single stripe for a short while.
+        while (vb->ht.resizeStep()) {
+            // Keep going...
+        }
         return false;
     }
 
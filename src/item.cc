@@ -17,12 +17,47 @@
 
 #include "config.h"
 
+#include <vector>
+
+#include "compressor.h"
 #include "item.h"
 #include "tools/cJSON.h"
 
 Atomic<uint64_t> Item::casCounter(1);
 const uint32_t Item::metaDataSize(2 * sizeof(uint32_t) + 2 * sizeof(uint64_t) + 2);
 
+Blob *Blob::compress() const {
+    assert(!compressed);
+    uint32_t len = size;
+    size_t budget = size - size / 8;
+    if (budget <= sizeof(len)) {
+        return NULL;
+    }
+    std::vector<char> buf(budget);
+    std::memcpy(&buf[0], &len, sizeof(len));
+    size_t clen = LZCompressor::compress(data, size, &buf[sizeof(len)],
+                                         budget - sizeof(len));
+    if (clen == 0) {
+        return NULL;
+    }
+    Blob *rv = New(&buf[0], clen + sizeof(len));
+    rv->compressed = 1;
+    return rv;
+}
+
+Blob *Blob::decompress() const {
+    assert(compressed);
+    size_t len = valueLength();
+    Blob *rv = New(len);
+    size_t got = LZCompressor::decompress(data + sizeof(uint32_t),
+                                          size - sizeof(uint32_t),
+                                          const_cast<char*>(rv->getData()),
+                                          len);
+    assert(got == len);
+    (void)got;
+    return rv;
+}
+
 bool Item::append(const Item &i) {
     assert(value.get() != NULL);
     assert(i.getValue().get() != NULL);
@@ -30,6 +30,7 @@
 #include "locks.h"
 #include "mutex.h"
 #include "objectregistry.h"
+#include "slab_allocator.h"
 #include "stats.h"
 
 /**
@@ -50,7 +51,9 @@ public:
      */
     static Blob* New(const char *start, const size_t len) {
         size_t total_len = len + sizeof(Blob);
-        Blob *t = new (::operator new(total_len)) Blob(start, len);
+        bool slab;
+        void *p = SlabAllocator::allocateObject(total_len, slab);
+        Blob *t = new (p) Blob(start, len, slab);
         assert(t->length() == len);
         return t;
     }
@@ -75,11 +78,41 @@ public:
      */
     static Blob* New(const size_t len) {
         size_t total_len = len + sizeof(Blob);
-        Blob *t = new (::operator new(total_len)) Blob(len);
+        bool slab;
+        void *p = SlabAllocator::allocateObject(total_len, slab);
+        Blob *t = new (p) Blob(len, slab);
         assert(t->length() == len);
         return t;
     }
 
+    /**
+     * Create an empty Blob inside storage owned by another object.
+     *
+     * The returned Blob holds a structural reference on behalf of its
+     * owner, which must drop it with releaseEmbedded() instead of
+     * freeing the storage itself.  Whoever drops the last reference
+     * frees the whole enclosing allocation.
+     *
+     * @param at where to construct the blob
+     * @param offset distance from the start of the enclosing
+     *               allocation to at
+     * @param capacity bytes of data the blob may hold; the enclosing
+     *                 allocation must end right after them
+     * @param slab true if the enclosing allocation came from the
+     *             SlabAllocator
+     *
+     * @return the new Blob instance
+     */
+    static Blob* NewEmbedded(char *at, const size_t offset,
+                             const size_t capacity, bool slab) {
+        assert(offset > 0 && offset < 0x4000 && capacity < 256);
+        Blob *t = new (at) Blob(static_cast<size_t>(0), slab);
+        t->embedOffset = static_cast<uint16_t>(offset);
+        t->embedCapacity = static_cast<uint8_t>(capacity);
+        t->_rc_incref();
+        return t;
+    }
+
     // Actual accessorish things.
 
     /**
@@ -96,6 +129,39 @@ public:
         return size;
     }
 
+    /**
+     * True if this blob holds a compressed value (see compress()).
+     */
+    bool isCompressed() const {
+        return compressed;
+    }
+
+    /**
+     * Get the length of the value this blob holds, which for a
+     * compressed blob is its length once decompressed.
+     */
+    size_t valueLength() const {
+        if (!compressed) {
+            return size;
+        }
+        uint32_t len;
+        std::memcpy(&len, data, sizeof(len));
+        return len;
+    }
+
+    /**
+     * Create a compressed copy of this blob.
+     *
+     * @return the copy, or NULL if compressing wouldn't save at least
+     *         an eighth of the space
+     */
+    Blob *compress() const;
+
+    /**
+     * Create an uncompressed copy of this compressed blob.
+     */
+    Blob *decompress() const;
+
     /**
      * Get the size of this Blob instance.
      */
@@ -103,6 +169,17 @@ public:
         return size + sizeof(Blob);
     }
 
+    /**
+     * Get the memory this Blob instance holds on to, including what
+     * the allocator rounded it up by.
+     */
+    size_t getAllocatedSize() const {
+        if (fromSlab && !isEmbedded()) {
+            return SlabAllocator::getInstance()->chunkSize(getSize());
+        }
+        return getSize();
+    }
+
     /**
      * Get a std::string representation of this blob.
      */
@@ -110,6 +187,61 @@ public:
         return std::string(data, size);
     }
 
+    /**
+     * True if this blob lives inside another object's allocation.
+     */
+    bool isEmbedded() const {
+        return embedOffset != 0;
+    }
+
+    /**
+     * Overwrite the contents of an embedded blob.
+     *
+     * This only succeeds when nothing but the owner's structural
+     * reference is held, i.e. no reader can observe the change.  The
+     * caller is responsible for len fitting in the owner's storage.
+     *
+     * @param start the beginning of the new contents
+     * @param len the length of the new contents
+     *
+     * @return true if the blob now holds the given contents
+     */
+    bool refill(const char *start, const size_t len) {
+        assert(isEmbedded());
+        if (_rc_count() != 1) {
+            return false;
+        }
+        ObjectRegistry::onDeleteBlob(this);
+        size = static_cast<uint32_t>(len);
+        std::memcpy(data, start, len);
+        ObjectRegistry::onCreateBlob(this);
+        return true;
+    }
+
+    /**
+     * Drop the owner's structural reference on an embedded blob.
+     */
+    void releaseEmbedded() {
+        assert(isEmbedded());
+        if (_rc_decref() == 0) {
+            destroyEmbedded();
+        }
+    }
+
+    /**
+     * Destroy this blob and release the storage it lives in.
+     */
+    void destroy() {
+        if (isEmbedded()) {
+            destroyEmbedded();
+        } else {
+            size_t total_len = getSize();
+            bool slab = fromSlab;
+            this->~Blob();
+            SlabAllocator::releaseObject(this, total_len, slab);
+        }
+    }
+
     // This is necessary for making C++ happy when I'm doing a
     // placement new on fairly "normal" c++ heap allocations, just
     // with variable-sized objects.
@@ -121,25 +253,51 @@ public:
 
 private:
 
-    explicit Blob(const char *start, const size_t len) :
-        size(static_cast<uint32_t>(len))
+    explicit Blob(const char *start, const size_t len, bool slab) :
+        size(static_cast<uint32_t>(len)), embedOffset(0), fromSlab(slab),
+        compressed(0), embedCapacity(0)
     {
         std::memcpy(data, start, len);
         ObjectRegistry::onCreateBlob(this);
     }
 
-    explicit Blob(const size_t len) :
-        size(static_cast<uint32_t>(len))
+    explicit Blob(const size_t len, bool slab) :
+        size(static_cast<uint32_t>(len)), embedOffset(0), fromSlab(slab),
+        compressed(0), embedCapacity(0)
     {
         ObjectRegistry::onCreateBlob(this);
     }
 
-    const uint32_t size;
+    void destroyEmbedded() {
+        char *block = reinterpret_cast<char*>(this) - embedOffset;
+        size_t total_len = embedOffset + sizeof(Blob) + embedCapacity;
+        bool slab = fromSlab;
+        this->~Blob();
+        SlabAllocator::releaseObject(block, total_len, slab);
+    }
+
+    uint32_t size;
+    //! Offset of this blob within its owner's allocation, 0 if standalone.
+    uint16_t embedOffset : 14;
+    //! True if this blob's allocation came from the SlabAllocator.
+    uint16_t fromSlab    :  1;
+    //! True if data is a 32 bit original length followed by LZ output.
+    uint16_t compressed  :  1;
+    //! Data capacity of an embedded blob.
+    uint8_t  embedCapacity;
     char data[1];
 
     DISALLOW_COPY_AND_ASSIGN(Blob);
 };
 
+/**
+ * Blobs may be embedded in another allocation, so let them pick how
+ * they are freed when the last reference goes away.
+ */
+inline void destroyRCValue(Blob *b) {
+    b->destroy();
+}
+
 typedef SingleThreadedRCPtr<Blob> value_t;
 
 const uint64_t DEFAULT_REV_SEQ_NUM = 1;
@@ -23,6 +23,7 @@
 #include <list>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "common.h"
 #include "ep.h"
@@ -31,6 +32,9 @@
 
 static const double EJECTION_RATIO_THRESHOLD(0.1);
 static const size_t MAX_PERSISTENCE_QUEUE_SIZE = 1000000;
+static const double SAMPLED_EVICTION_INTERVAL(1);
+//! Most samples one round of sampled eviction takes before yielding.
+static const size_t SAMPLED_EVICTION_MAX_ROUNDS(1000);
 
 const bool PagingConfig::phaseConfig[paging_max] = {false, true};
 
@@ -52,17 +56,31 @@ public:
      * @param sfin pointer to a bool to be set to true after run completes
      * @param pause flag indicating if PagingVisitor can pause between vbucket visits
      * @param nru false if ignoring reference bits
+     * @param freqs item counts per access frequency from the last run,
+     *        replaced by this run's counts when it completes
      */
     PagingVisitor(EventuallyPersistentStore &s, EPStats &st, double pcnt,
-                  bool *sfin, bool pause = false, double bias = 1, bool nru = true)
+                  bool *sfin, bool pause = false, double bias = 1, bool nru = true,
+                  std::vector<size_t> *freqs = NULL)
       : store(s), stats(st), randomEvict(PagingConfig::phaseConfig[0]), percent(pcnt),
-        activeBias(bias), ejected(0), totalEjected(0), totalEjectionAttempts(0),
+        activeBias(bias), ejected(0), compressed(0), totalEjected(0),
+        totalEjectionAttempts(0),
         startTime(ep_real_time()), stateFinalizer(sfin), canPause(pause),
-        useNru(nru) {}
+        useNru(nru), freqCutoff(StoredValue::MAX_FREQUENCY), cutoffProb(1),
+        lastFreqCounts(freqs),
+        freqCounts(StoredValue::MAX_FREQUENCY + 1, 0),
+        seed(static_cast<unsigned int>(hrtimeRandom(this))) {
+        if (freqs && freqs->size() == freqCounts.size()) {
+            prevFreqCounts = *freqs;
+        }
+    }
 
     void visit(StoredValue *v) {
-        // Remember expired objects -- we're going to delete them.
-        if ((v->isExpired(startTime) && !v->isDeleted()) || v->isTempItem()) {
+        // Remember expired objects -- we're going to delete them.  The
+        // expiry pager already took those from the index, if there is one.
+        bool fromIndex = percent <= 0 && currentBucket->ht.hasExpiryIndex();
+        if ((!fromIndex && v->isExpired(startTime) && !v->isDeleted()) ||
+            v->isTempItem()) {
             expired.push_back(std::make_pair(currentBucket->getId(), v->getKey()));
             return;
         }
@@ -72,11 +90,36 @@ public:
             return;
         }
 
-        // always evict unreferenced items, or randomly evict referenced item
-        double r = randomEvict == false ?
-            1 : static_cast<double>(std::rand()) / static_cast<double>(RAND_MAX);
-        if ((useNru && !v->isReferenced()) || percent >= r) {
+        // Age every key, so only the ones still being hit stay hot.
+        uint8_t freq = v->getFrequency();
+        v->decayFrequency();
+        if (v->isResident() && !v->isDeleted()) {
+            ++freqCounts[freq];
+        }
+
+        // always evict cold unreferenced items, or pick the coldest
+        // referenced items until the target share is reached
+        bool cold = freq <= freqCutoff;
+        if ((useNru && !v->isReferenced() && cold) ||
+            (randomEvict && pickVictim(freq))) {
             ++totalEjectionAttempts;
+            // Shrinking the value in place is cheaper than a later bg fetch.
+            if (v->compressValue(stats, currentBucket->ht)) {
+                ++compressed;
+                return;
+            }
+            if (store.isFullEviction()) {
+                // The whole item goes, which would pull v out from under
+                // the hash table walk, so that's done in update().
+                if (v->isDeleted() || !v->isClean()) {
+                    ++stats.numFailedEjects;
+                } else if (currentBucket->checkpointManager.eligibleForEviction(
+                                                              v->getKey())) {
+                    ejectedKeys.push_back(std::make_pair(currentBucket->getId(),
+                                                         v->getKey()));
+                }
+                return;
+            }
             if (!v->eligibleForEviction()) {
                 ++stats.numFailedEjects;
                 return;
@@ -84,8 +127,16 @@ public:
             // Check if the key was already visited by all the cursors.
             bool can_evict =
                 currentBucket->checkpointManager.eligibleForEviction(v->getKey());
-            if (can_evict && v->ejectValue(stats, currentBucket->ht)) {
+            value_t value;
+            if (can_evict &&
+                v->ejectValue(stats, currentBucket->ht,
+                              store.getValueCache() ? &value : NULL)) {
                 ++ejected;
+                if (value.get() != NULL) {
+                    toCache.push_back(EjectedValue(currentBucket->getId(),
+                                                   v->getKey(), v->getCas(),
+                                                   value));
+                }
             }
         }
     }
@@ -95,7 +146,21 @@ public:
 
         // fast path for expiry item pager
         if (percent <= 0 ) {
-            return VBucketVisitor::visitBucket(vb);;
+            if (!VBucketVisitor::visitBucket(vb)) {
+                return false;
+            }
+            if (!vb->ht.hasExpiryIndex()) {
+                return true;
+            }
+            // The index hands us what's due; only temporary items still
+            // need a walk to be found.
+            std::vector<std::string> keys;
+            vb->ht.popExpired(startTime, keys);
+            std::vector<std::string>::iterator it;
+            for (it = keys.begin(); it != keys.end(); ++it) {
+                expired.push_back(std::make_pair(vb->getId(), *it));
+            }
+            return vb->ht.getNumTempItems() > 0;
         }
 
         // skip active vbuckets if active resident ratio is lower than replica
@@ -113,18 +178,36 @@ public:
         if (current > lower) {
             double p = (current - static_cast<double>(lower)) / current;
             adjustPercent(p, vb->getState());
+            computeFrequencyCutoff();
             return VBucketVisitor::visitBucket(vb);
         }
         return false;
     }
 
     void update() {
+        // The walk holds the bucket locks, so the values it ejected go
+        // to the value cache only now.
+        std::list<EjectedValue>::iterator it;
+        for (it = toCache.begin(); it != toCache.end(); ++it) {
+            RCPtr<VBucket> vb = store.getVBucket(it->vbucket);
+            if (vb) {
+                store.cacheEjectedValue(vb, it->key, it->cas, it->value);
+            }
+        }
+        toCache.clear();
+
         store.deleteExpiredItems(expired);
+        ejected += store.ejectItems(ejectedKeys);
+        ejectedKeys.clear();
 
         if (numEjected() > 0) {
             LOG(EXTENSION_LOG_INFO, "Paged out %ld values", numEjected());
         }
 
+        if (compressed > 0) {
+            LOG(EXTENSION_LOG_INFO, "Compressed %ld values", compressed);
+        }
+
         size_t num_expired = expired.size();
         if (num_expired > 0) {
             LOG(EXTENSION_LOG_INFO, "Purged %ld expired items", num_expired);
@@ -132,6 +215,7 @@ public:
 
         totalEjected += (ejected + num_expired);
         ejected = 0;
+        compressed = 0;
         expired.clear();
     }
 
@@ -142,11 +226,33 @@ public:
 
     void complete() {
         update();
+        if (lastFreqCounts) {
+            *lastFreqCounts = freqCounts;
+        }
         if (stateFinalizer) {
             *stateFinalizer = true;
         }
     }
 
+    VBucketVisitor *clone() {
+        PagingVisitor *pv = new PagingVisitor(store, stats, percent, NULL,
+                                              canPause, activeBias, useNru);
+        pv->randomEvict = randomEvict;
+        pv->startTime = startTime;
+        pv->prevFreqCounts = prevFreqCounts;
+        return pv;
+    }
+
+    void merge(VBucketVisitor &other) {
+        PagingVisitor &pv = static_cast<PagingVisitor&>(other);
+        pv.update();
+        totalEjected += pv.totalEjected;
+        totalEjectionAttempts += pv.totalEjectionAttempts;
+        for (size_t i = 0; i < freqCounts.size(); ++i) {
+            freqCounts[i] += pv.freqCounts[i];
+        }
+    }
+
     /**
      * Get the number of items ejected during the visit.
      */
@@ -171,6 +277,46 @@ public:
     }
 
 private:
+
+    /**
+     * Find the frequency below which keys make up the share of items
+     * we want to evict, going by the counts of the last run.  Keys at
+     * that frequency are picked with the probability that makes up
+     * the rest of the share.
+     */
+    void computeFrequencyCutoff() {
+        size_t total = 0;
+        for (size_t i = 0; i < prevFreqCounts.size(); ++i) {
+            total += prevFreqCounts[i];
+        }
+        freqCutoff = StoredValue::MAX_FREQUENCY;
+        cutoffProb = 1;
+        if (total == 0) {
+            return;
+        }
+        double want = percent * static_cast<double>(total);
+        double below = 0;
+        for (size_t i = 0; i < prevFreqCounts.size(); ++i) {
+            double here = static_cast<double>(prevFreqCounts[i]);
+            if (below + here >= want) {
+                freqCutoff = static_cast<uint8_t>(i);
+                cutoffProb = here > 0 ? (want - below) / here : 1;
+                return;
+            }
+            below += here;
+        }
+    }
+
+    bool pickVictim(uint8_t freq) {
+        // Clones walk at the same time, so each rolls from its own seed.
+        double r = static_cast<double>(rand_r(&seed)) / static_cast<double>(RAND_MAX);
+        if (prevFreqCounts.empty()) {
+            // Nothing known about frequencies yet, so pick at random.
+            return percent >= r;
+        }
+        return freq < freqCutoff || (freq == freqCutoff && cutoffProb >= r);
+    }
+
     void adjustPercent(double prob, vbucket_state_t state) {
         if (state == vbucket_state_replica ||
             state == vbucket_state_dead)
@@ -184,7 +330,19 @@ private:
         }
     }
 
+    //! A value ejected during the walk, still to go to the value cache.
+    struct EjectedValue {
+        EjectedValue(uint16_t vb, const std::string &k, uint64_t c,
+                     const value_t &v) : vbucket(vb), key(k), cas(c), value(v) {}
+        uint16_t    vbucket;
+        std::string key;
+        uint64_t    cas;
+        value_t     value;
+    };
+
     std::list<std::pair<uint16_t, std::string> > expired;
+    std::list<std::pair<uint16_t, std::string> > ejectedKeys;
+    std::list<EjectedValue> toCache;
 
     EventuallyPersistentStore &store;
     EPStats                   &stats;
@@ -192,14 +350,159 @@ private:
     double                     percent;
     double                     activeBias;
     size_t                     ejected;
+    size_t                     compressed;
     size_t                     totalEjected;
     size_t                     totalEjectionAttempts;
     time_t                     startTime;
     bool                      *stateFinalizer;
     bool                       canPause;
     bool                       useNru;
+    uint8_t                    freqCutoff;
+    double                     cutoffProb;
+    std::vector<size_t>       *lastFreqCounts;
+    std::vector<size_t>        prevFreqCounts;
+    std::vector<size_t>        freqCounts;
+    unsigned int               seed;
 };
 
+/**
+ * Looks at the items of a few sampled hash buckets and keeps the least
+ * frequently used one that could be paged out.
+ */
+class EvictionSampler : public HashTableVisitor {
+public:
+
+    EvictionSampler() : sampled(0), freqs(0), found(false), victimFreq(0),
+                        victimReferenced(false), now(ep_real_time()) {}
+
+    void visit(StoredValue *v) {
+        if (!v->isResident() || v->isDeleted() || v->isTempItem() ||
+            !v->isClean() || v->isExpired(now)) {
+            return;
+        }
+        uint8_t freq = v->getFrequency();
+        bool referenced = v->isReferenced();
+        // Sampling takes the place of the sweep, so it ages what it sees.
+        v->decayFrequency();
+        ++sampled;
+        freqs += freq;
+        if (!found || freq < victimFreq ||
+            (freq == victimFreq && victimReferenced && !referenced)) {
+            found = true;
+            victim = v->getKey();
+            victimFreq = freq;
+            victimReferenced = referenced;
+        }
+    }
+
+    void reset() {
+        found = false;
+    }
+
+    size_t       sampled;
+    size_t       freqs;
+    bool         found;
+    std::string  victim;
+    uint8_t      victimFreq;
+    bool         victimReferenced;
+    time_t       now;
+};
+
+double ItemPager::evictSampled() {
+    double current = static_cast<double>(stats.getTotalMemoryUsed());
+    double upper = static_cast<double>(stats.mem_high_wat);
+    double lower = static_cast<double>(stats.mem_low_wat);
+    double target = lower + (upper - lower) / 2;
+    if (current <= target) {
+        stats.sampledEjectRate.set(0);
+        return SAMPLED_EVICTION_INTERVAL;
+    }
+    ++stats.pagerRuns;
+
+    // Close half the gap each round, so memory settles near the target
+    // instead of overshooting it.
+    double toFree = (current - target) / 2;
+
+    Configuration &cfg = store.getEPEngine().getConfiguration();
+    size_t sampleSize = cfg.getPagerSampleSize();
+    double bias = static_cast<double>(cfg.getPagerActiveVbPcnt()) / 50;
+
+    // Spread the bytes to free over the vbuckets by their memory, with
+    // active ones weighted down by the active eviction bias.
+    const VBucketMap &vbuckets = store.getVBuckets();
+    size_t num_vbuckets = vbuckets.getSize();
+    std::vector<double> weights(num_vbuckets, 0);
+    double total = 0;
+    for (size_t i = 0; i < num_vbuckets; ++i) {
+        assert(i <= std::numeric_limits<uint16_t>::max());
+        RCPtr<VBucket> vb = vbuckets.getBucket(static_cast<uint16_t>(i));
+        if (!vb) {
+            continue;
+        }
+        double w = vb->getState() == vbucket_state_active ? bias : 2 - bias;
+        weights[i] = w * static_cast<double>(vb->ht.memSize.get());
+        total += weights[i];
+    }
+    if (total <= 0) {
+        return SAMPLED_EVICTION_INTERVAL;
+    }
+
+    // Carry on from the vbucket the last round ran out of turns on, so
+    // the ones at the end aren't left for ever.
+    hrtime_t start = gethrtime();
+    size_t ejected = 0;
+    size_t turns = SAMPLED_EVICTION_MAX_ROUNDS;
+    bool yielded = false;
+    EvictionSampler sampler;
+    for (size_t n = 0; n < num_vbuckets && !yielded; ++n) {
+        size_t i = (nextSampledVb + n) % num_vbuckets;
+        RCPtr<VBucket> vb = vbuckets.getBucket(static_cast<uint16_t>(i));
+        size_t items = vb ? vb->ht.getNumItems() : 0;
+        if (weights[i] <= 0 || items == 0) {
+            continue;
+        }
+        double share = toFree * weights[i] / total;
+        double itemSize = static_cast<double>(vb->ht.memSize.get()) / items;
+        // Give up on a vbucket after twice the rounds it should take.
+        size_t rounds = static_cast<size_t>(2 * share / itemSize) + 1;
+        double freed = 0;
+        for (size_t r = 0; r < rounds && freed < share; ++r) {
+            if (turns == 0) {
+                nextSampledVb = i;
+                yielded = true;
+                break;
+            }
+            --turns;
+            sampler.reset();
+            vb->ht.sample(sampler, sampleSize, sampleSeed);
+            if (!sampler.found) {
+                continue;
+            }
+            size_t bytes = store.pageOutItem(vb, sampler.victim);
+            if (bytes > 0) {
+                freed += static_cast<double>(bytes);
+                ++ejected;
+                stats.evictionVictimFreqs.incr(sampler.victimFreq);
+            }
+        }
+    }
+    stats.numEvictionSamples.incr(sampler.sampled);
+    stats.evictionSampleFreqs.incr(sampler.freqs);
+    stats.numSampledEjects.incr(ejected);
+
+    double sleepTime = yielded ? 0 : SAMPLED_EVICTION_INTERVAL;
+    double elapsed = static_cast<double>(gethrtime() - start) / 1000000000;
+    double period = sleepTime + elapsed;
+    if (period > 0) {
+        stats.sampledEjectRate.set(static_cast<size_t>(ejected / period));
+    }
+    if (ejected > 0) {
+        LOG(EXTENSION_LOG_INFO, "Sampled eviction paged out %ld items",
+            ejected);
+    }
+    return sleepTime;
+}
+
 bool ItemPager::checkAccessScannerTask() {
     if (store.pager.biased) {
         return true;
@@ -221,6 +524,24 @@ bool ItemPager::callback(Dispatcher &d, TaskId &t) {
     double upper = static_cast<double>(stats.mem_high_wat);
     double lower = static_cast<double>(stats.mem_low_wat);
     double sleepTime = 10;
+
+    // Count the time since the last run as spent where memory is now.
+    hrtime_t now = gethrtime();
+    if (current > upper) {
+        stats.timeAboveHighWat.incr(static_cast<size_t>((now - lastRun) / 1000000));
+    }
+    lastRun = now;
+
+    // A sweep still going on has to finish first.
+    if (available &&
+        store.getEPEngine().getConfiguration().isPagerSampledEviction()) {
+        double sleep = evictSampled();
+        if (sleep > 0) {
+            d.snooze(t, sleep);
+        }
+        // Otherwise give the other tasks a turn before carrying on.
+        return true;
+    }
     if (available && current > upper) {
         ++stats.pagerRuns;
 
@@ -244,8 +565,8 @@ bool ItemPager::callback(Dispatcher &d, TaskId &t) {
 
         available = false;
         shared_ptr<PagingVisitor> pv(new PagingVisitor(store, stats, toKill,
-                                                       &available, false, bias, nru));
-        std::srand(ep_real_time());
+                                                       &available, false, bias, nru,
+                                                       &freqCounts));
         pv->configPaging(PagingConfig::phaseConfig[phase]);
         store.visit(pv, "Item pager", &d, Priority::ItemPagerPriority);
 
@@ -287,6 +608,17 @@ bool ExpiredItemPager::callback(Dispatcher &d, TaskId &t) {
     if (available) {
         ++stats.expiryPagerRuns;
 
+        hrtime_t now = gethrtime();
+        size_t expired = stats.expired_pager.get();
+        double elapsed = static_cast<double>(now - lastRun) / 1000000000;
+        // The counter starts over when the stats are reset.
+        if (elapsed > 0 && expired >= lastExpired) {
+            stats.expiredPagerRate.set(
+                static_cast<size_t>((expired - lastExpired) / elapsed));
+        }
+        lastExpired = expired;
+        lastRun = now;
+
         available = false;
         shared_ptr<PagingVisitor> pv(new PagingVisitor(store, stats,
                                                        -1, &available, true));
@@ -64,7 +64,9 @@ public:
      * @param st the stats
      */
     ItemPager(EventuallyPersistentStore *s, EPStats &st) :
-        store(*s), stats(st), available(true), phase(PagingConfig::paging_unreferenced) {}
+        store(*s), stats(st), available(true), phase(PagingConfig::paging_unreferenced),
+        lastRun(gethrtime()), nextSampledVb(0),
+        sampleSeed(static_cast<unsigned int>(hrtimeRandom(this))) {}
 
     bool callback(Dispatcher &d, TaskId &t);
 
@@ -73,10 +75,27 @@ public:
 private:
     bool checkAccessScannerTask();
 
+    /**
+     * Page out just enough sampled items to close part of the gap
+     * between memory usage and the middle of the watermarks, or as
+     * many as one round is allowed to.
+     *
+     * @return the number of seconds to sleep before the next round, 0
+     *         if this one ran out of turns and has to carry on
+     */
+    double evictSampled();
+
     EventuallyPersistentStore &store;
     EPStats                   &stats;
     bool                       available;
     short int                  phase;
+    //! Resident items per access frequency, as of the last run.
+    std::vector<size_t>        freqCounts;
+    hrtime_t                   lastRun;
+    //! Where the next round of sampled eviction starts.
+    size_t                     nextSampledVb;
+    //! rand_r state for picking the buckets sampled eviction looks at.
+    unsigned int               sampleSeed;
 };
 
 /**
@@ -96,7 +115,8 @@ public:
     ExpiredItemPager(EventuallyPersistentStore *s, EPStats &st,
                      size_t stime) :
         store(*s), stats(st), sleepTime(static_cast<double>(stime)),
-        available(true) {}
+        available(true), lastExpired(st.expired_pager.get()),
+        lastRun(gethrtime()) {}
 
     bool callback(Dispatcher &d, TaskId &t);
 
@@ -107,6 +127,9 @@ private:
     EPStats                   &stats;
     double                     sleepTime;
     bool                       available;
+    //! Items the pager had expired and when, as of the last run
+    size_t                     lastExpired;
+    hrtime_t                   lastRun;
 };
 
 #endif  // SRC_ITEM_PAGER_H_
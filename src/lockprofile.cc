@@ -0,0 +1,49 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2012 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "config.h"
+
+#include "lockprofile.h"
+
+volatile bool LockSite::profiling(false);
+// Constant initialized, so sites in other files constructed before this
+// one's dynamic initialization still find it.
+LockSite *LockSite::head(NULL);
+
+LockSite::LockSite(const char *nm) : name(nm), next(head) {
+    head = this;
+}
+
+void LockSite::reset() {
+    acquisitions.set(0);
+    contentions.set(0);
+    waitTime.reset();
+    holdTime.reset();
+}
+
+void LockSite::getAll(std::vector<LockSite*> &sites) {
+    sites.clear();
+    for (LockSite *s = head; s != NULL; s = s->next) {
+        sites.push_back(s);
+    }
+}
+
+void LockSite::resetAll() {
+    for (LockSite *s = head; s != NULL; s = s->next) {
+        s->reset();
+    }
+}
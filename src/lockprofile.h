@@ -0,0 +1,121 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2012 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#ifndef SRC_LOCKPROFILE_H_
+#define SRC_LOCKPROFILE_H_ 1
+
+#include "config.h"
+
+#include <vector>
+
+#include "atomic.h"
+#include "common.h"
+#include "histo.h"
+
+/**
+ * Contention figures for one place in the code locks are taken.
+ *
+ * A site is shared by every lock used for the same thing, e.g. all the
+ * stripes of every hash table, and a Mutex, SyncObject or SpinLock
+ * reports to the site it was handed through setLockSite().  Nothing is
+ * recorded unless profiling has been switched on, and a lock without a
+ * site costs nothing either way.
+ *
+ * Sites live as long as the process and must be defined at namespace
+ * scope (or as static members), which is when they put themselves on
+ * the list getAll() walks.
+ */
+class LockSite {
+public:
+
+    /**
+     * @param name what the site is reported as
+     */
+    LockSite(const char *name);
+
+    const char *getName() const {
+        return name;
+    }
+
+    /**
+     * Note a lock was acquired.
+     *
+     * @param waited nanoseconds spent getting it
+     * @param contended true if somebody else held it when we asked
+     */
+    void acquired(hrtime_t waited, bool contended) {
+        ++acquisitions;
+        if (contended) {
+            ++contentions;
+        }
+        waitTime.add(waited);
+    }
+
+    /**
+     * Note a lock was released.
+     *
+     * @param held nanoseconds it was held for
+     */
+    void released(hrtime_t held) {
+        holdTime.add(held);
+    }
+
+    /**
+     * Forget everything recorded at this site.
+     */
+    void reset();
+
+    //! Times a lock was acquired here.
+    Atomic<size_t>     acquisitions;
+    //! Times the lock was already held by somebody else.
+    Atomic<size_t>     contentions;
+    //! Nanoseconds spent waiting for a lock.
+    LogLinearHistogram waitTime;
+    //! Nanoseconds a lock was held for.
+    LogLinearHistogram holdTime;
+
+    static bool isProfiling() {
+        return profiling;
+    }
+
+    /**
+     * Switch profiling on or off for every site in the process.
+     */
+    static void setProfiling(bool to) {
+        profiling = to;
+    }
+
+    /**
+     * Get every site in the process.
+     */
+    static void getAll(std::vector<LockSite*> &sites);
+
+    /**
+     * Reset every site in the process.
+     */
+    static void resetAll();
+
+private:
+    const char *name;
+    LockSite   *next;
+
+    static volatile bool profiling;
+    static LockSite *head;
+
+    DISALLOW_COPY_AND_ASSIGN(LockSite);
+};
+
+#endif  // SRC_LOCKPROFILE_H_
@@ -93,12 +93,16 @@ public:
     /**
      * Acquire a series of locks.
      *
-     * @param m beginning of an array of locks
+     * @param m beginning of an array of locks (Mutex or a subclass)
      * @param n the number of locks to lock
      */
-    MultiLockHolder(Mutex *m, size_t n) : mutexes(m),
-                                          locked(new bool[n]),
-                                          n_locks(n) {
+    template <typename T>
+    MultiLockHolder(T *m, size_t n) : mutexes(new Mutex*[n]),
+                                      locked(new bool[n]),
+                                      n_locks(n) {
+        for (size_t i = 0; i < n_locks; i++) {
+            mutexes[i] = &m[i];
+        }
         std::fill_n(locked, n_locks, false);
         lock();
     }
@@ -106,6 +110,7 @@ public:
     ~MultiLockHolder() {
         unlock();
         delete[] locked;
+        delete[] mutexes;
     }
 
     /**
@@ -114,7 +119,7 @@ public:
     void lock() {
         for (size_t i = 0; i < n_locks; i++) {
             assert(!locked[i]);
-            mutexes[i].acquire();
+            mutexes[i]->acquire();
             locked[i] = true;
         }
     }
@@ -126,13 +131,13 @@ public:
         for (size_t i = 0; i < n_locks; i++) {
             if (locked[i]) {
                 locked[i] = false;
-                mutexes[i].release();
+                mutexes[i]->release();
             }
         }
     }
 
 private:
-    Mutex  *mutexes;
+    Mutex **mutexes;
     bool   *locked;
     size_t  n_locks;
 
@@ -20,9 +20,10 @@
 #include <string>
 
 #include "common.h"
+#include "lockprofile.h"
 #include "mutex.h"
 
-Mutex::Mutex() : held(false)
+Mutex::Mutex() : held(false), site(NULL), acquiredAt(0)
 {
     pthread_mutexattr_t *attr = NULL;
     int e=0;
@@ -80,7 +81,18 @@ Mutex::~Mutex() {
 
 void Mutex::acquire() {
     int e;
-    if ((e = pthread_mutex_lock(&mutex)) != 0) {
+    hrtime_t start = 0;
+    bool contended = false;
+    if (site != NULL && LockSite::isProfiling()) {
+        start = gethrtime();
+        if ((e = pthread_mutex_trylock(&mutex)) == EBUSY) {
+            contended = true;
+            e = pthread_mutex_lock(&mutex);
+        }
+    } else {
+        e = pthread_mutex_lock(&mutex);
+    }
+    if (e != 0) {
         std::cerr << "MUTEX ERROR: Failed to acquire lock: ";
         std::cerr << std::strerror(e) << std::endl;
         std::cerr.flush();
@@ -88,12 +100,23 @@ void Mutex::acquire() {
     }
     setHolder(true);
 
+    if (start != 0) {
+        acquiredAt = gethrtime();
+        site->acquired(acquiredAt - start, contended);
+    }
+
     EP_MUTEX_ACQUIRED(this);
 }
 
 void Mutex::release() {
     assert(held && pthread_equal(holder, pthread_self()));
     setHolder(false);
+    bool profiled = acquiredAt != 0;
+    hrtime_t heldFor = 0;
+    if (profiled) {
+        heldFor = gethrtime() - acquiredAt;
+        acquiredAt = 0;
+    }
     int e;
     if ((e = pthread_mutex_unlock(&mutex)) != 0) {
         std::cerr << "MUTEX ERROR: Failed to release lock: ";
@@ -101,6 +124,21 @@ void Mutex::release() {
         std::cerr.flush();
         abort();
     }
+    if (profiled) {
+        site->released(heldFor);
+    }
     EP_MUTEX_RELEASED(this);
 }
 
+void Mutex::suspendHold() {
+    if (acquiredAt != 0) {
+        site->released(gethrtime() - acquiredAt);
+        acquiredAt = 0;
+    }
+}
+
+void Mutex::resumeHold() {
+    if (site != NULL && LockSite::isProfiling()) {
+        acquiredAt = gethrtime();
+    }
+}
@@ -31,6 +31,8 @@
 
 #include "common.h"
 
+class LockSite;
+
 /**
  * Abstraction built on top of pthread mutexes
  */
@@ -49,23 +51,41 @@ public:
         return held && pthread_equal(holder, pthread_self());
     }
 
+    /**
+     * Report how contended this lock is to the given site while lock
+     * profiling is on.
+     */
+    void setLockSite(LockSite *s) {
+        site = s;
+    }
+
 protected:
 
     // The holders of locks twiddle these flags.
     friend class LockHolder;
     friend class MultiLockHolder;
 
-    void acquire();
-    void release();
+    virtual void acquire();
+    virtual void release();
 
     void setHolder(bool isHeld) {
         held = isHeld;
         holder = pthread_self();
     }
 
+    /**
+     * Stop counting the hold time while the mutex is let go of for a
+     * condition wait, and start again once it's back.
+     */
+    void suspendHold();
+    void resumeHold();
+
     pthread_mutex_t mutex;
     pthread_t holder;
     bool held;
+    LockSite *site;
+    //! When the holder got the lock if it was profiled, else 0.
+    hrtime_t acquiredAt;
 
 private:
     DISALLOW_COPY_AND_ASSIGN(Mutex);
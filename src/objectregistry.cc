@@ -55,8 +55,8 @@ void ObjectRegistry::onCreateBlob(Blob *blob)
    EventuallyPersistentEngine *engine = th->get();
    if (verifyEngine(engine)) {
        EPStats &stats = engine->getEpStats();
-       stats.currentSize.incr(blob->getSize());
-       stats.totalValueSize.incr(blob->getSize());
+       stats.currentSize.incr(blob->getAllocatedSize());
+       stats.totalValueSize.incr(blob->getAllocatedSize());
        assert(stats.currentSize.get() < GIGANTOR);
    }
 }
@@ -66,8 +66,8 @@ void ObjectRegistry::onDeleteBlob(Blob *blob)
    EventuallyPersistentEngine *engine = th->get();
    if (verifyEngine(engine)) {
        EPStats &stats = engine->getEpStats();
-       stats.currentSize.decr(blob->getSize());
-       stats.totalValueSize.decr(blob->getSize());
+       stats.currentSize.decr(blob->getAllocatedSize());
+       stats.totalValueSize.decr(blob->getAllocatedSize());
        assert(stats.currentSize.get() < GIGANTOR);
    }
 }
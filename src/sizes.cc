@@ -62,6 +62,27 @@ static void display(const char *name, const Histogram<T> &histo) {
     std::for_each(histo.begin(), histo.end(), histo_for_inner<T>());
 }
 
+/**
+ * Log-linear histograms have too many bins to list, so show where each
+ * power of two starts along with how finely it's split.
+ */
+static void display(const char *name, const LogLinearHistogram &) {
+    std::cout << name << " (" << LogLinearHistogram::SUB_BINS
+              << " bins per power of two)" << std::endl;
+    for (size_t i = 0; i < LogLinearHistogram::NUM_BINS;
+         i += LogLinearHistogram::SUB_BINS) {
+        size_t last = std::min(i + LogLinearHistogram::SUB_BINS,
+                               LogLinearHistogram::NUM_BINS) - 1;
+        std::cout << "   " << LogLinearHistogram::binStart(i) << " - ";
+        if (last == LogLinearHistogram::NUM_BINS - 1) {
+            std::cout << "inf";
+        } else {
+            std::cout << LogLinearHistogram::binEnd(last);
+        }
+        std::cout << std::endl;
+    }
+}
+
 int main(int, char **) {
     std::string s();
 
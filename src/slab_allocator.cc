@@ -0,0 +1,159 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2012 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "config.h"
+
+#include <cassert>
+#include <new>
+
+#include "lockprofile.h"
+#include "objectregistry.h"
+#include "slab_allocator.h"
+
+const size_t SlabAllocator::SLAB_SIZE = 256 * 1024;
+const size_t SlabAllocator::MAX_CHUNK_SIZE = 16 * 1024;
+Atomic<bool> SlabAllocator::enabled(false);
+Atomic<bool> SlabAllocator::configured(false);
+LockSite SlabAllocator::sizeClassSite("slab_size_class");
+
+static const size_t CHUNK_ALIGN(16);
+static const size_t SMALL_CLASS_LIMIT(256);
+
+SlabAllocator *SlabAllocator::getInstance() {
+    // Never destroyed: objects may still be freed during shutdown.
+    static SlabAllocator *instance = new SlabAllocator();
+    return instance;
+}
+
+bool SlabAllocator::configure(bool to) {
+    if (configured.cas(false, true)) {
+        setEnabled(to);
+        return true;
+    }
+    return isEnabled() == to;
+}
+
+SlabAllocator::SlabAllocator() {
+    size_t size = CHUNK_ALIGN;
+    while (size <= MAX_CHUNK_SIZE) {
+        classes.push_back(new SizeClass(size));
+        size_t step = CHUNK_ALIGN;
+        if (size >= SMALL_CLASS_LIMIT) {
+            step = (size / 8 + CHUNK_ALIGN - 1) & ~(CHUNK_ALIGN - 1);
+        }
+        size += step;
+    }
+    if (classes.back()->size != MAX_CHUNK_SIZE) {
+        classes.push_back(new SizeClass(MAX_CHUNK_SIZE));
+    }
+    for (size_t i = 0; i < classes.size(); ++i) {
+        classes[i]->lock.setLockSite(&sizeClassSite);
+    }
+}
+
+SlabAllocator::SizeClass *SlabAllocator::classFor(size_t size) const {
+    if (size > MAX_CHUNK_SIZE) {
+        return NULL;
+    }
+    if (size <= SMALL_CLASS_LIMIT) {
+        return classes[size == 0 ? 0 : (size - 1) / CHUNK_ALIGN];
+    }
+    size_t lo = SMALL_CLASS_LIMIT / CHUNK_ALIGN;
+    size_t hi = classes.size() - 1;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (classes[mid]->size < size) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return classes[lo];
+}
+
+size_t SlabAllocator::chunkSize(size_t size) const {
+    SizeClass *sc = classFor(size);
+    return sc ? sc->size : size;
+}
+
+void *SlabAllocator::allocate(size_t size) {
+    if (!isEnabled()) {
+        return NULL;
+    }
+    SizeClass *sc = classFor(size);
+    if (sc == NULL) {
+        return NULL;
+    }
+
+    SpinLockHolder lh(&sc->lock);
+    void *rv = sc->freeList;
+    if (rv != NULL) {
+        sc->freeList = *static_cast<void**>(rv);
+    } else {
+        if (sc->cursor == sc->end) {
+            // Shared by every bucket, so not charged to this one; its
+            // chunks are, as they're handed out.
+            EventuallyPersistentEngine *engine =
+                ObjectRegistry::onSwitchThread(NULL, true);
+            char *slab = static_cast<char*>(::operator new(SLAB_SIZE));
+            ObjectRegistry::onSwitchThread(engine);
+            sc->cursor = slab;
+            sc->end = slab + (SLAB_SIZE / sc->size) * sc->size;
+            ++sc->numSlabs;
+        }
+        rv = sc->cursor;
+        sc->cursor += sc->size;
+    }
+    ++sc->chunksInUse;
+    sc->bytesRequested += size;
+    lh.unlock();
+    ObjectRegistry::memoryAllocated(sc->size);
+    return rv;
+}
+
+void SlabAllocator::deallocate(void *p, size_t size) {
+    SizeClass *sc = classFor(size);
+    assert(sc != NULL);
+    SpinLockHolder lh(&sc->lock);
+    *static_cast<void**>(p) = sc->freeList;
+    sc->freeList = p;
+    assert(sc->chunksInUse > 0);
+    --sc->chunksInUse;
+    sc->bytesRequested -= size;
+    lh.unlock();
+    ObjectRegistry::memoryDeallocated(sc->size);
+}
+
+void SlabAllocator::getStats(std::map<std::string, size_t> &slab_stats) {
+    size_t reserved(0), allocated(0), requested(0), chunks(0);
+    std::vector<SizeClass*>::iterator it;
+    for (it = classes.begin(); it != classes.end(); ++it) {
+        SizeClass *sc = *it;
+        SpinLockHolder lh(&sc->lock);
+        reserved += sc->numSlabs * SLAB_SIZE;
+        allocated += sc->chunksInUse * sc->size;
+        requested += sc->bytesRequested;
+        chunks += sc->chunksInUse;
+    }
+    slab_stats["ep_slab_enabled"] = isEnabled();
+    slab_stats["ep_slab_chunks"] = chunks;
+    slab_stats["ep_slab_reserved_bytes"] = reserved;
+    slab_stats["ep_slab_allocated_bytes"] = allocated;
+    slab_stats["ep_slab_requested_bytes"] = requested;
+    slab_stats["ep_slab_internal_frag_bytes"] = allocated - requested;
+    slab_stats["ep_slab_free_bytes"] = reserved - allocated;
+}
@@ -0,0 +1,160 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2012 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#ifndef SRC_SLAB_ALLOCATOR_H_
+#define SRC_SLAB_ALLOCATOR_H_ 1
+
+#include "config.h"
+
+#include <map>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "atomic.h"
+#include "common.h"
+
+/**
+ * Size-class allocator for StoredValue and Blob instances.
+ *
+ * Requests are rounded up to one of a fixed set of chunk sizes and
+ * carved out of large slabs, so objects of similar size share slabs
+ * and freed chunks are reused by the next object of that class
+ * instead of leaving holes in the general purpose heap.  Slabs are
+ * never handed back.
+ *
+ * There is one allocator per process, shared by every bucket.  A slab
+ * isn't charged to the bucket that happened to grow it; instead each
+ * chunk is charged to the current bucket's memory use when it's handed
+ * out and credited back when it's returned.
+ *
+ * Callers must remember whether an object came from here and free it
+ * with the same size it was allocated with.
+ */
+class SlabAllocator {
+public:
+
+    //! Bytes carved from the heap at a time for one size class.
+    static const size_t SLAB_SIZE;
+    //! Largest request served from slabs; bigger ones use the heap.
+    static const size_t MAX_CHUNK_SIZE;
+
+    static SlabAllocator *getInstance();
+
+    /**
+     * Enable or disable serving new allocations from slabs.  Chunks
+     * already handed out stay valid either way.
+     */
+    static void setEnabled(bool to) {
+        enabled.set(to);
+    }
+
+    static bool isEnabled() {
+        return enabled.get();
+    }
+
+    /**
+     * Apply a bucket's setting.  It's a process wide setting, so only
+     * the first bucket to start decides it.
+     *
+     * @return false if the setting was already decided otherwise
+     */
+    static bool configure(bool to);
+
+    /**
+     * Allocate a chunk for an object of the given size.
+     *
+     * @return the chunk, or NULL if the allocator is disabled or the
+     *         size is too large, in which case the caller should use
+     *         the heap
+     */
+    void *allocate(size_t size);
+
+    /**
+     * Return a chunk obtained from allocate().
+     *
+     * @param p the chunk
+     * @param size the size passed to allocate()
+     */
+    void deallocate(void *p, size_t size);
+
+    /**
+     * Allocate memory for an object from the slabs if possible, or
+     * from the heap otherwise.
+     *
+     * @param size the size of the object
+     * @param fromSlab set to where the memory came from
+     */
+    static void *allocateObject(size_t size, bool &fromSlab) {
+        void *p = getInstance()->allocate(size);
+        fromSlab = p != NULL;
+        return fromSlab ? p : ::operator new(size);
+    }
+
+    /**
+     * Release memory obtained from allocateObject().
+     */
+    static void releaseObject(void *p, size_t size, bool fromSlab) {
+        if (fromSlab) {
+            getInstance()->deallocate(p, size);
+        } else {
+            ::operator delete(p);
+        }
+    }
+
+    /**
+     * Size of the chunk a request of the given size would be served
+     * from, or size itself if it wouldn't be served from slabs.
+     */
+    size_t chunkSize(size_t size) const;
+
+    /**
+     * Get the total and fragmentation stats of all size classes.
+     */
+    void getStats(std::map<std::string, size_t> &slab_stats);
+
+private:
+
+    SlabAllocator();
+
+    struct SizeClass {
+        SizeClass(size_t sz) : size(sz), freeList(NULL), cursor(NULL),
+                               end(NULL), numSlabs(0), chunksInUse(0),
+                               bytesRequested(0) {}
+
+        size_t   size;
+        SpinLock lock;
+        void    *freeList;
+        char    *cursor;
+        char    *end;
+        size_t   numSlabs;
+        size_t   chunksInUse;
+        size_t   bytesRequested;
+    };
+
+    SizeClass *classFor(size_t size) const;
+
+    //! 16 byte steps up to 256 bytes, then growing by an eighth.
+    std::vector<SizeClass*> classes;
+
+    static Atomic<bool> enabled;
+    static Atomic<bool> configured;
+    static LockSite sizeClassSite;
+
+    DISALLOW_COPY_AND_ASSIGN(SlabAllocator);
+};
+
+#endif  // SRC_SLAB_ALLOCATOR_H_
@@ -42,10 +42,7 @@ static const hrtime_t ONE_SECOND(1000000);
 class EPStats {
 public:
 
-    EPStats() : dirtyAgeHisto(GrowingWidthGenerator<hrtime_t>(0, ONE_SECOND, 1.4), 25),
-                diskCommitHisto(GrowingWidthGenerator<hrtime_t>(0, ONE_SECOND, 1.4), 25),
-                mlogCompactorHisto(GrowingWidthGenerator<hrtime_t>(0, ONE_SECOND, 1.4), 25),
-                timingLog(NULL), maxDataSize(DEFAULT_MAX_DATA_SIZE) {}
+    EPStats() : timingLog(NULL), maxDataSize(DEFAULT_MAX_DATA_SIZE) {}
 
     ~EPStats() {
         delete timingLog;
@@ -147,12 +144,46 @@ public:
     Atomic<size_t> pagerRuns;
     //! Number of times the expiry pager runs for purging expired items
     Atomic<size_t> expiryPagerRuns;
+    //! Items per second the expiry pager purged between its last two runs
+    Atomic<size_t> expiredPagerRate;
+    //! Number of items paged out by sampled eviction
+    Atomic<size_t> numSampledEjects;
+    //! Items per second sampled eviction paged out in its last interval
+    Atomic<size_t> sampledEjectRate;
+    //! Number of items sampled eviction looked at
+    Atomic<size_t> numEvictionSamples;
+    //! Sum of the access frequencies of the items sampled
+    Atomic<size_t> evictionSampleFreqs;
+    //! Sum of the access frequencies of the items sampled eviction picked
+    Atomic<size_t> evictionVictimFreqs;
+    //! Milliseconds memory usage was seen above the high watermark
+    Atomic<size_t> timeAboveHighWat;
     //! Number of items removed from closed unreferenced checkpoints.
     Atomic<size_t> itemsRemovedFromCheckpoints;
+    //! Number of TAP cursors dropped for falling too far behind
+    Atomic<size_t> tapCursorsDropped;
+    //! Checkpoint memory freed up by dropping slow TAP cursors
+    Atomic<size_t> tapCursorDropMemReclaimed;
+    //! Number of closed checkpoints spilled to segment files
+    Atomic<size_t> numCheckpointsSpilled;
+    //! Number of spilled checkpoints read back in for a cursor
+    Atomic<size_t> numCheckpointsLoaded;
     //! Number of times a value is ejected
     Atomic<size_t> numValueEjects;
+    //! Number of times a whole item, key and metadata included, is ejected
+    Atomic<size_t> numMetaEjects;
+    //! Number of ejected values or items read back from disk
+    Atomic<size_t> numEjectRefetches;
     //! Number of times a value could not be ejected
     Atomic<size_t> numFailedEjects;
+    //! Number of ejected values written to the value cache
+    Atomic<size_t> valueCacheWrites;
+    //! Bytes written to the value cache
+    Atomic<size_t> valueCacheBytesWritten;
+    //! Number of ejected values read back from the value cache
+    Atomic<size_t> valueCacheHits;
+    //! Number of ejected values the value cache no longer held
+    Atomic<size_t> valueCacheMisses;
     //! Number of times "Not my bucket" happened
     Atomic<size_t> numNotMyVBuckets;
     //! Total size of stored objects.
@@ -190,7 +221,7 @@ public:
     Atomic<hrtime_t> pendingOpsMaxDuration;
 
     //! Histogram of pending operation wait times.
-    Histogram<hrtime_t> pendingOpsHisto;
+    LogLinearHistogram pendingOpsHisto;
 
     //! Number of times background fetches occurred.
     Atomic<size_t> bg_fetched;
@@ -210,7 +241,7 @@ public:
     Atomic<hrtime_t> bgMaxWait;
 
     //! Histogram of background wait times.
-    Histogram<hrtime_t> bgWaitHisto;
+    LogLinearHistogram bgWaitHisto;
 
     /** The sum of the deltas (in usec) from the dispatcher started to load
      *  item until was done
@@ -222,7 +253,7 @@ public:
     Atomic<hrtime_t> bgMaxLoad;
 
     //! Histogram of background wait loads.
-    Histogram<hrtime_t> bgLoadHisto;
+    LogLinearHistogram bgLoadHisto;
 
     //! Max wall time of deleting a vbucket
     Atomic<hrtime_t> vbucketDelMaxWalltime;
@@ -257,7 +288,7 @@ public:
     Atomic<hrtime_t> tapBgMaxWait;
 
     //! Histogram of tap background wait loads.
-    Histogram<hrtime_t> tapBgWaitHisto;
+    LogLinearHistogram tapBgWaitHisto;
 
     /** The sum of the deltas (in usec) from the dispatcher started to load
      *  a tap item until was done
@@ -269,7 +300,7 @@ public:
     Atomic<hrtime_t> tapBgMaxLoad;
 
     //! Histogram of tap background wait loads.
-    Histogram<hrtime_t> tapBgLoadHisto;
+    LogLinearHistogram tapBgLoadHisto;
 
     //! The number of get with meta operations
     Atomic<size_t>  numOpsGetMeta;
@@ -290,7 +321,7 @@ public:
     Atomic<rel_time_t> alogRuntime;
 
     //! Histogram of queue processing dirty age.
-    Histogram<hrtime_t> dirtyAgeHisto;
+    LogLinearHistogram dirtyAgeHisto;
 
     //! Histogram of item allocation sizes.
     Histogram<size_t> itemAllocSizeHisto;
@@ -300,68 +331,68 @@ public:
     //
 
     //! Histogram of getvbucket timings
-    Histogram<hrtime_t> getVbucketCmdHisto;
+    LogLinearHistogram getVbucketCmdHisto;
 
     //! Histogram of setvbucket timings
-    Histogram<hrtime_t> setVbucketCmdHisto;
+    LogLinearHistogram setVbucketCmdHisto;
 
     //! Histogram of delvbucket timings
-    Histogram<hrtime_t> delVbucketCmdHisto;
+    LogLinearHistogram delVbucketCmdHisto;
 
     //! Histogram of get commands.
-    Histogram<hrtime_t> getCmdHisto;
+    LogLinearHistogram getCmdHisto;
 
     //! Histogram of store commands.
-    Histogram<hrtime_t> storeCmdHisto;
+    LogLinearHistogram storeCmdHisto;
 
     //! Histogram of arithmetic commands.
-    Histogram<hrtime_t> arithCmdHisto;
+    LogLinearHistogram arithCmdHisto;
 
     //! Histogram of tap VBucket reset timings
-    Histogram<hrtime_t> tapVbucketResetHisto;
+    LogLinearHistogram tapVbucketResetHisto;
 
     //! Histogram of tap mutation timings.
-    Histogram<hrtime_t> tapMutationHisto;
+    LogLinearHistogram tapMutationHisto;
 
     //! Histogram of tap vbucket set timings.
-    Histogram<hrtime_t> tapVbucketSetHisto;
+    LogLinearHistogram tapVbucketSetHisto;
 
     //! Time spent notifying completion of IO.
-    Histogram<hrtime_t> notifyIOHisto;
+    LogLinearHistogram notifyIOHisto;
 
     //! Histogram of get_stats commands.
-    Histogram<hrtime_t> getStatsCmdHisto;
+    LogLinearHistogram getStatsCmdHisto;
 
     //! Histogram of wait_for_checkpoint_persistence command
-    Histogram<hrtime_t> chkPersistenceHisto;
+    LogLinearHistogram chkPersistenceHisto;
 
     //
     // DB timers.
     //
 
     //! Histogram of insert disk writes
-    Histogram<hrtime_t> diskInsertHisto;
+    LogLinearHistogram diskInsertHisto;
 
     //! Histogram of update disk writes
-    Histogram<hrtime_t> diskUpdateHisto;
+    LogLinearHistogram diskUpdateHisto;
 
     //! Histogram of delete disk writes
-    Histogram<hrtime_t> diskDelHisto;
+    LogLinearHistogram diskDelHisto;
 
     //! Histogram of execution time of disk vbucket deletions
-    Histogram<hrtime_t> diskVBDelHisto;
+    LogLinearHistogram diskVBDelHisto;
 
     //! Histogram of disk commits
-    Histogram<hrtime_t> diskCommitHisto;
+    LogLinearHistogram diskCommitHisto;
 
     //! Histogram of setting vbucket state
-    Histogram<hrtime_t> snapshotVbucketHisto;
+    LogLinearHistogram snapshotVbucketHisto;
 
     //! Histogram of mutation log compactor
-    Histogram<hrtime_t> mlogCompactorHisto;
+    LogLinearHistogram mlogCompactorHisto;
 
     //! Historgram of batch reads
-    Histogram<hrtime_t> getMultiHisto;
+    LogLinearHistogram getMultiHisto;
 
     //! Reset all stats to reasonable values.
     void reset() {
@@ -371,9 +402,26 @@ public:
         dirtyAgeHighWat.set(0);
         commit_time.set(0);
         pagerRuns.set(0);
+        numSampledEjects.set(0);
+        sampledEjectRate.set(0);
+        expiredPagerRate.set(0);
+        numEvictionSamples.set(0);
+        evictionSampleFreqs.set(0);
+        evictionVictimFreqs.set(0);
+        timeAboveHighWat.set(0);
         itemsRemovedFromCheckpoints.set(0);
+        tapCursorsDropped.set(0);
+        tapCursorDropMemReclaimed.set(0);
+        numCheckpointsSpilled.set(0);
+        numCheckpointsLoaded.set(0);
         numValueEjects.set(0);
+        numMetaEjects.set(0);
+        numEjectRefetches.set(0);
         numFailedEjects.set(0);
+        valueCacheWrites.set(0);
+        valueCacheBytesWritten.set(0);
+        valueCacheHits.set(0);
+        valueCacheMisses.set(0);
         numNotMyVBuckets.set(0);
         io_num_read.set(0);
         io_num_write.set(0);
@@ -80,6 +80,40 @@ void add_casted_stat(const char *k, const Histogram<T> &v,
     std::for_each(v.begin(), v.end(), a);
 }
 
+/**
+ * Report the populated bins of a log-linear histogram in the same form
+ * as any other, followed by its percentiles as <name>_p50, _p99, _p999
+ * and _p9999.
+ */
+inline void add_casted_stat(const char *k, const LogLinearHistogram &v,
+                            ADD_STAT add_stat, const void *cookie) {
+    std::vector<size_t> counts;
+    v.getCounts(counts);
+    bool any = false;
+    for (size_t i = 0; i < counts.size(); ++i) {
+        if (counts[i] > 0) {
+            std::stringstream ss;
+            ss << k << "_" << LogLinearHistogram::binStart(i) << ","
+               << LogLinearHistogram::binEnd(i);
+            add_casted_stat(ss.str().c_str(), counts[i], add_stat, cookie);
+            any = true;
+        }
+    }
+    if (!any) {
+        return;
+    }
+
+    static const char *names[] = { "p50", "p99", "p999", "p9999" };
+    static const double fractions[] = { 0.5, 0.99, 0.999, 0.9999 };
+    for (size_t i = 0; i < sizeof(fractions) / sizeof(fractions[0]); ++i) {
+        std::stringstream ss;
+        ss << k << "_" << names[i];
+        add_casted_stat(ss.str().c_str(),
+                        LogLinearHistogram::percentile(counts, fractions[i]),
+                        add_stat, cookie);
+    }
+}
+
 template <typename P, typename T>
 void add_prefixed_stat(P prefix, const char *nm, T val,
                   ADD_STAT add_stat, const void *cookie) {
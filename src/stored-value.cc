@@ -18,9 +18,11 @@
 #include "config.h"
 
 #include <cassert>
+#include <cstdlib>
 #include <limits>
 #include <string>
 
+#include "lockprofile.h"
 #include "stored-value.h"
 
 #ifndef DEFAULT_HT_SIZE
@@ -29,12 +31,21 @@
 
 size_t HashTable::defaultNumBuckets = DEFAULT_HT_SIZE;
 size_t HashTable::defaultNumLocks = 193;
+bool HashTable::incrementalResize = true;
+bool HashTable::defaultGrouped = false;
+bool HashTable::defaultExpiryIndex = false;
+LockSite HashTable::stripeSite("hash_table_stripe");
 double StoredValue::mutation_mem_threshold = 0.9;
+size_t StoredValue::inline_value_threshold = 0;
+bool StoredValue::compress_on_store = false;
+bool StoredValue::compress_in_pager = false;
+size_t StoredValue::compression_threshold = 512;
 const int64_t StoredValue::state_id_cleared = -1;
 const int64_t StoredValue::state_id_pending = -2;
 const int64_t StoredValue::state_deleted_key = -3;
 const int64_t StoredValue::state_non_existent_key = -4;
 const int64_t StoredValue::state_temp_init = -5;
+const uint8_t StoredValue::MAX_FREQUENCY;
 
 static ssize_t prime_size_table[] = {
     3, 7, 13, 23, 47, 97, 193, 383, 769, 1531, 3067, 6143, 12289, 24571, 49157,
@@ -43,15 +54,18 @@ static ssize_t prime_size_table[] = {
     1610612741, -1
 };
 
-bool StoredValue::ejectValue(EPStats &stats, HashTable &ht) {
+bool StoredValue::ejectValue(EPStats &stats, HashTable &ht, value_t *ejectedValue) {
     if (eligibleForEviction()) {
         size_t oldsize = size();
         size_t old_valsize = value->length();
         blobval uval;
         uval.len = valLength();
+        if (ejectedValue) {
+            *ejectedValue = value;
+        }
         value_t sp(Blob::New(uval.chlen, sizeof(uval)));
         resident = false;
-        value = sp;
+        assignValue(sp, ht);
         size_t newsize = size();
         size_t new_valsize = value->length();
 
@@ -69,6 +83,7 @@ bool StoredValue::ejectValue(EPStats &stats, HashTable &ht) {
         } else if (new_keymeta_overhead < old_keymeta_overhead) {
             reduceCurrentSize(stats, old_keymeta_overhead - new_keymeta_overhead);
         }
+        ejected = true;
         ++stats.numValueEjects;
         ++ht.numNonResidentItems;
         ++ht.numEjects;
@@ -81,11 +96,88 @@ bool StoredValue::ejectValue(EPStats &stats, HashTable &ht) {
     return false;
 }
 
-void StoredValue::referenced(HashTable &ht) {
+bool StoredValue::compressValue(EPStats &stats, HashTable &ht) {
+    if (!compress_in_pager || isDeleted() || !isResident() ||
+        value->isCompressed() || value->isEmbedded()) {
+        return false;
+    }
+    value_t compressed(compressBlob(value, ht));
+    if (compressed.get() == NULL) {
+        return false;
+    }
+    replaceValue(compressed, stats, ht);
+    return true;
+}
+
+bool StoredValue::decompressValue(EPStats &stats, HashTable &ht) {
+    if (compress_on_store || isDeleted() || !isResident() ||
+        !value->isCompressed()) {
+        return false;
+    }
+    hrtime_t start = gethrtime();
+    value_t decompressed(value->decompress());
+    ++ht.numDecompressions;
+    ht.decompressTime.incr(gethrtime() - start);
+    replaceValue(decompressed, stats, ht);
+    return true;
+}
+
+void StoredValue::replaceValue(const value_t &v, EPStats &stats,
+                               HashTable &ht) {
+    size_t oldsize = size();
+    size_t old_valsize = value->length();
+    value = v;
+    size_t newsize = size();
+    size_t new_valsize = value->length();
+
+    if (oldsize < newsize) {
+        increaseCacheSize(ht, newsize - oldsize);
+    } else if (newsize < oldsize) {
+        reduceCacheSize(ht, oldsize - newsize);
+    }
+    // Add or substract the key/meta data overhead differenece.
+    size_t old_keymeta_overhead = (oldsize - old_valsize);
+    size_t new_keymeta_overhead = (newsize - new_valsize);
+    if (old_keymeta_overhead < new_keymeta_overhead) {
+        increaseCurrentSize(stats, new_keymeta_overhead - old_keymeta_overhead);
+    } else if (new_keymeta_overhead < old_keymeta_overhead) {
+        reduceCurrentSize(stats, old_keymeta_overhead - new_keymeta_overhead);
+    }
+}
+
+value_t StoredValue::compressBlob(const value_t &v, HashTable &ht) {
+    if (v.get() == NULL || v->isCompressed() || v->isEmbedded() ||
+        v->length() < compression_threshold) {
+        return value_t();
+    }
+    hrtime_t start = gethrtime();
+    Blob *compressed = v->compress();
+    ht.compressTime.incr(gethrtime() - start);
+    if (compressed == NULL) {
+        ++ht.numCompressFailures;
+        return value_t();
+    }
+    ++ht.numCompressions;
+    ht.compressInBytes.incr(v->length());
+    ht.compressOutBytes.incr(compressed->length());
+    return value_t(compressed);
+}
+
+void StoredValue::referenced(HashTable &ht, bool bumpFrequency) {
     if (nru == false) {
         nru = true;
         ++ht.numReferenced;
     }
+    if ((bumpFrequency || frequencyBumpDue()) && freq < MAX_FREQUENCY) {
+        ++freq;
+    }
+}
+
+bool StoredValue::frequencyBumpDue() const {
+    if (freq >= MAX_FREQUENCY) {
+        return false;
+    }
+    return (hrtimeRandom(this) & ((1ULL << freq) - 1)) == 0;
 }
 
 bool StoredValue::isReferenced(bool reset, HashTable *ht) {
@@ -98,17 +190,23 @@ bool StoredValue::isReferenced(bool reset, HashTable *ht) {
     return ret;
 }
 
+void StoredValue::updateExpiryIndex(HashTable &ht, time_t oldExptime) {
+    ht.indexExpiry(this, oldExptime);
+}
+
 bool StoredValue::unlocked_restoreValue(Item *itm, EPStats &stats,
                                         HashTable &ht) {
     // If cas == we loaded the object from our meta file, but
     // we didn't know the size of the object.. Don't report
     // this as an unexpected size change.
     if (getCas() == 0) {
+        time_t indexed = getIndexedExptime();
         cas = itm->getCas();
         flags = itm->getFlags();
         exptime = itm->getExptime();
         seqno = itm->getSeqno();
         setValue(*itm, stats, ht, true);
+        updateExpiryIndex(ht, indexed);
         if (!isResident()) {
             --ht.numNonResidentItems;
         }
@@ -131,8 +229,12 @@ bool StoredValue::unlocked_restoreValue(Item *itm, EPStats &stats,
             }
         }
 
+        if (ejected) {
+            ejected = false;
+            ++stats.numEjectRefetches;
+        }
         resident = true;
-        value = itm->getValue();
+        assignValue(itm->getValue(), ht);
 
         size_t newsize = size();
         size_t new_valsize = value->length();
@@ -155,6 +257,37 @@ bool StoredValue::unlocked_restoreValue(Item *itm, EPStats &stats,
     return false;
 }
 
+bool StoredValue::getValueCacheOffset(uint64_t &offset) {
+    if (isResident() || isDeleted() || isTempItem() ||
+        value->length() != sizeof(blobval) + sizeof(uint64_t)) {
+        return false;
+    }
+    std::memcpy(&offset, value->getData() + sizeof(blobval), sizeof(offset));
+    return true;
+}
+
+bool StoredValue::unlocked_setValueCacheOffset(uint64_t offset,
+                                               uint64_t valueCas,
+                                               HashTable &ht) {
+    if (isResident() || isDeleted() || isTempItem() || cas != valueCas ||
+        value->length() != sizeof(blobval)) {
+        return false;
+    }
+    char stub[sizeof(blobval) + sizeof(uint64_t)];
+    std::memcpy(stub, value->getData(), sizeof(blobval));
+    std::memcpy(stub + sizeof(blobval), &offset, sizeof(offset));
+    size_t oldsize = size();
+    value_t sp(Blob::New(stub, sizeof(stub)));
+    assignValue(sp, ht);
+    size_t newsize = size();
+    if (oldsize < newsize) {
+        increaseCacheSize(ht, newsize - oldsize);
+    } else if (newsize < oldsize) {
+        reduceCacheSize(ht, oldsize - newsize);
+    }
+    return true;
+}
+
 mutation_type_t HashTable::insert(const Item &itm, bool eject, bool partial) {
     assert(isActive());
     if (!StoredValue::hasAvailableSpace(stats, itm)) {
@@ -164,17 +297,18 @@ mutation_type_t HashTable::insert(const Item &itm, bool eject, bool partial) {
     assert(itm.getCas() != static_cast<uint64_t>(-1));
 
     int bucket_num(0);
-    LockHolder lh = getLockedBucket(itm.getKey(), &bucket_num);
-    StoredValue *v = unlocked_find(itm.getKey(), bucket_num, true, false);
+    int h = hash(itm.getKey());
+    LockHolder lh = getLockedBucket(h, &bucket_num);
+    StoredValue *v = unlocked_find(itm.getKey(), bucket_num, h, true, false);
 
     if (v == NULL) {
-        v = valFact(itm, values[bucket_num], *this);
+        v = valFact(itm, NULL, *this);
         v->markClean();
         if (partial) {
             v->resident = false;
             ++numNonResidentItems;
         }
-        values[bucket_num] = v;
+        linkValue(bucket_num, v, h);
         ++numItems;
     } else {
         if (partial) {
@@ -182,12 +316,12 @@ mutation_type_t HashTable::insert(const Item &itm, bool eject, bool partial) {
             return INVALID_CAS;
         }
 
-        // Verify that the CAS isn't changed
+        // Verify that the CAS isn't changed.  setValue takes the
+        // metadata, expiry time included, and indexes it.
         if (v->getCas() != itm.getCas()) {
             if (v->getCas() == 0) {
                 v->cas = itm.getCas();
                 v->flags = itm.getFlags();
-                v->exptime = itm.getExptime();
                 v->seqno = itm.getSeqno();
             } else {
                 return INVALID_CAS;
@@ -260,6 +394,38 @@ void HashTable::setDefaultNumLocks(size_t to) {
     }
 }
 
+void HashTable::setIncrementalResize(bool to) {
+    incrementalResize = to;
+}
+
+void HashTable::setDefaultGrouped(bool to) {
+    defaultGrouped = to;
+}
+
+void HashTable::setDefaultExpiryIndex(bool to) {
+    defaultExpiryIndex = to;
+}
+
+BucketGroup *HashTable::allocGroups(size_t n) {
+    // Over-allocate by one group so the array can start on a cache
+    // line; the original pointer is kept just in front of it.
+    char *raw = static_cast<char*>(calloc(n + 1, sizeof(BucketGroup)));
+    if (raw == NULL) {
+        return NULL;
+    }
+    uintptr_t start = (reinterpret_cast<uintptr_t>(raw) + sizeof(BucketGroup))
+        & ~static_cast<uintptr_t>(sizeof(BucketGroup) - 1);
+    char *aligned = reinterpret_cast<char*>(start);
+    reinterpret_cast<char**>(aligned)[-1] = raw;
+    return reinterpret_cast<BucketGroup*>(aligned);
+}
+
+void HashTable::freeGroups(BucketGroup *g) {
+    if (g != NULL) {
+        free(reinterpret_cast<char**>(g)[-1]);
+    }
+}
+
 HashTableStatVisitor HashTable::clear(bool deactivate) {
     HashTableStatVisitor rv;
 
@@ -267,23 +433,37 @@ HashTableStatVisitor HashTable::clear(bool deactivate) {
         // If not deactivating, assert we're already active.
         assert(isActive());
     }
+    LockHolder rlh(resizeLock);
     MultiLockHolder mlh(mutexes, n_locks);
     if (deactivate) {
         setActiveState(false);
     }
+    StoredValue *v;
     for (int i = 0; i < (int)size; i++) {
-        while (values[i]) {
-            StoredValue *v = values[i];
+        while ((v = bucketPop(values, groups, i)) != NULL) {
+            rv.visit(v);
+            StoredValue::destroy(v);
+        }
+    }
+    for (int i = 0; i < (int)oldSize; i++) {
+        while ((v = bucketPop(oldValues, oldGroups, i)) != NULL) {
             rv.visit(v);
-            values[i] = v->next;
-            delete v;
+            StoredValue::destroy(v);
         }
     }
+    if (oldValues) {
+        // Nothing left to migrate.
+        completeResize();
+    }
+    if (expiryIndex) {
+        expiryIndex->clear();
+    }
 
     stats.currentSize.decr(rv.memSize - rv.valSize);
     assert(stats.currentSize.get() < GIGANTOR);
 
     numItems.set(0);
+    numEjectedItems.set(0);
     numTempItems.set(0);
     numNonResidentItems.set(0);
     memSize.set(0);
@@ -303,6 +483,13 @@ void HashTable::resize(size_t newSize) {
         return;
     }
 
+    LockHolder rlh(resizeLock);
+
+    // Finish moving the previous generation before starting another one.
+    while (doResizeStep(std::numeric_limits<size_t>::max())) {
+        // Draining...
+    }
+
     // Don't resize to the same size, either.
     if (newSize == size) {
         return;
@@ -320,8 +507,13 @@ void HashTable::resize(size_t newSize) {
     // Get a place for the new items.
     StoredValue **newValues = static_cast<StoredValue**>(calloc(newSize,
                                                                 sizeof(StoredValue*)));
+    BucketGroup *newGroups = NULL;
+    if (grouped) {
+        newGroups = allocGroups(newSize);
+    }
     // If we can't allocate memory, don't move stuff around.
-    if (!newValues) {
+    if (!newValues || (grouped && !newGroups)) {
+        free(newValues);
         return;
     }
 
@@ -329,26 +521,95 @@ void HashTable::resize(size_t newSize) {
     ++numResizes;
 
     // Set the new size so all the hashy stuff works.
-    size_t oldSize = size;
+    oldValues = values;
+    oldGroups = groups;
+    oldSize = size;
+    values = newValues;
+    groups = newGroups;
     size = newSize;
     ep_sync_synchronize();
 
+    if (incrementalResize && oldSize >= n_locks && newSize >= n_locks) {
+        // Both tables keep every hash on the same lock stripe, so the
+        // old buckets can be drained one stripe at a time.
+        resizeStripe = 0;
+        resizeBucket = 0;
+        resizeBucketsDone.set(0);
+        resizeBucketsTotal.set(oldSize);
+
+        stats.memOverhead.incr(memorySize());
+        assert(stats.memOverhead.get() < GIGANTOR);
+        return;
+    }
+
     // Move existing records into the new space.
     for (size_t i = 0; i < oldSize; i++) {
-        while (values[i]) {
-            StoredValue *v = values[i];
-            values[i] = v->next;
+        migrateBucket(static_cast<int>(i));
+    }
 
-            int newBucket = getBucketForHash(hash(v->getKeyBytes(), v->getKeyLen()));
-            v->next = newValues[newBucket];
-            newValues[newBucket] = v;
+    free(oldValues);
+    freeGroups(oldGroups);
+    oldValues = NULL;
+    oldGroups = NULL;
+    oldSize = 0;
+
+    stats.memOverhead.incr(memorySize());
+    assert(stats.memOverhead.get() < GIGANTOR);
+}
+
+bool HashTable::resizeStep(size_t maxBuckets) {
+    LockHolder rlh(resizeLock);
+    return doResizeStep(maxBuckets);
+}
+
+bool HashTable::doResizeStep(size_t maxBuckets) {
+    if (oldValues == NULL) {
+        return false;
+    }
+
+    if (resizeStripe < n_locks) {
+        hrtime_t start = gethrtime();
+        LockHolder lh(mutexes[resizeStripe]);
+        size_t migrated = 0;
+        while (resizeBucket < oldSize && migrated < maxBuckets) {
+            migrateBucket(static_cast<int>(resizeBucket));
+            resizeBucket += n_locks;
+            ++migrated;
+        }
+        lh.unlock();
+        hrtime_t spent = (gethrtime() - start) / 1000;
+
+        ++resizeSteps;
+        resizeStepTime.incr(spent);
+        resizeStepMaxTime.setIfBigger(spent);
+        resizeBucketsDone.incr(migrated);
+
+        if (resizeBucket >= oldSize) {
+            ++resizeStripe;
+            resizeBucket = resizeStripe;
         }
     }
 
-    // values still points to the old (now empty) table.
-    free(values);
-    values = newValues;
+    if (resizeStripe >= n_locks) {
+        // Every old bucket is empty now, but a foreground operation
+        // may still be looking at the old array under its stripe.
+        MultiLockHolder mlh(mutexes, n_locks);
+        completeResize();
+        return false;
+    }
+    return true;
+}
 
+void HashTable::completeResize() {
+    stats.memOverhead.decr(memorySize());
+    free(oldValues);
+    freeGroups(oldGroups);
+    oldValues = NULL;
+    oldGroups = NULL;
+    oldSize = 0;
+    resizeStripe = 0;
+    resizeBucket = 0;
+    resizeBucketsTotal.set(0);
     stats.memOverhead.incr(memorySize());
     assert(stats.memOverhead.get() < GIGANTOR);
 }
@@ -371,7 +632,11 @@ void HashTable::resize() {
     int i(0);
     size_t new_size(0);
 
-    // Figure out where in the prime table we are.
+    // Figure out where in the prime table we are.  Grouped buckets
+    // each hold several items before spilling onto their chain.
+    if (grouped) {
+        ni /= BucketGroup::TARGET_LOAD;
+    }
     ssize_t target(static_cast<ssize_t>(ni));
     for (i = 0; prime_size_table[i] > 0 && prime_size_table[i] < target; ++i) {
         // Just looking...
@@ -396,29 +661,85 @@ void HashTable::resize() {
 }
 
 void HashTable::visit(HashTableVisitor &visitor) {
-    if ((numItems.get() + numTempItems.get()) == 0 || !isActive()) {
-        return;
+    visit(visitor, Position(), 0, 0);
+}
+
+HashTable::Position HashTable::visit(HashTableVisitor &visitor,
+                                     const Position &start,
+                                     size_t maxItems, hrtime_t maxTime) {
+    Position end(-1, 0, 0);
+    if (start.isEnd() || (numItems.get() + numTempItems.get()) == 0 ||
+        !isActive()) {
+        return end;
     }
     VisitorTracker vt(&visitors);
-    bool aborted = !visitor.shouldContinue();
+    hrtime_t deadline = maxTime > 0 ? gethrtime() + maxTime * 1000 : 0;
     size_t visited = 0;
-    for (int l = 0; isActive() && !aborted && l < static_cast<int>(n_locks); l++) {
+    size_t buckets = 0;
+    int row = start.row;
+    size_t rowSize = start.tableSize;
+    for (int l = start.lock; isActive() && l < static_cast<int>(n_locks);
+         ++l, row = 0) {
+        if (!visitor.shouldContinue()) {
+            return Position(l, row, rowSize);
+        }
         LockHolder lh(mutexes[l]);
-        for (int i = l; i < static_cast<int>(size); i+= n_locks) {
+        if (oldValues) {
+            migrateStripe(l);
+        }
+        if (rowSize != size) {
+            // Resized since; the stripe's items have all moved.
+            row = 0;
+            rowSize = size;
+        }
+        for (int i = l + row * static_cast<int>(n_locks);
+             i < static_cast<int>(size); i += n_locks) {
             assert(l == mutexForBucket(i));
-            StoredValue *v = values[i];
+            BucketWalker walker(values, groups, i);
+            StoredValue *v = walker.next();
             assert(v == NULL || i == getBucketForHash(hash(v->getKeyBytes(),
                                                            v->getKeyLen())));
             while (v) {
                 visitor.visit(v);
-                v = v->next;
+                ++visited;
+                v = walker.next();
+            }
+            ++row;
+            // The clock is only read every few buckets.
+            if ((maxItems > 0 && visited >= maxItems) ||
+                (deadline > 0 && (++buckets & 0x1f) == 0 &&
+                 gethrtime() >= deadline)) {
+                return Position(l, row, rowSize);
             }
-            ++visited;
         }
-        lh.unlock();
-        aborted = !visitor.shouldContinue();
     }
-    assert(aborted || visited == size);
+    return end;
+}
+
+void HashTable::sample(HashTableVisitor &visitor, size_t buckets,
+                       unsigned int &seed) {
+    if ((numItems.get() + numTempItems.get()) == 0 || !isActive()) {
+        return;
+    }
+    VisitorTracker vt(&visitors);
+    for (size_t n = 0; isActive() && n < buckets; ++n) {
+        int l = rand_r(&seed) % static_cast<int>(n_locks);
+        LockHolder lh(mutexes[l]);
+        if (oldValues) {
+            migrateStripe(l);
+        }
+        // The buckets of stripe l are l, l + n_locks, ...; the table
+        // can't be resized while we hold one of its stripes.
+        if (static_cast<size_t>(l) >= size) {
+            continue;
+        }
+        int rows = static_cast<int>((size - l + n_locks - 1) / n_locks);
+        int i = l + static_cast<int>(n_locks) * (rand_r(&seed) % rows);
+        BucketWalker walker(values, groups, i);
+        for (StoredValue *v = walker.next(); v; v = walker.next()) {
+            visitor.visit(v);
+        }
+    }
 }
 
 void HashTable::visitDepth(HashTableDepthVisitor &visitor) {
@@ -430,16 +751,20 @@ void HashTable::visitDepth(HashTableDepthVisitor &visitor) {
 
     for (int l = 0; l < static_cast<int>(n_locks); l++) {
         LockHolder lh(mutexes[l]);
+        if (oldValues) {
+            migrateStripe(l);
+        }
         for (int i = l; i < static_cast<int>(size); i+= n_locks) {
             size_t depth = 0;
-            StoredValue *p = values[i];
+            BucketWalker walker(values, groups, i);
+            StoredValue *p = walker.next();
             assert(p == NULL || i == getBucketForHash(hash(p->getKeyBytes(),
                                                            p->getKeyLen())));
             size_t mem(0);
             while (p) {
                 depth++;
                 mem += p->size();
-                p = p->next;
+                p = walker.next();
             }
             visitor.visit(i, depth, mem);
             ++visited;
@@ -449,12 +774,12 @@ void HashTable::visitDepth(HashTableDepthVisitor &visitor) {
     assert(visited == size);
 }
 
-add_type_t HashTable::unlocked_add(int &bucket_num,
+add_type_t HashTable::unlocked_add(int &bucket_num, int h,
                                    const Item &val,
                                    bool isDirty,
                                    bool storeVal,
                                    bool trackReference) {
-    StoredValue *v = unlocked_find(val.getKey(), bucket_num,
+    StoredValue *v = unlocked_find(val.getKey(), bucket_num, h,
                                    true, trackReference);
     add_type_t rv = ADD_SUCCESS;
     if (v && !v->isDeleted() && !v->isExpired(ep_real_time())) {
@@ -467,6 +792,13 @@ add_type_t HashTable::unlocked_add(int &bucket_num,
         }
         if (v) {
             rv = (v->isDeleted() || v->isExpired(ep_real_time())) ? ADD_UNDEL : ADD_SUCCESS;
+            if (v->isTempItem() &&
+                val.getId() != StoredValue::state_temp_init) {
+                // Only a placeholder from a disk lookup was here.
+                v->clearId();
+                --numTempItems;
+                ++numItems;
+            }
             v->setValue(itm, stats, *this, false);
             if (isDirty) {
                 v->markDirty();
@@ -474,8 +806,8 @@ add_type_t HashTable::unlocked_add(int &bucket_num,
                 v->markClean();
             }
         } else {
-            v = valFact(itm, values[bucket_num], *this, isDirty);
-            values[bucket_num] = v;
+            v = valFact(itm, NULL, *this, isDirty);
+            linkValue(bucket_num, v, h);
 
             if (v->isTempItem()) {
                 ++numTempItems;
@@ -505,6 +837,53 @@ add_type_t HashTable::unlocked_add(int &bucket_num,
     return rv;
 }
 
+bool HashTable::unlocked_ejectItem(StoredValue *&v, int bucket_num) {
+    assert(v);
+    if (v->isDeleted() || v->isDirty() || !v->hasId() ||
+        v->isLocked(ep_current_time())) {
+        return false;
+    }
+    if (!v->isResident()) {
+        --numNonResidentItems;
+    }
+    // The key may be set again before it's read back; its new seqno has
+    // to be larger than the one on disk.
+    updateMaxDeletedSeqno(v->getSeqno());
+
+    // Still an item, only no longer in memory.
+    --numItems;
+    ++numEjectedItems;
+    unlinkValue(bucket_num, v);
+    v = NULL;
+    ++stats.numMetaEjects;
+    return true;
+}
+
+void HashTable::forgetEjectedItem() {
+    size_t n;
+    do {
+        n = numEjectedItems.get();
+        if (n == 0) {
+            // Not one this table ejected, e.g. from before a clear().
+            return;
+        }
+    } while (!numEjectedItems.cas(n, n - 1));
+}
+
+StoredValue *HashTable::unlocked_restoreEjected(const Item &itm,
+                                                int bucket_num) {
+    int h = lookupHash(itm.getKey());
+    bool removed = unlocked_del(itm.getKey(), bucket_num, h);
+    assert(removed);
+    (void)removed;
+    StoredValue *v = valFact(itm, NULL, *this, false);
+    linkValue(bucket_num, v, h);
+    ++numItems;
+    forgetEjectedItem();
+    ++stats.numEjectRefetches;
+    return v;
+}
+
 add_type_t HashTable::unlocked_addTempDeletedItem(int &bucket_num,
                                                   const std::string &key) {
 
@@ -528,6 +907,36 @@ void StoredValue::setMutationMemoryThreshold(double memThreshold) {
     }
 }
 
+void StoredValue::setInlineValueThreshold(size_t threshold) {
+    inline_value_threshold = std::min(threshold, static_cast<size_t>(255));
+}
+
+void StoredValue::setCompressionMode(const std::string &mode) {
+    compress_on_store = mode == "store";
+    compress_in_pager = mode == "store" || mode == "pager";
+}
+
+void StoredValue::setCompressionThreshold(size_t threshold) {
+    // Never let the four byte length of an ejected value be compressed.
+    compression_threshold = std::max(threshold, static_cast<size_t>(64));
+}
+
+void StoredValue::destroy(StoredValue *v) {
+    if (v->inlineCapacity == 0) {
+        size_t len = v->blockSize();
+        bool slab = v->fromSlab;
+        v->~StoredValue();
+        SlabAllocator::releaseObject(v, len, slab);
+        return;
+    }
+    // Items handed out earlier may still reference the inline value,
+    // in which case the allocation outlives the StoredValue and is
+    // freed by whoever drops the last reference.
+    Blob *b = v->inlineBlob();
+    v->~StoredValue();
+    b->releaseEmbedded();
+}
+
 void StoredValue::increaseCacheSize(HashTable &ht, size_t by) {
     ht.cacheSize.incr(by);
     assert(ht.cacheSize.get() < GIGANTOR);
@@ -575,9 +984,22 @@ bool StoredValue::hasAvailableSpace(EPStats &st, const Item &itm) {
     return newSize <= maxSize;
 }
 
-Item* StoredValue::toItem(bool lck, uint16_t vbucket) const {
-    return new Item(getKey(), getFlags(), getExptime(),
-                    value,
-                    lck ? static_cast<uint64_t>(-1) : getCas(),
-                    id, vbucket, getSeqno());
+Item* StoredValue::toItem(bool lck, uint16_t vbucket, HashTable *ht) const {
+    ItemSnapshot snapshot;
+    snapshot.take(*this, lck);
+    return snapshot.toItem(getKey(), vbucket, ht);
+}
+
+Item *ItemSnapshot::toItem(const std::string &key, uint16_t vbucket,
+                           HashTable *ht) const {
+    value_t v(value);
+    if (v.get() != NULL && v->isCompressed()) {
+        hrtime_t start = gethrtime();
+        v.reset(value->decompress());
+        if (ht) {
+            ++ht->numDecompressions;
+            ht->decompressTime.incr(gethrtime() - start);
+        }
+    }
+    return new Item(key, flags, exptime, v, cas, id, vbucket, seqno);
 }
@@ -24,9 +24,11 @@
 #include <climits>
 #include <cstring>
 #include <string>
+#include <vector>
 
 #include "common.h"
 #include "ep_time.h"
+#include "expiry_index.h"
 #include "histo.h"
 #include "item.h"
 #include "locks.h"
@@ -55,9 +57,44 @@ public:
         ::operator delete(p);
      }
 
+    //! Largest value of the access frequency counter.
+    static const uint8_t MAX_FREQUENCY = 7;
+
     bool isReferenced(bool reset=false, HashTable *ht=NULL);
 
-    void referenced(HashTable &ht);
+    /**
+     * Record an access: set the nru bit and maybe bump the frequency.
+     *
+     * @param ht the hashtable that contains this StoredValue instance
+     * @param bumpFrequency bump the frequency counter without rolling
+     *        for it, as the caller already has (see frequencyBumpDue())
+     */
+    void referenced(HashTable &ht, bool bumpFrequency=false);
+
+    /**
+     * Roll for a frequency bump.
+     *
+     * The counter is logarithmic: at value f it only moves up with
+     * probability 1/2^f, so it takes about 2^MAX_FREQUENCY - 1 (127)
+     * hits on average to saturate.
+     */
+    bool frequencyBumpDue() const;
+
+    /**
+     * Get the approximate, logarithmic access frequency of this item.
+     */
+    uint8_t getFrequency() const {
+        return freq;
+    }
+
+    /**
+     * Age the access frequency, halving the hit count it stands for.
+     */
+    void decayFrequency() {
+        if (freq > 0) {
+            --freq;
+        }
+    }
 
     /**
      * Mark this item as needing to be persisted.
@@ -121,6 +158,14 @@ public:
         return false;
     }
 
+    /**
+     * The expiry time the expiry index holds this item under, 0 if the
+     * index has no business with it.
+     */
+    time_t getIndexedExptime() {
+        return isDeleted() || isTempItem() ? 0 : getExptime();
+    }
+
     /**
      * Get the pointer to the beginning of the key.
      */
@@ -154,12 +199,24 @@ public:
     }
 
     /**
-     * Get this item's value.
+     * Get this item's value, decompressed if it's held compressed.
+     * That's done again on every call, so a caller that needs the value
+     * more than once should keep the result.
      */
-    const value_t &getValue() const {
+    value_t getValue() const {
+        if (value.get() != NULL && value->isCompressed()) {
+            return value_t(value->decompress());
+        }
         return value;
     }
 
+    /**
+     * True if this item's value is resident in compressed form.
+     */
+    bool isCompressed() const {
+        return !isDeleted() && isResident() && value->isCompressed();
+    }
+
     /**
      * Get the expiration time of this item.
      *
@@ -199,11 +256,13 @@ public:
      * @param preserveSeqno Preserve the sequence number from the item.
      */
     void setValue(Item &itm, EPStats &stats, HashTable &ht, bool preserveSeqno) {
+        time_t indexed = getIndexedExptime();
         size_t currSize = size();
         reduceCacheSize(ht, currSize);
         reduceCurrentSize(stats, isDeleted() ? currSize : currSize - value->length());
-        value = itm.getValue();
+        assignValue(itm.getValue(), ht);
         setResident();
+        ejected = false;
         flags = itm.getFlags();
 
         cas = itm.getCas();
@@ -219,6 +278,7 @@ public:
         size_t newSize = size();
         increaseCacheSize(ht, newSize);
         increaseCurrentSize(stats, newSize - value->length());
+        updateExpiryIndex(ht, indexed);
     }
 
     /**
@@ -235,7 +295,7 @@ public:
         if (isDeleted()) {
             return 0;
         } else if (isResident()) {
-            return value->length();
+            return value->valueLength();
         } else {
             // This is a special case for two phase warmup as an item's value size
             // is not known during the first phase warmup.
@@ -243,7 +303,9 @@ public:
                 return 0;
             }
             blobval uval;
-            assert(value->length() == sizeof(uval));
+            // Followed by an offset if the value went to a value cache.
+            assert(value->length() == sizeof(uval) ||
+                   value->length() == sizeof(uval) + sizeof(uint64_t));
             std::memcpy(uval.chlen, value->getData(), sizeof(uval));
             return static_cast<size_t>(uval.len);
         }
@@ -253,8 +315,34 @@ public:
      * Eject an item value from memory.
      * @param stats the global stat instance
      * @param ht the hashtable that contains this StoredValue instance
+     * @param ejectedValue if not NULL, set to the value ejected, so it
+     *        can be put in a value cache once the bucket is unlocked
      */
-    bool ejectValue(EPStats &stats, HashTable &ht);
+    bool ejectValue(EPStats &stats, HashTable &ht,
+                    value_t *ejectedValue = NULL);
+
+    /**
+     * Compress a resident item value in place, as a cheaper alternative
+     * to ejecting it.
+     *
+     * @param stats the global stat instance
+     * @param ht the hashtable that contains this StoredValue instance
+     *
+     * @return true if the value is now held compressed
+     */
+    bool compressValue(EPStats &stats, HashTable &ht);
+
+    /**
+     * Hold a value the item pager compressed uncompressed again, as it
+     * has been read since.  Values compressed on store stay compressed;
+     * that mode trades the decompression on every read for the memory.
+     *
+     * @param stats the global stat instance
+     * @param ht the hashtable that contains this StoredValue instance
+     *
+     * @return true if the value is now held uncompressed
+     */
+    bool decompressValue(EPStats &stats, HashTable &ht);
 
     /**
      * Restore the value for this item.
@@ -264,6 +352,23 @@ public:
      */
     bool unlocked_restoreValue(Item *itm, EPStats &stats, HashTable &ht);
 
+    /**
+     * Get where in the value cache the ejected value was put.
+     * @param offset set to the value's offset in the value cache
+     * @return false if the value isn't in a value cache
+     */
+    bool getValueCacheOffset(uint64_t &offset);
+
+    /**
+     * Remember where in the value cache the ejected value was put.
+     * @param offset the value's offset in the value cache
+     * @param valueCas the CAS of the item the value was ejected from
+     * @param ht the hashtable that contains this StoredValue instance
+     * @return false if the item changed since the value was ejected
+     */
+    bool unlocked_setValueCacheOffset(uint64_t offset, uint64_t valueCas,
+                                      HashTable &ht);
+
     /**
      * Restore the metadata of of a temporary item upon completion of a
      * background fetch assuming the hashtable bucket is locked.
@@ -436,11 +541,12 @@ public:
         if (getKeyLen() % sizeof(void*) != 0) {
             kalign = sizeof(void*) - getKeyLen() % sizeof(void*);
         }
-        return sizeof(StoredValue) + getKeyLen() + vallen + valign + kalign;
+        return sizeof(StoredValue) + getKeyLen() + vallen + valign + kalign +
+            slabSlack();
     }
 
     size_t metaDataSize() {
-        return sizeof(StoredValue) + getKeyLen();
+        return sizeof(StoredValue) + getKeyLen() + slabSlack();
     }
 
     /**
@@ -457,6 +563,14 @@ public:
         return true;
     }
 
+    /**
+     * Same as isLocked(), but leaves an expired lock in place so it
+     * may be used without holding the bucket lock.
+     */
+    bool isLockedReadOnly(rel_time_t curtime) const {
+        return lock_expiry != 0 && curtime <= lock_expiry;
+    }
+
     /**
      * True if this value is resident in memory currently.
      */
@@ -483,6 +597,7 @@ public:
         size_t old_valsize = value->length();
 
         resetValue();
+        ejected = false;
         markDirty();
         if (!isMetaDelete) {
             setCas(getCas() + 1);
@@ -524,14 +639,61 @@ public:
      *
      * @param lck if true, the new item will return a locked CAS ID.
      * @param vbucket the vbucket containing this item.
+     * @param ht if given, the hashtable to charge decompression to
      */
-    Item *toItem(bool lck, uint16_t vbucket) const;
+    Item *toItem(bool lck, uint16_t vbucket, HashTable *ht = NULL) const;
 
     /**
      * Set the memory threshold on the current bucket quota for accepting a new mutation
      */
     static void setMutationMemoryThreshold(double memThreshold);
 
+    /**
+     * Set the largest value that gets stored inline, in the same
+     * allocation as its StoredValue.  0 disables inline values.
+     */
+    static void setInlineValueThreshold(size_t threshold);
+
+    /**
+     * Get the largest value that gets stored inline.
+     */
+    static size_t getInlineValueThreshold() {
+        return inline_value_threshold;
+    }
+
+    /**
+     * Set which values get compressed: "off", "pager" (by the item
+     * pager instead of ejecting them) or "store" (on every store, and
+     * by the item pager).
+     */
+    static void setCompressionMode(const std::string &mode);
+
+    /**
+     * True if values are kept compressed from the time they're stored.
+     */
+    static bool isCompressedOnStore() {
+        return compress_on_store;
+    }
+
+    /**
+     * Set the smallest value that gets compressed.
+     */
+    static void setCompressionThreshold(size_t threshold);
+
+    /**
+     * True if this item's value is stored inline, right after the key,
+     * rather than in its own allocation.
+     */
+    bool isValueInline() const {
+        return inlineCapacity != 0 && value.get() == inlineBlob();
+    }
+
+    /**
+     * Release a StoredValue that is no longer reachable from any
+     * hash table.
+     */
+    static void destroy(StoredValue *v);
+
     static const int64_t state_id_cleared;
     static const int64_t state_id_pending;
 
@@ -549,16 +711,27 @@ public:
 private:
 
     StoredValue(const Item &itm, StoredValue *n, EPStats &stats, HashTable &ht,
-                bool setDirty = true) :
-        value(itm.getValue()), next(n), id(itm.getId()), flags(itm.getFlags()) {
+                bool setDirty = true, size_t capacity = 0, bool slab = false) :
+        next(n), id(itm.getId()), flags(itm.getFlags()) {
         cas = itm.getCas();
         exptime = itm.getExptime();
         resident = true;
         nru = false;
+        fromSlab = slab;
+        ejected = false;
+        freq = 0;
         lock_expiry = 0;
         keylen = itm.getKey().length();
+        inlineCapacity = static_cast<uint8_t>(capacity);
         seqno = itm.getSeqno();
 
+        if (inlineCapacity != 0) {
+            size_t offset = inlineValueOffset(keylen);
+            Blob::NewEmbedded(reinterpret_cast<char*>(this) + offset, offset,
+                              inlineCapacity, fromSlab);
+        }
+        assignValue(itm.getValue(), ht);
+
         if (setDirty) {
             markDirty();
         } else {
@@ -574,7 +747,85 @@ private:
         resident = true;
     }
 
+    /**
+     * Offset of the inline value area from the start of a StoredValue
+     * with a key of the given length.
+     */
+    static size_t inlineValueOffset(size_t keyLength) {
+        size_t offset = sizeof(StoredValue) + keyLength;
+        return (offset + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+    }
+
+    /**
+     * Size of the allocation holding this StoredValue.
+     */
+    size_t blockSize() const {
+        if (inlineCapacity != 0) {
+            return inlineValueOffset(keylen) + sizeof(Blob) + inlineCapacity;
+        }
+        return sizeof(StoredValue) + keylen;
+    }
+
+    /**
+     * Bytes the slab allocator rounded this StoredValue's allocation up by.
+     */
+    size_t slabSlack() const {
+        if (!fromSlab) {
+            return 0;
+        }
+        size_t len = blockSize();
+        return SlabAllocator::getInstance()->chunkSize(len) - len;
+    }
+
+    Blob *inlineBlob() const {
+        assert(inlineCapacity != 0);
+        const char *base = reinterpret_cast<const char*>(this);
+        return reinterpret_cast<Blob*>(const_cast<char*>(base) +
+                                       inlineValueOffset(keylen));
+    }
+
+    /**
+     * Point this item at the given value, copying it into the inline
+     * area when it fits and nobody still holds the previous inline
+     * value, or compressing it when compressing on store.
+     */
+    void assignValue(const value_t &v, HashTable &ht) {
+        value.reset();
+        if (inlineCapacity != 0 && v.get() != NULL &&
+            v->length() <= inlineCapacity) {
+            Blob *b = inlineBlob();
+            if (b->refill(v->getData(), v->length())) {
+                value.reset(b);
+                return;
+            }
+        }
+        if (compress_on_store) {
+            value_t compressed(compressBlob(v, ht));
+            if (compressed.get() != NULL) {
+                value = compressed;
+                return;
+            }
+        }
+        value = v;
+    }
+
+    /**
+     * Compress the given value if it is eligible and compresses well.
+     *
+     * @return the compressed value, or a NULL value otherwise
+     */
+    static value_t compressBlob(const value_t &v, HashTable &ht);
+
+    /**
+     * Swap in another form of the value, moving the memory accounting
+     * along with it.
+     */
+    void replaceValue(const value_t &v, EPStats &stats, HashTable &ht);
+
+    friend class BucketWalker;
     friend class HashTable;
+    friend class HashTableStatVisitor;
+    friend class ItemSnapshot;
     friend class StoredValueFactory;
 
     value_t            value;          // 16 bytes
@@ -588,9 +839,15 @@ private:
     bool               _isDirty  :  1; // 1 bit
     bool               resident  :  1; //!< True if this object's value is in memory.
     bool               nru       :  1; //!< True if referenced since last sweep
+    bool               fromSlab  :  1; //!< True if allocated by SlabAllocator.
+    bool               ejected   :  1; //!< True if the value was paged out.
+    uint8_t            freq      :  3; //!< Logarithmic access frequency.
     uint8_t            keylen;
+    uint8_t            inlineCapacity; //!< Bytes reserved for an inline value.
     char               keybytes[1];    //!< The key itself.
 
+    void updateExpiryIndex(HashTable &ht, time_t oldExptime);
+
     static void increaseMetaDataSize(HashTable &ht, size_t by);
     static void reduceMetaDataSize(HashTable &ht, size_t by);
     static void increaseCacheSize(HashTable &ht, size_t by);
@@ -599,6 +856,10 @@ private:
     static void reduceCurrentSize(EPStats&, size_t by);
     static bool hasAvailableSpace(EPStats&, const Item &item);
     static double mutation_mem_threshold;
+    static size_t inline_value_threshold;
+    static bool compress_on_store;
+    static bool compress_in_pager;
+    static size_t compression_threshold;
 
     DISALLOW_COPY_AND_ASSIGN(StoredValue);
 };
@@ -708,7 +969,7 @@ public:
     void visit(StoredValue *v) {
         ++numTotal;
         memSize += v->size();
-        valSize += v->isDeleted() ? 0 : v->getValue()->length();
+        valSize += v->isDeleted() ? 0 : v->value->length();
 
         if (v->isResident()) {
             cacheSize += v->size();
@@ -750,6 +1011,56 @@ private:
     Atomic<size_t> *counter;
 };
 
+/**
+ * What an Item is built from, copied out of a StoredValue.
+ *
+ * Taking one only touches the value's reference count, so an optimistic
+ * reader can take it inside its read section and allocate the Item (and
+ * decompress its value) after leaving.
+ */
+class ItemSnapshot {
+public:
+    ItemSnapshot() : cas(0), seqno(0), id(-1), exptime(0), flags(0) {}
+
+    /**
+     * Copy the metadata of the given value and keep a reference to its
+     * value.
+     *
+     * @param v the value to copy
+     * @param lck if true, the item built will have a locked CAS ID
+     */
+    void take(const StoredValue &v, bool lck) {
+        value = v.value;
+        cas = lck ? static_cast<uint64_t>(-1) : v.cas;
+        seqno = v.seqno;
+        id = v.id;
+        exptime = v.exptime;
+        flags = v.flags;
+    }
+
+    int64_t getId() const {
+        return id;
+    }
+
+    /**
+     * Build the item.
+     *
+     * @param key the key of the value this was taken from
+     * @param vbucket the vbucket containing the item
+     * @param ht if given, the hashtable to charge decompression to
+     */
+    Item *toItem(const std::string &key, uint16_t vbucket,
+                 HashTable *ht = NULL) const;
+
+private:
+    value_t  value;
+    uint64_t cas;
+    uint64_t seqno;
+    int64_t  id;
+    uint32_t exptime;
+    uint32_t flags;
+};
+
 /**
  * Creator of StoredValue instances.
  */
@@ -784,8 +1095,27 @@ private:
         assert(key.length() < 256);
         size_t len = key.length() + base;
 
-        StoredValue *t = new (::operator new(len))
-        StoredValue(itm, n, *stats, ht, setDirty);
+        // Small values are carved out of the same allocation, using up
+        // whatever the allocator would have rounded the block up to.
+        size_t capacity = 0;
+        const value_t &val = itm.getValue();
+        if (val.get() != NULL && val->length() != 0 &&
+            val->length() <= StoredValue::inline_value_threshold) {
+            size_t offset = StoredValue::inlineValueOffset(key.length());
+            size_t need = offset + sizeof(Blob) + val->length();
+            size_t rounded = (need + 15) & ~15;
+            if (SlabAllocator::isEnabled()) {
+                rounded = SlabAllocator::getInstance()->chunkSize(need);
+            }
+            capacity = std::min(rounded - offset - sizeof(Blob),
+                                static_cast<size_t>(255));
+            len = offset + sizeof(Blob) + capacity;
+        }
+
+        bool slab;
+        void *p = SlabAllocator::allocateObject(len, slab);
+        StoredValue *t = new (p)
+        StoredValue(itm, n, *stats, ht, setDirty, capacity, slab);
         std::memcpy(t->keybytes, key.data(), key.length());
         return t;
     }
@@ -793,12 +1123,146 @@ private:
     EPStats                *stats;
 };
 
+/**
+ * RAII holder of an optimistic read section on a HashTable lock stripe.
+ *
+ * While held, no writer can modify or free anything in the stripe.
+ */
+class OptimisticReadHolder {
+public:
+    OptimisticReadHolder() : mutex(NULL) {}
+
+    ~OptimisticReadHolder() {
+        release();
+    }
+
+    /**
+     * Leave the read section early.
+     */
+    void release() {
+        if (mutex) {
+            mutex->readEnd();
+            mutex = NULL;
+        }
+    }
+
+private:
+    friend class HashTable;
+
+    SeqMutex *mutex;
+
+    DISALLOW_COPY_AND_ASSIGN(OptimisticReadHolder);
+};
+
+/**
+ * A cache line worth of hash table slots.
+ *
+ * In a grouped hash table every bucket has one of these in front of
+ * its chain.  Each slot carries a one-byte tag taken from the hash of
+ * its key, so a lookup reads the group and only dereferences values
+ * whose tag matches.  Items that don't fit go on the bucket's chain.
+ */
+struct BucketGroup {
+    static const size_t SLOTS = 7;
+    //! Items per group the automatic resizer aims for.
+    static const size_t TARGET_LOAD = 5;
+
+    /**
+     * The tag stored for a hash; never zero (free slot) or one (flag).
+     */
+    static uint8_t tagFor(int h) {
+        return static_cast<uint8_t>(0x80 | ((static_cast<unsigned int>(h) >> 24) & 0x7f));
+    }
+
+    /**
+     * True if some slot might carry the given tag.
+     *
+     * Compares all tags at once; it may report a match that isn't
+     * there, but never misses one.
+     */
+    bool mayContain(uint8_t tag) const {
+        const uint64_t ones = 0x0101010101010101ULL;
+        uint64_t w;
+        std::memcpy(&w, tags, sizeof(w));
+        w ^= ones * tag;
+        return ((w - ones) & ~w & (ones << 7)) != 0;
+    }
+
+    bool hasOverflow() const {
+        return tags[SLOTS] != 0;
+    }
+
+    //! Slot tags (0 when free), followed by the overflow chain flag.
+    uint8_t      tags[SLOTS + 1];
+    StoredValue *slots[SLOTS];
+};
+
+/**
+ * Iterates over the values of a single (locked) hash bucket.
+ */
+class BucketWalker {
+public:
+    BucketWalker(StoredValue **chains, BucketGroup *groups, int bucket)
+        : group(groups ? &groups[bucket] : NULL), slot(0),
+          chain(chains[bucket]) {}
+
+    /**
+     * Get the next value, or NULL when the bucket is exhausted.
+     */
+    StoredValue *next() {
+        if (group) {
+            while (slot < BucketGroup::SLOTS) {
+                size_t i = slot++;
+                if (group->tags[i] != 0) {
+                    return group->slots[i];
+                }
+            }
+        }
+        StoredValue *v = chain;
+        if (v) {
+            chain = v->next;
+        }
+        return v;
+    }
+
+private:
+    BucketGroup *group;
+    size_t       slot;
+    StoredValue *chain;
+};
+
 /**
  * A container of StoredValue instances.
  */
 class HashTable {
 public:
 
+    /**
+     * Where a bounded visit stopped, to carry on from.
+     *
+     * A default constructed position is the start of the table.
+     */
+    class Position {
+    public:
+        Position() : lock(0), row(0), tableSize(0) {}
+
+        //! True once the whole table was visited.
+        bool isEnd() const {
+            return lock < 0;
+        }
+
+    private:
+        Position(int l, int r, size_t sz) : lock(l), row(r), tableSize(sz) {}
+
+        //! The lock stripe, and how far into its buckets.
+        int    lock;
+        int    row;
+        //! The table size the row applies to.
+        size_t tableSize;
+
+        friend class HashTable;
+    };
+
     /**
      * Create a HashTable.
      *
@@ -813,7 +1277,18 @@ public:
         assert(n_locks > 0);
         assert(visitors == 0);
         values = static_cast<StoredValue**>(calloc(size, sizeof(StoredValue*)));
-        mutexes = new Mutex[n_locks];
+        groups = defaultGrouped ? allocGroups(size) : NULL;
+        grouped = groups != NULL;
+        expiryIndex = defaultExpiryIndex ? new ExpiryIndex(stats, ep_real_time()) : NULL;
+        mutexes = new SeqMutex[n_locks];
+        for (size_t i = 0; i < n_locks; ++i) {
+            mutexes[i].setLockSite(&stripeSite);
+        }
+        oldValues = NULL;
+        oldGroups = NULL;
+        oldSize = 0;
+        resizeStripe = 0;
+        resizeBucket = 0;
         activeState = true;
     }
 
@@ -826,14 +1301,26 @@ public:
         delete []mutexes;
         free(values);
         values = NULL;
+        freeGroups(groups);
+        groups = NULL;
+        delete expiryIndex;
     }
 
     size_t memorySize() {
+        size_t bucketSize = sizeof(StoredValue*);
+        if (grouped) {
+            bucketSize += sizeof(BucketGroup);
+        }
         return sizeof(HashTable)
-            + (size * sizeof(StoredValue*))
+            + ((size + oldSize) * bucketSize)
             + (n_locks * sizeof(Mutex));
     }
 
+    /**
+     * True if buckets are grouped (tagged slots in front of each chain).
+     */
+    bool isGrouped() const { return grouped; }
+
     /**
      * Get the number of hash table buckets this hash table has.
      */
@@ -849,6 +1336,25 @@ public:
      */
     size_t getNumItems(void) { return numItems; }
 
+    /**
+     * Get the number of items ejected whole, which now live only on disk.
+     */
+    size_t getNumEjectedItems(void) { return numEjectedItems; }
+
+    /**
+     * Get the number of items this hash table accounts for, both the
+     * ones in memory and the ones ejected whole.
+     */
+    size_t getNumTotalItems(void) {
+        return numItems.get() + numEjectedItems.get();
+    }
+
+    /**
+     * Note that an ejected item has been replaced by a new one in memory
+     * without being read back.
+     */
+    void forgetEjectedItem(void);
+
     /**
      * Get the number of non-resident items within this hash table.
      */
@@ -900,9 +1406,38 @@ public:
 
     /**
      * Resize to the specified size.
+     *
+     * In incremental mode this only installs the new bucket array;
+     * existing items are moved over by resizeStep() and by the
+     * foreground operations that touch their old buckets.
      */
     void resize(size_t to);
 
+    /**
+     * Migrate a slice of the buckets of an in-progress incremental
+     * resize.  Only one lock stripe is held while doing so.
+     *
+     * @param maxBuckets the max number of old buckets to migrate
+     * @return true if there is more migration work to do
+     */
+    bool resizeStep(size_t maxBuckets = 64);
+
+    /**
+     * True if an incremental resize is currently in progress.
+     */
+    bool isResizing() { return resizeBucketsTotal.get() != 0; }
+
+    /**
+     * Get the number of old buckets swept by the current incremental resize.
+     */
+    size_t getResizeBucketsDone() { return resizeBucketsDone; }
+
+    /**
+     * Get the number of old buckets the current incremental resize has
+     * to sweep (0 if no resize is in progress).
+     */
+    size_t getResizeBucketsTotal() { return resizeBucketsTotal; }
+
     /**
      * Find the item with the given key.
      *
@@ -911,9 +1446,30 @@ public:
      */
     StoredValue *find(std::string &key, bool trackReference=true) {
         assert(isActive());
+        bool bumpDue = false;
+        {
+            OptimisticReadHolder rh;
+            StoredValue *v = NULL;
+            if (optimisticFind(key, rh, &v)) {
+                if (v == NULL || v->isDeleted()) {
+                    return NULL;
+                }
+                if (!trackReference ||
+                    (v->isReferenced() && !(bumpDue = v->frequencyBumpDue()))) {
+                    return v;
+                }
+            }
+        }
         int bucket_num(0);
-        LockHolder lh = getLockedBucket(key, &bucket_num);
-        return unlocked_find(key, bucket_num, false, trackReference);
+        int h = hash(key);
+        LockHolder lh = getLockedBucket(h, &bucket_num);
+        StoredValue *v = unlocked_find(key, bucket_num, h, false,
+                                       trackReference && !bumpDue);
+        if (v && bumpDue) {
+            // Already rolled for above; rolling again would square the odds.
+            v->referenced(*this, true);
+        }
+        return v;
     }
 
     /**
@@ -925,14 +1481,15 @@ public:
                               enum queue_operation op,
                               int bucket_num)
     {
-        if (unlocked_find(itm.getKey(), bucket_num, true)) {
+        int h = lookupHash(itm.getKey());
+        if (unlocked_find(itm.getKey(), bucket_num, h, true, true)) {
             // it's already there...
             return false;
         }
 
-        StoredValue *v = valFact(itm, values[bucket_num], *this);
+        StoredValue *v = valFact(itm, NULL, *this);
         assert(v);
-        values[bucket_num] = v;
+        linkValue(bucket_num, v, h);
         ++numItems;
         if (op == queue_op_del) {
             unlocked_softDelete(v, itm.getCas());
@@ -968,15 +1525,43 @@ public:
                         bool allowExisting, bool hasMetaData = true,
                         bool trackReference=true) {
         assert(isActive());
+        int bucket_num(0);
+        int h = hash(val.getKey());
+        LockHolder lh = getLockedBucket(h, &bucket_num);
+        return unlocked_set(val, cas, allowExisting, hasMetaData,
+                            trackReference, bucket_num, h);
+    }
+
+    /**
+     * Unlocked version of the set() method.
+     *
+     * @param bucket_num the locked partition where the key belongs
+     */
+    mutation_type_t unlocked_set(const Item &val, uint64_t cas,
+                                 bool allowExisting, bool hasMetaData,
+                                 bool trackReference, int bucket_num) {
+        return unlocked_set(val, cas, allowExisting, hasMetaData,
+                            trackReference, bucket_num, lookupHash(val.getKey()));
+    }
+
+    /**
+     * Unlocked version of the set() method, for a caller that already
+     * hashed the key to lock its bucket.
+     *
+     * @param bucket_num the locked partition where the key belongs
+     * @param h the hash of the key
+     */
+    mutation_type_t unlocked_set(const Item &val, uint64_t cas,
+                                 bool allowExisting, bool hasMetaData,
+                                 bool trackReference, int bucket_num, int h) {
+        assert(isActive());
         Item &itm = const_cast<Item&>(val);
         if (!StoredValue::hasAvailableSpace(stats, itm)) {
             return NOMEM;
         }
 
         mutation_type_t rv = NOT_FOUND;
-        int bucket_num(0);
-        LockHolder lh = getLockedBucket(val.getKey(), &bucket_num);
-        StoredValue *v = unlocked_find(val.getKey(), bucket_num, true,
+        StoredValue *v = unlocked_find(val.getKey(), bucket_num, h, true,
                                        trackReference);
 
         /*
@@ -1034,8 +1619,8 @@ public:
             if (!hasMetaData) {
                 itm.setCas();
             }
-            v = valFact(itm, values[bucket_num], *this);
-            values[bucket_num] = v;
+            v = valFact(itm, NULL, *this);
+            linkValue(bucket_num, v, h);
             ++numItems;
             if (trackReference && !v->isTempItem()) {
                 v->referenced(*this);
@@ -1079,8 +1664,9 @@ public:
     add_type_t add(const Item &val, bool isDirty = true, bool storeVal = true) {
         assert(isActive());
         int bucket_num(0);
-        LockHolder lh = getLockedBucket(val.getKey(), &bucket_num);
-        return unlocked_add(bucket_num, val, isDirty, storeVal);
+        int h = hash(val.getKey());
+        LockHolder lh = getLockedBucket(h, &bucket_num);
+        return unlocked_add(bucket_num, h, val, isDirty, storeVal, true);
     }
 
     /**
@@ -1097,7 +1683,19 @@ public:
                             const Item &val,
                             bool isDirty = true,
                             bool storeVal = true,
-                            bool trackReference = true);
+                            bool trackReference = true) {
+        return unlocked_add(bucket_num, lookupHash(val.getKey()), val,
+                            isDirty, storeVal, trackReference);
+    }
+
+    /**
+     * Unlocked version of the add() method, for a caller that already
+     * hashed the key to lock its bucket.
+     *
+     * @param h the hash of the key
+     */
+    add_type_t unlocked_add(int &bucket_num, int h, const Item &val,
+                            bool isDirty, bool storeVal, bool trackReference);
 
     /**
      * Add a temporary item to the hash table iff it doesn't already exist.
@@ -1122,8 +1720,9 @@ public:
     mutation_type_t softDelete(const std::string &key, uint64_t cas) {
         assert(isActive());
         int bucket_num(0);
-        LockHolder lh = getLockedBucket(key, &bucket_num);
-        StoredValue *v = unlocked_find(key, bucket_num, false, false);
+        int h = hash(key);
+        LockHolder lh = getLockedBucket(h, &bucket_num);
+        StoredValue *v = unlocked_find(key, bucket_num, h, false, false);
         return unlocked_softDelete(v, cas);
     }
 
@@ -1146,12 +1745,14 @@ public:
                                         time_t newExptime=0) {
         mutation_type_t rv = NOT_FOUND;
         if (v) {
+            time_t indexed = v->getIndexedExptime();
             if (v->isExpired(ep_real_time()) && !use_meta) {
                 if (!v->isResident() && !v->isDeleted()) {
                     --numNonResidentItems;
                 }
                 v->setSeqno(newSeqno);
                 v->del(stats, *this, use_meta);
+                indexExpiry(v, indexed);
                 updateMaxDeletedSeqno(v->getSeqno());
                 return rv;
             }
@@ -1184,6 +1785,7 @@ public:
                 }
             }
             v->del(stats, *this, use_meta);
+            indexExpiry(v, indexed);
 
             updateMaxDeletedSeqno(v->getSeqno());
         }
@@ -1202,26 +1804,83 @@ public:
      */
     StoredValue *unlocked_find(const std::string &key, int bucket_num,
                                bool wantsDeleted=false, bool trackReference=true) {
-        StoredValue *v = values[bucket_num];
-        while (v) {
-            if (v->hasKey(key)) {
-                if (trackReference && !v->isDeleted()) {
-                    v->referenced(*this);
-                }
-                if (wantsDeleted || !v->isDeleted()) {
-                    return v;
-                } else {
-                    return NULL;
-                }
+        return unlocked_find(key, bucket_num, lookupHash(key), wantsDeleted,
+                             trackReference);
+    }
+
+    /**
+     * Find an item within a specific bucket assuming you already
+     * locked the bucket, with the hash that locked it, so a grouped
+     * table doesn't have to hash the key again.
+     *
+     * @param key the key of the item to find
+     * @param bucket_num the bucket number
+     * @param h the hash of the key
+     * @param wantsDeleted true if soft deleted items should be returned
+     * @param trackReference true if the nru bit should be set
+     *
+     * @return a pointer to a StoredValue -- NULL if not found
+     */
+    StoredValue *unlocked_find(const std::string &key, int bucket_num, int h,
+                               bool wantsDeleted, bool trackReference) {
+        StoredValue *v = bucketLookup(values, groups, bucket_num, key, h);
+        if (v) {
+            if (trackReference && !v->isDeleted()) {
+                v->referenced(*this);
+            }
+            if (wantsDeleted || !v->isDeleted()) {
+                return v;
             }
-            v = v->next;
         }
         return NULL;
     }
 
+    /**
+     * Look up a key without taking its bucket lock.
+     *
+     * On success the result (NULL if the key isn't present, and
+     * possibly a deleted item otherwise) may be inspected until rh is
+     * released; writers to the stripe wait for that.  Nothing may be
+     * modified through it.
+     *
+     * @param key the key to find
+     * @param rh holder of the read section
+     * @param v output parameter to receive the value
+     * @return false if a writer owns the bucket; use getLockedBucket()
+     */
+    bool optimisticFind(const std::string &key, OptimisticReadHolder &rh,
+                        StoredValue **v) {
+        assert(isActive());
+        assert(rh.mutex == NULL);
+        int h = hash(key.data(), key.size());
+        int bucket = getBucketForHash(h);
+        SeqMutex &m = mutexes[mutexForBucket(bucket)];
+        if (!m.readBegin()) {
+            ++numOptimisticFallbacks;
+            return false;
+        }
+        rh.mutex = &m;
+        if (bucket != getBucketForHash(h)) {
+            // Resized before we got in.
+            rh.release();
+            return false;
+        }
+
+        *v = bucketLookup(values, groups, bucket, key, h);
+        if (*v == NULL && oldValues) {
+            *v = bucketLookup(oldValues, oldGroups, getBucketForHash(h, oldSize),
+                              key, h);
+        }
+        return true;
+    }
+
     /**
      * Compute a hash for the given string.
      *
+     * This is MurmurHash64A: it consumes the key eight bytes at a time
+     * and mixes every input bit into the whole result, which keeps
+     * chains short for long keys sharing prefixes.
+     *
      * @param str the beginning of the string
      * @param len the number of bytes in the string
      *
@@ -1229,13 +1888,38 @@ public:
      */
     inline int hash(const char *str, const size_t len) {
         assert(isActive());
-        int h=5381;
+        const uint64_t m = 0xc6a4a7935bd1e995ULL;
+        const int r = 47;
+        uint64_t h = 0x9747b28cULL ^ (len * m);
+
+        const char *end = str + (len & ~static_cast<size_t>(7));
+        for (; str != end; str += 8) {
+            uint64_t k;
+            std::memcpy(&k, str, sizeof(k));
+            k *= m;
+            k ^= k >> r;
+            k *= m;
+            h ^= k;
+            h *= m;
+        }
 
-        for(size_t i=0; i < len; i++) {
-            h = ((h << 5) + h) ^ str[i];
+        const unsigned char *tail = reinterpret_cast<const unsigned char*>(str);
+        switch (len & 7) {
+        case 7: h ^= static_cast<uint64_t>(tail[6]) << 48;
+        case 6: h ^= static_cast<uint64_t>(tail[5]) << 40;
+        case 5: h ^= static_cast<uint64_t>(tail[4]) << 32;
+        case 4: h ^= static_cast<uint64_t>(tail[3]) << 24;
+        case 3: h ^= static_cast<uint64_t>(tail[2]) << 16;
+        case 2: h ^= static_cast<uint64_t>(tail[1]) << 8;
+        case 1: h ^= static_cast<uint64_t>(tail[0]);
+            h *= m;
         }
 
-        return h;
+        h ^= h >> r;
+        h *= m;
+        h ^= h >> r;
+
+        return static_cast<int>(h ^ (h >> 32));
     }
 
     /**
@@ -1248,6 +1932,18 @@ public:
         return hash(s.data(), s.length());
     }
 
+    /**
+     * Get what the unlocked_ methods need to know of a key's hash: the
+     * hash itself in a grouped table, where slot tags come from it, and
+     * nothing otherwise.
+     *
+     * @param s the key
+     * @return the hash value, or 0 if the table isn't grouped
+     */
+    inline int lookupHash(const std::string &s) {
+        return grouped ? hash(s) : 0;
+    }
+
     /**
      * Get a lock holder holding a lock for the bucket for the given
      * hash.
@@ -1262,6 +1958,11 @@ public:
             *bucket = getBucketForHash(h);
             LockHolder rv(mutexes[mutexForBucket(*bucket)]);
             if (*bucket == getBucketForHash(h)) {
+                if (oldValues) {
+                    // Pull the key's old bucket into the new table so
+                    // the caller only ever has to look at values.
+                    migrateBucket(getBucketForHash(h, oldSize));
+                }
                 return rv;
             }
         }
@@ -1292,6 +1993,38 @@ public:
         return getLockedBucket(hash(s.data(), s.size()), bucket);
     }
 
+    /**
+     * Get the bucket a hash maps onto right now.  Without the bucket's
+     * lock this may change under a resize, so it is only good for
+     * grouping keys that are then checked with unlocked_inBucket().
+     *
+     * @param h the input hash
+     * @return the bucket for the hash
+     */
+    int bucketHint(int h) {
+        return getBucketForHash(h);
+    }
+
+    /**
+     * Check whether a hash maps onto a bucket whose lock is already held
+     * (Please note that you <b>MUST</b> acquire the mutex before calling
+     * this function!!!), so its key can be handled under the same lock.
+     *
+     * @param h the input hash
+     * @param bucket the locked bucket
+     * @return true if the hash's bucket is the locked one
+     */
+    bool unlocked_inBucket(int h, int bucket) {
+        assert(isActive());
+        if (bucket != getBucketForHash(h)) {
+            return false;
+        }
+        if (oldValues) {
+            migrateBucket(getBucketForHash(h, oldSize));
+        }
+        return true;
+    }
+
     /**
      * Delete a key from the cache without trying to lock the cache first
      * (Please note that you <b>MUST</b> acquire the mutex before calling
@@ -1302,63 +2035,58 @@ public:
      * @return true if an object was deleted, false otherwise
      */
     bool unlocked_del(const std::string &key, int bucket_num) {
-        assert(isActive());
-        StoredValue *v = values[bucket_num];
+        return unlocked_del(key, bucket_num, lookupHash(key));
+    }
 
-        // Special case empty bucket.
+    /**
+     * Delete a key from the cache without trying to lock the cache
+     * first, with the hash that locked its bucket.
+     *
+     * @param key the key to delete
+     * @param bucket_num the bucket to look in (must already be locked)
+     * @param h the hash of the key
+     * @return true if an object was deleted, false otherwise
+     */
+    bool unlocked_del(const std::string &key, int bucket_num, int h) {
+        assert(isActive());
+        StoredValue *v = bucketLookup(values, groups, bucket_num, key, h);
         if (!v) {
             return false;
         }
 
-        // Special case the first one
-        if (v->hasKey(key)) {
-            if (!v->isDeleted() && v->isLocked(ep_current_time())) {
-                return false;
-            }
-
-            values[bucket_num] = v->next;
-            size_t currSize = v->size();
-            StoredValue::reduceCacheSize(*this, currSize);
-            StoredValue::reduceCurrentSize(stats, v->isDeleted() ? currSize
-                                           : currSize - v->getValue()->length());
-            StoredValue::reduceMetaDataSize(*this, v->metaDataSize());
-            if (v->isTempItem()) {
-                --numTempItems;
-            } else {
-                --numItems;
-            }
-            delete v;
-            return true;
+        if (!v->isDeleted() && v->isLocked(ep_current_time())) {
+            return false;
         }
 
-        while (v->next) {
-            if (v->next->hasKey(key)) {
-                StoredValue *tmp = v->next;
-                if (!tmp->isDeleted() && tmp->isLocked(ep_current_time())) {
-                    return false;
-                }
-
-                v->next = v->next->next;
-                size_t currSize = tmp->size();
-                StoredValue::reduceCacheSize(*this, currSize);
-                StoredValue::reduceCurrentSize(stats, tmp->isDeleted() ? currSize
-                                               : currSize - tmp->getValue()->length());
-                StoredValue::reduceMetaDataSize(*this, tmp->metaDataSize());
-                if (tmp->isTempItem()) {
-                    --numTempItems;
-                } else {
-                    --numItems;
-                }
-                delete tmp;
-                return true;
-            } else {
-                v = v->next;
-            }
+        if (v->isTempItem()) {
+            --numTempItems;
+        } else {
+            --numItems;
         }
-
-        return false;
+        unlinkValue(bucket_num, v);
+        return true;
     }
 
+    /**
+     * Remove a clean item from memory altogether, key and metadata
+     * included, leaving only its copy on disk.
+     *
+     * @param v the item to eject; set to NULL if it was ejected
+     * @param bucket_num the locked partition where the key belongs
+     * @return true if the item was ejected
+     */
+    bool unlocked_ejectItem(StoredValue *&v, int bucket_num);
+
+    /**
+     * Replace the temporary item standing in for an ejected key with
+     * the item read back from disk.
+     *
+     * @param itm the item fetched from disk
+     * @param bucket_num the locked partition where the key belongs
+     * @return the restored item
+     */
+    StoredValue *unlocked_restoreEjected(const Item &itm, int bucket_num);
+
     /**
      * Delete the item with the given key.
      *
@@ -1368,8 +2096,9 @@ public:
     bool del(const std::string &key) {
         assert(isActive());
         int bucket_num(0);
-        LockHolder lh = getLockedBucket(key, &bucket_num);
-        return unlocked_del(key, bucket_num);
+        int h = hash(key);
+        LockHolder lh = getLockedBucket(h, &bucket_num);
+        return unlocked_del(key, bucket_num, h);
     }
 
     /**
@@ -1377,11 +2106,88 @@ public:
      */
     void visit(HashTableVisitor &visitor);
 
+    /**
+     * Visit items from the given position until a budget runs out, so
+     * a big table can be walked a piece at a time without holding up
+     * its writers or the thread doing the walking.
+     *
+     * Lock stripes are visited one by one, and within a stripe the
+     * budget is checked after each bucket.  If the table is resized
+     * between calls the stripe that was interrupted is started over,
+     * so some of its items may be visited twice but none are missed.
+     *
+     * @param visitor the visitor, whose shouldContinue() is checked
+     *        before each stripe
+     * @param start where to start, the start of the table or what an
+     *        earlier call returned
+     * @param maxItems stop after visiting this many items (0 for no limit)
+     * @param maxTime stop after this many microseconds (0 for no limit)
+     * @return where to carry on from, the end if everything was visited
+     */
+    Position visit(HashTableVisitor &visitor, const Position &start,
+                   size_t maxItems, hrtime_t maxTime);
+
+    /**
+     * Visit the items of a few randomly picked buckets, each under its
+     * lock, rather than walking the whole table.
+     *
+     * @param visitor the visitor
+     * @param buckets the number of buckets to pick
+     * @param seed the caller's rand_r state, so threads sampling at the
+     *        same time don't share one
+     */
+    void sample(HashTableVisitor &visitor, size_t buckets, unsigned int &seed);
+
     /**
      * Visit all items within this call with a depth visitor.
      */
     void visitDepth(HashTableDepthVisitor &visitor);
 
+    /**
+     * Bring the expiry index in line with a change to an item's expiry
+     * time or deletion.  The item's bucket must be locked.
+     *
+     * @param v the item that changed
+     * @param oldExptime what getIndexedExptime() returned before
+     */
+    void indexExpiry(StoredValue *v, time_t oldExptime) {
+        time_t exptime = v->getIndexedExptime();
+        if (expiryIndex == NULL || exptime == oldExptime) {
+            return;
+        }
+        if (oldExptime != 0) {
+            expiryIndex->remove(v->getKey(), oldExptime);
+        }
+        if (exptime != 0) {
+            expiryIndex->add(v->getKey(), exptime);
+        }
+    }
+
+    /**
+     * True if this table indexes its items by expiry time.
+     */
+    bool hasExpiryIndex() const {
+        return expiryIndex != NULL;
+    }
+
+    /**
+     * Take out the keys of the indexed items that expire before the
+     * given time.  They may have changed since, so check each one.
+     */
+    void popExpired(time_t asOf, std::vector<std::string> &keys) {
+        if (expiryIndex) {
+            expiryIndex->popExpired(asOf, keys);
+        }
+    }
+
+    size_t getExpiryIndexKeys() const {
+        return expiryIndex ? expiryIndex->getNumKeys() : 0;
+    }
+
+    size_t getExpiryIndexMemory() const {
+        return expiryIndex ? expiryIndex->memorySize() : 0;
+    }
+
     /**
      * Get the number of buckets that should be used for initialization.
      *
@@ -1406,6 +2212,24 @@ public:
      */
     static void setDefaultNumLocks(size_t);
 
+    /**
+     * Choose between incremental and stop-the-world resizing.
+     */
+    static void setIncrementalResize(bool);
+
+    /**
+     * Choose the bucket layout of hash tables created from now on.
+     *
+     * @param grouped true for grouped (tagged) buckets, false for chains
+     */
+    static void setDefaultGrouped(bool grouped);
+
+    /**
+     * Choose whether hash tables created from now on keep an expiry
+     * index.
+     */
+    static void setDefaultExpiryIndex(bool to);
+
     /**
      * Get the max deleted seqno seen so far.
      */
@@ -1428,10 +2252,31 @@ public:
     }
 
     Atomic<uint64_t>     maxDeletedSeqno;
+    //! Number of incremental resize steps taken.
+    Atomic<size_t>       resizeSteps;
+    //! Total time (us) lock stripes were held by resize steps.
+    Atomic<hrtime_t>     resizeStepTime;
+    //! Longest time (us) a lock stripe was held by a single resize step.
+    Atomic<hrtime_t>     resizeStepMaxTime;
+    //! Number of lock-free lookups turned away by a writer.
+    Atomic<size_t>       numOptimisticFallbacks;
     Atomic<size_t>       numNonResidentItems;
     Atomic<size_t>       numEjects;
     Atomic<size_t>       numReferenced;
     Atomic<size_t>       numReferencedEjects;
+    //! Number of values compressed.
+    Atomic<size_t>       numCompressions;
+    //! Number of values that didn't compress well enough to keep.
+    Atomic<size_t>       numCompressFailures;
+    //! Bytes fed to and produced by successful compressions.
+    Atomic<size_t>       compressInBytes;
+    Atomic<size_t>       compressOutBytes;
+    //! Total time (ns) spent compressing values.
+    Atomic<hrtime_t>     compressTime;
+    //! Number of values decompressed to serve a read.
+    Atomic<size_t>       numDecompressions;
+    //! Total time (ns) spent decompressing values.
+    Atomic<hrtime_t>     decompressTime;
     //! Memory consumed by items in this hashtable.
     Atomic<size_t>       memSize;
     //! Cache size.
@@ -1446,22 +2291,234 @@ private:
     size_t               size;
     size_t               n_locks;
     StoredValue        **values;
-    Mutex               *mutexes;
+    //! Tagged slot groups in front of each chain (NULL unless grouped).
+    BucketGroup         *groups;
+    bool                 grouped;
+    //! Keys of the items that expire, by time (or NULL).
+    ExpiryIndex         *expiryIndex;
+    SeqMutex            *mutexes;
+    //! Bucket array being drained by an incremental resize (or NULL).
+    StoredValue        **oldValues;
+    BucketGroup         *oldGroups;
+    size_t               oldSize;
+    //! Resize cursor: the lock stripe and old bucket to migrate next.
+    size_t               resizeStripe;
+    size_t               resizeBucket;
+    //! Serializes resize(), resizeStep() and clear().
+    Mutex                resizeLock;
+    Atomic<size_t>       resizeBucketsDone;
+    Atomic<size_t>       resizeBucketsTotal;
     EPStats&             stats;
     StoredValueFactory   valFact;
     Atomic<size_t>       visitors;
     Atomic<size_t>       numItems;
+    //! Items ejected whole; still on disk, so still counted.
+    Atomic<size_t>       numEjectedItems;
     Atomic<size_t>       numResizes;
     Atomic<size_t>       numTempItems;
     bool                 activeState;
 
     static size_t                 defaultNumBuckets;
     static size_t                 defaultNumLocks;
+    static bool                   incrementalResize;
+    static bool                   defaultGrouped;
+    static bool                   defaultExpiryIndex;
+    static LockSite               stripeSite;
 
     int getBucketForHash(int h) {
-        return abs(h % static_cast<int>(size));
+        return getBucketForHash(h, size);
+    }
+
+    /**
+     * Map a hash onto a table of the given size.
+     *
+     * As long as the table has at least as many buckets as there are
+     * locks, a hash always maps to a bucket guarded by the lock stripe
+     * (h % n_locks), whatever the table size.  This is what allows an
+     * incremental resize to move a bucket while only holding that one
+     * stripe.
+     */
+    int getBucketForHash(int h, size_t sz) {
+        unsigned int uh = static_cast<unsigned int>(h);
+        if (sz < n_locks) {
+            return static_cast<int>(uh % sz);
+        }
+        unsigned int stripe = uh % n_locks;
+        unsigned int rows = (sz - stripe + n_locks - 1) / n_locks;
+        return static_cast<int>(stripe + n_locks * ((uh / n_locks) % rows));
     }
 
+    /**
+     * Move the contents of an old bucket into the new table.  The
+     * lock stripe of the bucket must be held.
+     */
+    void migrateBucket(int oldBucket) {
+        StoredValue *v;
+        while ((v = bucketPop(oldValues, oldGroups, oldBucket)) != NULL) {
+            int h = hash(v->getKeyBytes(), v->getKeyLen());
+            bucketLink(values, groups, getBucketForHash(h), v, h);
+        }
+    }
+
+    /**
+     * Find a key in one bucket of a table, deleted or not.
+     *
+     * @param h the hash of the key (only used by grouped tables)
+     */
+    StoredValue *bucketLookup(StoredValue **chains, BucketGroup *grps,
+                              int bucket, const std::string &key, int h) {
+        if (grps) {
+            BucketGroup &g = grps[bucket];
+            uint8_t tag = BucketGroup::tagFor(h);
+            if (g.mayContain(tag)) {
+                for (size_t i = 0; i < BucketGroup::SLOTS; ++i) {
+                    if (g.tags[i] == tag && g.slots[i]->hasKey(key)) {
+                        return g.slots[i];
+                    }
+                }
+            }
+            if (!g.hasOverflow()) {
+                return NULL;
+            }
+        }
+        StoredValue *v = chains[bucket];
+        while (v && !v->hasKey(key)) {
+            v = v->next;
+        }
+        return v;
+    }
+
+    /**
+     * Put a value into a bucket of a table.
+     */
+    void bucketLink(StoredValue **chains, BucketGroup *grps, int bucket,
+                    StoredValue *v, int h) {
+        if (grps) {
+            BucketGroup &g = grps[bucket];
+            for (size_t i = 0; i < BucketGroup::SLOTS; ++i) {
+                if (g.tags[i] == 0) {
+                    v->next = NULL;
+                    g.slots[i] = v;
+                    g.tags[i] = BucketGroup::tagFor(h);
+                    return;
+                }
+            }
+            g.tags[BucketGroup::SLOTS] = 1;
+        }
+        v->next = chains[bucket];
+        chains[bucket] = v;
+    }
+
+    /**
+     * Take a value out of a bucket of a table.
+     */
+    void bucketUnlink(StoredValue **chains, BucketGroup *grps, int bucket,
+                      StoredValue *v) {
+        if (grps) {
+            BucketGroup &g = grps[bucket];
+            for (size_t i = 0; i < BucketGroup::SLOTS; ++i) {
+                if (g.tags[i] != 0 && g.slots[i] == v) {
+                    // Refill the slot from the chain to keep it short.
+                    StoredValue *o = chains[bucket];
+                    if (o) {
+                        chains[bucket] = o->next;
+                        o->next = NULL;
+                        g.slots[i] = o;
+                        g.tags[i] = BucketGroup::tagFor(hash(o->getKeyBytes(),
+                                                             o->getKeyLen()));
+                        g.tags[BucketGroup::SLOTS] = chains[bucket] != NULL;
+                    } else {
+                        g.slots[i] = NULL;
+                        g.tags[i] = 0;
+                    }
+                    return;
+                }
+            }
+        }
+        StoredValue **p = &chains[bucket];
+        while (*p != v) {
+            assert(*p);
+            p = &(*p)->next;
+        }
+        *p = v->next;
+        if (grps) {
+            grps[bucket].tags[BucketGroup::SLOTS] = chains[bucket] != NULL;
+        }
+    }
+
+    /**
+     * Take any value out of a bucket of a table.
+     *
+     * @return the value, or NULL if the bucket was empty
+     */
+    StoredValue *bucketPop(StoredValue **chains, BucketGroup *grps, int bucket) {
+        if (grps) {
+            BucketGroup &g = grps[bucket];
+            for (size_t i = 0; i < BucketGroup::SLOTS; ++i) {
+                if (g.tags[i] != 0) {
+                    StoredValue *v = g.slots[i];
+                    g.slots[i] = NULL;
+                    g.tags[i] = 0;
+                    return v;
+                }
+            }
+        }
+        StoredValue *v = chains[bucket];
+        if (v) {
+            chains[bucket] = v->next;
+            if (grps) {
+                grps[bucket].tags[BucketGroup::SLOTS] = chains[bucket] != NULL;
+            }
+        }
+        return v;
+    }
+
+    /**
+     * Put a new value into the given (locked) bucket of the live table.
+     */
+    void linkValue(int bucket_num, StoredValue *v) {
+        linkValue(bucket_num, v,
+                  grouped ? hash(v->getKeyBytes(), v->getKeyLen()) : 0);
+    }
+
+    void linkValue(int bucket_num, StoredValue *v, int h) {
+        bucketLink(values, groups, bucket_num, v, h);
+        indexExpiry(v, 0);
+    }
+
+    /**
+     * Take a value out of the given (locked) bucket and free it.  The
+     * caller keeps the item counts.
+     */
+    void unlinkValue(int bucket_num, StoredValue *v) {
+        bucketUnlink(values, groups, bucket_num, v);
+        time_t indexed = v->getIndexedExptime();
+        if (indexed != 0 && expiryIndex) {
+            expiryIndex->remove(v->getKey(), indexed);
+        }
+        size_t currSize = v->size();
+        StoredValue::reduceCacheSize(*this, currSize);
+        StoredValue::reduceCurrentSize(stats, v->isDeleted() ? currSize
+                                       : currSize - v->value->length());
+        StoredValue::reduceMetaDataSize(*this, v->metaDataSize());
+        StoredValue::destroy(v);
+    }
+
+    static BucketGroup *allocGroups(size_t n);
+    static void freeGroups(BucketGroup *g);
+
+    /**
+     * Move every old bucket of the given (held) lock stripe.
+     */
+    void migrateStripe(int lock_num) {
+        for (int i = lock_num; i < static_cast<int>(oldSize); i += n_locks) {
+            migrateBucket(i);
+        }
+    }
+
+    bool doResizeStep(size_t maxBuckets);
+    void completeResize();
+
     inline int mutexForBucket(int bucket_num) {
         assert(isActive());
         assert(bucket_num >= 0);
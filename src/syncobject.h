@@ -63,10 +63,12 @@ public:
     }
 
     void wait() {
+        suspendHold();
         if (pthread_cond_wait(&cond, &mutex) != 0) {
             throw std::runtime_error("Failed to wait for condition.");
         }
         setHolder(true);
+        resumeHold();
     }
 
     bool wait(const struct timeval &tv) {
@@ -74,12 +76,15 @@ public:
         ts.tv_sec = tv.tv_sec + 0;
         ts.tv_nsec = tv.tv_usec * 1000;
 
+        suspendHold();
         switch (pthread_cond_timedwait(&cond, &mutex, &ts)) {
         case 0:
             setHolder(true);
+            resumeHold();
             return true;
         case ETIMEDOUT:
             setHolder(true);
+            resumeHold();
             return false;
         default:
             throw std::runtime_error("Failed timed_wait for condition.");
@@ -21,11 +21,14 @@
 
 #include "dispatcher.h"
 #include "ep_engine.h"
+#include "lockprofile.h"
 #define STATWRITER_NAMESPACE tap
 #include "statwriter.h"
 #undef STATWRITER_NAMESPACE
 #include "tapconnection.h"
 
+LockSite TapProducer::queueLockSite("tap_producer_queue_lock");
+
 const uint8_t TapEngineSpecific::nru(1);
 const short int TapEngineSpecific::sizeRevSeqno(8);
 const short int TapEngineSpecific::sizeExtra(1);
@@ -157,6 +160,14 @@ public:
             config.setBgMaxPending(value);
         } else if (key.compare("tap_backlog_limit") == 0) {
             config.setBackfillBacklogLimit(value);
+        } else if (key.compare("tap_cursor_batch_items") == 0) {
+            config.setCursorBatchItems(value);
+        } else if (key.compare("tap_cursor_batch_bytes") == 0) {
+            config.setCursorBatchBytes(value);
+        } else if (key.compare("tap_cursor_drop_pcnt") == 0) {
+            config.setCursorDropPcnt(value);
+        } else if (key.compare("tap_cursor_drop_chks") == 0) {
+            config.setCursorDropChks(value);
         }
     }
 
@@ -187,6 +198,10 @@ TapConfig::TapConfig(EventuallyPersistentEngine &e)
     requeueSleepTime = config.getTapRequeueSleepTime();
     backfillBacklogLimit = config.getTapBacklogLimit();
     backfillResidentThreshold = config.getTapBackfillResident();
+    cursorBatchItems = config.getTapCursorBatchItems();
+    cursorBatchBytes = config.getTapCursorBatchBytes();
+    cursorDropPcnt = config.getTapCursorDropPcnt();
+    cursorDropChks = config.getTapCursorDropChks();
 }
 
 void TapConfig::addConfigChangeListener(EventuallyPersistentEngine &engine) {
@@ -209,6 +224,14 @@ void TapConfig::addConfigChangeListener(EventuallyPersistentEngine &engine) {
                               new TapConfigChangeListener(engine.getTapConfig()));
     configuration.addValueChangedListener("tap_backfill_resident",
                               new TapConfigChangeListener(engine.getTapConfig()));
+    configuration.addValueChangedListener("tap_cursor_batch_items",
+                              new TapConfigChangeListener(engine.getTapConfig()));
+    configuration.addValueChangedListener("tap_cursor_batch_bytes",
+                              new TapConfigChangeListener(engine.getTapConfig()));
+    configuration.addValueChangedListener("tap_cursor_drop_pcnt",
+                              new TapConfigChangeListener(engine.getTapConfig()));
+    configuration.addValueChangedListener("tap_cursor_drop_chks",
+                              new TapConfigChangeListener(engine.getTapConfig()));
 }
 
 TapProducer::TapProducer(EventuallyPersistentEngine &theEngine,
@@ -250,6 +273,7 @@ TapProducer::TapProducer(EventuallyPersistentEngine &theEngine,
     specificData(NULL),
     backfillTimestamp(0)
 {
+    queueLock.setLockSite(&queueLockSite);
     evaluateFlags();
     queue = new std::list<queued_item>;
     specificData = new uint8_t[TapEngineSpecific::sizeTotal];
@@ -479,7 +503,7 @@ void TapProducer::registerTAPCursor(const std::map<uint16_t, uint64_t> &lastChec
             // As TAP dump option simply requires the snapshot of each vbucket, simply schedule
             // backfill and skip the checkpoint cursor registration.
             if (dumpQueue) {
-                if (vb->getState() == vbucket_state_active && vb->ht.getNumItems() > 0) {
+                if (vb->getState() == vbucket_state_active && vb->ht.getNumTotalItems() > 0) {
                     backfill_vbuckets.push_back(vbid);
                 }
                 continue;
@@ -626,6 +650,7 @@ void TapProducer::clearQueues_UNLOCKED() {
     std::map<uint16_t, TapCheckpointState>::iterator it = tapCheckpointState.begin();
     for (; it != tapCheckpointState.end(); ++it) {
         it->second.bgResultSize = 0;
+        it->second.queuedLastItems.clear();
     }
 
     // Clear the checkpoint message queue as well
@@ -1518,6 +1543,15 @@ queued_item TapProducer::nextFgFetched_UNLOCKED(bool &shouldPause) {
         uint16_t invalid_count = 0;
         uint16_t open_checkpoint_count = 0;
         uint16_t wait_for_ack_count = 0;
+        uint16_t wait_for_load_count = 0;
+        // Each cursor is drained a batch at a time into the queue, under a
+        // single acquisition of its checkpoint manager's lock.
+        const TapConfig &tapConfig = engine.getTapConfig();
+        std::vector<queued_item> items;
+        std::vector<bool> lastItems;
+        // Spilled checkpoints are read back in on the auxiliary IO
+        // dispatcher, never on this thread.
+        bool loadWanted = false;
 
         std::map<uint16_t, TapCheckpointState>::iterator it = tapCheckpointState.begin();
         for (; it != tapCheckpointState.end(); ++it) {
@@ -1531,74 +1565,94 @@ queued_item TapProducer::nextFgFetched_UNLOCKED(bool &shouldPause) {
                 continue;
             }
 
-            bool isLastItem = false;
-            queued_item qi = vb->checkpointManager.nextItem(name, isLastItem);
-            switch(qi->getOperation()) {
-            case queue_op_set:
-            case queue_op_del:
-                if (supportCheckpointSync && isLastItem) {
-                    it->second.lastItem = true;
-                } else {
-                    it->second.lastItem = false;
+            items.clear();
+            lastItems.clear();
+            size_t fetched = vb->checkpointManager.nextItems(name, it->second.cursorHandle,
+                                                             tapConfig.getCursorBatchItems(),
+                                                             tapConfig.getCursorBatchBytes(),
+                                                             items, lastItems);
+            bool waiting = vb->checkpointManager.hasPendingReadAhead();
+            loadWanted = loadWanted || waiting;
+            if (fetched == 0) {
+                if (waiting) {
+                    // Not at the open checkpoint, just held up until the
+                    // next one is back in memory.
+                    ++wait_for_load_count;
+                    continue;
                 }
-                addEvent_UNLOCKED(qi);
-                break;
-            case queue_op_checkpoint_start:
-                {
-                    it->second.currentCheckpointId = qi->getSeqno();
-                    if (supportCheckpointSync) {
-                        it->second.state = checkpoint_start;
-                        addCheckpointMessage_UNLOCKED(qi);
+                ++open_checkpoint_count;
+                if (closedCheckpointOnly) {
+                    // If all the cursors are at the open checkpoints, send the OPAQUE message
+                    // to the TAP client so that it can close the connection if necessary.
+                    if (open_checkpoint_count == (tapCheckpointState.size() - invalid_count)) {
+                        TapVBucketEvent ev(TAP_OPAQUE, vbid,
+                                           (vbucket_state_t)htonl(TAP_OPAQUE_OPEN_CHECKPOINT));
+                        addVBucketHighPriority_UNLOCKED(ev);
                     }
                 }
-                break;
-            case queue_op_checkpoint_end:
-                if (supportCheckpointSync) {
-                    it->second.state = checkpoint_end;
-                    uint32_t seqno_acked;
-                    if (seqnoReceived == 0) {
-                        seqno_acked = 0;
-                    } else {
-                        seqno_acked = isLastAckSucceed ? seqnoReceived : seqnoReceived - 1;
+                continue;
+            }
+
+            for (size_t i = 0; i < items.size(); ++i) {
+                const queued_item &qi = items[i];
+                switch(qi->getOperation()) {
+                case queue_op_set:
+                case queue_op_del:
+                    // lastItem is set once this is the item being sent.
+                    if (supportCheckpointSync && lastItems[i]) {
+                        it->second.queuedLastItems.push_back(qi);
                     }
-                    if (it->second.lastSeqNum <= seqno_acked &&
-                        it->second.isBgFetchCompleted()) {
-                        // All resident and non-resident items in a checkpoint are sent
-                        // and acked. CHEKCPOINT_END message is going to be sent.
-                        addCheckpointMessage_UNLOCKED(qi);
-                    } else {
-                        vb->checkpointManager.decrTapCursorFromCheckpointEnd(name);
-                        ++wait_for_ack_count;
+                    addEvent_UNLOCKED(qi);
+                    break;
+                case queue_op_checkpoint_start:
+                    {
+                        it->second.currentCheckpointId = qi->getSeqno();
+                        if (supportCheckpointSync) {
+                            it->second.state = checkpoint_start;
+                            addCheckpointMessage_UNLOCKED(qi);
+                        }
                     }
-                }
-                break;
-            case queue_op_empty:
-                {
-                    ++open_checkpoint_count;
-                    if (closedCheckpointOnly) {
-                        // If all the cursors are at the open checkpoints, send the OPAQUE message
-                        // to the TAP client so that it can close the connection if necessary.
-                        if (open_checkpoint_count == (tapCheckpointState.size() - invalid_count)) {
-                            TapVBucketEvent ev(TAP_OPAQUE, qi->getVBucketId(),
-                                               (vbucket_state_t)htonl(TAP_OPAQUE_OPEN_CHECKPOINT));
-                            addVBucketHighPriority_UNLOCKED(ev);
+                    break;
+                case queue_op_checkpoint_end:
+                    if (supportCheckpointSync) {
+                        it->second.state = checkpoint_end;
+                        uint32_t seqno_acked;
+                        if (seqnoReceived == 0) {
+                            seqno_acked = 0;
+                        } else {
+                            seqno_acked = isLastAckSucceed ? seqnoReceived : seqnoReceived - 1;
+                        }
+                        if (it->second.lastSeqNum <= seqno_acked &&
+                            it->second.isBgFetchCompleted()) {
+                            // All resident and non-resident items in a checkpoint are sent
+                            // and acked. CHEKCPOINT_END message is going to be sent.
+                            addCheckpointMessage_UNLOCKED(qi);
+                        } else {
+                            vb->checkpointManager.decrTapCursorFromCheckpointEnd(name);
+                            ++wait_for_ack_count;
                         }
                     }
+                    break;
+                default:
+                    break;
                 }
-                break;
-            default:
-                break;
             }
         }
 
+        if (loadWanted) {
+            engine.getEpStore()->scheduleCheckpointLoad();
+        }
+
         if (wait_for_ack_count == (tapCheckpointState.size() - invalid_count)) {
             // All the TAP cursors are now at their checkpoint end position and should wait until
             // they are implicitly acked for all items belonging to their corresponding checkpoint.
             shouldPause = true;
-        } else if ((wait_for_ack_count + open_checkpoint_count) ==
+        } else if (static_cast<size_t>(wait_for_ack_count + open_checkpoint_count +
+                                       wait_for_load_count) ==
                    (tapCheckpointState.size() - invalid_count)) {
-            // All the TAP cursors are either at their checkpoint end position to wait for acks or
-            // reaches to the end of the current open checkpoint.
+            // All the TAP cursors are either at their checkpoint end position to wait for acks,
+            // reaches to the end of the current open checkpoint, or wait for a spilled one to
+            // be read back in.
             shouldPause = true;
         }
     }
@@ -1615,6 +1669,18 @@ queued_item TapProducer::nextFgFetched_UNLOCKED(bool &shouldPause) {
         stats.memOverhead.decr(sizeof(queued_item));
         assert(stats.memOverhead.get() < GIGANTOR);
         ++recordsFetched;
+        if (supportCheckpointSync) {
+            std::map<uint16_t, TapCheckpointState>::iterator it =
+                tapCheckpointState.find(qi->getVBucketId());
+            if (it != tapCheckpointState.end()) {
+                std::list<queued_item> &lastItems = it->second.queuedLastItems;
+                it->second.lastItem = !lastItems.empty() &&
+                    lastItems.front().get() == qi.get();
+                if (it->second.lastItem) {
+                    lastItems.pop_front();
+                }
+            }
+        }
         return qi;
     }
 
@@ -1697,9 +1763,9 @@ void TapProducer::setClosedCheckpointOnlyFlag(bool isClosedCheckpointOnly) {
     closedCheckpointOnly = isClosedCheckpointOnly;
 }
 
-void TapProducer::scheduleBackfill_UNLOCKED(const std::vector<uint16_t> &vblist) {
+size_t TapProducer::scheduleBackfill_UNLOCKED(const std::vector<uint16_t> &vblist) {
     if (backfillAge > (uint64_t)ep_real_time()) {
-        return;
+        return 0;
     }
 
     std::vector<uint16_t> new_vblist;
@@ -1745,6 +1811,7 @@ void TapProducer::scheduleBackfill_UNLOCKED(const std::vector<uint16_t> &vblist)
         backfillCompleted = false;
         backfillTimestamp = ep_real_time();
     }
+    return new_vblist.size();
 }
 
 Item* TapProducer::getNextItem(const void *c, uint16_t *vbucket, tap_event_t &ret,
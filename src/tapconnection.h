@@ -190,7 +190,11 @@ public:
 
     // True if the TAP cursor reaches to the last item at its current checkpoint.
     bool lastItem;
+    // Queued items that are the last ones at their checkpoints, oldest first.
+    std::list<queued_item> queuedLastItems;
     tap_checkpoint_state state;
+    // Where the TAP cursor is in the vbucket's checkpoint manager.
+    TapCursorHandle cursorHandle;
 };
 
 /**
@@ -235,6 +239,22 @@ public:
         return backfillResidentThreshold;
     }
 
+    size_t getCursorBatchItems() const {
+        return cursorBatchItems;
+    }
+
+    size_t getCursorBatchBytes() const {
+        return cursorBatchBytes;
+    }
+
+    size_t getCursorDropPcnt() const {
+        return cursorDropPcnt;
+    }
+
+    size_t getCursorDropChks() const {
+        return cursorDropChks;
+    }
+
 protected:
     friend class TapConfigChangeListener;
     friend class EventuallyPersistentEngine;
@@ -278,6 +298,22 @@ protected:
         backfillResidentThreshold = value;
     }
 
+    void setCursorBatchItems(size_t value) {
+        cursorBatchItems = value;
+    }
+
+    void setCursorBatchBytes(size_t value) {
+        cursorBatchBytes = value;
+    }
+
+    void setCursorDropPcnt(size_t value) {
+        cursorDropPcnt = value;
+    }
+
+    void setCursorDropChks(size_t value) {
+        cursorDropChks = value;
+    }
+
     static void addConfigChangeListener(EventuallyPersistentEngine &engine);
 
 private:
@@ -301,6 +337,16 @@ private:
     size_t backfillBacklogLimit;
     double backfillResidentThreshold;
 
+    // Most items and bytes taken from a checkpoint cursor at once
+    size_t cursorBatchItems;
+    size_t cursorBatchBytes;
+
+    // When a cursor falling behind is dropped for a backfill from disk;
+    // the percentage of mem_used its unread checkpoints take, and how many
+    // of them there are (0 for no limit)
+    size_t cursorDropPcnt;
+    size_t cursorDropChks;
+
     EventuallyPersistentEngine &engine;
 };
 
@@ -947,11 +993,16 @@ private:
         return isBackfillCompleted_UNLOCKED();
     }
 
-    void scheduleBackfill_UNLOCKED(const std::vector<uint16_t> &vblist);
+    /**
+     * Backfill the given vbuckets from disk, dropping their checkpoint
+     * cursors, skipping any already being backfilled.
+     * @return the number of vbuckets a backfill was scheduled for
+     */
+    size_t scheduleBackfill_UNLOCKED(const std::vector<uint16_t> &vblist);
 
-    void scheduleBackfill(const std::vector<uint16_t> &vblist) {
+    size_t scheduleBackfill(const std::vector<uint16_t> &vblist) {
         LockHolder lh(queueLock);
-        scheduleBackfill_UNLOCKED(vblist);
+        return scheduleBackfill_UNLOCKED(vblist);
     }
 
     bool runBackfill(VBucketFilter &vbFilter);
@@ -1077,6 +1128,7 @@ private:
 
     //! Lock held during queue operations.
     Mutex queueLock;
+    static LockSite queueLockSite;
     //! Queue of live stream items that needs to be sent
     std::list<queued_item> *queue;
     //! Live stream queue size
@@ -24,9 +24,12 @@
 #include <vector>
 
 #include "ep_engine.h"
+#include "lockprofile.h"
 #include "tapconnection.h"
 #include "tapconnmap.h"
 
+LockSite TapConnMap::notifySyncSite("tap_notify_sync");
+
 /**
  * Dispatcher task to nuke a tap connection.
  */
@@ -87,6 +90,7 @@ private:
 TapConnMap::TapConnMap(EventuallyPersistentEngine &theEngine) :
     notifyCounter(0), engine(theEngine), nextTapNoop(0)
 {
+    notifySync.setLockSite(&notifySyncSite);
     Configuration &config = engine.getConfiguration();
     tapNoopInterval = config.getTapNoopInterval();
     config.addValueChangedListener("tap_noop_interval",
@@ -410,6 +414,25 @@ void TapConnMap::scheduleBackfill(const std::set<uint16_t> &backfillVBuckets) {
     }
 }
 
+bool TapConnMap::dropSlowCursor(const std::string &name, uint16_t vbucket) {
+    LockHolder lh(notifySync);
+    TapProducer *tp = dynamic_cast<TapProducer*>(findByName_UNLOCKED(name));
+    if (!(tp && (tp->isConnected() || tp->getExpiryTime() > ep_current_time())) ||
+        !tp->checkVBucketFilter(vbucket)) {
+        return false;
+    }
+
+    std::vector<uint16_t> vblist(1, vbucket);
+    if (tp->scheduleBackfill(vblist) == 0) {
+        return false;
+    }
+    LOG(EXTENSION_LOG_WARNING,
+        "%s Dropped the slow checkpoint cursor for vbucket %d, backfilling "
+        "it from disk instead", tp->logHeader(), vbucket);
+    notify_UNLOCKED();
+    return true;
+}
+
 void TapConnMap::resetReplicaChain() {
     LockHolder lh(notifySync);
     rel_time_t now = ep_current_time();
@@ -273,6 +273,15 @@ public:
 
     void scheduleBackfill(const std::set<uint16_t> &backfillVBuckets);
 
+    /**
+     * Drop a TAP producer's checkpoint cursor on a vbucket it has fallen
+     * too far behind on, and backfill the vbucket from disk instead.
+     * @param name the TAP producer name, which is also its cursor's
+     * @param vbucket the vbucket whose cursor is dropped
+     * @return true if the cursor was dropped
+     */
+    bool dropSlowCursor(const std::string &name, uint16_t vbucket);
+
     void resetReplicaChain();
 
     /**
@@ -339,6 +348,7 @@ private:
     }
 
     SyncObject                               notifySync;
+    static LockSite                          notifySyncSite;
     uint32_t                                 notifyCounter;
     std::map<const void*, TapConnection*>    map;
     std::list<TapConnection*>                all;
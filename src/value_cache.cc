@@ -0,0 +1,133 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2012 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "config.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+
+#include "value_cache.h"
+
+const size_t ValueCache::MIN_CAPACITY(1024 * 1024);
+
+ValueCache::ValueCache(EPStats &st, const std::string &p, size_t cap) :
+    stats(st), path(p), capacity(cap & ~(sizeof(uint64_t) - 1)), fd(-1),
+    base(NULL) {
+    if (capacity < MIN_CAPACITY) {
+        std::stringstream ss;
+        ss << "Value cache size " << cap << " is below " << MIN_CAPACITY;
+        throw OpenException(ss.str());
+    }
+    // Whatever an earlier run left behind is stale.
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0 || ftruncate(fd, capacity) != 0) {
+        std::stringstream ss;
+        ss << "Unable to create value cache file " << path << ": "
+           << strerror(errno);
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        throw OpenException(ss.str());
+    }
+    void *m = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (m == MAP_FAILED) {
+        std::stringstream ss;
+        ss << "Unable to map value cache file " << path << ": "
+           << strerror(errno);
+        ::close(fd);
+        unlink(path.c_str());
+        throw OpenException(ss.str());
+    }
+    base = static_cast<char*>(m);
+}
+
+ValueCache::~ValueCache() {
+    munmap(base, capacity);
+    ::close(fd);
+    unlink(path.c_str());
+}
+
+bool ValueCache::put(const std::string &key, uint64_t cas,
+                     const value_t &value, uint64_t &offset) {
+    assert(!value->isCompressed());
+    size_t len = recordSize(key.length(), value->length());
+    // Anything bigger would push out too much at once.
+    if (len > capacity / 4) {
+        return false;
+    }
+
+    uint64_t at;
+    {
+        LockHolder lh(mutex);
+        at = head.get();
+        // Records don't wrap; the end of the file is skipped instead.
+        size_t pos = static_cast<size_t>(at % capacity);
+        if (pos + len > capacity) {
+            at += capacity - pos;
+        }
+        // Moved before writing, so readers of what gets overwritten
+        // see their records are gone.
+        head.set(at + len);
+    }
+
+    Record r;
+    r.offset = at;
+    r.cas = cas;
+    r.keylen = static_cast<uint32_t>(key.length());
+    r.vlen = static_cast<uint32_t>(value->length());
+    char *p = base + at % capacity;
+    std::memcpy(p, &r, sizeof(r));
+    std::memcpy(p + sizeof(r), key.data(), key.length());
+    std::memcpy(p + sizeof(r) + key.length(), value->getData(),
+                value->length());
+
+    offset = at;
+    ++stats.valueCacheWrites;
+    stats.valueCacheBytesWritten.incr(len);
+    return true;
+}
+
+value_t ValueCache::get(uint64_t offset, const std::string &key, uint64_t cas) {
+    value_t rv;
+    if (isLive(offset)) {
+        const char *p = base + offset % capacity;
+        Record r;
+        std::memcpy(&r, p, sizeof(r));
+        if (r.offset == offset && r.cas == cas && r.keylen == key.length() &&
+            offset % capacity + recordSize(r.keylen, r.vlen) <= capacity &&
+            std::memcmp(p + sizeof(r), key.data(), key.length()) == 0) {
+            rv.reset(Blob::New(p + sizeof(r) + r.keylen, r.vlen));
+        }
+        // The record may have been overwritten while it was copied.
+        if (!isLive(offset)) {
+            rv.reset();
+        }
+    }
+
+    if (rv.get() != NULL) {
+        ++stats.valueCacheHits;
+    } else {
+        ++stats.valueCacheMisses;
+    }
+    return rv;
+}
@@ -0,0 +1,140 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2012 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#ifndef SRC_VALUE_CACHE_H_
+#define SRC_VALUE_CACHE_H_ 1
+
+#include "config.h"
+
+#include <stdexcept>
+#include <string>
+
+#include "atomic.h"
+#include "common.h"
+#include "item.h"
+#include "locks.h"
+#include "stats.h"
+
+/**
+ * A second tier for ejected values: a memory mapped local file written
+ * as a log.
+ *
+ * Every value put here is appended at the head of the log, and the
+ * caller keeps the offset it went to.  Once the log reaches its size it
+ * wraps around and overwrites its oldest records, so the file never
+ * grows and nothing ever has to be compacted; records that were
+ * overwritten, or whose item changed since, simply no longer match and
+ * the value has to come from disk again.
+ *
+ * The file only holds copies of clean values and is started over every
+ * time it's opened.
+ */
+class ValueCache {
+public:
+
+    /**
+     * Exception thrown when the cache file can't be set up.
+     */
+    class OpenException : public std::runtime_error {
+    public:
+        OpenException(const std::string &s) : std::runtime_error(s) {}
+    };
+
+    /**
+     * Create and map the cache file.
+     *
+     * @param st the stats to count hits and misses in
+     * @param path where to put the file
+     * @param capacity the size of the file in bytes, at least MIN_CAPACITY
+     * @throws OpenException if the file can't be created or mapped
+     */
+    ValueCache(EPStats &st, const std::string &path, size_t capacity);
+
+    //! Smallest file the cache works with.
+    static const size_t MIN_CAPACITY;
+
+    ~ValueCache();
+
+    /**
+     * Append a value to the log.
+     *
+     * @param key the item's key
+     * @param cas the item's CAS, which has to match when reading it back
+     * @param value the value, which must not be compressed
+     * @param offset set to where the value went
+     * @return false if the value is too big for the cache
+     */
+    bool put(const std::string &key, uint64_t cas, const value_t &value,
+             uint64_t &offset);
+
+    /**
+     * Read a value back.
+     *
+     * @param offset where put() stored the value
+     * @param key the item's key
+     * @param cas the item's CAS
+     * @return the value, or a NULL value if it has been overwritten or
+     *         the item has changed since
+     */
+    value_t get(uint64_t offset, const std::string &key, uint64_t cas);
+
+    size_t getCapacity() const {
+        return capacity;
+    }
+
+    /**
+     * Bytes of the file that hold records.
+     */
+    size_t getUsed() const {
+        uint64_t h = head.get();
+        return h < capacity ? static_cast<size_t>(h) : capacity;
+    }
+
+private:
+
+    //! What precedes every value in the log.
+    struct Record {
+        uint64_t offset;
+        uint64_t cas;
+        uint32_t keylen;
+        uint32_t vlen;
+    };
+
+    static size_t recordSize(size_t keylen, size_t vlen) {
+        size_t len = sizeof(Record) + keylen + vlen;
+        return (len + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1);
+    }
+
+    //! True if the record at the offset hasn't been overwritten.
+    bool isLive(uint64_t offset) const {
+        uint64_t h = head.get();
+        return h <= capacity || offset >= h - capacity;
+    }
+
+    EPStats          &stats;
+    std::string       path;
+    size_t            capacity;
+    int               fd;
+    char             *base;
+    //! Logical offset the next record goes to; the file holds the
+    //! capacity bytes before it.
+    Atomic<uint64_t>  head;
+    Mutex             mutex;
+
+    DISALLOW_COPY_AND_ASSIGN(ValueCache);
+};
+
+#endif  // SRC_VALUE_CACHE_H_
@@ -156,17 +156,17 @@ void VBucket::setState(vbucket_state_t to, SERVER_HANDLE_V1 *sapi) {
     state = to;
 }
 
-void VBucket::doStatsForQueueing(QueuedItem& qi, size_t itemBytes)
+void VBucket::doStatsForQueueing(uint32_t queuedTime, size_t itemBytes)
 {
     ++dirtyQueueSize;
     dirtyQueueMem.incr(sizeof(QueuedItem));
     ++dirtyQueueFill;
-    dirtyQueueAge.incr(qi.getQueuedTime());
+    dirtyQueueAge.incr(queuedTime);
     dirtyQueuePendingWrites.incr(itemBytes);
 }
 
 
-void VBucket::doStatsForFlushing(QueuedItem& qi, size_t itemBytes)
+void VBucket::doStatsForFlushing(uint32_t queuedTime, size_t itemBytes)
 {
     if (dirtyQueueSize > 0) {
         --dirtyQueueSize;
@@ -178,8 +178,8 @@ void VBucket::doStatsForFlushing(QueuedItem& qi, size_t itemBytes)
     }
     ++dirtyQueueDrain;
 
-    if (dirtyQueueAge > qi.getQueuedTime()) {
-        dirtyQueueAge.decr(qi.getQueuedTime());
+    if (dirtyQueueAge > queuedTime) {
+        dirtyQueueAge.decr(queuedTime);
     } else {
         dirtyQueueAge.set(0);
     }
@@ -205,6 +205,8 @@ void VBucket::resetStats() {
     dirtyQueueAge.set(0);
     dirtyQueuePendingWrites.set(0);
     dirtyQueueDrain.set(0);
+    bFilterSkips.set(0);
+    bFilterFalsePositives.set(0);
 }
 
 template <typename T>
@@ -299,11 +301,14 @@ size_t VBucket::getCheckpointFlushTimeout() {
 void VBucket::addStats(bool details, ADD_STAT add_stat, const void *c) {
     addStat(NULL, toString(state), add_stat, c);
     if (details) {
-        size_t numItems = ht.getNumItems();
+        size_t numItems = ht.getNumTotalItems();
         size_t tempItems = ht.getNumTempItems();
         addStat("num_items", numItems, add_stat, c);
         addStat("num_temp_items", tempItems, add_stat, c);
-        addStat("num_non_resident", ht.getNumNonResidentItems(), add_stat, c);
+        addStat("num_non_resident",
+                ht.getNumNonResidentItems() + ht.getNumEjectedItems(),
+                add_stat, c);
+        addStat("num_ejected_items", ht.getNumEjectedItems(), add_stat, c);
         addStat("num_referenced", ht.getNumReferenced(), add_stat, c);
         addStat("ht_memory", ht.memorySize(), add_stat, c);
         addStat("ht_item_memory", ht.getItemMemory(), add_stat, c);
@@ -319,5 +324,13 @@ void VBucket::addStats(bool details, ADD_STAT add_stat, const void *c) {
         addStat("queue_drain", dirtyQueueDrain, add_stat, c);
         addStat("queue_age", getQueueAge(), add_stat, c);
         addStat("pending_writes", dirtyQueuePendingWrites, add_stat, c);
+        if (bFilter) {
+            addStat("bloom_filter_key_count", bFilter->getNumKeys(), add_stat, c);
+            addStat("bloom_filter_size", bFilter->getNumCounters(), add_stat, c);
+            addStat("bloom_filter_hashes", bFilter->getNumHashes(), add_stat, c);
+            addStat("bloom_filter_skips", bFilterSkips, add_stat, c);
+            addStat("bloom_filter_false_positives", bFilterFalsePositives,
+                    add_stat, c);
+        }
     }
 }
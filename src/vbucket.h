@@ -34,6 +34,7 @@
 
 #include "atomic.h"
 #include "bgfetcher.h"
+#include "bloomfilter.h"
 #include "checkpoint.h"
 #include "common.h"
 #include "queueditem.h"
@@ -140,15 +141,23 @@ class EventuallyPersistentEngine;
 class VBucket : public RCValue {
 public:
 
+    /**
+     * @param filterKeyCount the number of keys to size the Bloom filter
+     *        of keys on disk for, or 0 for none
+     * @param filterFpProb the filter's false positive rate at that many keys
+     */
     VBucket(int i, vbucket_state_t newState, EPStats &st, CheckpointConfig &checkpointConfig,
-            vbucket_state_t initState = vbucket_state_dead, uint64_t checkpointId = 1) :
+            vbucket_state_t initState = vbucket_state_dead, uint64_t checkpointId = 1,
+            size_t filterKeyCount = 0, double filterFpProb = 0.01) :
         ht(st), checkpointManager(st, i, checkpointConfig, checkpointId), id(i), state(newState),
         initialState(initState), stats(st) {
 
         backfill.isBackfillPhase = false;
         pendingOpsStart = 0;
-        stats.memOverhead.incr(sizeof(VBucket)
-                               + ht.memorySize() + sizeof(CheckpointManager));
+        bFilter = filterKeyCount ? new BloomFilter(filterKeyCount,
+                                                   filterFpProb) : NULL;
+        stats.memOverhead.incr(sizeof(VBucket) + ht.memorySize() +
+                               sizeof(CheckpointManager) + filterMemorySize());
         assert(stats.memOverhead.get() < GIGANTOR);
     }
 
@@ -167,8 +176,10 @@ public:
             delete pendingBGFetches.front();
             pendingBGFetches.pop();
         }
-        stats.memOverhead.decr(sizeof(VBucket) + ht.memorySize() + sizeof(CheckpointManager));
+        stats.memOverhead.decr(sizeof(VBucket) + ht.memorySize() +
+                               sizeof(CheckpointManager) + filterMemorySize());
         assert(stats.memOverhead.get() < GIGANTOR);
+        delete bFilter;
         LOG(EXTENSION_LOG_INFO, "Destroying vbucket %d\n", id);
     }
 
@@ -197,8 +208,19 @@ public:
         return true;
     }
 
-    void doStatsForQueueing(QueuedItem& item, size_t itemBytes);
-    void doStatsForFlushing(QueuedItem& item, size_t itemBytes);
+    void doStatsForQueueing(QueuedItem& qi, size_t itemBytes) {
+        doStatsForQueueing(qi.getQueuedTime(), itemBytes);
+    }
+    void doStatsForFlushing(QueuedItem& qi, size_t itemBytes) {
+        doStatsForFlushing(qi.getQueuedTime(), itemBytes);
+    }
+
+    /**
+     * Account for an item queued or flushed by its queued time alone, for
+     * callers that never materialize a QueuedItem.
+     */
+    void doStatsForQueueing(uint32_t queuedTime, size_t itemBytes);
+    void doStatsForFlushing(uint32_t queuedTime, size_t itemBytes);
     void resetStats();
 
     // Get age sum in millisecond
@@ -258,6 +280,38 @@ public:
         return !pendingBGFetches.empty();
     }
 
+    bool hasFilter() const {
+        return bFilter != NULL;
+    }
+
+    /**
+     * Note that a new document for the key is being written to disk.
+     */
+    void addToFilter(const std::string &key) {
+        if (bFilter) {
+            bFilter->addKey(key);
+        }
+    }
+
+    /**
+     * Note that the document for a key added earlier has been deleted
+     * on disk.
+     */
+    void removeFromFilter(const std::string &key) {
+        if (bFilter) {
+            bFilter->removeKey(key);
+        }
+    }
+
+    /**
+     * @return false if the key definitely has no live document on disk;
+     *         always true until warmup has seen every key on disk
+     */
+    bool maybeKeyExistsInFilter(const std::string &key) {
+        return bFilter == NULL || !stats.warmupComplete.get() ||
+            bFilter->maybeKeyExists(key);
+    }
+
     static const char* toString(vbucket_state_t s) {
         switch(s) {
         case vbucket_state_active: return "active"; break;
@@ -315,6 +369,11 @@ public:
 
     Atomic<size_t>  numExpiredItems;
 
+    //! Disk lookups the Bloom filter ruled out.
+    Atomic<size_t>  bFilterSkips;
+    //! Disk lookups the Bloom filter let through that found nothing.
+    Atomic<size_t>  bFilterFalsePositives;
+
 private:
     template <typename T>
     void addStat(const char *nm, T val, ADD_STAT add_stat, const void *c);
@@ -323,6 +382,10 @@ private:
 
     void adjustCheckpointFlushTimeout(size_t wall_time);
 
+    size_t filterMemorySize() const {
+        return bFilter ? sizeof(BloomFilter) + bFilter->memorySize() : 0;
+    }
+
     int                      id;
     Atomic<vbucket_state_t>  state;
     vbucket_state_t          initialState;
@@ -338,6 +401,8 @@ private:
     std::list<HighPriorityVBEntry> hpChks;
     static size_t chkFlushTimeout;
 
+    BloomFilter *bFilter;
+
     DISALLOW_COPY_AND_ASSIGN(VBucket);
 };
 
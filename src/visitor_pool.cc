@@ -0,0 +1,223 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2012 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "config.h"
+
+#include <algorithm>
+#include <limits>
+
+#include "ep.h"
+#include "visitor_pool.h"
+
+extern "C" {
+    static void *launch_visitor_thread(void *arg) {
+        static_cast<VisitorPool*>(arg)->run();
+        return NULL;
+    }
+}
+
+size_t VisitorPool::grow(size_t to) {
+    LockHolder lh(mutex);
+    while (!stopping && threads.size() < to) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, launch_visitor_thread, this) != 0) {
+            LOG(EXTENSION_LOG_WARNING,
+                "Failed to start a visitor thread, have %ld",
+                threads.size());
+            break;
+        }
+        threads.push_back(thread);
+    }
+    return threads.size();
+}
+
+bool VisitorPool::submit(Job *job) {
+    LockHolder lh(mutex);
+    if (stopping || threads.empty()) {
+        return false;
+    }
+    jobs.push(job);
+    mutex.notify();
+    return true;
+}
+
+void VisitorPool::stop() {
+    std::vector<pthread_t> joining;
+    {
+        LockHolder lh(mutex);
+        stopping = true;
+        joining.swap(threads);
+        mutex.notify();
+    }
+    std::vector<pthread_t>::iterator it;
+    for (it = joining.begin(); it != joining.end(); ++it) {
+        pthread_join(*it, NULL);
+    }
+}
+
+void VisitorPool::run() {
+    LockHolder lh(mutex);
+    while (true) {
+        while (jobs.empty() && !stopping) {
+            mutex.wait();
+        }
+        if (jobs.empty()) {
+            break;
+        }
+        Job *job = jobs.front();
+        jobs.pop();
+        lh.unlock();
+        job->run();
+        lh.lock();
+    }
+}
+
+ParallelVBCBAdaptor::ParallelVBCBAdaptor(VisitorPool &p,
+                                         const VBucketMap &vbs,
+                                         shared_ptr<VBucketVisitor> v,
+                                         std::vector<shared_ptr<VBucketVisitor> > &clones,
+                                         const char *l, size_t chunkItems,
+                                         size_t chunkTime, double sleep) :
+    nextvb(0), running(0), stopping(false), pool(p), vbuckets(vbs),
+    visitor(v), label(l), visitorChunkItems(chunkItems),
+    visitorChunkTime(chunkTime), sleepTime(sleep), started(false)
+{
+    const VBucketFilter &vbFilter = visitor->getVBucketFilter();
+    size_t maxSize = vbuckets.getSize();
+    assert(maxSize <= std::numeric_limits<uint16_t>::max());
+    for (size_t i = 0; i < maxSize; ++i) {
+        uint16_t vbid = static_cast<uint16_t>(i);
+        RCPtr<VBucket> vb = vbuckets.getBucket(vbid);
+        if (vb && vbFilter(vbid)) {
+            vbList.push_back(vbid);
+        }
+    }
+
+    std::vector<shared_ptr<VBucketVisitor> >::iterator it;
+    for (it = clones.begin(); it != clones.end(); ++it) {
+        workers.push_back(new Worker(*this, *it));
+    }
+}
+
+ParallelVBCBAdaptor::~ParallelVBCBAdaptor() {
+    stopWorkers();
+    std::vector<Worker*>::iterator it;
+    for (it = workers.begin(); it != workers.end(); ++it) {
+        delete *it;
+    }
+}
+
+void ParallelVBCBAdaptor::stopWorkers() {
+    // Jobs still queued in the pool find nothing left to do.
+    stopping.set(true);
+    while (running.get() > 0) {
+        usleep(100);
+    }
+}
+
+bool ParallelVBCBAdaptor::run(VBucketVisitor &clone) {
+    while (!stopping.get()) {
+        // Don't sit on the pool thread; other visits need it too.
+        if (clone.pauseVisitor()) {
+            return nextvb.get() < vbList.size();
+        }
+        size_t idx = nextvb++;
+        if (idx >= vbList.size()) {
+            break;
+        }
+        RCPtr<VBucket> vb = vbuckets.getBucket(vbList[idx]);
+        if (!vb || !clone.visitBucket(vb)) {
+            continue;
+        }
+        // Walked in pieces too, so a stop doesn't wait on a big vbucket.
+        HashTable::Position pos;
+        do {
+            pos = vb->ht.visit(clone, pos, visitorChunkItems, visitorChunkTime);
+        } while (!pos.isEnd() && clone.shouldContinue() && !stopping.get());
+    }
+    return false;
+}
+
+void ParallelVBCBAdaptor::runWorker(Worker &w) {
+    if (run(*w.visitor)) {
+        // Marked before it stops counting as running, so step() never
+        // sees it as done.  It may be resubmitted from here on.
+        w.paused.set(true);
+    }
+    --running;
+}
+
+bool ParallelVBCBAdaptor::step() {
+    std::vector<Worker*>::iterator it;
+    if (!started) {
+        started = true;
+        running.set(workers.size());
+        for (it = workers.begin(); it != workers.end(); ++it) {
+            if (!pool.submit(*it)) {
+                --running;
+            }
+        }
+        if (running.get() == 0) {
+            LOG(EXTENSION_LOG_WARNING,
+                "No visitor thread to run %s on, visiting from here", label);
+            ++running;
+            runWorker(*workers.front());
+        }
+    } else {
+        for (it = workers.begin(); it != workers.end(); ++it) {
+            if ((*it)->paused.get()) {
+                (*it)->paused.set(false);
+                ++running;
+                if (!pool.submit(*it)) {
+                    runWorker(**it);
+                }
+            }
+        }
+    }
+
+    if (running.get() > 0) {
+        return true;
+    }
+    for (it = workers.begin(); it != workers.end(); ++it) {
+        if ((*it)->paused.get()) {
+            return true;
+        }
+    }
+
+    for (it = workers.begin(); it != workers.end(); ++it) {
+        visitor->merge(*(*it)->visitor);
+    }
+    visitor->complete();
+    return false;
+}
+
+bool ParallelVBCBAdaptor::callback(Dispatcher &d, TaskId &t) {
+    if (!step()) {
+        return false;
+    }
+    // Back off as the serial adaptor does while a clone is paused.
+    double snooze = 0.1;
+    std::vector<Worker*>::iterator it;
+    for (it = workers.begin(); it != workers.end(); ++it) {
+        if ((*it)->paused.get()) {
+            snooze = std::max(sleepTime, snooze);
+            break;
+        }
+    }
+    d.snooze(t, snooze);
+    return true;
+}
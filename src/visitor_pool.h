@@ -0,0 +1,94 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2012 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#ifndef SRC_VISITOR_POOL_H_
+#define SRC_VISITOR_POOL_H_ 1
+
+#include "config.h"
+
+#include <pthread.h>
+
+#include <queue>
+#include <vector>
+
+#include "common.h"
+#include "locks.h"
+#include "syncobject.h"
+
+/**
+ * A fixed set of threads the vbucket visitors are run on, so a visit
+ * split over threads doesn't have to start and join them every time.
+ */
+class VisitorPool {
+public:
+
+    /**
+     * Something to be run on a pool thread.
+     */
+    class Job {
+    public:
+        virtual ~Job() {}
+        virtual void run() = 0;
+    };
+
+    VisitorPool() : stopping(false) {}
+
+    ~VisitorPool() {
+        stop();
+    }
+
+    /**
+     * Start threads until the pool has the given number.  Threads are
+     * never taken away; the ones not needed just wait for jobs.
+     *
+     * @return the number of threads in the pool
+     */
+    size_t grow(size_t to);
+
+    /**
+     * Queue a job for the next free thread.  The job has to stay around
+     * until it has run.
+     *
+     * @return false if there is no thread to run it
+     */
+    bool submit(Job *job);
+
+    size_t getNumThreads() {
+        LockHolder lh(mutex);
+        return threads.size();
+    }
+
+    /**
+     * Run the jobs still queued, then stop the threads.
+     */
+    void stop();
+
+    /**
+     * The loop every pool thread runs.
+     */
+    void run();
+
+private:
+
+    SyncObject             mutex;
+    std::queue<Job*>       jobs;
+    std::vector<pthread_t> threads;
+    bool                   stopping;
+
+    DISALLOW_COPY_AND_ASSIGN(VisitorPool);
+};
+
+#endif  // SRC_VISITOR_POOL_H_
@@ -164,8 +164,7 @@ void LoadStorageKVPairCallback::initVBucket(uint16_t vbid,
                                             const vbucket_state &vbs) {
     RCPtr<VBucket> vb = vbuckets.getBucket(vbid);
     if (!vb) {
-        vb.reset(new VBucket(vbid, vbucket_state_dead, stats,
-                             epstore->getEPEngine().getCheckpointConfig()));
+        vb.reset(epstore->newVBucket(vbid, vbucket_state_dead));
         vbuckets.addBucket(vb);
     }
     // Set the past initial state of each vbucket.
@@ -184,8 +183,8 @@ void LoadStorageKVPairCallback::callback(GetValue &val) {
     if (i != NULL) {
         RCPtr<VBucket> vb = vbuckets.getBucket(i->getVBucketId());
         if (!vb) {
-            vb.reset(new VBucket(i->getVBucketId(), vbucket_state_dead, stats,
-                                 epstore->getEPEngine().getCheckpointConfig()));
+            vb.reset(epstore->newVBucket(i->getVBucketId(),
+                                         vbucket_state_dead));
             vbuckets.addBucket(vb);
         }
         bool succeeded(false);
@@ -231,6 +230,13 @@ void LoadStorageKVPairCallback::callback(GetValue &val) {
             }
         } while (!succeeded && retry-- > 0);
 
+        // The key is on disk whether or not it made it into memory.
+        // Values loaded after a key dump are for keys seen already.
+        if (warmupState != WarmupState::LoadingData &&
+            warmupState != WarmupState::LoadingAccessLog) {
+            vb->addToFilter(i->getKey());
+        }
+
         bool expired = i->isExpired(startTime);
         if (succeeded && expired) {
             ItemMetaData itemMeta;
@@ -0,0 +1,125 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2012 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "config.h"
+
+#include <cassert>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "bloomfilter.h"
+
+static std::vector<std::string> makeKeys(const std::string &prefix, size_t n) {
+    std::vector<std::string> rv;
+    for (size_t i = 0; i < n; ++i) {
+        std::stringstream ss;
+        ss << prefix << i;
+        rv.push_back(ss.str());
+    }
+    return rv;
+}
+
+static size_t countFalsePositives(BloomFilter &bf,
+                                  const std::vector<std::string> &absent) {
+    size_t rv = 0;
+    for (size_t i = 0; i < absent.size(); ++i) {
+        if (bf.maybeKeyExists(absent[i])) {
+            ++rv;
+        }
+    }
+    return rv;
+}
+
+static void testSizing() {
+    BloomFilter bf(10000, 0.01);
+    // About 9.6 counters and 7 hashes per key for 1%.
+    assert(bf.getNumCounters() > 90000 && bf.getNumCounters() < 100000);
+    assert(bf.getNumHashes() == 7);
+    assert(bf.memorySize() == (bf.getNumCounters() + 1) / 2);
+
+    BloomFilter tiny(1, 0.5);
+    assert(tiny.getNumCounters() >= 64);
+    assert(tiny.getNumHashes() >= 1);
+}
+
+static void testNoFalseNegatives() {
+    BloomFilter bf(10000, 0.01);
+    std::vector<std::string> keys(makeKeys("key:", 10000));
+    for (size_t i = 0; i < keys.size(); ++i) {
+        bf.addKey(keys[i]);
+    }
+    assert(bf.getNumKeys() == keys.size());
+    for (size_t i = 0; i < keys.size(); ++i) {
+        assert(bf.maybeKeyExists(keys[i]));
+    }
+
+    // Near the configured rate at the configured size.
+    std::vector<std::string> absent(makeKeys("missing:", 100000));
+    size_t fp = countFalsePositives(bf, absent);
+    assert(fp < absent.size() / 50);
+}
+
+static void testRemove() {
+    BloomFilter bf(1000, 0.01);
+    std::vector<std::string> keys(makeKeys("k", 1000));
+    for (size_t i = 0; i < keys.size(); ++i) {
+        bf.addKey(keys[i]);
+    }
+    // Keys sharing counters with a removed key must still be found.
+    for (size_t i = 0; i < keys.size(); i += 2) {
+        bf.removeKey(keys[i]);
+    }
+    assert(bf.getNumKeys() == keys.size() / 2);
+    for (size_t i = 1; i < keys.size(); i += 2) {
+        assert(bf.maybeKeyExists(keys[i]));
+    }
+    size_t gone = 0;
+    for (size_t i = 0; i < keys.size(); i += 2) {
+        if (!bf.maybeKeyExists(keys[i])) {
+            ++gone;
+        }
+    }
+    assert(gone > keys.size() / 2 * 9 / 10);
+
+    for (size_t i = 1; i < keys.size(); i += 2) {
+        bf.removeKey(keys[i]);
+    }
+    assert(bf.getNumKeys() == 0);
+    assert(countFalsePositives(bf, keys) == 0);
+}
+
+static void testSaturation() {
+    BloomFilter bf(10, 0.01);
+    // Far more adds of one key than a counter holds.
+    for (int i = 0; i < 100; ++i) {
+        bf.addKey("hot");
+    }
+    for (int i = 0; i < 100; ++i) {
+        bf.removeKey("hot");
+    }
+    // A stuck counter errs on the side of "maybe".
+    assert(bf.maybeKeyExists("hot"));
+}
+
+int main() {
+    testSizing();
+    testNoFalseNegatives();
+    testRemove();
+    testSaturation();
+    return 0;
+}
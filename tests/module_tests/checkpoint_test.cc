@@ -17,11 +17,18 @@
 
 #include "config.h"
 
+#include <dirent.h>
 #include <pthread.h>
 #include <signal.h>
+#include <stdlib.h>
+#include <unistd.h>
 
 #include <algorithm>
+#include <cstdio>
+#include <map>
 #include <set>
+#include <sstream>
+#include <string>
 #include <vector>
 
 #include "assert.h"
@@ -33,6 +40,7 @@
 #define NUM_TAP_THREADS 3
 #define NUM_SET_THREADS 4
 #define NUM_ITEMS 50000
+#define NUM_BENCH_ITEMS 200000
 
 EPStats global_stats;
 CheckpointConfig checkpoint_config;
@@ -300,9 +308,414 @@ void test_reset_checkpoint_id() {
     assert(items.size() == 0);
 }
 
+void test_queue_dirty_batch() {
+    RCPtr<VBucket> vbucket(new VBucket(0, vbucket_state_active, global_stats,
+                                       checkpoint_config));
+    CheckpointManager *manager =
+        new CheckpointManager(global_stats, 0, checkpoint_config, 1);
+
+    std::vector<queued_item> batch;
+    for (int i = 0; i < 10; ++i) {
+        std::stringstream key;
+        key << "key-" << i;
+        batch.push_back(queued_item(new QueuedItem(key.str(), 0, queue_op_set)));
+    }
+    // A key queued twice in one batch only grows the queue once.
+    batch.push_back(queued_item(new QueuedItem("key-3", 0, queue_op_del)));
+
+    std::vector<queued_item> notQueued;
+    assert(manager->queueDirty(batch, vbucket, notQueued) == 10);
+    assert(notQueued.size() == 1);
+    assert(notQueued[0]->getKey() == "key-3");
+
+    std::vector<queued_item> items;
+    manager->getAllItemsForPersistence(items);
+    // The checkpoint start, then the keys with key-3 moved to the end.
+    assert(items.size() == 11);
+    assert(items.back()->getKey() == "key-3");
+    assert(items.back()->getOperation() == queue_op_del);
+    delete manager;
+}
+
+void test_queue_dirty_by_key() {
+    RCPtr<VBucket> vbucket(new VBucket(0, vbucket_state_active, global_stats,
+                                       checkpoint_config));
+    CheckpointManager *manager =
+        new CheckpointManager(global_stats, 0, checkpoint_config, 1);
+
+    for (int i = 0; i < 10; ++i) {
+        std::stringstream key;
+        key << "key-" << i;
+        assert(manager->queueDirty(key.str(), queue_op_set, 0, vbucket));
+    }
+    std::vector<queued_item> items;
+    manager->getAllItemsForPersistence(items);
+    assert(items.size() == 11);
+    queued_item first = items[4];
+    assert(first->getKey() == "key-3");
+    items.clear();
+
+    // Queueing a key again moves its item to the end without a new one,
+    // to be persisted again as the flusher already went past it.
+    size_t overhead = global_stats.memOverhead.get();
+    assert(manager->queueDirty("key-3", queue_op_del, 0, vbucket));
+    assert(global_stats.memOverhead.get() == overhead);
+    manager->getAllItemsForPersistence(items);
+    assert(items.size() == 1);
+    assert(items.back().get() == first.get());
+    assert(items.back()->getOperation() == queue_op_del);
+    delete manager;
+}
+
+void test_collapse_checkpoints() {
+    RCPtr<VBucket> vbucket(new VBucket(0, vbucket_state_replica, global_stats,
+                                       checkpoint_config));
+    CheckpointManager *manager =
+        new CheckpointManager(global_stats, 0, checkpoint_config, 1);
+    manager->registerTAPCursor("tap", 1);
+
+    for (int i = 0; i < 10; ++i) {
+        std::stringstream key;
+        key << "key-" << i;
+        manager->queueDirty(key.str(), queue_op_set, 0, vbucket);
+    }
+    bool isLast;
+    assert(manager->nextItem("tap", isLast)->getOperation() ==
+           queue_op_checkpoint_start);
+    assert(manager->nextItem("tap", isLast)->getKey() == "key-0");
+    assert(manager->nextItem("tap", isLast)->getKey() == "key-1");
+
+    manager->createNewCheckpoint();
+    for (int i = 5; i < 15; ++i) {
+        std::stringstream key;
+        key << "key-" << i;
+        manager->queueDirty(key.str(), queue_op_set, 0, vbucket);
+    }
+    // Folds the first checkpoint's items in front of the second one's.
+    manager->checkAndAddNewCheckpoint(1);
+    assert(manager->getNumCheckpoints() == 1);
+
+    std::vector<queued_item> items;
+    manager->getAllItemsForTAPConnection("tap", items);
+    assert(items.size() == 13);
+    for (int i = 0; i < 13; ++i) {
+        std::stringstream key;
+        key << "key-" << (i + 2);
+        assert(items[i]->getKey() == key.str());
+    }
+    items.clear();
+    manager->getAllItemsForPersistence(items);
+    assert(items.size() == 16);
+    assert(items[0]->getOperation() == queue_op_checkpoint_start);
+    assert(items.back()->getKey() == "key-14");
+    delete manager;
+}
+
+void test_next_items() {
+    RCPtr<VBucket> vbucket(new VBucket(0, vbucket_state_active, global_stats,
+                                       checkpoint_config));
+    CheckpointManager *manager =
+        new CheckpointManager(global_stats, 0, checkpoint_config, 1);
+    manager->registerTAPCursor("tap", 1);
+    for (int i = 0; i < 10; ++i) {
+        std::stringstream key;
+        key << "key-" << i;
+        manager->queueDirty(key.str(), queue_op_set, 0, vbucket);
+    }
+    manager->createNewCheckpoint();
+    for (int i = 10; i < 13; ++i) {
+        std::stringstream key;
+        key << "key-" << i;
+        manager->queueDirty(key.str(), queue_op_set, 0, vbucket);
+    }
+
+    TapCursorHandle handle;
+    std::vector<queued_item> items;
+    std::vector<bool> lastItems;
+    assert(manager->nextItems("tap", handle, 4, 1 << 20, items, lastItems) == 4);
+    assert(items[0]->getOperation() == queue_op_checkpoint_start);
+    assert(items[3]->getKey() == "key-2");
+
+    // The checkpoint_end is held back until the mutations before it are out.
+    items.clear();
+    lastItems.clear();
+    assert(manager->nextItems("tap", handle, 100, 1 << 20, items, lastItems) == 7);
+    assert(items.back()->getKey() == "key-9");
+    assert(lastItems.back() && !lastItems.front());
+    items.clear();
+    lastItems.clear();
+    assert(manager->nextItems("tap", handle, 100, 1 << 20, items, lastItems) == 1);
+    assert(items[0]->getOperation() == queue_op_checkpoint_end);
+
+    // On into the open checkpoint, a byte at a time.
+    items.clear();
+    lastItems.clear();
+    assert(manager->nextItems("tap", handle, 100, 1, items, lastItems) == 1);
+    assert(items[0]->getOperation() == queue_op_checkpoint_start);
+    assert(manager->nextItems("tap", handle, 100, 1 << 20, items, lastItems) == 3);
+    assert(items.back()->getKey() == "key-12");
+    assert(manager->nextItems("tap", handle, 100, 1 << 20, items, lastItems) == 0);
+    assert(manager->getNumItemsForTAPConnection("tap") == 0);
+
+    // A cursor removed behind the handle's back isn't used.
+    manager->removeTAPCursor("tap");
+    manager->queueDirty("key-13", queue_op_set, 0, vbucket);
+    assert(manager->nextItems("tap", handle, 100, 1 << 20, items, lastItems) == 0);
+    delete manager;
+}
+
+void test_slow_tap_cursors() {
+    RCPtr<VBucket> vbucket(new VBucket(0, vbucket_state_active, global_stats,
+                                       checkpoint_config));
+    CheckpointManager *manager =
+        new CheckpointManager(global_stats, 0, checkpoint_config, 1);
+    manager->registerTAPCursor("slow", 1);
+    manager->registerTAPCursor("fast", 1);
+    for (int i = 0; i < 20; ++i) {
+        std::stringstream key;
+        key << "key-" << i;
+        manager->queueDirty(key.str(), queue_op_set, 0, vbucket);
+        if (i % 10 == 9) {
+            manager->createNewCheckpoint();
+        }
+    }
+
+    std::vector<queued_item> items;
+    manager->getAllItemsForPersistence(items);
+    manager->getAllItemsForTAPConnection("fast", items);
+    std::list<std::string> slow;
+    std::map<std::string, size_t> pinnedBytes;
+    manager->getSlowTAPCursors(2, slow, pinnedBytes);
+    assert(slow.empty());
+    manager->getSlowTAPCursors(1, slow, pinnedBytes);
+    assert(slow.size() == 1 && slow.front() == "slow");
+    slow.clear();
+    manager->getSlowTAPCursors(0, slow, pinnedBytes);
+    assert(slow.empty());
+    // What each cursor pins is reported to be added up over the vbuckets.
+    assert(pinnedBytes.size() == 2);
+    assert(pinnedBytes["fast"] == 0 && pinnedBytes["slow"] > 0);
+
+    // Only the slow cursor is keeping the closed checkpoints around.
+    assert(manager->getUnrefCheckpointMemory() == 0);
+    manager->removeTAPCursor("slow");
+    assert(manager->getUnrefCheckpointMemory() > 0);
+    bool newCheckpointCreated;
+    // Both checkpoints go, their start and end items with them.
+    assert(manager->removeClosedUnrefCheckpoints(vbucket, newCheckpointCreated) == 24);
+    assert(manager->getUnrefCheckpointMemory() == 0);
+    delete manager;
+}
+
+/**
+ * Checkpoint config spilling closed checkpoints to the given directory.
+ */
+class SpillConfig : public CheckpointConfig {
+public:
+    SpillConfig(const std::string &path) {
+        setSpillPath(path);
+    }
+};
+
+static size_t countFiles(const std::string &path) {
+    size_t count = 0;
+    DIR *dir = opendir(path.c_str());
+    assert(dir);
+    struct dirent *de;
+    while ((de = readdir(dir)) != NULL) {
+        if (de->d_name[0] != '.') {
+            ++count;
+        }
+    }
+    closedir(dir);
+    return count;
+}
+
+/**
+ * Queue 31 items in checkpoints of 10, and persist them.
+ */
+static void queueSpillItems(CheckpointManager *manager,
+                            RCPtr<VBucket> &vbucket) {
+    for (int i = 0; i < 31; ++i) {
+        std::stringstream key;
+        key << "key-" << i;
+        manager->queueDirty(key.str(), queue_op_set, i, vbucket);
+        if (i % 10 == 9) {
+            manager->createNewCheckpoint();
+        }
+    }
+    std::vector<queued_item> items;
+    manager->getAllItemsForPersistence(items);
+}
+
+void test_spill_checkpoints() {
+    char dirTemplate[] = "/tmp/chk_spill_XXXXXX";
+    std::string dir(mkdtemp(dirTemplate));
+    SpillConfig config(dir);
+    RCPtr<VBucket> vbucket(new VBucket(0, vbucket_state_active, global_stats,
+                                       config));
+    CheckpointManager *manager = new CheckpointManager(global_stats, 0, config, 1);
+    manager->registerTAPCursor("slow", 1);
+    queueSpillItems(manager, vbucket);
+
+    // The slow cursor is still in the first checkpoint and the second is
+    // read next, so only the third one goes.
+    size_t spilled = global_stats.numCheckpointsSpilled;
+    size_t loaded = global_stats.numCheckpointsLoaded;
+    assert(manager->spillClosedCheckpoints() == 1);
+    assert(manager->spillClosedCheckpoints() == 0);
+    assert(global_stats.numCheckpointsSpilled == spilled + 1);
+    assert(countFiles(dir) == 1);
+
+    // The cursor reads it all back in order, waiting at the spilled
+    // checkpoint until it's been loaded.
+    int next = 0;
+    size_t checkpointEnds = 0;
+    size_t waits = 0;
+    bool isLastMutationItem;
+    while (true) {
+        queued_item qi = manager->nextItem("slow", isLastMutationItem);
+        if (qi->getOperation() == queue_op_empty) {
+            if (!manager->hasPendingReadAhead()) {
+                break;
+            }
+            assert(next == 20);
+            assert(manager->loadSpilledCheckpoints() == 1);
+            ++waits;
+        } else if (qi->getOperation() == queue_op_checkpoint_end) {
+            ++checkpointEnds;
+        } else if (qi->getOperation() == queue_op_set) {
+            std::stringstream key;
+            key << "key-" << next;
+            assert(qi->getKey() == key.str());
+            assert(qi->getSeqno() == static_cast<uint64_t>(next));
+            ++next;
+        }
+    }
+    assert(next == 31 && checkpointEnds == 3 && waits == 1);
+    assert(global_stats.numCheckpointsLoaded == loaded + 1);
+    assert(countFiles(dir) == 0);
+
+    // Segment files go along with their checkpoints.
+    assert(manager->spillClosedCheckpoints() == 3);
+    assert(countFiles(dir) == 3);
+    delete manager;
+    assert(countFiles(dir) == 0);
+
+    // A cursor can't get past a checkpoint whose segment is damaged, and
+    // is dropped to a backfill instead.
+    manager = new CheckpointManager(global_stats, 0, config, 1);
+    manager->registerTAPCursor("stuck", 1);
+    queueSpillItems(manager, vbucket);
+    assert(manager->spillClosedCheckpoints() == 1);
+    std::list<std::string> slow;
+    std::map<std::string, size_t> pinnedBytes;
+    manager->getSlowTAPCursors(0, slow, pinnedBytes);
+    assert(slow.empty());
+
+    DIR *dp = opendir(dir.c_str());
+    struct dirent *de;
+    while ((de = readdir(dp)) != NULL) {
+        if (de->d_name[0] != '.') {
+            std::string path = dir + "/" + de->d_name;
+            assert(truncate(path.c_str(), 5) == 0);
+        }
+    }
+    closedir(dp);
+
+    size_t sent = 0;
+    while (manager->nextItem("stuck", isLastMutationItem)->getOperation() !=
+           queue_op_empty) {
+        ++sent;
+    }
+    assert(manager->hasPendingReadAhead());
+    assert(manager->loadSpilledCheckpoints() == 0);
+    assert(!manager->hasPendingReadAhead());
+    assert(manager->nextItem("stuck", isLastMutationItem)->getOperation() ==
+           queue_op_empty);
+    // The items and meta items of the first two checkpoints.
+    assert(sent == 24);
+    assert(countFiles(dir) == 0);
+    manager->getSlowTAPCursors(0, slow, pinnedBytes);
+    assert(slow.size() == 1 && slow.front() == "stuck");
+    delete manager;
+    rmdir(dir.c_str());
+}
+
+static double itemsPerSec(size_t items, hrtime_t start) {
+    hrtime_t elapsed = gethrtime() - start;
+    return elapsed == 0 ? 0 : items * 1000000000.0 / elapsed;
+}
+
+void bench_queue_and_drain() {
+    RCPtr<VBucket> vbucket(new VBucket(0, vbucket_state_active, global_stats,
+                                       checkpoint_config));
+    CheckpointManager *manager =
+        new CheckpointManager(global_stats, 0, checkpoint_config, 1);
+    manager->registerTAPCursor("tap", 1);
+
+    std::vector<std::string> keys;
+    for (int i = 0; i < NUM_BENCH_ITEMS; ++i) {
+        std::stringstream key;
+        key << "key-" << i;
+        keys.push_back(key.str());
+    }
+
+    hrtime_t start = gethrtime();
+    for (int i = 0; i < NUM_BENCH_ITEMS; ++i) {
+        manager->queueDirty(keys[i], queue_op_set, 0, vbucket);
+    }
+    double queueRate = itemsPerSec(NUM_BENCH_ITEMS, start);
+
+    // Checkpoints close every chk_max_items, so re-queue only keys that are
+    // known to be in the open checkpoint to measure deduplication.
+    uint64_t openId = manager->createNewCheckpoint();
+    size_t numOpenKeys = checkpoint_config.getCheckpointMaxItems() / 2;
+    for (size_t i = 0; i < numOpenKeys; ++i) {
+        manager->queueDirty(keys[i], queue_op_set, 0, vbucket);
+    }
+    start = gethrtime();
+    for (int i = 0; i < NUM_BENCH_ITEMS / 2; ++i) {
+        manager->queueDirty(keys[i % numOpenKeys], queue_op_set, 0, vbucket);
+    }
+    double dedupRate = itemsPerSec(NUM_BENCH_ITEMS / 2, start);
+    assert(manager->getOpenCheckpointId() == openId);
+
+    std::vector<queued_item> items;
+    items.reserve(NUM_BENCH_ITEMS + 1);
+    start = gethrtime();
+    manager->getAllItemsForPersistence(items);
+    double drainRate = itemsPerSec(items.size(), start);
+    // Checkpoints are closed every chk_max_items, so there are more meta
+    // items than the first checkpoint_start.
+    assert(items.size() > NUM_BENCH_ITEMS);
+
+    size_t sent = 0;
+    bool isLast;
+    start = gethrtime();
+    while (manager->nextItem("tap", isLast)->getOperation() != queue_op_empty) {
+        ++sent;
+    }
+    double nextRate = itemsPerSec(sent, start);
+    assert(sent > NUM_BENCH_ITEMS);
+
+    printf("queueDirty %.0f items/sec, deduplicated %.0f items/sec\n",
+           queueRate, dedupRate);
+    printf("persistence drain %.0f items/sec, nextItem %.0f items/sec\n",
+           drainRate, nextRate);
+    delete manager;
+}
+
 int main(int argc, char **argv) {
     (void)argc; (void)argv;
     putenv(strdup("ALLOW_NO_STATS_UPDATE=yeah"));
     basic_chk_test();
     test_reset_checkpoint_id();
+    test_queue_dirty_batch();
+    test_queue_dirty_by_key();
+    test_collapse_checkpoints();
+    test_next_items();
+    test_slow_tap_cursors();
+    test_spill_checkpoints();
+    bench_queue_and_drain();
 }
@@ -0,0 +1,157 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2012 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "config.h"
+
+#include <cassert>
+#include <vector>
+
+#include "chunked_queue.h"
+
+typedef ChunkedQueue<int, 4> IntQueue;
+
+static std::vector<int> contents(IntQueue &q) {
+    std::vector<int> rv;
+    for (IntQueue::iterator it = q.begin(); it != q.end(); ++it) {
+        rv.push_back(*it);
+    }
+    return rv;
+}
+
+static void testEmpty() {
+    IntQueue q;
+    assert(q.empty());
+    assert(q.begin() == q.end());
+    assert(q.rbegin() == q.rend());
+}
+
+static void testPushAcrossChunks() {
+    IntQueue q;
+    for (int i = 1; i <= 10; ++i) {
+        q.push_back(i);
+    }
+    assert(q.size() == 10);
+    std::vector<int> v(contents(q));
+    assert(v.size() == 10);
+    for (int i = 0; i < 10; ++i) {
+        assert(v[i] == i + 1);
+    }
+    assert(q.back() == 10);
+
+    int expected = 10;
+    IntQueue::reverse_iterator rit = q.rbegin();
+    for (; rit != q.rend(); ++rit) {
+        assert(*rit == expected--);
+    }
+    assert(expected == 0);
+}
+
+static void testStablePositions() {
+    IntQueue q;
+    q.push_back(1);
+    q.push_back(2);
+    IntQueue::iterator second = --q.end();
+    for (int i = 3; i <= 20; ++i) {
+        q.push_back(i);
+    }
+    assert(*second == 2);
+
+    // Step past the end and back, as the checkpoint cursors do.
+    IntQueue::iterator last = --q.end();
+    assert(++last == q.end());
+    assert(*(--last) == 20);
+}
+
+static void testEraseAndMove() {
+    IntQueue q;
+    for (int i = 1; i <= 10; ++i) {
+        q.push_back(i);
+    }
+    IntQueue::iterator three = q.begin();
+    ++three; ++three;
+    IntQueue::iterator four = three;
+    ++four;
+    IntQueue::iterator moved = q.moveToBack(three);
+    assert(*moved == 3);
+    assert(q.size() == 10);
+    assert(*four == 4);
+    std::vector<int> v(contents(q));
+    int expected[] = {1, 2, 4, 5, 6, 7, 8, 9, 10, 3};
+    for (int i = 0; i < 10; ++i) {
+        assert(v[i] == expected[i]);
+    }
+
+    // Moving the last one leaves it where it is.
+    assert(q.moveToBack(moved) == moved);
+
+    // Stepping back skips the erased slot.
+    IntQueue::iterator it = four;
+    assert(*(--it) == 2);
+
+    // Erasing a whole chunk drops it out of the walk.
+    for (int i = 0; i < 4; ++i) {
+        IntQueue::iterator b = q.begin();
+        q.erase(b);
+    }
+    v = contents(q);
+    assert(v.size() == 6);
+    assert(v[0] == 6 && v[5] == 3);
+    assert(*q.begin() == 6);
+}
+
+static void testPopBack() {
+    IntQueue q;
+    for (int i = 1; i <= 5; ++i) {
+        q.push_back(i);
+    }
+    q.pop_back();
+    assert(q.back() == 4);
+    q.push_back(6);
+    std::vector<int> v(contents(q));
+    assert(v.size() == 5 && v[4] == 6);
+    while (!q.empty()) {
+        q.pop_back();
+    }
+    assert(q.begin() == q.end());
+    q.push_back(7);
+    assert(q.size() == 1 && *q.begin() == 7);
+}
+
+static void testSwapAndClear() {
+    IntQueue a, b;
+    for (int i = 0; i < 9; ++i) {
+        a.push_back(i);
+    }
+    b.push_back(42);
+    a.swap(b);
+    assert(a.size() == 1 && *a.begin() == 42);
+    assert(b.size() == 9 && b.back() == 8);
+    b.clear();
+    assert(b.empty() && b.begin() == b.end());
+    b.push_back(1);
+    assert(b.back() == 1);
+}
+
+int main() {
+    testEmpty();
+    testPushAcrossChunks();
+    testStablePositions();
+    testEraseAndMove();
+    testPopBack();
+    testSwapAndClear();
+    return 0;
+}
@@ -0,0 +1,124 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2012 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "config.h"
+
+#include <cassert>
+#include <string>
+#include <vector>
+
+#include "compressor.h"
+
+static std::string randomBytes(size_t len, uint32_t seed) {
+    std::string rv;
+    for (size_t i = 0; i < len; ++i) {
+        seed = seed * 1103515245 + 12345;
+        rv.push_back(static_cast<char>(seed >> 16));
+    }
+    return rv;
+}
+
+/**
+ * Compress and decompress, returning the compressed size.
+ */
+static size_t roundTrip(const std::string &in) {
+    std::vector<char> out(in.size() + in.size() / 16 + 64);
+    size_t clen = LZCompressor::compress(in.data(), in.size(),
+                                         &out[0], out.size());
+    assert(clen > 0);
+
+    std::vector<char> back(in.size() + 1);
+    size_t dlen = LZCompressor::decompress(&out[0], clen,
+                                           &back[0], back.size());
+    assert(dlen == in.size());
+    assert(std::string(&back[0], dlen) == in);
+    return clen;
+}
+
+static void testRoundTrips() {
+    roundTrip("a");
+    roundTrip("ab");
+    roundTrip("abc");
+    roundTrip(std::string(31, 'x'));
+    roundTrip(std::string(33, 'x'));
+    roundTrip(randomBytes(5000, 7));
+
+    // Long runs need extended lengths and overlapping references.
+    assert(roundTrip(std::string(100000, 'z')) < 2000);
+
+    std::string doc;
+    for (int i = 0; i < 500; ++i) {
+        doc.append("{\"name\": \"user\", \"age\": 42, \"tags\": [\"a\", \"b\"]}");
+        doc.append(randomBytes(3, i));
+    }
+    assert(roundTrip(doc) < doc.size() / 4);
+
+    // Repeats further back than a reference can reach.
+    std::string far(randomBytes(10000, 3));
+    far.append(far);
+    roundTrip(far);
+}
+
+static void testReusedTable() {
+    // The trigram table is kept between calls, so a short input follows
+    // a long one whose entries point past its end.
+    std::string doc;
+    for (int i = 0; i < 2000; ++i) {
+        doc.append("abcdefgh");
+        doc.append(randomBytes(2, i));
+    }
+    roundTrip(doc);
+    roundTrip("abcdefghabcdefgh");
+    roundTrip(randomBytes(100, 9));
+    assert(roundTrip(doc) < doc.size() * 3 / 4);
+}
+
+static void testOutputTooSmall() {
+    std::string noise(randomBytes(1000, 11));
+    std::vector<char> out(900);
+    assert(LZCompressor::compress(noise.data(), noise.size(),
+                                  &out[0], out.size()) == 0);
+    assert(LZCompressor::compress(noise.data(), 0, &out[0], out.size()) == 0);
+}
+
+static void testCorruptInput() {
+    std::string in(std::string(200, 'q') + randomBytes(200, 5));
+    std::vector<char> out(1000);
+    size_t clen = LZCompressor::compress(in.data(), in.size(),
+                                         &out[0], out.size());
+    assert(clen > 0);
+
+    std::vector<char> back(in.size());
+    // Truncated input and a too small output are both rejected.
+    assert(LZCompressor::decompress(&out[0], clen - 1,
+                                    &back[0], back.size()) != in.size());
+    assert(LZCompressor::decompress(&out[0], clen,
+                                    &back[0], back.size() - 1) == 0);
+
+    // A reference before the start of the output.
+    const char bogus[] = { '\x20', '\x10' };
+    assert(LZCompressor::decompress(bogus, sizeof(bogus),
+                                    &back[0], back.size()) == 0);
+}
+
+int main() {
+    testRoundTrips();
+    testReusedTable();
+    testOutputTooSmall();
+    testCorruptInput();
+    return 0;
+}
@@ -0,0 +1,141 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2012 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "config.h"
+
+#include <algorithm>
+#include <cassert>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "expiry_index.h"
+#include "stats.h"
+
+EPStats global_stats;
+
+static std::string keyFor(time_t t, int i) {
+    std::stringstream ss;
+    ss << "key:" << t << ":" << i;
+    return ss.str();
+}
+
+static void testPopInOrder() {
+    time_t start = 1000000;
+    ExpiryIndex index(global_stats, start);
+    // Times on every level, in the overflow and already passed.
+    time_t offsets[] = { 0, 1, 63, 64, 65, 4095, 4096, 70000, 300000,
+                         16777215, 16777216, 40000000 };
+    size_t n = sizeof(offsets) / sizeof(offsets[0]);
+    for (size_t i = 0; i < n; ++i) {
+        index.add(keyFor(start + offsets[i], 0), start + offsets[i]);
+    }
+    index.add("late", start - 10);
+    assert(index.getNumKeys() == n + 1);
+    assert(index.memorySize() > 0);
+    assert(global_stats.memOverhead.get() ==
+           sizeof(ExpiryIndex) + index.memorySize());
+
+    std::vector<std::string> keys;
+    index.popExpired(start, keys);
+    assert(keys.size() == 1 && keys[0] == "late");
+
+    for (size_t i = 0; i < n; ++i) {
+        time_t t = start + offsets[i];
+        keys.clear();
+        // Nothing before its time...
+        index.popExpired(t, keys);
+        assert(keys.empty());
+        // ...and exactly the key once it has passed.
+        index.popExpired(t + 1, keys);
+        assert(keys.size() == 1 && keys[0] == keyFor(t, 0));
+    }
+    assert(index.getNumKeys() == 0);
+    assert(index.memorySize() == 0);
+    assert(global_stats.memOverhead.get() == sizeof(ExpiryIndex));
+}
+
+static void testRemove() {
+    time_t start = 5000;
+    ExpiryIndex index(global_stats, start);
+    for (int i = 0; i < 1000; ++i) {
+        index.add(keyFor(start + i * 97, i), start + i * 97);
+    }
+    // Let the keys left cascade down some levels before removing them.
+    std::vector<std::string> keys;
+    index.popExpired(start + 20000, keys);
+    assert(keys.size() == 207);
+    for (int i = 0; i < 1000; i += 2) {
+        index.remove(keyFor(start + i * 97, i), start + i * 97);
+    }
+    // Removing what isn't there is harmless.
+    index.remove("nope", start + 1);
+    assert(index.getNumKeys() == 793 - 396);
+
+    keys.clear();
+    index.popExpired(start + 1000 * 97, keys);
+    std::vector<std::string> want;
+    for (int i = 207; i < 1000; i += 2) {
+        want.push_back(keyFor(start + i * 97, i));
+    }
+    std::sort(keys.begin(), keys.end());
+    std::sort(want.begin(), want.end());
+    assert(keys == want);
+    assert(index.getNumKeys() == 0);
+}
+
+static void testRandomTimes() {
+    time_t start = 123456789;
+    ExpiryIndex index(global_stats, start);
+    std::multimap<time_t, std::string> expected;
+    uint32_t seed = 42;
+    for (int i = 0; i < 20000; ++i) {
+        seed = seed * 1103515245 + 12345;
+        time_t t = start + (seed >> 8) % 10000000;
+        std::string k(keyFor(t, i));
+        index.add(k, t);
+        expected.insert(std::make_pair(t, k));
+    }
+
+    // Pop in steps of varying size and check against the sorted times.
+    time_t now = start;
+    while (!expected.empty()) {
+        seed = seed * 1103515245 + 12345;
+        now += (seed >> 8) % 200000;
+        std::vector<std::string> keys;
+        index.popExpired(now, keys);
+        std::vector<std::string> want;
+        while (!expected.empty() && expected.begin()->first < now) {
+            want.push_back(expected.begin()->second);
+            expected.erase(expected.begin());
+        }
+        std::sort(keys.begin(), keys.end());
+        std::sort(want.begin(), want.end());
+        assert(keys == want);
+    }
+    assert(index.getNumKeys() == 0);
+}
+
+int main() {
+    testPopInOrder();
+    testRemove();
+    testRandomTimes();
+    // Whatever the indexes held went with them.
+    assert(global_stats.memOverhead.get() == 0);
+    return 0;
+}
@@ -0,0 +1,244 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2010 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * Compares HashTable::hash against the DJB hash it replaced, both for
+ * raw throughput and for the bucket depth distribution it produces,
+ * then compares lookup speed of the chained and grouped bucket layouts.
+ */
+
+#include "config.h"
+
+#include <item.h>
+#include <stats.h>
+#include <stored-value.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+extern "C" {
+    static rel_time_t basic_current_time(void) {
+        return 0;
+    }
+
+    rel_time_t (*ep_current_time)() = basic_current_time;
+
+    time_t ep_real_time() {
+        return time(NULL);
+    }
+}
+
+EPStats global_stats;
+
+static const size_t NUM_KEYS(200000);
+static const size_t NUM_BUCKETS(49157);
+static const int HASH_ROUNDS(10);
+
+static int djbHash(const char *str, const size_t len) {
+    int h=5381;
+
+    for(size_t i=0; i < len; i++) {
+        h = ((h << 5) + h) ^ str[i];
+    }
+
+    return h;
+}
+
+/**
+ * Build UUID-ish keys between 40 and 120 bytes sharing a few prefixes.
+ */
+static std::vector<std::string> generateKeys(size_t n) {
+    static const char *prefixes[] = { "session::", "user::profile::",
+                                      "cart::", "doc::" };
+    static const char *hex = "0123456789abcdef";
+    std::vector<std::string> rv;
+    rv.reserve(n);
+    uint32_t seed = 0x2545f491;
+    for (size_t i = 0; i < n; ++i) {
+        std::string key(prefixes[i % 4]);
+        size_t len = 40 + (i % 81);
+        while (key.size() < len) {
+            seed = seed * 1103515245 + 12345;
+            key.push_back(hex[(seed >> 16) & 0xf]);
+            if (key.size() % 9 == 0 && key.size() < len) {
+                key.push_back('-');
+            }
+        }
+        rv.push_back(key);
+    }
+    return rv;
+}
+
+/**
+ * Build long keys that differ only in a trailing sequence number.
+ */
+static std::vector<std::string> generateSequentialKeys(size_t n) {
+    std::vector<std::string> rv;
+    rv.reserve(n);
+    for (size_t i = 0; i < n; ++i) {
+        char buf[64];
+        snprintf(buf, sizeof(buf), "%010lu", static_cast<unsigned long>(i));
+        rv.push_back(std::string("customer-account-document-") + buf);
+    }
+    return rv;
+}
+
+struct DepthSummary {
+    DepthSummary() : empty(0), maxDepth(0), over4(0) {}
+    size_t empty;
+    size_t maxDepth;
+    size_t over4;
+};
+
+static DepthSummary summarize(const std::vector<size_t> &depths) {
+    DepthSummary rv;
+    std::vector<size_t>::const_iterator it;
+    for (it = depths.begin(); it != depths.end(); ++it) {
+        if (*it == 0) {
+            ++rv.empty;
+        } else if (*it > 4) {
+            ++rv.over4;
+        }
+        rv.maxDepth = std::max(rv.maxDepth, *it);
+    }
+    return rv;
+}
+
+static void report(const char *name, hrtime_t ns, const DepthSummary &d) {
+    printf("%-10s %8.1f ns/key  empty=%-6lu max_depth=%-3lu depth>4=%lu\n",
+           name, static_cast<double>(ns) / (NUM_KEYS * HASH_ROUNDS),
+           static_cast<unsigned long>(d.empty),
+           static_cast<unsigned long>(d.maxDepth),
+           static_cast<unsigned long>(d.over4));
+}
+
+/**
+ * Expected number of empty buckets for a perfectly uniform hash.
+ */
+static double idealEmpty() {
+    double load = static_cast<double>(NUM_KEYS) / NUM_BUCKETS;
+    return NUM_BUCKETS * exp(-load);
+}
+
+/**
+ * Depth visitor collecting every bucket's depth.
+ */
+class DepthCollector : public HashTableDepthVisitor {
+public:
+    DepthCollector(size_t n) : depths(n) {}
+
+    void visit(int bucket, int depth, size_t mem) {
+        (void)mem;
+        depths[bucket] = depth;
+    }
+
+    std::vector<size_t> depths;
+};
+
+static void compare(const char *title, std::vector<std::string> keys) {
+    HashTable ht(global_stats, NUM_BUCKETS, 1);
+    volatile int sink = 0;
+
+    // Throughput and distribution of the old DJB hash.
+    hrtime_t start = gethrtime();
+    for (int r = 0; r < HASH_ROUNDS; ++r) {
+        for (size_t i = 0; i < NUM_KEYS; ++i) {
+            sink ^= djbHash(keys[i].data(), keys[i].size());
+        }
+    }
+    hrtime_t djbTime = gethrtime() - start;
+
+    std::vector<size_t> djbDepths(NUM_BUCKETS);
+    for (size_t i = 0; i < NUM_KEYS; ++i) {
+        unsigned int h = djbHash(keys[i].data(), keys[i].size());
+        ++djbDepths[h % NUM_BUCKETS];
+    }
+
+    // Same for HashTable::hash, with depths taken from a real table.
+    start = gethrtime();
+    for (int r = 0; r < HASH_ROUNDS; ++r) {
+        for (size_t i = 0; i < NUM_KEYS; ++i) {
+            sink ^= ht.hash(keys[i].data(), keys[i].size());
+        }
+    }
+    hrtime_t newTime = gethrtime() - start;
+    (void)sink;
+
+    for (size_t i = 0; i < NUM_KEYS; ++i) {
+        Item itm(keys[i], 0, 0, "v", 1);
+        assert(ht.set(itm) == WAS_CLEAN);
+    }
+    DepthCollector collector(NUM_BUCKETS);
+    ht.visitDepth(collector);
+
+    DepthSummary djb = summarize(djbDepths);
+    DepthSummary murmur = summarize(collector.depths);
+    printf("%s keys (ideal: empty=%.0f):\n", title, idealEmpty());
+    report("djb", djbTime, djb);
+    report("murmur64a", newTime, murmur);
+
+    // With a uniform hash the number of empty buckets is Poisson
+    // distributed; insist on being close to it.
+    assert(murmur.empty > idealEmpty() * 0.85);
+    assert(murmur.empty < idealEmpty() * 1.15);
+}
+
+/**
+ * Time lookups of every key in a table with the given bucket layout,
+ * sized the way the resizer would size it.
+ */
+static void timeLookups(const char *name, bool grouped,
+                        std::vector<std::string> &keys) {
+    HashTable::setDefaultGrouped(grouped);
+    HashTable ht(global_stats, 0, 0);
+    HashTable::setDefaultGrouped(false);
+    for (size_t i = 0; i < NUM_KEYS; ++i) {
+        Item itm(keys[i], 0, 0, "v", 1);
+        assert(ht.set(itm) == WAS_CLEAN);
+    }
+    ht.resize();
+    while (ht.resizeStep()) {}
+
+    hrtime_t start = gethrtime();
+    for (int r = 0; r < HASH_ROUNDS; ++r) {
+        for (size_t i = 0; i < NUM_KEYS; ++i) {
+            assert(ht.find(keys[i], false));
+        }
+    }
+    hrtime_t spent = gethrtime() - start;
+    printf("%-10s %8.1f ns/lookup  buckets=%lu mem_overhead=%lu\n", name,
+           static_cast<double>(spent) / (NUM_KEYS * HASH_ROUNDS),
+           static_cast<unsigned long>(ht.getSize()),
+           static_cast<unsigned long>(ht.memorySize()));
+}
+
+int main() {
+    putenv(strdup("ALLOW_NO_STATS_UPDATE=yeah"));
+    global_stats.setMaxDataSize(1024*1024*1024);
+    compare("random", generateKeys(NUM_KEYS));
+    compare("sequential", generateSequentialKeys(NUM_KEYS));
+
+    std::vector<std::string> keys = generateKeys(NUM_KEYS);
+    printf("lookups:\n");
+    timeLookups("chained", false, keys);
+    timeLookups("grouped", true, keys);
+    return 0;
+}
@@ -25,6 +25,9 @@
 #include <algorithm>
 #include <cassert>
 #include <limits>
+#include <map>
+#include <set>
+#include <sstream>
 
 #include "threadtests.h"
 
@@ -313,6 +316,563 @@ private:
     size_t                    size;
 };
 
+static void testIncrementalResize() {
+    HashTable h(global_stats, 769, 31);
+
+    std::vector<std::string> keys = generateKeys(5000);
+    storeMany(h, keys);
+
+    h.resize(6143);
+    assert(h.getSize() == 6143);
+    assert(h.isResizing());
+    assert(h.getResizeBucketsTotal() == 769);
+
+    // Items stay reachable while the old table drains.
+    assert(h.resizeStep(4));
+    verifyFound(h, keys);
+    assert(count(h) == 5000);
+
+    while (h.resizeStep(4)) {
+        assert(h.getResizeBucketsDone() <= h.getResizeBucketsTotal());
+    }
+    assert(!h.isResizing());
+    assert(h.resizeSteps > 31);
+    verifyFound(h, keys);
+
+    // A new resize finishes the pending one first.
+    h.resize(1531);
+    assert(h.isResizing());
+    h.resize(769);
+    assert(h.getSize() == 769);
+    verifyFound(h, keys);
+    while (h.resizeStep()) {}
+    assert(!h.isResizing());
+    assert(count(h) == 5000);
+}
+
+static void testGroupedBuckets() {
+    size_t initialSize = global_stats.currentSize.get();
+    HashTable::setDefaultGrouped(true);
+    HashTable h(global_stats, 31, 7);
+    HashTable::setDefaultGrouped(false);
+    assert(h.isGrouped());
+
+    // Enough keys that most groups overflow onto their chains.
+    std::vector<std::string> keys = generateKeys(5000);
+    storeMany(h, keys);
+    verifyFound(h, keys);
+    assert(count(h) == 5000);
+
+    HashTableDepthStatVisitor depthCounter;
+    h.visitDepth(depthCounter);
+    assert(depthCounter.size == 5000);
+    assert(depthCounter.max > static_cast<int>(BucketGroup::SLOTS));
+
+    // Deleting every other key refills slots from the chains.
+    for (size_t i = 0; i < keys.size(); i += 2) {
+        assert(h.del(keys[i]));
+    }
+    for (size_t i = 0; i < keys.size(); ++i) {
+        assert((h.find(keys[i]) != NULL) == (i % 2 == 1));
+    }
+    assert(count(h) == 2500);
+
+    h.resize();
+    while (h.resizeStep()) {}
+    assert(h.getSize() != 31);
+    assert(count(h) == 2500);
+
+    h.resize(769);
+    assert(count(h) == 2500);
+    h.resize(5);
+    for (size_t i = 1; i < keys.size(); i += 2) {
+        assert(h.find(keys[i]));
+        assert(h.del(keys[i]));
+    }
+    assert(count(h) == 0);
+    assert(global_stats.currentSize.get() == initialSize);
+}
+
+static void testInlineValues() {
+    StoredValue::setInlineValueThreshold(32);
+    HashTable h(global_stats, 5, 1);
+    size_t initialSize = global_stats.currentSize.get();
+    std::string sk("small"), lk("large");
+
+    Item small("small", 0, 0, "tiny value", 10);
+    Item large("large", 0, 0, std::string(100, 'x').c_str(), 100);
+    assert(h.set(small) == WAS_CLEAN);
+    assert(h.set(large) == WAS_CLEAN);
+
+    StoredValue *v = h.find(sk);
+    assert(v && v->isValueInline());
+    assert(v->getValue()->to_s() == "tiny value");
+    assert(!h.find(lk)->isValueInline());
+
+    // Updates that still fit reuse the inline storage.
+    Item updated("small", 0, 0, "other", 5);
+    assert(h.set(updated) == WAS_DIRTY);
+    v = h.find(sk);
+    assert(v->isValueInline());
+    assert(v->getValue()->to_s() == "other");
+
+    // A value handed out stays intact while the item is rewritten and
+    // after it is gone entirely.
+    value_t held = v->getValue();
+    Item again("small", 0, 0, "third", 5);
+    assert(h.set(again) == WAS_DIRTY);
+    v = h.find(sk);
+    assert(!v->isValueInline());
+    assert(v->getValue()->to_s() == "third");
+    assert(h.del(sk));
+    assert(held->to_s() == "other");
+    held.reset();
+
+    // Values too large for the reserved space are shared as usual.
+    Item fresh("small", 0, 0, "tiny value", 10);
+    assert(h.set(fresh) == WAS_CLEAN);
+    assert(h.find(sk)->isValueInline());
+    Item grown("small", 0, 0, std::string(64, 'y').c_str(), 64);
+    assert(h.set(grown) == WAS_DIRTY);
+    assert(!h.find(sk)->isValueInline());
+
+    h.clear();
+    assert(count(h) == 0);
+    assert(h.memSize.get() == 0);
+    assert(global_stats.currentSize.get() == initialSize);
+    StoredValue::setInlineValueThreshold(0);
+}
+
+static void testSlabAllocation() {
+    SlabAllocator::setEnabled(true);
+    StoredValue::setInlineValueThreshold(32);
+    HashTable h(global_stats, 5, 1);
+    size_t initialSize = global_stats.currentSize.get();
+
+    std::vector<std::string> keys = generateKeys(1000);
+    for (size_t i = 0; i < keys.size(); ++i) {
+        std::string val(i % 100, 'v');
+        Item itm(keys[i], 0, 0, val.data(), val.size());
+        assert(h.set(itm) == WAS_CLEAN);
+    }
+    verifyFound(h, keys);
+
+    std::map<std::string, size_t> st;
+    SlabAllocator::getInstance()->getStats(st);
+    assert(st["ep_slab_chunks"] >= keys.size());
+
+    for (size_t i = 0; i < keys.size(); i += 2) {
+        assert(h.del(keys[i]));
+    }
+    h.clear();
+    assert(h.memSize.get() == 0);
+    assert(h.cacheSize.get() == 0);
+    assert(global_stats.currentSize.get() == initialSize);
+
+    st.clear();
+    SlabAllocator::getInstance()->getStats(st);
+    assert(st["ep_slab_chunks"] == 0);
+    StoredValue::setInlineValueThreshold(0);
+    SlabAllocator::setEnabled(false);
+}
+
+static void testCompressedValues() {
+    HashTable h(global_stats, 5, 1);
+    size_t initialSize = global_stats.currentSize.get();
+    std::string bk("big"), sk("small"), nk("noise");
+
+    std::string big;
+    for (size_t i = 0; i < 200; ++i) {
+        big.append("compressible value ");
+    }
+    std::string noise;
+    uint32_t seed = 1;
+    for (size_t i = 0; i < 1000; ++i) {
+        seed = seed * 1103515245 + 12345;
+        noise.push_back(static_cast<char>(seed >> 16));
+    }
+
+    // Values are only compressed on store when asked to.
+    Item plain("big", 0, 0, big.data(), big.size());
+    assert(h.set(plain) == WAS_CLEAN);
+    assert(!h.find(bk)->isCompressed());
+
+    StoredValue::setCompressionMode("store");
+    Item bigItem("big", 0, 0, big.data(), big.size());
+    Item smallItem("small", 0, 0, "short value", 11);
+    Item noiseItem("noise", 0, 0, noise.data(), noise.size());
+    assert(h.set(bigItem) == WAS_DIRTY);
+    assert(h.set(smallItem) == WAS_CLEAN);
+    assert(h.set(noiseItem) == WAS_CLEAN);
+
+    StoredValue *v = h.find(bk);
+    assert(v->isCompressed());
+    assert(v->valLength() == big.size());
+    assert(v->size() < big.size());
+    assert(v->getValue()->to_s() == big);
+    assert(!h.find(sk)->isCompressed());
+    assert(!h.find(nk)->isCompressed());
+    assert(h.numCompressions.get() == 1);
+    assert(h.numCompressFailures.get() == 1);
+    assert(h.compressInBytes.get() == big.size());
+
+    Item *itm = v->toItem(false, 0, &h);
+    assert(itm->getNBytes() == big.size());
+    assert(std::string(itm->getData(), itm->getNBytes()) == big);
+    assert(h.numDecompressions.get() == 1);
+    delete itm;
+
+    // Ejecting and restoring a compressed value keeps it compressed.
+    v->markClean();
+    assert(v->ejectValue(global_stats, h));
+    assert(!v->isCompressed());
+    assert(v->valLength() == big.size());
+    Item fetched("big", 0, 0, big.data(), big.size());
+    assert(v->unlocked_restoreValue(&fetched, global_stats, h));
+    assert(v->isCompressed());
+    assert(v->getValue()->to_s() == big);
+
+    // In pager mode only the pager compresses.
+    StoredValue::setCompressionMode("pager");
+    Item other("other", 0, 0, big.data(), big.size());
+    assert(h.set(other) == WAS_CLEAN);
+    std::string ok("other");
+    v = h.find(ok);
+    assert(!v->isCompressed());
+    size_t whole = h.memSize.get();
+    assert(v->compressValue(global_stats, h));
+    assert(v->isCompressed());
+    assert(!v->compressValue(global_stats, h));
+    assert(v->getValue()->to_s() == big);
+    assert(h.memSize.get() < whole);
+
+    // Once read it is held whole again, unless compressing on store.
+    StoredValue::setCompressionMode("store");
+    assert(!v->decompressValue(global_stats, h));
+    StoredValue::setCompressionMode("pager");
+    assert(v->decompressValue(global_stats, h));
+    assert(!v->isCompressed());
+    assert(v->getValue()->to_s() == big);
+    assert(h.memSize.get() == whole);
+    assert(!v->decompressValue(global_stats, h));
+
+    StoredValue::setCompressionMode("off");
+    assert(!h.find(sk)->compressValue(global_stats, h));
+
+    h.clear();
+    assert(count(h) == 0);
+    assert(h.memSize.get() == 0);
+    assert(h.cacheSize.get() == 0);
+    assert(global_stats.currentSize.get() == initialSize);
+}
+
+static void testEjectItems() {
+    global_stats.reset();
+    HashTable ht(global_stats, 5, 1);
+    size_t initialSize = global_stats.currentSize.get();
+
+    std::string k("ejectme");
+    Item i(k, 0, 0, "somevalue", 9);
+    assert(ht.set(i) == WAS_CLEAN);
+
+    int bucket_num(0);
+    {
+        LockHolder lh = ht.getLockedBucket(k, &bucket_num);
+        StoredValue *v = ht.unlocked_find(k, bucket_num);
+        assert(v);
+        // Dirty items and items never persisted stay.
+        assert(!ht.unlocked_ejectItem(v, bucket_num));
+        v->markClean();
+        assert(!ht.unlocked_ejectItem(v, bucket_num));
+        v->setId(42);
+        uint64_t seqno = v->getSeqno();
+        assert(ht.unlocked_ejectItem(v, bucket_num));
+        assert(v == NULL);
+        assert(ht.getMaxDeletedSeqno() >= seqno);
+    }
+    assert(ht.find(k) == NULL);
+    assert(ht.getNumItems() == 0);
+    // Still on disk, so still counted.
+    assert(ht.getNumEjectedItems() == 1);
+    assert(ht.getNumTotalItems() == 1);
+    assert(ht.memSize.get() == 0);
+    assert(ht.cacheSize.get() == 0);
+    assert(initialSize == global_stats.currentSize.get());
+    assert(global_stats.numMetaEjects.get() == 1);
+
+    // A disk lookup leaves a temporary item that the fetch replaces.
+    {
+        LockHolder lh = ht.getLockedBucket(k, &bucket_num);
+        assert(ht.unlocked_addTempDeletedItem(bucket_num, k) == ADD_SUCCESS);
+        assert(ht.getNumTempItems() == 1);
+        Item fetched(k.c_str(), k.length(), 0, 0, "somevalue", 9, 0, 42);
+        StoredValue *v = ht.unlocked_restoreEjected(fetched, bucket_num);
+        assert(v && v->isClean() && v->getId() == 42);
+    }
+    assert(ht.getNumTempItems() == 0);
+    assert(ht.getNumItems() == 1);
+    assert(ht.getNumEjectedItems() == 0);
+    assert(ht.getNumTotalItems() == 1);
+    ht.forgetEjectedItem();
+    assert(ht.getNumEjectedItems() == 0);
+    Item *restored = ht.find(k)->toItem(false, 0);
+    assert(restored->getValue()->to_s() == "somevalue");
+    delete restored;
+
+    // An add over a temporary item keeps its value.
+    std::string k2("addme");
+    {
+        LockHolder lh = ht.getLockedBucket(k2, &bucket_num);
+        assert(ht.unlocked_addTempDeletedItem(bucket_num, k2) == ADD_SUCCESS);
+    }
+    Item added(k2, 0, 0, "addvalue", 8);
+    assert(ht.add(added) == ADD_UNDEL);
+    assert(ht.getNumTempItems() == 0);
+    assert(ht.getNumItems() == 2);
+    StoredValue *v = ht.find(k2);
+    assert(v && !v->isTempItem());
+    restored = v->toItem(false, 0);
+    assert(restored->getValue()->to_s() == "addvalue");
+    delete restored;
+}
+
+static void testAccessFrequency() {
+    global_stats.reset();
+    HashTable ht(global_stats, 5, 1);
+
+    std::string hot("hot"), cold("cold");
+    Item hi(hot, 0, 0, "value", 5);
+    Item ci(cold, 0, 0, "value", 5);
+    assert(ht.set(hi) == WAS_CLEAN);
+    assert(ht.set(ci) == WAS_CLEAN);
+
+    // The store is the first access and always counts, later ones
+    // count ever more rarely.
+    StoredValue *c = ht.find(cold, false);
+    assert(c->getFrequency() == 1);
+    StoredValue *h = NULL;
+    for (int i = 0; i < 100000; ++i) {
+        h = ht.find(hot);
+    }
+    assert(h->getFrequency() > 4);
+    assert(h->getFrequency() <= StoredValue::MAX_FREQUENCY);
+
+    // Decay halves what the counter stands for, down to zero.
+    uint8_t f = h->getFrequency();
+    h->decayFrequency();
+    assert(h->getFrequency() == f - 1);
+    c->decayFrequency();
+    c->decayFrequency();
+    assert(c->getFrequency() == 0);
+
+    // Values read back after ejection are counted.
+    h->markClean();
+    h->setId(1);
+    assert(h->ejectValue(global_stats, ht));
+    Item fetched(hot.c_str(), hot.length(), 0, 0, "value", 5,
+                 h->getCas(), 1);
+    h->unlocked_restoreValue(&fetched, global_stats, ht);
+    assert(h->isResident());
+    assert(global_stats.numEjectRefetches.get() == 1);
+}
+
+class KeyCollector : public HashTableVisitor {
+public:
+
+    void visit(StoredValue *v) {
+        keys.insert(v->getKey());
+    }
+
+    std::set<std::string> keys;
+};
+
+static void testSample() {
+    HashTable h(global_stats, 97, 7);
+    std::vector<std::string> keys = generateKeys(500);
+    storeMany(h, keys);
+    unsigned int seed = 42;
+
+    // Each pick only looks at one bucket's chain.
+    Counter few(false);
+    h.sample(few, 3, seed);
+    assert(few.count < 100);
+
+    // Enough random picks come close to covering every bucket.
+    KeyCollector collector;
+    for (int i = 0; i < 100; ++i) {
+        h.sample(collector, 97, seed);
+    }
+    assert(collector.keys.size() > keys.size() * 9 / 10);
+
+    HashTable empty(global_stats, 5, 1);
+    Counter none(false);
+    empty.sample(none, 10, seed);
+    assert(none.count == 0);
+}
+
+static void testResumableVisit() {
+    HashTable h(global_stats, 97, 7);
+    std::vector<std::string> keys = generateKeys(500);
+    storeMany(h, keys);
+
+    // Pieces of about 50 items add up to the whole table.
+    KeyCollector collector;
+    HashTable::Position pos;
+    int pieces = 0;
+    do {
+        size_t before = collector.keys.size();
+        pos = h.visit(collector, pos, 50, 0);
+        assert(collector.keys.size() - before < 100);
+        ++pieces;
+    } while (!pos.isEnd());
+    assert(pieces >= 5);
+    assert(collector.keys.size() == keys.size());
+
+    // A resize partway through doesn't make the walk miss anything.
+    KeyCollector resized;
+    pos = h.visit(resized, HashTable::Position(), 100, 0);
+    assert(!pos.isEnd());
+    h.resize(769);
+    while (!pos.isEnd()) {
+        pos = h.visit(resized, pos, 100, 0);
+    }
+    assert(resized.keys.size() == keys.size());
+
+    // With no limits it's done in one go.
+    Counter all(false);
+    assert(h.visit(all, HashTable::Position(), 0, 0).isEnd());
+    assert(all.count == keys.size());
+}
+
+static void testExpiryIndex() {
+    HashTable::setDefaultExpiryIndex(true);
+    HashTable h(global_stats, 5, 1);
+    HashTable::setDefaultExpiryIndex(false);
+    assert(h.hasExpiryIndex());
+
+    time_t now = ep_real_time();
+    add(h, "a", ADD_SUCCESS, now + 5);
+    add(h, "b", ADD_SUCCESS, now + 10);
+    add(h, "c", ADD_SUCCESS);
+    assert(h.getExpiryIndexKeys() == 2);
+    assert(h.getExpiryIndexMemory() > 0);
+
+    // Storing with a new time moves the key, deleting drops it.
+    Item later("a", 0, now + 20, "a", 1);
+    assert(h.set(later) == WAS_DIRTY);
+    assert(h.softDelete("b", 0) == WAS_DIRTY);
+    assert(h.getExpiryIndexKeys() == 1);
+
+    std::vector<std::string> keys;
+    h.popExpired(now + 15, keys);
+    assert(keys.empty());
+    h.popExpired(now + 21, keys);
+    assert(keys.size() == 1 && keys[0] == "a");
+    assert(h.getExpiryIndexKeys() == 0);
+    assert(h.getExpiryIndexMemory() == 0);
+
+    HashTable plain(global_stats, 5, 1);
+    assert(!plain.hasExpiryIndex());
+}
+
+static void testValueCache() {
+    std::stringstream path;
+    path << "/tmp/hash_table_test_cache." << getpid();
+    ValueCache cache(global_stats, path.str(), ValueCache::MIN_CAPACITY);
+    HashTable h(global_stats, 5, 1);
+
+    std::string k("cached");
+    std::string value(1000, 'x');
+    Item i(k, 0, 0, value.data(), value.length());
+    assert(h.set(i) == WAS_CLEAN);
+
+    int bucket_num(0);
+    LockHolder lh = h.getLockedBucket(k, &bucket_num);
+    StoredValue *v = h.unlocked_find(k, bucket_num);
+    v->markClean();
+    value_t ejected;
+    assert(v->ejectValue(global_stats, h, &ejected));
+    assert(!v->isResident());
+    assert(v->valLength() == value.length());
+    uint64_t offset;
+    assert(!v->getValueCacheOffset(offset));
+
+    // The copy to the cache is made after the eject, out of the lock.
+    uint64_t cached;
+    assert(cache.put(k, v->getCas(), ejected, cached));
+    assert(v->unlocked_setValueCacheOffset(cached, v->getCas(), h));
+    assert(v->valLength() == value.length());
+    assert(global_stats.valueCacheWrites.get() == 1);
+
+    assert(v->getValueCacheOffset(offset));
+    assert(offset == cached);
+    value_t back(cache.get(offset, k, v->getCas()));
+    assert(back.get() != NULL);
+    Item itm(k, v->getFlags(), v->getExptime(), back, v->getCas(), v->getId(),
+             0, v->getSeqno());
+    assert(v->unlocked_restoreValue(&itm, global_stats, h));
+    assert(v->isResident());
+    assert(v->getValue()->to_s() == value);
+    assert(h.getNumNonResidentItems() == 0);
+
+    // An item changed since its value was ejected keeps no offset.
+    v->markClean();
+    assert(v->ejectValue(global_stats, h, &ejected));
+    assert(!v->unlocked_setValueCacheOffset(cached, v->getCas() + 1, h));
+    assert(!v->getValueCacheOffset(offset));
+    assert(!v->isResident());
+}
+
+static void testOptimisticFind() {
+    HashTable h(global_stats, 5, 1);
+
+    std::vector<std::string> keys = generateKeys(50);
+    storeMany(h, keys);
+
+    std::vector<std::string>::iterator it;
+    for (it = keys.begin(); it != keys.end(); ++it) {
+        OptimisticReadHolder rh;
+        StoredValue *v = NULL;
+        assert(h.optimisticFind(*it, rh, &v));
+        assert(v);
+        assert(v->getKey() == *it);
+    }
+
+    {
+        std::string missing("nope");
+        OptimisticReadHolder rh;
+        StoredValue *v = reinterpret_cast<StoredValue*>(0x1);
+        assert(h.optimisticFind(missing, rh, &v));
+        assert(v == NULL);
+    }
+
+    {
+        // The item is built from a snapshot after leaving the section.
+        ItemSnapshot snapshot;
+        {
+            OptimisticReadHolder rh;
+            StoredValue *v = NULL;
+            assert(h.optimisticFind(keys[1], rh, &v));
+            snapshot.take(*v, false);
+        }
+        Item *i = snapshot.toItem(keys[1], 0);
+        Item *expected = h.find(keys[1])->toItem(false, 0);
+        assert(i->getKey() == keys[1]);
+        assert(i->getCas() == expected->getCas());
+        assert(i->getValue()->to_s() == expected->getValue()->to_s());
+        delete i;
+        delete expected;
+    }
+
+    // A writer holding the stripe turns readers away.
+    int bucket_num(0);
+    LockHolder lh = h.getLockedBucket(keys[0], &bucket_num);
+    OptimisticReadHolder rh;
+    StoredValue *v = NULL;
+    assert(!h.optimisticFind(keys[0], rh, &v));
+    assert(h.numOptimisticFallbacks == 1);
+}
+
 static void testConcurrentAccessResize() {
     HashTable h(global_stats, 5, 3);
 
@@ -574,6 +1134,18 @@ int main() {
     testDepthCounting();
     testPoisonKey();
     testResize();
+    testIncrementalResize();
+    testOptimisticFind();
+    testGroupedBuckets();
+    testInlineValues();
+    testSlabAllocation();
+    testCompressedValues();
+    testEjectItems();
+    testAccessFrequency();
+    testSample();
+    testResumableVisit();
+    testExpiryIndex();
+    testValueCache();
     testConcurrentAccessResize();
     testAutoResize();
     testSizeStats();
@@ -21,7 +21,9 @@
 #include <cassert>
 #include <cmath>
 #include <functional>
+#include <limits>
 #include <sstream>
+#include <vector>
 
 #include "histo.h"
 
@@ -107,10 +109,66 @@ static void test_complete_range() {
     } while (i != 0);
 }
 
+static void test_log_linear_bins() {
+    // Bins run end to end, and every value lands in the bin covering it.
+    for (size_t i = 0; i + 1 < LogLinearHistogram::NUM_BINS; ++i) {
+        assert(LogLinearHistogram::binEnd(i) ==
+               LogLinearHistogram::binStart(i + 1));
+        assert(LogLinearHistogram::binStart(i) < LogLinearHistogram::binEnd(i));
+    }
+    uint64_t samples[] = { 0, 1, 15, 16, 17, 31, 32, 33, 1000, 1023, 1024,
+                           123456789, (1ULL << 36) - 1, 1ULL << 36,
+                           std::numeric_limits<uint64_t>::max() };
+    for (size_t i = 0; i < sizeof(samples) / sizeof(samples[0]); ++i) {
+        uint64_t v = samples[i];
+        size_t bin = LogLinearHistogram::binFor(v);
+        assert(bin < LogLinearHistogram::NUM_BINS);
+        assert(LogLinearHistogram::binStart(bin) <= v);
+        assert(v < LogLinearHistogram::binEnd(bin) ||
+               bin == LogLinearHistogram::NUM_BINS - 1);
+        // No wider than a sixteenth of where the bin starts.
+        if (v >= 16 && bin != LogLinearHistogram::NUM_BINS - 1) {
+            uint64_t width = LogLinearHistogram::binEnd(bin) -
+                LogLinearHistogram::binStart(bin);
+            assert(width * 16 <= LogLinearHistogram::binStart(bin));
+        }
+    }
+}
+
+static void test_log_linear_percentiles() {
+    LogLinearHistogram histo;
+    for (uint64_t v = 1; v <= 10000; ++v) {
+        histo.add(v);
+    }
+    histo.add(1000000, 10);
+    assert(histo.total() == 10010);
+
+    std::vector<size_t> counts;
+    histo.getCounts(counts);
+    uint64_t p50 = LogLinearHistogram::percentile(counts, 0.5);
+    uint64_t p99 = LogLinearHistogram::percentile(counts, 0.99);
+    uint64_t p9999 = LogLinearHistogram::percentile(counts, 0.9999);
+    assert(p50 >= 5005 && p50 < 5005 + 5005 / 16 + 1);
+    assert(p99 >= 9910 && p99 < 9910 + 9910 / 16 + 1);
+    assert(p9999 >= 1000000 && p9999 < 1000000 + 1000000 / 16 + 1);
+
+    // Merging loses nothing.
+    LogLinearHistogram other;
+    other.add(3, 7);
+    other.merge(histo);
+    assert(other.total() == 10017);
+    histo.reset();
+    assert(histo.total() == 0);
+    histo.getCounts(counts);
+    assert(LogLinearHistogram::percentile(counts, 0.5) == 0);
+}
+
 int main() {
     test_basic();
     test_fixed_input();
     test_exponential();
     test_complete_range();
+    test_log_linear_bins();
+    test_log_linear_percentiles();
     return 0;
 }
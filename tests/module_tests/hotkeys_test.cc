@@ -0,0 +1,131 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2012 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "config.h"
+
+#include <cassert>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "hotkeys.h"
+
+static std::string keyFor(int i) {
+    std::stringstream ss;
+    ss << "key" << i;
+    return ss.str();
+}
+
+static void access(HotKeyTracker &tracker, uint16_t vb, const std::string &k) {
+    tracker.access(vb, k.data(), k.length());
+}
+
+static void testSkewedStream() {
+    HotKeyTracker tracker(10, 1);
+    std::map<std::string, size_t> actual;
+    // One key in four is "hot", one in eight "warm", the rest all differ.
+    for (int i = 0; i < 10000; ++i) {
+        std::string k;
+        if (i % 4 == 0) {
+            k = "hot";
+        } else if (i % 8 == 1) {
+            k = "warm";
+        } else {
+            k = keyFor(i);
+        }
+        access(tracker, i % 2, k);
+        ++actual[k];
+    }
+    assert(tracker.getNumSamples() == 10000);
+
+    std::vector<HotKeyTracker::HotKey> keys;
+    tracker.getHotKeys(keys);
+    assert(keys.size() == 10);
+    assert(keys[0].key == "hot");
+    assert(keys[0].vbucket == 0);
+    assert(keys[1].key == "warm");
+    assert(keys[1].vbucket == 1);
+    for (size_t i = 0; i < keys.size(); ++i) {
+        if (i > 0) {
+            assert(keys[i - 1].count >= keys[i].count);
+        }
+        // Never under, and over by no more than the error.
+        size_t n = actual[keys[i].key];
+        assert(keys[i].count >= n);
+        assert(keys[i].count - keys[i].error <= n);
+    }
+
+    std::map<uint16_t, size_t> vbSamples;
+    tracker.getVBucketSamples(vbSamples);
+    assert(vbSamples.size() == 2);
+    assert(vbSamples[0] == 5000 && vbSamples[1] == 5000);
+}
+
+static void testSameKeyOtherVBucket() {
+    HotKeyTracker tracker(4, 1);
+    access(tracker, 1, "k");
+    access(tracker, 2, "k");
+    access(tracker, 2, "k");
+    std::vector<HotKeyTracker::HotKey> keys;
+    tracker.getHotKeys(keys);
+    assert(keys.size() == 2);
+    assert(keys[0].vbucket == 2 && keys[0].count == 2);
+    assert(keys[1].vbucket == 1 && keys[1].count == 1);
+}
+
+static void testSampling() {
+    HotKeyTracker tracker(4, 0);
+    for (int i = 0; i < 1000; ++i) {
+        access(tracker, 0, "k");
+    }
+    assert(tracker.getNumSamples() == 0);
+
+    tracker.setSampleRate(10);
+    for (int i = 0; i < 100000; ++i) {
+        access(tracker, 0, "k");
+    }
+    size_t samples = tracker.getNumSamples();
+    assert(samples > 5000 && samples < 15000);
+}
+
+static void testReset() {
+    HotKeyTracker tracker(4, 1);
+    for (int i = 0; i < 100; ++i) {
+        access(tracker, 0, keyFor(i));
+    }
+    tracker.reset();
+    std::vector<HotKeyTracker::HotKey> keys;
+    tracker.getHotKeys(keys);
+    assert(keys.empty());
+    assert(tracker.getNumSamples() == 0);
+
+    tracker.setCapacity(2);
+    for (int i = 0; i < 100; ++i) {
+        access(tracker, 0, keyFor(i));
+    }
+    tracker.getHotKeys(keys);
+    assert(keys.size() == 2);
+}
+
+int main() {
+    testSkewedStream();
+    testSameKeyOtherVBucket();
+    testSampling();
+    testReset();
+    return 0;
+}
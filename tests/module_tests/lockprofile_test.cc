@@ -0,0 +1,161 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2012 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "config.h"
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include <cassert>
+#include <cstring>
+#include <vector>
+
+#include "atomic.h"
+#include "locks.h"
+#include "lockprofile.h"
+
+static LockSite mutexSite("test_mutex");
+static LockSite syncSite("test_sync");
+static LockSite spinSite("test_spin");
+
+static const hrtime_t MSEC(1000000);
+
+static uint64_t percentile(const LogLinearHistogram &h, double fraction) {
+    std::vector<size_t> counts;
+    h.getCounts(counts);
+    return LogLinearHistogram::percentile(counts, fraction);
+}
+
+static void testDisabled() {
+    LockSite::setProfiling(false);
+    Mutex m;
+    m.setLockSite(&mutexSite);
+    for (int i = 0; i < 10; ++i) {
+        LockHolder lh(m);
+    }
+    assert(mutexSite.acquisitions.get() == 0);
+    assert(mutexSite.waitTime.total() == 0);
+    assert(mutexSite.holdTime.total() == 0);
+}
+
+static void testUncontended() {
+    LockSite::setProfiling(true);
+    Mutex m;
+    m.setLockSite(&mutexSite);
+    for (int i = 0; i < 100; ++i) {
+        LockHolder lh(m);
+    }
+    assert(mutexSite.acquisitions.get() == 100);
+    assert(mutexSite.contentions.get() == 0);
+    assert(mutexSite.waitTime.total() == 100);
+    assert(mutexSite.holdTime.total() == 100);
+
+    // A lock without a site is never counted.
+    Mutex other;
+    {
+        LockHolder lh(other);
+    }
+    assert(mutexSite.acquisitions.get() == 100);
+    mutexSite.reset();
+}
+
+extern "C" {
+    static void *grab(void *arg) {
+        LockHolder lh(*static_cast<Mutex*>(arg));
+        return NULL;
+    }
+}
+
+static void testContended() {
+    LockSite::setProfiling(true);
+    Mutex m;
+    m.setLockSite(&mutexSite);
+    pthread_t tid;
+    {
+        LockHolder lh(m);
+        assert(pthread_create(&tid, NULL, grab, &m) == 0);
+        usleep(20000);
+    }
+    assert(pthread_join(tid, NULL) == 0);
+
+    assert(mutexSite.acquisitions.get() == 2);
+    assert(mutexSite.contentions.get() == 1);
+    // The other thread waited about as long as we held it.
+    assert(percentile(mutexSite.waitTime, 1.0) >= 10 * MSEC);
+    assert(percentile(mutexSite.holdTime, 1.0) >= 10 * MSEC);
+    assert(percentile(mutexSite.holdTime, 0.5) < 10 * MSEC);
+    mutexSite.reset();
+}
+
+static void testConditionWait() {
+    LockSite::setProfiling(true);
+    SyncObject so;
+    so.setLockSite(&syncSite);
+    {
+        LockHolder lh(so);
+        so.wait(0.05);
+    }
+    // Sleeping on the condition doesn't count as holding the lock.
+    assert(syncSite.acquisitions.get() == 1);
+    assert(syncSite.holdTime.total() == 2);
+    assert(percentile(syncSite.holdTime, 1.0) < 10 * MSEC);
+}
+
+static void testSpinLock() {
+    LockSite::setProfiling(true);
+    SpinLock sl;
+    sl.setLockSite(&spinSite);
+    for (int i = 0; i < 10; ++i) {
+        SpinLockHolder lh(&sl);
+    }
+    assert(spinSite.acquisitions.get() == 10);
+    assert(spinSite.contentions.get() == 0);
+    assert(spinSite.holdTime.total() == 10);
+
+    // Switching profiling off while held doesn't leave a stale start.
+    sl.acquire();
+    LockSite::setProfiling(false);
+    sl.release();
+    assert(spinSite.holdTime.total() == 11);
+    {
+        SpinLockHolder lh(&sl);
+    }
+    assert(spinSite.acquisitions.get() == 11);
+}
+
+static void testSites() {
+    std::vector<LockSite*> sites;
+    LockSite::getAll(sites);
+    bool found = false;
+    for (size_t i = 0; i < sites.size(); ++i) {
+        found |= strcmp(sites[i]->getName(), "test_spin") == 0;
+    }
+    assert(found);
+    LockSite::resetAll();
+    assert(spinSite.acquisitions.get() == 0);
+    assert(spinSite.holdTime.total() == 0);
+}
+
+int main() {
+    testDisabled();
+    testUncontended();
+    testContended();
+    testConditionWait();
+    testSpinLock();
+    testSites();
+    return 0;
+}
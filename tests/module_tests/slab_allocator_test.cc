@@ -0,0 +1,193 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2012 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "config.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "atomic.h"
+#include "objectregistry.h"
+#include "slab_allocator.h"
+#include "threadtests.h"
+
+typedef std::pair<void*, size_t> Chunk;
+
+static std::map<std::string, size_t> getStats() {
+    std::map<std::string, size_t> rv;
+    SlabAllocator::getInstance()->getStats(rv);
+    return rv;
+}
+
+static void testChunkSizes() {
+    SlabAllocator *sa = SlabAllocator::getInstance();
+    size_t prev = 0;
+    for (size_t sz = 1; sz <= SlabAllocator::MAX_CHUNK_SIZE; ++sz) {
+        size_t chunk = sa->chunkSize(sz);
+        assert(chunk >= sz);
+        assert(chunk % 16 == 0);
+        assert(chunk >= prev);
+        // Never waste more than an eighth past the small classes.
+        assert(chunk - sz < std::max(static_cast<size_t>(16), sz / 8 + 16));
+        prev = chunk;
+    }
+    assert(sa->chunkSize(SlabAllocator::MAX_CHUNK_SIZE + 1) ==
+           SlabAllocator::MAX_CHUNK_SIZE + 1);
+}
+
+static void testDisabled() {
+    SlabAllocator::setEnabled(false);
+    assert(SlabAllocator::getInstance()->allocate(64) == NULL);
+
+    bool slab = true;
+    void *p = SlabAllocator::allocateObject(64, slab);
+    assert(!slab);
+    SlabAllocator::releaseObject(p, 64, slab);
+}
+
+static void testAllocateAndReuse() {
+    SlabAllocator::setEnabled(true);
+    SlabAllocator *sa = SlabAllocator::getInstance();
+
+    std::vector<Chunk> chunks;
+    for (size_t i = 0; i < 10000; ++i) {
+        size_t sz = 8 + (i * 37) % 4000;
+        void *p = sa->allocate(sz);
+        assert(p);
+        std::memset(p, static_cast<int>(i & 0xff), sz);
+        chunks.push_back(Chunk(p, sz));
+    }
+
+    std::map<std::string, size_t> st = getStats();
+    assert(st["ep_slab_chunks"] == chunks.size());
+    assert(st["ep_slab_requested_bytes"] <= st["ep_slab_allocated_bytes"]);
+    assert(st["ep_slab_allocated_bytes"] <= st["ep_slab_reserved_bytes"]);
+    assert(st["ep_slab_internal_frag_bytes"] ==
+           st["ep_slab_allocated_bytes"] - st["ep_slab_requested_bytes"]);
+
+    // Nothing got overwritten by a neighbour.
+    for (size_t i = 0; i < chunks.size(); ++i) {
+        const char *c = static_cast<const char*>(chunks[i].first);
+        for (size_t j = 0; j < chunks[i].second; ++j) {
+            assert(c[j] == static_cast<char>(i & 0xff));
+        }
+    }
+
+    size_t reserved = st["ep_slab_reserved_bytes"];
+    for (size_t i = 0; i < chunks.size(); ++i) {
+        sa->deallocate(chunks[i].first, chunks[i].second);
+    }
+    st = getStats();
+    assert(st["ep_slab_chunks"] == 0);
+    assert(st["ep_slab_requested_bytes"] == 0);
+    assert(st["ep_slab_free_bytes"] == reserved);
+
+    // Freed chunks get handed out again before any new slab.
+    void *p = sa->allocate(100);
+    assert(getStats()["ep_slab_chunks"] == 1);
+    assert(getStats()["ep_slab_reserved_bytes"] == reserved);
+    sa->deallocate(p, 100);
+    SlabAllocator::setEnabled(false);
+}
+
+static void testChunksCharged() {
+    SlabAllocator::setEnabled(true);
+    SlabAllocator *sa = SlabAllocator::getInstance();
+    Atomic<size_t> charged(0);
+    ObjectRegistry::setStats(&charged);
+
+    // The chunk is charged, not the slab it's carved from.
+    void *p = sa->allocate(100);
+    assert(charged.get() == sa->chunkSize(100));
+    sa->deallocate(p, 100);
+    assert(charged.get() == 0);
+
+    // A reused chunk is charged again.
+    p = sa->allocate(100);
+    assert(charged.get() == sa->chunkSize(100));
+    sa->deallocate(p, 100);
+    assert(charged.get() == 0);
+
+    ObjectRegistry::setStats(NULL);
+    SlabAllocator::setEnabled(false);
+}
+
+static void testConfigure() {
+    // The first bucket decides.
+    assert(SlabAllocator::configure(false));
+    assert(!SlabAllocator::isEnabled());
+    assert(SlabAllocator::configure(false));
+    assert(!SlabAllocator::configure(true));
+    assert(!SlabAllocator::isEnabled());
+}
+
+class ChurnGenerator : public Generator<bool> {
+public:
+    ChurnGenerator() : nextSeed(1) {}
+
+    bool operator()() {
+        SlabAllocator *sa = SlabAllocator::getInstance();
+        std::vector<Chunk> live;
+        size_t seed = nextSeed++;
+        for (size_t i = 0; i < 20000; ++i) {
+            seed = seed * 1103515245 + 12345;
+            if (!live.empty() && (seed >> 16) % 3 == 0) {
+                size_t victim = (seed >> 8) % live.size();
+                sa->deallocate(live[victim].first, live[victim].second);
+                live[victim] = live.back();
+                live.pop_back();
+            } else {
+                size_t sz = 16 + (seed >> 16) % 512;
+                void *p = sa->allocate(sz);
+                assert(p);
+                live.push_back(Chunk(p, sz));
+            }
+        }
+        std::vector<Chunk>::iterator it;
+        for (it = live.begin(); it != live.end(); ++it) {
+            sa->deallocate(it->first, it->second);
+        }
+        return true;
+    }
+
+private:
+    Atomic<size_t> nextSeed;
+};
+
+static void testConcurrentChurn() {
+    SlabAllocator::setEnabled(true);
+    ChurnGenerator gen;
+    std::vector<bool> r(getCompletedThreads<bool>(8, &gen));
+    assert(r.size() == 8);
+    assert(getStats()["ep_slab_chunks"] == 0);
+    SlabAllocator::setEnabled(false);
+}
+
+int main() {
+    testChunkSizes();
+    testDisabled();
+    testAllocateAndReuse();
+    testChunksCharged();
+    testConcurrentChurn();
+    testConfigure();
+    return 0;
+}
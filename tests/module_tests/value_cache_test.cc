@@ -0,0 +1,121 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2012 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "config.h"
+
+#include <unistd.h>
+
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "value_cache.h"
+
+EPStats global_stats;
+
+static std::string cachePath() {
+    std::stringstream ss;
+    ss << "/tmp/value_cache_test." << getpid();
+    return ss.str();
+}
+
+static std::string keyFor(size_t i) {
+    std::stringstream ss;
+    ss << "key" << i;
+    return ss.str();
+}
+
+static value_t valueFor(size_t i, size_t len) {
+    std::string s(len, static_cast<char>('a' + i % 26));
+    return value_t(Blob::New(s));
+}
+
+static void testPutGet() {
+    ValueCache cache(global_stats, cachePath(), ValueCache::MIN_CAPACITY);
+    std::vector<uint64_t> offsets;
+    for (size_t i = 0; i < 100; ++i) {
+        uint64_t offset;
+        assert(cache.put(keyFor(i), i + 1, valueFor(i, 100 + i), offset));
+        offsets.push_back(offset);
+    }
+    assert(cache.getUsed() > 100 * 150);
+
+    for (size_t i = 0; i < 100; ++i) {
+        value_t v(cache.get(offsets[i], keyFor(i), i + 1));
+        assert(v.get() != NULL);
+        assert(v->to_s() == valueFor(i, 100 + i)->to_s());
+    }
+    assert(global_stats.valueCacheHits.get() == 100);
+
+    // A changed item or another key doesn't match what was stored.
+    assert(cache.get(offsets[0], keyFor(0), 2).get() == NULL);
+    assert(cache.get(offsets[0], keyFor(1), 1).get() == NULL);
+    assert(cache.get(offsets[0] + 8, keyFor(0), 1).get() == NULL);
+    assert(global_stats.valueCacheMisses.get() == 3);
+
+    // Too big to be worth keeping.
+    uint64_t offset;
+    assert(!cache.put("big", 1, valueFor(0, ValueCache::MIN_CAPACITY / 2),
+                      offset));
+}
+
+static void testWrapAround() {
+    ValueCache cache(global_stats, cachePath(), ValueCache::MIN_CAPACITY);
+    size_t vlen = 1000;
+    size_t n = 3 * ValueCache::MIN_CAPACITY / vlen;
+    std::vector<uint64_t> offsets;
+    for (size_t i = 0; i < n; ++i) {
+        uint64_t offset;
+        assert(cache.put(keyFor(i), 1, valueFor(i, vlen), offset));
+        offsets.push_back(offset);
+    }
+    assert(cache.getUsed() == cache.getCapacity());
+
+    // The oldest records were overwritten, the newest are all there.
+    size_t hits = 0;
+    for (size_t i = 0; i < n; ++i) {
+        value_t v(cache.get(offsets[i], keyFor(i), 1));
+        if (v.get() != NULL) {
+            assert(v->to_s() == valueFor(i, vlen)->to_s());
+            ++hits;
+        } else {
+            assert(hits == 0);
+        }
+    }
+    assert(hits > n / 4 && hits < n / 2);
+}
+
+static void testTooSmall() {
+    bool thrown = false;
+    try {
+        ValueCache cache(global_stats, cachePath(), 4096);
+    } catch (ValueCache::OpenException &e) {
+        thrown = true;
+    }
+    assert(thrown);
+}
+
+int main() {
+    putenv(strdup("ALLOW_NO_STATS_UPDATE=yeah"));
+    testPutGet();
+    testWrapAround();
+    testTooSmall();
+    return 0;
+}
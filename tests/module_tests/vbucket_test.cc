@@ -215,6 +215,22 @@ static void testGetVBucketsByState(void) {
 
 }
 
+static void testBloomFilterDuringWarmup(void) {
+    VBucket vb(0, vbucket_state_active, global_stats, checkpoint_config,
+               vbucket_state_dead, 1, 1000, 0.01);
+    assert(vb.hasFilter());
+    vb.addToFilter("on disk");
+
+    // Until warmup has seen every key, a miss proves nothing.
+    global_stats.warmupComplete.set(false);
+    assert(vb.maybeKeyExistsInFilter("on disk"));
+    assert(vb.maybeKeyExistsInFilter("not on disk"));
+
+    global_stats.warmupComplete.set(true);
+    assert(vb.maybeKeyExistsInFilter("on disk"));
+    assert(!vb.maybeKeyExistsInFilter("not on disk"));
+}
+
 int main(int argc, char **argv) {
     (void)argc; (void)argv;
     putenv(strdup("ALLOW_NO_STATS_UPDATE=yeah"));
@@ -229,4 +245,5 @@ int main(int argc, char **argv) {
     testVBucketFilter();
     testVBucketFilterFormatter();
     testGetVBucketsByState();
+    testBloomFilterDuringWarmup();
 }
@@ -0,0 +1,245 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2013 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "config.h"
+
+#include <signal.h>
+
+#include <cassert>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "configuration.h"
+#include "ep.h"
+#include "stats.h"
+#include "vbucket.h"
+#include "vbucketmap.h"
+#include "visitor_pool.h"
+
+static const size_t numBuckets = 8;
+static const size_t itemsEach = 50;
+
+EPStats global_stats;
+CheckpointConfig checkpoint_config;
+
+extern "C" {
+    static rel_time_t basic_current_time(void) {
+        return 0;
+    }
+
+    rel_time_t (*ep_current_time)() = basic_current_time;
+
+    time_t ep_real_time() {
+        return time(NULL);
+    }
+}
+
+class CountingJob : public VisitorPool::Job {
+public:
+    CountingJob(Atomic<size_t> &c) : count(c) {}
+
+    void run() {
+        ++count;
+    }
+
+private:
+    Atomic<size_t> &count;
+};
+
+class CountingVisitor : public VBucketVisitor {
+public:
+    CountingVisitor() : items(0), completed(false) {}
+
+    bool visitBucket(RCPtr<VBucket> &vb) {
+        buckets.insert(vb->getId());
+        return VBucketVisitor::visitBucket(vb);
+    }
+
+    void visit(StoredValue *v) {
+        (void)v;
+        ++items;
+    }
+
+    VBucketVisitor *clone() {
+        return new CountingVisitor();
+    }
+
+    void merge(VBucketVisitor &other) {
+        CountingVisitor &o = static_cast<CountingVisitor&>(other);
+        items += o.items;
+        std::set<uint16_t>::iterator it;
+        for (it = o.buckets.begin(); it != o.buckets.end(); ++it) {
+            // Each vbucket is walked by one clone only.
+            assert(buckets.insert(*it).second);
+        }
+    }
+
+    void complete() {
+        completed = true;
+    }
+
+    size_t             items;
+    std::set<uint16_t> buckets;
+    bool               completed;
+};
+
+class PausingVisitor : public CountingVisitor {
+public:
+    PausingVisitor(Atomic<bool> &p) : pause(p) {}
+
+    bool pauseVisitor() {
+        return pause.get();
+    }
+
+    VBucketVisitor *clone() {
+        return new PausingVisitor(pause);
+    }
+
+private:
+    Atomic<bool> &pause;
+};
+
+static void waitFor(Atomic<size_t> &count, size_t want) {
+    while (count.get() < want) {
+        usleep(100);
+    }
+}
+
+static void testPoolRunsEveryJob() {
+    VisitorPool pool;
+    Atomic<size_t> count(0);
+    CountingJob job(count);
+
+    assert(!pool.submit(&job));
+    assert(pool.grow(4) == 4);
+    for (size_t i = 0; i < 100; ++i) {
+        assert(pool.submit(&job));
+    }
+    waitFor(count, 100);
+
+    // The threads stay around for the next round.
+    assert(pool.grow(2) == 4);
+    for (size_t i = 0; i < 100; ++i) {
+        assert(pool.submit(&job));
+    }
+    pool.stop();
+    assert(count.get() == 200);
+    assert(pool.getNumThreads() == 0);
+    assert(!pool.submit(&job));
+    assert(pool.grow(4) == 0);
+}
+
+static void fill(VBucketMap &vbm) {
+    for (size_t i = 0; i < numBuckets; ++i) {
+        RCPtr<VBucket> vb(new VBucket(static_cast<int>(i), vbucket_state_active,
+                                      global_stats, checkpoint_config));
+        for (size_t j = 0; j < itemsEach; ++j) {
+            std::stringstream ss;
+            ss << "key" << j;
+            std::string k(ss.str());
+            Item itm(k, 0, 0, k.c_str(), k.length());
+            assert(vb->ht.set(itm) == WAS_CLEAN);
+        }
+        assert(vbm.addBucket(vb) == ENGINE_SUCCESS);
+    }
+}
+
+static void runParallelVisit(VisitorPool &pool, size_t threads) {
+    Configuration config;
+    VBucketMap vbm(config);
+    fill(vbm);
+
+    shared_ptr<CountingVisitor> visitor(new CountingVisitor());
+    std::vector<shared_ptr<VBucketVisitor> > clones;
+    for (size_t i = 0; i < threads; ++i) {
+        clones.push_back(shared_ptr<VBucketVisitor>(visitor->clone()));
+    }
+
+    // Walk a few items at a time to exercise the chunked walk too.
+    ParallelVBCBAdaptor adaptor(pool, vbm, visitor, clones, "test", 7, 0);
+    while (adaptor.step()) {
+        assert(!visitor->completed);
+        usleep(100);
+    }
+
+    assert(visitor->completed);
+    assert(visitor->items == numBuckets * itemsEach);
+    assert(visitor->buckets.size() == numBuckets);
+}
+
+static void testParallelVisit() {
+    VisitorPool pool;
+    assert(pool.grow(3) == 3);
+    runParallelVisit(pool, 3);
+    // Again on the same threads.
+    runParallelVisit(pool, 3);
+    assert(pool.getNumThreads() == 3);
+}
+
+static void testParallelVisitWithoutThreads() {
+    // Nothing to submit to, so the clone is run by the caller.
+    VisitorPool pool;
+    runParallelVisit(pool, 2);
+}
+
+static void testPausedVisitGivesThreadBack() {
+    VisitorPool pool;
+    assert(pool.grow(1) == 1);
+    Configuration config;
+    VBucketMap vbm(config);
+    fill(vbm);
+
+    Atomic<bool> pause(true);
+    shared_ptr<PausingVisitor> visitor(new PausingVisitor(pause));
+    std::vector<shared_ptr<VBucketVisitor> > clones;
+    clones.push_back(shared_ptr<VBucketVisitor>(visitor->clone()));
+
+    ParallelVBCBAdaptor adaptor(pool, vbm, visitor, clones, "test", 7, 0);
+    assert(adaptor.step());
+
+    // The only pool thread is free for other jobs while the visit waits.
+    Atomic<size_t> count(0);
+    CountingJob job(count);
+    assert(pool.submit(&job));
+    waitFor(count, 1);
+    assert(adaptor.step());
+    assert(visitor->items == 0);
+
+    pause.set(false);
+    while (adaptor.step()) {
+        usleep(100);
+    }
+    assert(visitor->completed);
+    assert(visitor->items == numBuckets * itemsEach);
+}
+
+int main(int argc, char **argv) {
+    (void)argc; (void)argv;
+    putenv(strdup("ALLOW_NO_STATS_UPDATE=yeah"));
+
+    HashTable::setDefaultNumBuckets(5);
+    HashTable::setDefaultNumLocks(1);
+
+    alarm(60);
+
+    testPoolRunsEveryJob();
+    testParallelVisit();
+    testParallelVisitWithoutThreads();
+    testPausedVisitGivesThreadBack();
+}